@@ -18,13 +18,6 @@
 char* MBED_CONF_APP_WIFI_SSID = 0;      // Requerido en easy-connect
 char* MBED_CONF_APP_WIFI_PASSWORD = 0;  // Requerido en easy-connect
 
-static MQNetBridge* gThis=0;
-static void remoteSubscriptionCb(MQTT::MessageData& md){
-    if(gThis){
-        gThis->notifyRemoteSubscription(md);
-    }
-}
-
     
 //------------------------------------------------------------------------------------
 //-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
@@ -34,7 +27,6 @@ static void remoteSubscriptionCb(MQTT::MessageData& md){
 MQNetBridge::MQNetBridge(const char* base_topic, uint32_t mqtt_yield_millis) { 
     _debug = 0;
     _stat = Unknown;
-    gThis = this;
     _client_id = 0;
     _user = 0;
     _userpass = 0;
@@ -47,6 +39,7 @@ MQNetBridge::MQNetBridge(const char* base_topic, uint32_t mqtt_yield_millis) {
     _net = 0;
     _client = 0;    
     _yield_millis = mqtt_yield_millis;
+    _rsub_count = 0;
     
     _base_topic = (char*)Heap::memAlloc(strlen(base_topic)+1);
     if(_base_topic){
@@ -107,9 +100,17 @@ void MQNetBridge::task(){
     for(;;){       
         
         _timeout = osWaitForever;        
+        // mientras se conecta, las solicitudes esperan en la cola, y se rechazan si se llena
+        if(_stat == Connecting){
+            _client->drain(_yield_millis);
+            if(_stat == Connected){
+                restoreRemoteSubscriptions();
+            }
+            continue;
+        }
         // procesa solicitudes pendientes
         if(_stat == Connected){
-            _client->yield(_yield_millis);
+            _client->drain(_yield_millis);
             _timeout = 0;
         }
         osEvent evt = _queue.get(_timeout);
@@ -139,17 +140,35 @@ void MQNetBridge::task(){
                 // Si hay que suscribirse a un topic...
                 case RemoteSubscriptionSig:{
                     DEBUG_TRACE("\r\nNetBridge: Suscribindose a %s ... ", msg->data);
-                    char *topic = (char*)Heap::memAlloc(strlen(msg->data)+1);
+                    // si ya estaba suscrito reutiliza el topic guardado, que es el que conserva el cliente
+                    char *topic = 0;
+                    for(uint8_t i=0;i<_rsub_count;i++){
+                        if(strcmp(_rsubs[i], msg->data) == 0){
+                            topic = _rsubs[i];
+                            break;
+                        }
+                    }
+                    bool stored = (topic != 0);
                     if(!topic){
-                        DEBUG_TRACE("ERROR HEAP ALLOC");
-                        break;
+                        topic = (char*)Heap::memAlloc(strlen(msg->data)+1);
+                        if(!topic){
+                            DEBUG_TRACE("ERROR HEAP ALLOC");
+                            break;
+                        }
+                        strcpy(topic, msg->data);
                     }
-                    strcpy(topic, msg->data);
-                    if (_client->subscribe(topic, MQTT::QOS0, remoteSubscriptionCb) != 0){
+                    if (_client->subscribe(topic, MQTT::QOS0, MQTT::Delegate<void, MQTT::MessageData&>(this, &MQNetBridge::notifyRemoteSubscription)) != 0){
                         DEBUG_TRACE("ERROR");
                     }
                     else{
                         DEBUG_TRACE("OK!!!!");
+                        // la guarda para restaurarla al reconectar
+                        if(!stored && _rsub_count < MaxRemoteSubscriptions){
+                            _rsubs[_rsub_count++] = topic;
+                        }
+                        else if(!stored){
+                            DEBUG_TRACE(" (no se restaurar al reconectar)");
+                        }
                     }             
                     break;
                 }  
@@ -159,11 +178,19 @@ void MQNetBridge::task(){
                 case RemoteUnsubscriptionSig:{
                     DEBUG_TRACE("\r\nNetBridge: Quitando suscripcin a %s ... ", msg->data);  
                     if(_client->unsubscribe(msg->data) != 0){
+                        // el cliente conserva el topic hasta recibir el UNSUBACK, no puede liberarse
                         DEBUG_TRACE("ERROR");
+                        break;
+                    }
+                    DEBUG_TRACE("OK!!!!");
+                    // deja de restaurarla al reconectar
+                    for(uint8_t i=0;i<_rsub_count;i++){
+                        if(strcmp(_rsubs[i], msg->data) == 0){
+                            Heap::memFree(_rsubs[i]);
+                            _rsubs[i] = _rsubs[--_rsub_count];
+                            break;
+                        }
                     }
-                    else{
-                        DEBUG_TRACE("OK!!!!");
-                    }           
                     break;
                 }         
                                 
@@ -270,7 +297,7 @@ void MQNetBridge::localSubscriptionCb(const char* topic, void* msg, uint16_t msg
             DEBUG_TRACE("\r\nNetBridge: Conexin solicitada...");              
             op->data = 0;
             op->id = ConnectSig;
-            _queue.put(op);            
+            putRequest(op);
         }
         return;
     }    
@@ -284,7 +311,7 @@ void MQNetBridge::localSubscriptionCb(const char* topic, void* msg, uint16_t msg
         DEBUG_TRACE("\r\nNetBridge: Desconexin solicitada..."); 
         op->data = 0;
         op->id = DisconnectSig;            
-        _queue.put(op);
+        putRequest(op);
         return;
     }   
         
@@ -324,7 +351,7 @@ void MQNetBridge::localSubscriptionCb(const char* topic, void* msg, uint16_t msg
             strcpy(op->data, (char*)msg);
             op->id = RemoteSubscriptionSig;
             DEBUG_TRACE("\r\nNetBridge: Suscripcin remota a %s solicitada...", op->data);  
-            _queue.put(op);             
+            putRequest(op);
         }
         return;
     }    
@@ -345,7 +372,7 @@ void MQNetBridge::localSubscriptionCb(const char* topic, void* msg, uint16_t msg
             strcpy(op->data, (char*)msg);
             op->id = RemoteSubscriptionSig;
             DEBUG_TRACE("\r\nNetBridge: Unsuscripcin remota a %s solicitada...", op->data);  
-            _queue.put(op);             
+            putRequest(op);
         }
         return;
     }     
@@ -367,7 +394,20 @@ void MQNetBridge::localSubscriptionCb(const char* topic, void* msg, uint16_t msg
     }
     sprintf(op->data, "%s\n%s", topic, (char*)msg);
     op->id = RemotePublishSig;
-    _queue.put(op);        
+    putRequest(op);
+}
+
+
+//------------------------------------------------------------------------------------
+void MQNetBridge::putRequest(RequestOperation_t* op){
+    // con la cola llena (p.ej. mientras se conecta) la solicitud se descarta sin esperar
+    if(_queue.put(op) != osOK){
+        DEBUG_TRACE("\r\nNetBridge: ERR cola llena, solicitud descartada");
+        if(op->data){
+            Heap::memFree(op->data);
+        }
+        Heap::memFree(op);
+    }
 }
 
 
@@ -403,6 +443,8 @@ int MQNetBridge::connect(){
     // Prepara cliente mqtt...
     if(!_client){
         _client = new MQTT::Client<MQTTNetwork, Countdown>(*_net);
+        // los topics restaurados que no tengan manejador propio llegan por el de defecto
+        _client->setDefaultMessageHandler(MQTT::Delegate<void, MQTT::MessageData&>(this, &MQNetBridge::notifyRemoteSubscription));
     }
     
     // Abre socket tcp...
@@ -412,19 +454,53 @@ int MQNetBridge::connect(){
     }                
     DEBUG_TRACE("socket_OK... ");
     
-    // Conecta cliente MQTT...
+    // Inicia la conexin del cliente MQTT, que completa connectCb sin bloquear la tarea...
     MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
     data.MQTTVersion = 3;
     data.clientID.cstring = _client_id;
     data.username.cstring = _user;
     data.password.cstring = _userpass;
-    if ((rc = _client->connect(data)) != 0){
+    if ((rc = _client->connectAsync(data, MQTT::Delegate<void, MQTT::connackData&>(this, &MQNetBridge::connectCb))) != 0){
         _stat = MqttError;
         return rc;
     }     
+    DEBUG_TRACE("mqtt_CONNECT... ");
+    _stat = Connecting;
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQNetBridge::connectCb(MQTT::connackData& data){
+    if(data.rc != 0){
+        DEBUG_TRACE("\r\nNetBridge: ERR mqtt rc=%d", data.rc);
+        _stat = MqttError;
+        return;
+    }
     DEBUG_TRACE("mqtt_OK... CONECTADO!");
     _stat = Connected;
-    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQNetBridge::restoreRemoteSubscriptions(){
+    if(_rsub_count == 0){
+        return;
+    }
+    // se empaquetan en unos pocos SUBSCRIBE que se envan sin esperar cada SUBACK
+    int granted[MaxRemoteSubscriptions];
+    DEBUG_TRACE("\r\nNetBridge: Restaurando %d suscripciones... ", _rsub_count);
+    int rc = _client->subscribeMany(_rsub_count, _rsubs, MQTT::QOS0, MQTT::Delegate<void, MQTT::MessageData&>(this, &MQNetBridge::notifyRemoteSubscription), granted);
+    if(rc == MQTT::FAILURE){
+        DEBUG_TRACE("ERROR");
+        return;
+    }
+    for(uint8_t i=0;i<_rsub_count;i++){
+        if(granted[i] == 0x80){
+            DEBUG_TRACE("\r\nNetBridge: ERR suscripcin a %s rechazada", _rsubs[i]);
+        }
+    }
+    DEBUG_TRACE("OK!");
 }
 
 //------------------------------------------------------------------------------------
@@ -68,6 +68,7 @@ public:
         Unknown,        /// No iniciado
         Ready,          /// Iniciado pero sin configurar la conexin
         Disconnected,   /// Configurado pero no conectado
+        Connecting,     /// Configurado, esperando la respuesta del servidor mqtt
         Connected,      /// Configurado y conectado
         WifiError,      /// Error al conectar con la red wifi
         SockError,      /// Error al abrir el socket con el servidor mqtt
@@ -89,7 +90,7 @@ public:
     
                 
 	/** notifyRmoteSubscription()
-     *  Callback invocada de forma esttica al recibir una actualizacin de un topic remoto al que est suscrito
+     *  Callback invocada por el cliente MQTT al recibir una actualizacin de un topic remoto al que est suscrito
      *  @param md Referencia del mensaje recibido
      */    
     void notifyRemoteSubscription(MQTT::MessageData& md);
@@ -114,6 +115,8 @@ protected:
     /** Nmero de items para la cola de mensajes entrantes */
     static const uint8_t MaxQueueEntries = 8;
     static const uint8_t RetriesOnError = 3;
+    /** Nmero de suscripciones remotas que se restauran al reconectar */
+    static const uint8_t MaxRemoteSubscriptions = 16;
 
     /** Flags de tarea (asociados a la mquina de estados) */
     enum SigEventFlags{
@@ -156,6 +159,8 @@ protected:
     char* _passwd;                                  /// Clave wifi
     char* _gw;                                      /// Gateway IP
     uint32_t _yield_millis;                         /// Tiemout para mqtt yield
+    char* _rsubs[MaxRemoteSubscriptions];           /// Topics remotos suscritos
+    uint8_t _rsub_count;                            /// Nmero de topics remotos suscritos
 
     /** task()
      *  Hilo de ejecucin asociado para el procesado de las comunicaciones serie
@@ -170,6 +175,13 @@ protected:
      *  @param msg_len Tamao del mensaje
      */    
     void localSubscriptionCb(const char* topic, void* msg, uint16_t msg_len);
+
+
+	/** putRequest()
+     *  Inserta una solicitud en la cola de proceso, o la descarta si est llena
+     *  @param op Solicitud
+     */    
+    void putRequest(RequestOperation_t* op);
     
 
 	/** localPublicationCb()
@@ -200,6 +212,19 @@ protected:
      int reconnect(){ disconnect(); return(connect()); }
 
 
+	/** restoreRemoteSubscriptions()
+     *  Vuelve a suscribir los topics remotos tras una conexin, todos a la vez con MQTT::Client::subscribeMany
+     */    
+     void restoreRemoteSubscriptions();
+
+
+	/** connectCb()
+     *  Callback invocada por el cliente MQTT al completar la conexin iniciada en connect()
+     *  @param data Respuesta del servidor, data.rc = 0 si se ha conectado
+     */    
+     void connectCb(MQTT::connackData& data);
+
+
 };
 
 #endif  /** _MQNETBRIDGE_H */
@@ -0,0 +1,277 @@
+/*
+ * MQSerialArgs.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+
+#include "MQSerialArgs.h"
+#include <errno.h>
+
+
+//------------------------------------------------------------------------------------
+//- STATIC ---------------------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+/** Tipos mayores CBOR utilizados */
+#define CBOR_UINT           0
+#define CBOR_NINT           1
+#define CBOR_BYTES          2
+#define CBOR_TEXT           3
+
+/** Bytes de control CBOR */
+#define CBOR_ARRAY_INDEF    0x9F
+#define CBOR_FLOAT32        0xFA
+#define CBOR_FLOAT64        0xFB
+#define CBOR_BREAK          0xFF
+
+
+static int8_t hexValue(char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+/** Comprueba si el argumento es un entero decimal o hexadecimal (0x...) */
+static bool isInteger(const char* token, int64_t* value){
+    const char* p = (*token == '-' || *token == '+')? token + 1 : token;
+    bool hex = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'));
+    const char* digits = (hex)? p + 2 : p;
+    if(*digits == 0){
+        return false;
+    }
+    for(const char* d = digits; *d; d++){
+        if((hex && hexValue(*d) < 0) || (!hex && (*d < '0' || *d > '9'))){
+            return false;
+        }
+    }
+    errno = 0;
+    *value = strtoll(token, 0, (hex)? 16 : 10);
+    return (errno == 0);
+}
+
+
+/** Comprueba si el argumento es un nmero en coma flotante */
+static bool isFloat(const char* token, float* value){
+    // slo se consideran los que comienzan como un nmero, para no confundir "inf" o "nan" con texto
+    const char* p = (*token == '-' || *token == '+')? token + 1 : token;
+    if(!((*p >= '0' && *p <= '9') || *p == '.')){
+        return false;
+    }
+    char* end;
+    *value = strtof(token, &end);
+    return (end != token && *end == 0);
+}
+
+
+/** Comprueba si el argumento es un blob ("#" seguido de un nmero par de dgitos hex) */
+static bool isBlob(const char* token){
+    if(*token != '#' || token[1] == 0){
+        return false;
+    }
+    uint16_t n = 0;
+    for(const char* d = token + 1; *d; d++, n++){
+        if(hexValue(*d) < 0){
+            return false;
+        }
+    }
+    return ((n & 1) == 0);
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- MQSerialArgWriter ---------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+MQSerialArgWriter::MQSerialArgWriter(uint8_t* buf, uint16_t size) {
+    _buf = buf;
+    _size = size;
+    _len = 0;
+    _error = (_size < 2);
+    if(!_error){
+        _buf[_len++] = CBOR_ARRAY_INDEF;
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQSerialArgWriter::addToken(const char* token){
+    if(_error){
+        return false;
+    }
+    int64_t ival;
+    float fval;
+    if(isInteger(token, &ival)){
+        if(ival >= 0){
+            return putHeader(CBOR_UINT, (uint64_t)ival);
+        }
+        return putHeader(CBOR_NINT, (uint64_t)(-1 - ival));
+    }
+    if(isFloat(token, &fval)){
+        // se reserva 1 byte para el cierre de la lista
+        if(_len + 5 >= _size){
+            _error = true;
+            return false;
+        }
+        uint32_t raw;
+        memcpy(&raw, &fval, sizeof(raw));
+        _buf[_len++] = CBOR_FLOAT32;
+        for(int i=3;i>=0;i--){
+            _buf[_len++] = (uint8_t)(raw >> (8 * i));
+        }
+        return true;
+    }
+    uint16_t len = strlen(token);
+    if(isBlob(token)){
+        // los dgitos hex se convierten directamente sobre el buffer de salida
+        len = (len - 1) / 2;
+        if(!putHeader(CBOR_BYTES, len) || _len + len >= _size){
+            _error = true;
+            return false;
+        }
+        for(uint16_t i=0;i<len;i++){
+            _buf[_len++] = (uint8_t)((hexValue(token[1 + 2*i]) << 4) | hexValue(token[2 + 2*i]));
+        }
+        return true;
+    }
+    if(!putHeader(CBOR_TEXT, len) || _len + len >= _size){
+        _error = true;
+        return false;
+    }
+    memcpy(&_buf[_len], token, len);
+    _len += len;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+uint16_t MQSerialArgWriter::finish(){
+    if(_error){
+        return 0;
+    }
+    _buf[_len++] = CBOR_BREAK;
+    return _len;
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQSerialArgWriter::putHeader(uint8_t major, uint64_t value){
+    uint8_t bytes = (value < 24)? 0 : (value <= 0xff)? 1 : (value <= 0xffff)? 2 : (value <= 0xffffffffUL)? 4 : 8;
+    // se reserva 1 byte para el cierre de la lista
+    if(_len + 1 + bytes >= _size){
+        _error = true;
+        return false;
+    }
+    uint8_t info = (bytes == 0)? (uint8_t)value : (bytes == 1)? 24 : (bytes == 2)? 25 : (bytes == 4)? 26 : 27;
+    _buf[_len++] = (major << 5) | info;
+    for(int i=bytes-1;i>=0;i--){
+        _buf[_len++] = (uint8_t)(value >> (8 * i));
+    }
+    return true;
+}
+
+
+
+//------------------------------------------------------------------------------------
+//-- MQSerialArgReader ---------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+MQSerialArgReader::MQSerialArgReader(const void* msg, uint16_t len) {
+    _msg = (const uint8_t*)msg;
+    _len = len;
+    _pos = 1;
+    _end = false;
+    _error = (_len < 2 || _msg[0] != CBOR_ARRAY_INDEF);
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQSerialArgReader::next(MQSerialArg_t* arg){
+    if(_error || _end){
+        return false;
+    }
+    // la lista debe finalizar con el byte de cierre
+    if(_pos >= _len){
+        _error = true;
+        return false;
+    }
+    uint8_t ib = _msg[_pos++];
+    if(ib == CBOR_BREAK){
+        _end = true;
+        return false;
+    }
+    // floats de 32 y 64 bits
+    if(ib == CBOR_FLOAT32 || ib == CBOR_FLOAT64){
+        uint8_t bytes = (ib == CBOR_FLOAT32)? 4 : 8;
+        if(_pos + bytes > _len){
+            _error = true;
+            return false;
+        }
+        uint64_t raw = 0;
+        for(uint8_t i=0;i<bytes;i++){
+            raw = (raw << 8) | _msg[_pos++];
+        }
+        arg->type = MQSerialArgFloat;
+        if(bytes == 4){
+            uint32_t raw32 = (uint32_t)raw;
+            memcpy(&arg->fval, &raw32, sizeof(float));
+        }
+        else{
+            double d;
+            memcpy(&d, &raw, sizeof(double));
+            arg->fval = (float)d;
+        }
+        return true;
+    }
+    // resto de tipos: cabecera con tipo mayor y valor o longitud
+    uint8_t major = ib >> 5;
+    uint8_t info = ib & 0x1f;
+    uint64_t value = info;
+    if(info >= 24){
+        uint8_t bytes = (info == 24)? 1 : (info == 25)? 2 : (info == 26)? 4 : (info == 27)? 8 : 0;
+        if(bytes == 0 || _pos + bytes > _len){
+            _error = true;
+            return false;
+        }
+        value = 0;
+        for(uint8_t i=0;i<bytes;i++){
+            value = (value << 8) | _msg[_pos++];
+        }
+    }
+    switch(major){
+        case CBOR_UINT:
+            arg->type = MQSerialArgInt;
+            arg->ival = (int64_t)value;
+            return true;
+        case CBOR_NINT:
+            arg->type = MQSerialArgInt;
+            arg->ival = -1 - (int64_t)value;
+            return true;
+        case CBOR_BYTES:
+        case CBOR_TEXT:
+            if(value > (uint64_t)(_len - _pos)){
+                break;
+            }
+            arg->type = (major == CBOR_BYTES)? MQSerialArgBlob : MQSerialArgString;
+            arg->data = &_msg[_pos];
+            arg->len = (uint16_t)value;
+            _pos += arg->len;
+            return true;
+        default:
+            break;
+    }
+    _error = true;
+    return false;
+}
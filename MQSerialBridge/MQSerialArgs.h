@@ -0,0 +1,143 @@
+/*
+ * MQSerialArgs.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Codificacin de los argumentos de las publicaciones recibidas en modo texto con varios argumentos
+ *  ("TOPIC ARG0 ARG1 ... ARGn"). MQSerialBridge los publica codificados en el propio mensaje, de forma que los
+ *  suscriptores obtienen valores ya tipados sin volver a interpretar el texto y sin depender de la vida del
+ *  buffer de recepcin.
+ *
+ *  El formato es un subconjunto de CBOR (RFC 7049): un array de longitud indefinida (0x9F ... 0xFF) con un
+ *  elemento por argumento. Cada argumento se codifica segn su contenido:
+ *
+ *      ENTERO: "123", "-45", "0x1F" -> entero CBOR (tipo 0 o 1), de 1 a 9 bytes
+ *      FLOAT:  "1.5", "-0.25", "1e3" -> float CBOR de 32 bits (0xFA + 4 bytes)
+ *      BLOB:   "#0A1B2C" (nmero par de dgitos hex) -> byte string CBOR (tipo 2) con los bytes 0A 1B 2C
+ *      STRING: cualquier otro argumento -> text string CBOR (tipo 3)
+ *
+ *  Ejemplo de uso en un suscriptor:
+ *
+ *      MQSerialArgReader args(msg, msg_len);
+ *      MQSerialArg_t arg;
+ *      while(args.next(&arg)){
+ *          if(arg.type == MQSerialArgInt){ ... arg.ival ... }
+ *      }
+ */
+
+
+#ifndef _MQSERIALARGS_H
+#define _MQSERIALARGS_H
+
+
+#include "mbed.h"
+
+
+
+/** Tipos de argumento */
+enum MQSerialArgType{
+    MQSerialArgInt,                             /// Entero (ival)
+    MQSerialArgFloat,                           /// Float (fval)
+    MQSerialArgString,                          /// Cadena de texto sin terminador (data, len)
+    MQSerialArgBlob,                            /// Array de bytes (data, len)
+};
+
+/** Argumento decodificado */
+struct MQSerialArg_t{
+    MQSerialArgType type;                       /// Tipo de argumento
+    int64_t ival;                               /// Valor si es entero
+    float fval;                                 /// Valor si es float
+    const uint8_t* data;                        /// Contenido si es cadena o blob (apunta al mensaje)
+    uint16_t len;                               /// Tamao del contenido si es cadena o blob
+};
+
+
+
+//---------------------------------------------------------------------------------
+//- class MQSerialArgWriter -------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+class MQSerialArgWriter {
+
+public:
+
+    /** MQSerialArgWriter()
+     *  Inicia la codificacin de una lista de argumentos
+     *  @param buf Buffer de salida
+     *  @param size Tamao del buffer de salida
+     */
+    MQSerialArgWriter(uint8_t* buf, uint16_t size);
+
+
+    /** addToken()
+     *  Codifica un argumento en formato texto, deduciendo su tipo a partir del contenido
+     *  @param token Argumento (cadena terminada en NULL)
+     *  @return true si se codifica, false si no cabe en el buffer
+     */
+    bool addToken(const char* token);
+
+
+    /** finish()
+     *  Cierra la lista de argumentos
+     *  @return Tamao del mensaje codificado, o 0 si algn argumento no ha cabido en el buffer
+     */
+    uint16_t finish();
+
+protected:
+
+    /** putHeader()
+     *  Codifica la cabecera de un elemento CBOR (tipo mayor y valor o longitud)
+     */
+    bool putHeader(uint8_t major, uint64_t value);
+
+    uint8_t* _buf;                              /// Buffer de salida
+    uint16_t _size;                             /// Tamao del buffer de salida
+    uint16_t _len;                              /// Bytes codificados
+    bool _error;                                /// Flag de buffer insuficiente
+};
+
+
+
+//---------------------------------------------------------------------------------
+//- class MQSerialArgReader -------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+class MQSerialArgReader {
+
+public:
+
+    /** MQSerialArgReader()
+     *  Inicia la lectura de un mensaje con argumentos codificados
+     *  @param msg Mensaje recibido
+     *  @param len Tamao del mensaje
+     */
+    MQSerialArgReader(const void* msg, uint16_t len);
+
+
+    /** next()
+     *  Decodifica el siguiente argumento
+     *  @param arg Recibe el argumento decodificado
+     *  @return true si hay argumento, false al finalizar la lista o si el mensaje no es vlido (ver error())
+     */
+    bool next(MQSerialArg_t* arg);
+
+
+    /** error()
+     *  Indica si el mensaje no tiene el formato esperado
+     *  @return true si el mensaje no es vlido
+     */
+    bool error() { return _error; }
+
+protected:
+
+    const uint8_t* _msg;                        /// Mensaje
+    uint16_t _len;                              /// Tamao del mensaje
+    uint16_t _pos;                              /// Posicin de lectura
+    bool _end;                                  /// Flag de fin de lista
+    bool _error;                                /// Flag de formato incorrecto
+};
+
+#endif  /** _MQSERIALARGS_H */
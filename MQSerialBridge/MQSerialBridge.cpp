@@ -7,13 +7,15 @@
 
 
 #include "MQSerialBridge.h"
+#include "MQSerialHub.h"
+#include "MQSerialArgs.h"
 
 
 //------------------------------------------------------------------------------------
 //- STATIC ---------------------------------------------------------------------------
 //------------------------------------------------------------------------------------
 
-static uint16_t getCRC(void* data, uint32_t size){
+uint16_t MQSerialBridge::getCRC(void* data, uint32_t size){
     uint16_t crc = 0;
     uint8_t* udata = (uint8_t*)data;
     for(int i=0;i<size;i++){
@@ -26,6 +28,80 @@ static uint16_t getCRC(void* data, uint32_t size){
     }
     return crc;
 }    
+
+
+/** CRC16-CCITT (polinomio 0x1021, valor inicial 0xFFFF) utilizado por el enlace fiable */
+static uint16_t getCRC16(const uint8_t* data, uint32_t size){
+    uint16_t crc = 0xFFFF;
+    for(uint32_t i=0;i<size;i++){
+        crc ^= ((uint16_t)data[i]) << 8;
+        for(int b=0;b<8;b++){
+            crc = (crc & 0x8000)? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+/** Tipos de trama del enlace fiable */
+enum LinkFrameType{
+    LINK_DATA   = 0x01,
+    LINK_ACK    = 0x02,
+};
+
+/** Tamao de la cabecera (tipo, secuencia, ack/bitmap) y del CRC de las tramas del enlace */
+#define LINK_HEADER_SIZE    3
+#define LINK_CRC_SIZE       2
+
+
+/** Tipos de mensaje MQTT-SN v1.2 utilizados por el gateway */
+enum SnMsgType{
+    SN_SEARCHGW     = 0x01,
+    SN_GWINFO       = 0x02,
+    SN_CONNECT      = 0x04,
+    SN_CONNACK      = 0x05,
+    SN_REGISTER     = 0x0A,
+    SN_REGACK       = 0x0B,
+    SN_PUBLISH      = 0x0C,
+    SN_PUBACK       = 0x0D,
+    SN_SUBSCRIBE    = 0x12,
+    SN_SUBACK       = 0x13,
+    SN_UNSUBSCRIBE  = 0x14,
+    SN_UNSUBACK     = 0x15,
+    SN_PINGREQ      = 0x16,
+    SN_PINGRESP     = 0x17,
+    SN_DISCONNECT   = 0x18,
+};
+
+/** Cdigos de retorno MQTT-SN */
+enum SnReturnCode{
+    SN_RC_ACCEPTED      = 0x00,
+    SN_RC_CONGESTION    = 0x01,
+    SN_RC_INVALID_ID    = 0x02,
+    SN_RC_NOT_SUPPORTED = 0x03,
+};
+
+/** Campos del byte de flags MQTT-SN */
+#define SN_FLAG_WILL            0x08
+#define SN_FLAG_CLEAN           0x04
+#define SN_FLAG_QOS(f)          (((f) >> 5) & 0x03)
+#define SN_FLAG_TOPIC_TYPE(f)   ((f) & 0x03)
+#define SN_QOS_MINUS_ONE        0x03
+#define SN_TOPIC_NORMAL         0x00
+#define SN_TOPIC_PREDEFINED     0x01
+#define SN_TOPIC_SHORT          0x02
+
+/** Identificador del gateway en GWINFO */
+#define SN_GATEWAY_ID           0x01
+
+static uint16_t snReadU16(const uint8_t* p){
+    return (((uint16_t)p[0]) << 8) | p[1];
+}
+
+static void snWriteU16(uint8_t* p, uint16_t v){
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v & 0xff);
+}
     
 //------------------------------------------------------------------------------------
 //-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
@@ -34,7 +110,121 @@ static uint16_t getCRC(void* data, uint32_t size){
 
 MQSerialBridge::MQSerialBridge(PinName tx, PinName rx, uint32_t baud, uint16_t recv_buf_size, const char* cfg_topic, MQSerialBridge::ModeType mode) 
                     : SerialTerminal(tx, rx, recv_buf_size, baud, SerialTerminal::ReceiveAfterBreakTime) {    
+    _hub = 0;
+    _port = 0;
+    if(init(baud, recv_buf_size, cfg_topic, mode)){
+        // Inicializa parmetros del hilo de ejecucin propio
+        _th.start(callback(this, &MQSerialBridge::task));
+    }
+}
+ 
+
+//------------------------------------------------------------------------------------
+bool MQSerialBridge::enableLink(uint8_t window, uint32_t rto_ms){
+    // la ventana debe dividir a 256 para que el slot de cada secuencia no cambie al pasar de 255 a 0
+    if(_link_window || window == 0 || window > MaxLinkWindow || (window & (window - 1)) != 0 || !_rbuf){
+        return false;
+    }
+    uint8_t tx_size = 2 * window;
+    _link_tx = (LinkSlot_t*)Heap::memAlloc(tx_size * sizeof(LinkSlot_t));
+    if(_link_tx){
+        memset(_link_tx, 0, tx_size * sizeof(LinkSlot_t));
+    }
+    _link_rx = (LinkSlot_t*)Heap::memAlloc(window * sizeof(LinkSlot_t));
+    if(_link_rx){
+        memset(_link_rx, 0, window * sizeof(LinkSlot_t));
+    }
+    // cada slot reserva una trama completa: la ventana y la cola de emisin, y la ventana de recepcin. En modo
+    // hub los slots toman los buffers del pool compartido slo mientras estn ocupados
+    bool ok = (_link_tx && _link_rx);
+    for(int i=0;ok && !_hub && i<tx_size;i++){
+        _link_tx[i].buf = (uint8_t*)Heap::memAlloc(_rbufsize);
+        ok = (_link_tx[i].buf != 0);
+    }
+    for(int i=0;ok && !_hub && i<window;i++){
+        _link_rx[i].buf = (uint8_t*)Heap::memAlloc(_rbufsize);
+        ok = (_link_rx[i].buf != 0);
+    }
+    if(!ok){
+        // libera lo reservado hasta el fallo
+        for(int i=0;_link_tx && i<tx_size;i++){
+            if(_link_tx[i].buf){
+                Heap::memFree(_link_tx[i].buf);
+            }
+        }
+        for(int i=0;_link_rx && i<window;i++){
+            if(_link_rx[i].buf){
+                Heap::memFree(_link_rx[i].buf);
+            }
+        }
+        if(_link_tx){
+            Heap::memFree(_link_tx);
+        }
+        if(_link_rx){
+            Heap::memFree(_link_rx);
+        }
+        _link_tx = 0;
+        _link_rx = 0;
+        return false;
+    }
+    _link_sem = new Semaphore(tx_size);
+    _link_tx_size = tx_size;
+    _link_rto = rto_ms;
+    _link_tx_base = 0;
+    _link_tx_next = 0;
+    _link_rx_expected = 0;
+    _link_tm.start();
+    _link_window = window;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQSerialBridge::addPredefinedTopic(uint16_t topic_id, const char* topic){
+    if(!_sn_topics){
+        return false;
+    }
+    _tx_mutex.lock();
+    for(int i=0;i<MaxSnTopics;i++){
+        if(_sn_topics[i].name == 0){
+            _sn_topics[i].name = (char*)Heap::memAlloc(strlen(topic)+1);
+            if(!_sn_topics[i].name){
+                break;
+            }
+            strcpy(_sn_topics[i].name, topic);
+            _sn_topics[i].id = topic_id;
+            _sn_topics[i].predefined = true;
+            _sn_topics[i].known = true;
+            _sn_topics[i].subscribed = false;
+            _tx_mutex.unlock();
+            return true;
+        }
+    }
+    _tx_mutex.unlock();
+    return false;
+}
+
+
+    
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+MQSerialBridge::MQSerialBridge(MQSerialHub* hub, uint8_t port, PinName tx, PinName rx, uint32_t baud, uint16_t recv_buf_size, const char* cfg_topic, MQSerialBridge::ModeType mode) 
+                    : SerialTerminal(tx, rx, recv_buf_size, baud, SerialTerminal::ReceiveAfterBreakTime) {    
+    _hub = hub;
+    _port = port;
+    init(baud, recv_buf_size, cfg_topic, mode);
+}
+
+
+//---------------------------------------------------------------------------------
+bool MQSerialBridge::init(uint32_t baud, uint16_t recv_buf_size, const char* cfg_topic, MQSerialBridge::ModeType mode){
     _rbufsize = recv_buf_size;
+    _tbuf = 0;
+    _rbuf = 0;
+    _abuf = 0;
     _mode = mode;
     if(_mode == TextMode){
         _token = (char*)" ";
@@ -42,51 +232,98 @@ MQSerialBridge::MQSerialBridge(PinName tx, PinName rx, uint32_t baud, uint16_t r
     if(_mode == MixMode){
         _token = (char*)"\n";
     }
+    if(_mode == SnMode){
+        // los topics de configuracin siguen utilizando el formato texto
+        _token = (char*)" ";
+    }
     _cfg_topic = (char*)cfg_topic;
+    _timeout = osWaitForever;
+    memset(&_stats, 0, sizeof(Stats_t));
     
-    if(_rbufsize){
+    _link_window = 0;
+    _link_sem = 0;
+    _link_tx = 0;
+    _link_rx = 0;
+    _link_tx_size = 0;
+    _link_credits = 0;
+    
+    _sn_state = SnDisconnected;
+    _sn_topics = 0;
+    _sn_wildcards = 0;
+    _sn_next_id = 1;
+    _sn_msgid = 1;
+    _sn_sleep = 0;
+    _sn_sleep_count = 0;
+    if(_mode == SnMode){
+        _sn_topics = (SnTopic_t*)Heap::memAlloc(MaxSnTopics * sizeof(SnTopic_t));
+        _sn_wildcards = (char**)Heap::memAlloc(MaxSnWildcards * sizeof(char*));
+        _sn_sleep = (SnSleepMessage_t*)Heap::memAlloc(MaxSnSleepMessages * sizeof(SnSleepMessage_t));
+        if(!_sn_topics || !_sn_wildcards || !_sn_sleep){
+            return false;
+        }
+        memset(_sn_topics, 0, MaxSnTopics * sizeof(SnTopic_t));
+        memset(_sn_wildcards, 0, MaxSnWildcards * sizeof(char*));
+    }
+    
+    if(!_rbufsize){
+        return false;
+    }
+    // en modo hub, el buffer de recepcin es compartido y los de envo se toman del pool bajo demanda
+    if(_hub){
+        _rbuf = _hub->_rbuf;
+        _abuf = _hub->_abuf;
+    }
+    else{
         _tbuf = (char*)Heap::memAlloc(_rbufsize);
         _rbuf = (char*)Heap::memAlloc(_rbufsize);
-        if(_tbuf && _rbuf){
-            // prepara buffers
-            memset(_tbuf, 0, _rbufsize);
-            memset(_rbuf, 0, _rbufsize);
-            
-            // Carga callbacks estticas de publicacin/suscripcin
-            _subscriptionCb = callback(this, &MQSerialBridge::subscriptionCb);
-            _publicationCb = callback(this, &MQSerialBridge::publicationCb);   
-            
-            // Prepara terminal serie con un breaktime de 4 * tbyte y un mnimo de 500us
-            uint32_t break_time = 4 * (10000000/baud);
-            break_time = (break_time < 500)? 500 : break_time;
-            SerialTerminal::config(callback(this, &MQSerialBridge::onRxComplete), callback(this, &MQSerialBridge::onRxTimeout), callback(this, &MQSerialBridge::onRxOvf), break_time, 0);
-
-            // Inicializa parmetros del hilo de ejecucin propio
-            _th.start(callback(this, &MQSerialBridge::task));
+        if(!_tbuf || !_rbuf){
+            return false;
+        }
+        if(_mode == TextMode){
+            _abuf = (uint8_t*)Heap::memAlloc(argBufferSize(_rbufsize));
+            if(!_abuf){
+                return false;
+            }
         }
+        // prepara buffers
+        memset(_tbuf, 0, _rbufsize);
+        memset(_rbuf, 0, _rbufsize);
     }
+    
+    // Carga callbacks estticas de publicacin/suscripcin
+    _subscriptionCb = callback(this, &MQSerialBridge::subscriptionCb);
+    _publicationCb = callback(this, &MQSerialBridge::publicationCb);   
+    
+    // Prepara terminal serie con un breaktime de 4 * tbyte y un mnimo de 500us
+    uint32_t break_time = 4 * (10000000/baud);
+    break_time = (break_time < 500)? 500 : break_time;
+    SerialTerminal::config(callback(this, &MQSerialBridge::onRxComplete), callback(this, &MQSerialBridge::onRxTimeout), callback(this, &MQSerialBridge::onRxOvf), break_time, 0);
+    return true;
 }
- 
 
-    
-//------------------------------------------------------------------------------------
-//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
-//------------------------------------------------------------------------------------
 
+//---------------------------------------------------------------------------------
+void MQSerialBridge::notify(uint32_t flags){
+    if(_hub){
+        _hub->notify(_port, flags);
+        return;
+    }
+    _th.signal_set(flags);
+}
 
 //---------------------------------------------------------------------------------
 void MQSerialBridge::onRxComplete(){
-    _th.signal_set(ReceivedData);
+    notify(ReceivedData);
 }
 
 //---------------------------------------------------------------------------------
 void MQSerialBridge::onRxTimeout(){
-    _th.signal_set(TimeoutOnRecv);
+    notify(TimeoutOnRecv);
 }
 
 //---------------------------------------------------------------------------------
 void MQSerialBridge::onRxOvf(){
-    _th.signal_set(OverflowOnRecv);
+    notify(OverflowOnRecv);
 }
 
 //---------------------------------------------------------------------------------
@@ -96,7 +333,19 @@ void MQSerialBridge::onTxComplete(){
 
 //---------------------------------------------------------------------------------
 void MQSerialBridge::task(){    
-    
+    start();
+    for(;;){        
+        osEvent evt = _th.signal_wait(0, _timeout);
+        if(evt.status == osEventSignal){   
+            dispatch(evt.value.signals);
+        }
+        _timeout = poll();
+    }
+}
+
+
+//---------------------------------------------------------------------------------
+void MQSerialBridge::start(){
     // se suscribe a todos los topics de configuracin
     char* all_cfg_topics = (char*)Heap::memAlloc(strlen(_cfg_topic) + strlen("/#")+1);
     if(all_cfg_topics){
@@ -106,60 +355,147 @@ void MQSerialBridge::task(){
     
     // Inicializo el terminal de recepcin    
     SerialTerminal::startReceiver();
+}
+
+
+//---------------------------------------------------------------------------------
+void MQSerialBridge::dispatch(uint32_t sig){
+    if((sig & (TimeoutOnRecv | OverflowOnRecv))!=0){
+        // descarto la trama recibida
+        SerialTerminal::recv(0, 0);
+        _stats.rx_timeout += ((sig & TimeoutOnRecv)!=0)? 1 : 0;
+        _stats.rx_overflow += ((sig & OverflowOnRecv)!=0)? 1 : 0;
+    }
+    if((sig & ReceivedData)!=0){
+        // se lee la trama recibida
+        uint16_t bufsize = SerialTerminal::recv(_rbuf, _rbufsize);
+        _stats.rx_frames++;
         
-    for(;;){        
-        osEvent evt = _th.signal_wait(0, _timeout);
-        if(evt.status == osEventSignal){   
-            uint32_t sig = evt.value.signals;
-            if((sig & (TimeoutOnRecv | OverflowOnRecv))!=0){
-                // descarto la trama recibida
-                SerialTerminal::recv(0, 0);
-            }
-            if((sig & ReceivedData)!=0){
-                // se lee la trama recibida
-                uint16_t bufsize = SerialTerminal::recv(_rbuf, _rbufsize);
-                
-                // se extraen los tokens en funcin del modo
-                if(_mode == TextMode){
-                    char* args[MaxNumArguments];
-                    int8_t num_arg = -1;
-                    char* topic = strtok(_rbuf, (const char*)_token);
-                    do{
-                        num_arg++;
-                        args[num_arg] = strtok(0, (const char*)_token);
-                    }while(args[num_arg] != 0 && num_arg < MaxNumArguments);
-                    // por ltimo se publica el mensaje
-                    // si slo hay un dato asociado, se incluye de forma normal
-                    if(num_arg == 1){
-                        MQ::MQClient::publish(topic, args[0], strlen(args[0])+1, &_publicationCb);
-                    }
-                    // si hay varios datos, se pasa como mensaje, la referencia al array (char**) y el nmero de elementos
-                    else if(num_arg > 1){
-                        MQ::MQClient::publish(topic, args, num_arg, &_publicationCb);
-                    }
-                }
-                else if(_mode == MixMode){
-                    int32_t data_size = bufsize - (strlen(_rbuf) + 1);
-                    uint8_t* data = (uint8_t*)(_rbuf + strlen(_rbuf) + 1);
-                    char* topic = strtok(_rbuf, (const char*)_token);
-                    char* msg_size = strtok(0, (const char*)_token);
-                    char* msg_crc = strtok(0, (const char*)_token);
-                    
-                    // en primer lugar se comprueba si hay datos coherentes
-                    if(topic && msg_size && msg_crc && data_size >= 0){
-                        // en segundo lugar se comprueba si el tamao de los datos coincide
-                        if(atoi(msg_size) == data_size){
-                            // a continuacin se verifica si el crc de los datos es correcto
-                            if(atoi(msg_crc) == getCRC(data, data_size)){
-                                // por ltimo se publica el mensaje
-                                MQ::MQClient::publish(topic, data, data_size, &_publicationCb);
-                            }
-                        }
-                    }
-                }
+        // si el enlace fiable est activo, la trama se procesa a travs de l
+        if(_link_window){
+            linkRecv((uint8_t*)_rbuf, bufsize);
+        }
+        else{
+            processFrame(_rbuf, bufsize);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------------
+uint32_t MQSerialBridge::poll(){
+    uint32_t timeout = osWaitForever;
+    // gestiona las retransmisiones pendientes
+    if(_link_window){
+        timeout = linkPoll();
+    }
+    // en modo hub, devuelve al pool el buffer de envo en cuanto finaliza la transmisin
+    if(_hub && _tbuf){
+        releaseTxBuffer();
+        if(_tbuf && timeout > MQSerialHub::TxReleasePollMillis){
+            timeout = MQSerialHub::TxReleasePollMillis;
+        }
+    }
+    return timeout;
+}
+
+
+//---------------------------------------------------------------------------------
+char* MQSerialBridge::txBuffer(){
+    while(SerialTerminal::busy()){
+        Thread::yield();
+    }
+    if(_hub && !_tbuf){
+        _tbuf = _hub->allocTxBuffer();
+    }
+    return _tbuf;
+}
+
+
+//---------------------------------------------------------------------------------
+void MQSerialBridge::releaseTxBuffer(){
+    if(!_tx_mutex.trylock()){
+        return;
+    }
+    if(_tbuf && !SerialTerminal::busy()){
+        _hub->_pool->free(_tbuf);
+        _tbuf = 0;
+    }
+    _tx_mutex.unlock();
+}
+
+
+//---------------------------------------------------------------------------------
+void MQSerialBridge::processFrame(char* buf, uint16_t bufsize){
+    // se extraen los tokens en funcin del modo
+    if(_mode == TextMode){
+        char* topic = strtok(buf, (const char*)_token);
+        char* arg = (topic)? strtok(0, (const char*)_token) : 0;
+        char* next = (arg)? strtok(0, (const char*)_token) : 0;
+        if(!arg){
+            _stats.rx_format++;
+        }
+        // si slo hay un dato asociado, se incluye de forma normal
+        else if(!next){
+            MQ::MQClient::publish(topic, arg, strlen(arg)+1, &_publicationCb);
+            _stats.rx_published++;
+        }
+        // si hay varios datos, se codifican en el propio mensaje a medida que se extraen (ver MQSerialArgs.h)
+        else{
+            MQSerialArgWriter args(_abuf, argBufferSize(_rbufsize));
+            args.addToken(arg);
+            do{
+                args.addToken(next);
+            }while((next = strtok(0, (const char*)_token)) != 0);
+            uint16_t size = args.finish();
+            if(size){
+                MQ::MQClient::publish(topic, _abuf, size, &_publicationCb);
+                _stats.rx_published++;
             }
+            else{
+                _stats.rx_format++;
+            }
+        }
+    }
+    else if(_mode == MixMode){
+        int32_t data_size = bufsize - (strlen(buf) + 1);
+        uint8_t* data = (uint8_t*)(buf + strlen(buf) + 1);
+        char* topic = strtok(buf, (const char*)_token);
+        char* msg_size = strtok(0, (const char*)_token);
+        char* msg_crc = strtok(0, (const char*)_token);
+        
+        // en primer lugar se comprueba si hay datos coherentes
+        if(!topic || !msg_size || !msg_crc || data_size < 0){
+            _stats.rx_format++;
+        }
+        // en segundo lugar se comprueba si el tamao de los datos coincide
+        else if(atoi(msg_size) != data_size){
+            _stats.rx_size++;
+        }
+        // a continuacin se verifica si el crc de los datos es correcto
+        else if(atoi(msg_crc) != getCRC(data, data_size)){
+            _stats.rx_crc++;
+        }
+        // por ltimo se publica el mensaje
+        else{
+            MQ::MQClient::publish(topic, data, data_size, &_publicationCb);
+            _stats.rx_published++;
         }
     }
+    else if(_mode == SnMode){
+        snProcess((uint8_t*)buf, bufsize);
+    }
+}
+
+
+//---------------------------------------------------------------------------------
+bool MQSerialBridge::sendFrame(void* buf, uint16_t size){
+    if(_link_window){
+        return linkSend((const uint8_t*)buf, size);
+    }
+    SerialTerminal::send(buf, size, _cb_tx);
+    _stats.tx_frames++;
+    return true;
 }
 
 
@@ -168,19 +504,42 @@ void MQSerialBridge::subscriptionCb(const char* topic, void* msg, uint16_t msg_l
     // en primer lugar chequea qu tipo de mensaje es
     // si no es de configuracin, entonces lo enva al enlace serie
     if(strncmp(topic, _cfg_topic, strlen(_cfg_topic)) != 0){
+        if(_mode == SnMode){
+            snForward(topic, msg, msg_len);
+            return;
+        }
         uint32_t msg_crc = getCRC(msg, msg_len);
-        while(SerialTerminal::busy()){
-            Thread::yield();
+        // descarta los mensajes que no caben en el buffer de envo (o, con el enlace activo, en un slot) antes de
+        // escribir en l, ya que en modo hub es un bloque del pool compartido
+        int hdr_len = (_mode == TextMode)? snprintf(0, 0, "%s ", topic) : snprintf(0, 0, "%s\n%d\n%d\n", topic, msg_len, msg_crc);
+        uint32_t size = hdr_len + 1 + msg_len;
+        if(size + ((_link_window)? (LINK_HEADER_SIZE + LINK_CRC_SIZE) : 0) > _rbufsize){
+            _stats.tx_dropped++;
+            return;
+        }
+        uint8_t credits = linkReserve(1);
+        _tx_mutex.lock();
+        _link_credits = credits;
+        char* tbuf = txBuffer();
+        if(!tbuf){
+            _stats.tx_dropped++;
+            linkUnreserve();
+            _tx_mutex.unlock();
+            return;
         }
         if(_mode == TextMode){
-            sprintf(_tbuf, "%s ", topic);
+            sprintf(tbuf, "%s ", topic);
         }
         else if(_mode == MixMode){
-            sprintf(_tbuf, "%s\n%d\n%d\n", topic, msg_len, msg_crc);
+            sprintf(tbuf, "%s\n%d\n%d\n", topic, msg_len, msg_crc);
         }
-        char* data = (char*)(_tbuf + strlen(_tbuf) + 1);
+        char* data = (char*)(tbuf + hdr_len + 1);
         memcpy(data, msg, msg_len);
-        SerialTerminal::send(_tbuf, msg_len + strlen(_tbuf) + 1, _cb_tx);
+        if(!sendFrame(tbuf, size)){
+            _stats.tx_dropped++;
+        }
+        linkUnreserve();
+        _tx_mutex.unlock();
         return;
     }
     
@@ -205,3 +564,690 @@ void MQSerialBridge::publicationCb(const char* topic, int32_t result){
 }  
 
 
+
+
+//------------------------------------------------------------------------------------
+bool MQSerialBridge::linkSend(const uint8_t* data, uint16_t size){
+    // las tramas que no caben en un slot no pueden enviarse
+    if(size + LINK_HEADER_SIZE + LINK_CRC_SIZE > _rbufsize){
+        return false;
+    }
+    // ocupa un hueco reservado antes de tomar _tx_mutex, o uno libre sin esperar
+    if(_link_credits){
+        _link_credits--;
+    }
+    else if(_link_sem->wait(0) <= 0){
+        return false;
+    }
+    _link_mutex.lock();
+    uint8_t seq = _link_tx_next++;
+    LinkSlot_t* slot = &_link_tx[seq % _link_tx_size];
+    if(_hub){
+        // en modo hub la trama est en el buffer de envo del pool, que pasa al slot hasta recibir su ack
+        memmove(_tbuf + LINK_HEADER_SIZE, data, size);
+        slot->buf = (uint8_t*)_tbuf;
+        _tbuf = 0;
+    }
+    else{
+        memcpy(&slot->buf[LINK_HEADER_SIZE], data, size);
+    }
+    slot->buf[0] = LINK_DATA;
+    slot->buf[1] = seq;
+    slot->buf[2] = 0;
+    uint16_t crc = getCRC16(slot->buf, size + LINK_HEADER_SIZE);
+    slot->buf[size + LINK_HEADER_SIZE] = (uint8_t)(crc >> 8);
+    slot->buf[size + LINK_HEADER_SIZE + 1] = (uint8_t)(crc & 0xff);
+    slot->len = size + LINK_HEADER_SIZE + LINK_CRC_SIZE;
+    slot->seq = seq;
+    slot->used = true;
+    slot->sent = false;
+    slot->acked = false;
+    slot->fast_retx = false;
+    // se enva si est dentro de la ventana, si no queda en cola
+    linkFlush();
+    _link_mutex.unlock();
+    // notifica a la tarea para que planifique la retransmisin
+    notify(LinkTxPending);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+uint8_t MQSerialBridge::linkReserve(uint8_t count){
+    if(!_link_window){
+        return 0;
+    }
+    // el hilo que procesa los ack (la tarea del puerto o la del hub, que publica por ejemplo las respuestas
+    // MQTT-SN) no espera: mientras esperase, la cola no podra liberarse
+    osThreadId owner = (_hub)? _hub->_th.get_id() : _th.get_id();
+    if(Thread::gettid() == owner){
+        return 0;
+    }
+    uint8_t reserved = 0;
+    while(reserved < count && _link_sem->wait(LinkTxMaxRto * _link_rto) > 0){
+        reserved++;
+    }
+    return reserved;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::linkUnreserve(){
+    while(_link_credits){
+        _link_credits--;
+        _link_sem->release();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::linkTransmit(LinkSlot_t* slot){
+    while(SerialTerminal::busy()){
+        Thread::yield();
+    }
+    slot->sent_ms = _link_tm.read_ms();
+    SerialTerminal::send(slot->buf, slot->len, _cb_tx);
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::linkFlush(){
+    for(uint8_t seq = _link_tx_base; seq != _link_tx_next && (uint8_t)(seq - _link_tx_base) < _link_window; seq++){
+        LinkSlot_t* slot = &_link_tx[seq % _link_tx_size];
+        if(!slot->sent){
+            slot->sent = true;
+            linkTransmit(slot);
+            _stats.tx_frames++;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::linkRecv(uint8_t* buf, uint16_t size){
+    // las tramas corruptas se descartan, el emisor las retransmitir al no recibir su ack
+    if(size < LINK_HEADER_SIZE + LINK_CRC_SIZE){
+        _stats.rx_format++;
+        return;
+    }
+    uint16_t crc = (((uint16_t)buf[size - 2]) << 8) | buf[size - 1];
+    if(crc != getCRC16(buf, size - LINK_CRC_SIZE)){
+        _stats.rx_crc++;
+        return;
+    }
+    
+    // ack acumulativo con bitmap de las tramas recibidas fuera de orden
+    if(buf[0] == LINK_ACK){
+        uint8_t ack = buf[1];
+        uint8_t bitmap = buf[2];
+        _link_mutex.lock();
+        // libera las tramas confirmadas de forma acumulativa. Slo pueden confirmarse las enviadas, las de la
+        // cola quedan fuera de la ventana
+        uint8_t inflight = _link_tx_next - _link_tx_base;
+        if(inflight > _link_window){
+            inflight = _link_window;
+        }
+        uint8_t released = ack - _link_tx_base;
+        if(released > inflight){
+            // ack fuera de la ventana (duplicado antiguo), se ignora
+            _link_mutex.unlock();
+            return;
+        }
+        for(uint8_t i=0;i<released;i++){
+            LinkSlot_t* slot = &_link_tx[_link_tx_base % _link_tx_size];
+            slot->used = false;
+            if(_hub){
+                _hub->_pool->free((char*)slot->buf);
+                slot->buf = 0;
+            }
+            _link_tx_base++;
+        }
+        inflight -= released;
+        // marca las tramas confirmadas selectivamente. Los huecos anteriores a la ltima trama confirmada
+        // se han perdido, as que se retransmiten de inmediato (una sola vez, el resto queda para el rto)
+        int8_t highest = -1;
+        for(uint8_t i=0;i<8 && i+1<inflight;i++){
+            if((bitmap & (1 << i)) != 0){
+                _link_tx[(uint8_t)(ack + 1 + i) % _link_tx_size].acked = true;
+                highest = i;
+            }
+        }
+        for(int8_t i=-1;i<highest;i++){
+            LinkSlot_t* slot = &_link_tx[(uint8_t)(ack + 1 + i) % _link_tx_size];
+            if(slot->used && !slot->acked && !slot->fast_retx){
+                slot->fast_retx = true;
+                linkTransmit(slot);
+                _stats.link_retx++;
+            }
+        }
+        // la ventana se ha desplazado, se envan las tramas de la cola que han entrado en ella
+        linkFlush();
+        _link_mutex.unlock();
+        while(released--){
+            _link_sem->release();
+        }
+        return;
+    }
+    
+    if(buf[0] != LINK_DATA){
+        return;
+    }
+    uint8_t seq = buf[1];
+    uint8_t offset = seq - _link_rx_expected;
+    uint16_t len = size - LINK_HEADER_SIZE - LINK_CRC_SIZE;
+    if(offset == 0){
+        // trama en orden, se entrega junto con las consecutivas almacenadas
+        processFrame((char*)&buf[LINK_HEADER_SIZE], len);
+        _link_rx_expected++;
+        LinkSlot_t* slot = &_link_rx[_link_rx_expected % _link_window];
+        while(slot->used && slot->seq == _link_rx_expected){
+            slot->used = false;
+            processFrame((char*)slot->buf, slot->len);
+            if(_hub){
+                _hub->_pool->free((char*)slot->buf);
+                slot->buf = 0;
+            }
+            _link_rx_expected++;
+            slot = &_link_rx[_link_rx_expected % _link_window];
+        }
+    }
+    else if(offset < _link_window){
+        // trama fuera de orden dentro de la ventana, se almacena hasta recibir las anteriores
+        // En modo hub, si el pool est agotado se descarta y el emisor la retransmitir
+        LinkSlot_t* slot = &_link_rx[seq % _link_window];
+        if(!slot->used && _hub){
+            slot->buf = (uint8_t*)_hub->_pool->alloc(0);
+        }
+        if(!slot->used && slot->buf){
+            memcpy(slot->buf, &buf[LINK_HEADER_SIZE], len);
+            slot->len = len;
+            slot->seq = seq;
+            slot->used = true;
+        }
+    }
+    // en cualquier caso (incluidos duplicados) se responde con el estado actual de recepcin
+    uint8_t bitmap = 0;
+    for(uint8_t i=0;i<8 && i+1<_link_window;i++){
+        uint8_t s = _link_rx_expected + 1 + i;
+        LinkSlot_t* slot = &_link_rx[s % _link_window];
+        if(slot->used && slot->seq == s){
+            bitmap |= (1 << i);
+        }
+    }
+    _link_mutex.lock();
+    while(SerialTerminal::busy()){
+        Thread::yield();
+    }
+    _link_ack[0] = LINK_ACK;
+    _link_ack[1] = _link_rx_expected;
+    _link_ack[2] = bitmap;
+    crc = getCRC16(_link_ack, LINK_HEADER_SIZE);
+    _link_ack[3] = (uint8_t)(crc >> 8);
+    _link_ack[4] = (uint8_t)(crc & 0xff);
+    SerialTerminal::send(_link_ack, LINK_HEADER_SIZE + LINK_CRC_SIZE, _cb_tx);
+    _link_mutex.unlock();
+}
+
+
+//------------------------------------------------------------------------------------
+uint32_t MQSerialBridge::linkPoll(){
+    uint32_t next = osWaitForever;
+    _link_mutex.lock();
+    uint32_t now = _link_tm.read_ms();
+    for(uint8_t seq = _link_tx_base; seq != _link_tx_next; seq++){
+        LinkSlot_t* slot = &_link_tx[seq % _link_tx_size];
+        if(!slot->used || !slot->sent || slot->acked){
+            continue;
+        }
+        uint32_t elapsed = now - slot->sent_ms;
+        if(elapsed >= _link_rto){
+            linkTransmit(slot);
+            _stats.link_retx++;
+            elapsed = 0;
+        }
+        if(_link_rto - elapsed < next){
+            next = _link_rto - elapsed;
+        }
+    }
+    _link_mutex.unlock();
+    return next;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snProcess(uint8_t* buf, uint16_t size){
+    // una misma trama puede agrupar varios mensajes MQTT-SN consecutivos
+    while(size >= 2){
+        uint16_t len;
+        uint8_t hlen;
+        if(buf[0] == 0x01){
+            if(size < 4){
+                return;
+            }
+            len = snReadU16(&buf[1]);
+            hlen = 3;
+        }
+        else{
+            len = buf[0];
+            hlen = 1;
+        }
+        // si la longitud es incoherente, se descarta el resto de la trama
+        if(len < hlen + 1 || len > size){
+            _stats.rx_format++;
+            return;
+        }
+        uint8_t type = buf[hlen];
+        uint8_t* p = &buf[hlen + 1];
+        uint16_t plen = len - hlen - 1;
+        uint8_t rsp[7];
+
+        _tx_mutex.lock();
+        switch(type){
+            // bsqueda de gateway
+            case SN_SEARCHGW:{
+                rsp[0] = SN_GATEWAY_ID;
+                snSend(SN_GWINFO, rsp, 1, 0, 0);
+                break;
+            }
+
+            // conexin: Flags, ProtocolId, Duration, ClientId
+            case SN_CONNECT:{
+                if(plen < 4){
+                    break;
+                }
+                // los mensajes de ltima voluntad no estn soportados
+                if((p[0] & SN_FLAG_WILL) != 0){
+                    rsp[0] = SN_RC_NOT_SUPPORTED;
+                    snSend(SN_CONNACK, rsp, 1, 0, 0);
+                    break;
+                }
+                // con CleanSession el cliente ha olvidado sus registros y suscripciones anteriores
+                if((p[0] & SN_FLAG_CLEAN) != 0){
+                    snCleanSession();
+                }
+                _sn_state = SnActive;
+                rsp[0] = SN_RC_ACCEPTED;
+                snSend(SN_CONNACK, rsp, 1, 0, 0);
+                snFlushSleepMessages();
+                break;
+            }
+
+            // registro de topic: TopicId, MsgId, TopicName
+            case SN_REGISTER:{
+                if(plen < 5){
+                    break;
+                }
+                SnTopic_t* t = snRegisterTopic((const char*)&p[4], plen - 4);
+                snWriteU16(&rsp[0], (t)? t->id : 0);
+                rsp[2] = p[2];
+                rsp[3] = p[3];
+                rsp[4] = (t)? SN_RC_ACCEPTED : SN_RC_CONGESTION;
+                snSend(SN_REGACK, rsp, 5, 0, 0);
+                break;
+            }
+
+            // publicacin: Flags, TopicId, MsgId, Data
+            case SN_PUBLISH:{
+                if(plen < 5){
+                    break;
+                }
+                uint8_t qos = SN_FLAG_QOS(p[0]);
+                uint8_t ttype = SN_FLAG_TOPIC_TYPE(p[0]);
+                // salvo en QoS -1, es necesario estar conectado
+                if(qos != SN_QOS_MINUS_ONE && _sn_state == SnDisconnected){
+                    break;
+                }
+                // obtiene el nombre del topic segn el tipo de identificador
+                char short_name[3];
+                const char* name = 0;
+                if(ttype == SN_TOPIC_SHORT){
+                    short_name[0] = (char)p[1];
+                    short_name[1] = (char)p[2];
+                    short_name[2] = 0;
+                    name = short_name;
+                }
+                else{
+                    SnTopic_t* t = snFindTopicId(snReadU16(&p[1]), (ttype == SN_TOPIC_PREDEFINED));
+                    if(t){
+                        name = t->name;
+                    }
+                }
+                // QoS2 no est soportado, y los topics desconocidos se rechazan
+                uint8_t rc = (qos == 2)? SN_RC_NOT_SUPPORTED : ((name)? SN_RC_ACCEPTED : SN_RC_INVALID_ID);
+                if(rc == SN_RC_ACCEPTED){
+                    MQ::MQClient::publish(name, &p[5], plen - 5, &_publicationCb);
+                    _stats.rx_published++;
+                }
+                if(qos != SN_QOS_MINUS_ONE && (qos == 1 || rc != SN_RC_ACCEPTED)){
+                    memcpy(rsp, &p[1], 4);
+                    rsp[4] = rc;
+                    snSend(SN_PUBACK, rsp, 5, 0, 0);
+                }
+                break;
+            }
+
+            // suscripcin: Flags, MsgId, TopicName o TopicId
+            case SN_SUBSCRIBE:
+            case SN_UNSUBSCRIBE:{
+                if(plen < 4){
+                    break;
+                }
+                // los identificadores predefinidos y los nombres cortos ocupan dos bytes
+                uint8_t ttype = SN_FLAG_TOPIC_TYPE(p[0]);
+                if(ttype != SN_TOPIC_NORMAL && plen < 5){
+                    break;
+                }
+                const char* tname = (const char*)&p[3];
+                uint16_t tlen = plen - 3;
+                SnTopic_t* t = 0;
+                int w = -1;
+                char* name = 0;
+                bool subscribed = false;
+                if(ttype == SN_TOPIC_PREDEFINED){
+                    t = snFindTopicId(snReadU16(&p[3]), true);
+                }
+                else if(memchr(tname, '+', tlen) == 0 && memchr(tname, '#', tlen) == 0){
+                    // topic sin comodines, se registra para poder notificar el identificador. Si es un topic
+                    // predefinido, se utiliza su entrada y las publicaciones llevarn su identificador predefinido
+                    t = snFindTopic(tname, tlen);
+                    if(!t && type == SN_SUBSCRIBE){
+                        t = snRegisterTopic(tname, tlen);
+                    }
+                }
+                else{
+                    // topic con comodines, la tabla mantiene el nombre que referencia MQLib durante la suscripcin
+                    w = snWildcard(tname, tlen, false);
+                    subscribed = (w >= 0);
+                    if(w < 0 && type == SN_SUBSCRIBE){
+                        w = snWildcard(tname, tlen, true);
+                    }
+                    name = (w >= 0)? _sn_wildcards[w] : 0;
+                }
+                if(t){
+                    name = t->name;
+                    subscribed = t->subscribed;
+                }
+                if(type == SN_UNSUBSCRIBE){
+                    if(name && subscribed){
+                        MQ::MQClient::unsubscribe(name, &_subscriptionCb);
+                        if(t){
+                            t->subscribed = false;
+                        }
+                        else{
+                            Heap::memFree(name);
+                            _sn_wildcards[w] = 0;
+                        }
+                    }
+                    snSend(SN_UNSUBACK, &p[1], 2, 0, 0);
+                    break;
+                }
+                // una suscripcin repetida no se duplica en MQLib
+                if(name && !subscribed){
+                    MQ::MQClient::subscribe(name, &_subscriptionCb);
+                    if(t){
+                        t->subscribed = true;
+                    }
+                }
+                // slo se conceden publicaciones QoS0 hacia el cliente
+                rsp[0] = 0;
+                snWriteU16(&rsp[1], (t)? t->id : 0);
+                rsp[3] = p[1];
+                rsp[4] = p[2];
+                rsp[5] = (name)? SN_RC_ACCEPTED : ((ttype == SN_TOPIC_PREDEFINED)? SN_RC_INVALID_ID : SN_RC_CONGESTION);
+                snSend(SN_SUBACK, rsp, 6, 0, 0);
+                break;
+            }
+
+            // ping: si el cliente duerme y se identifica, se entregan las publicaciones pendientes
+            case SN_PINGREQ:{
+                if(_sn_state == SnAsleep && plen > 0){
+                    _sn_state = SnAwake;
+                    snFlushSleepMessages();
+                    _sn_state = SnAsleep;
+                }
+                snSend(SN_PINGRESP, 0, 0, 0, 0);
+                break;
+            }
+
+            // desconexin: con Duration el cliente pasa a modo sleep
+            case SN_DISCONNECT:{
+                _sn_state = (plen >= 2)? SnAsleep : SnDisconnected;
+                snSend(SN_DISCONNECT, 0, 0, 0, 0);
+                break;
+            }
+
+            // resto de mensajes (REGACK, PUBACK, ...) no requieren accin
+            default:
+                break;
+        }
+        _tx_mutex.unlock();
+
+        buf += len;
+        size -= len;
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snForward(const char* topic, void* msg, uint16_t msg_len){
+    // la publicacin puede ir precedida del REGISTER de su topic
+    uint8_t credits = linkReserve(2);
+    _tx_mutex.lock();
+    _link_credits = credits;
+    if(_sn_state == SnDisconnected){
+        linkUnreserve();
+        _tx_mutex.unlock();
+        return;
+    }
+    // los topics recibidos por suscripciones con comodines se registran en el gateway
+    SnTopic_t* t = snFindTopic(topic, strlen(topic));
+    if(!t){
+        t = snRegisterTopic(topic, strlen(topic));
+        if(!t){
+            // tabla de topics llena
+            _stats.tx_dropped++;
+            linkUnreserve();
+            _tx_mutex.unlock();
+            return;
+        }
+    }
+    // si el cliente duerme, se almacena la publicacin descartando la ms antigua si no hay espacio
+    if(_sn_state == SnAsleep){
+        uint8_t* data = (uint8_t*)Heap::memAlloc(msg_len);
+        if(data){
+            if(_sn_sleep_count == MaxSnSleepMessages){
+                Heap::memFree(_sn_sleep[0].data);
+                memmove(&_sn_sleep[0], &_sn_sleep[1], (MaxSnSleepMessages - 1) * sizeof(SnSleepMessage_t));
+                _sn_sleep_count--;
+            }
+            memcpy(data, msg, msg_len);
+            _sn_sleep[_sn_sleep_count].topic = t;
+            _sn_sleep[_sn_sleep_count].len = msg_len;
+            _sn_sleep[_sn_sleep_count].data = data;
+            _sn_sleep_count++;
+        }
+        linkUnreserve();
+        _tx_mutex.unlock();
+        return;
+    }
+    snPublish(t, msg, msg_len);
+    linkUnreserve();
+    _tx_mutex.unlock();
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snPublish(SnTopic_t* t, const void* msg, uint16_t msg_len){
+    // si el cliente no conoce el identificador, se le notifica antes de publicar
+    uint8_t hdr[5];
+    if(!t->known){
+        snWriteU16(&hdr[0], t->id);
+        snWriteU16(&hdr[2], _sn_msgid++);
+        snSend(SN_REGISTER, hdr, 4, t->name, strlen(t->name));
+        t->known = true;
+    }
+    hdr[0] = (t->predefined)? SN_TOPIC_PREDEFINED : SN_TOPIC_NORMAL;
+    snWriteU16(&hdr[1], t->id);
+    snWriteU16(&hdr[3], 0);
+    snSend(SN_PUBLISH, hdr, 5, msg, msg_len);
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snSend(uint8_t type, const uint8_t* hdr, uint16_t hdr_len, const void* data, uint16_t data_len){
+    uint32_t len = hdr_len + data_len + 2;
+    if(len > 255){
+        len += 2;
+    }
+    // descarta los mensajes que no caben en el buffer de envo
+    if(len > _rbufsize){
+        _stats.tx_dropped++;
+        return;
+    }
+    uint8_t* p = (uint8_t*)txBuffer();
+    if(!p){
+        _stats.tx_dropped++;
+        return;
+    }
+    uint8_t* frame = p;
+    if(len > 255){
+        *p++ = 0x01;
+        snWriteU16(p, (uint16_t)len);
+        p += 2;
+    }
+    else{
+        *p++ = (uint8_t)len;
+    }
+    *p++ = type;
+    if(hdr_len){
+        memcpy(p, hdr, hdr_len);
+        p += hdr_len;
+    }
+    if(data_len){
+        memcpy(p, data, data_len);
+    }
+    if(!sendFrame(frame, len)){
+        _stats.tx_dropped++;
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+MQSerialBridge::SnTopic_t* MQSerialBridge::snFindTopic(const char* name, uint16_t len, bool predefined){
+    for(int i=0;i<MaxSnTopics;i++){
+        SnTopic_t* t = &_sn_topics[i];
+        if(t->name && (predefined || !t->predefined) && strlen(t->name) == len && strncmp(t->name, name, len) == 0){
+            return t;
+        }
+    }
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+MQSerialBridge::SnTopic_t* MQSerialBridge::snFindTopicId(uint16_t id, bool predefined){
+    for(int i=0;i<MaxSnTopics;i++){
+        SnTopic_t* t = &_sn_topics[i];
+        if(t->name && t->id == id && t->predefined == predefined){
+            return t;
+        }
+    }
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+MQSerialBridge::SnTopic_t* MQSerialBridge::snRegisterTopic(const char* name, uint16_t len){
+    // el cliente registra nombres para obtener un identificador normal, aunque exista uno predefinido
+    SnTopic_t* t = snFindTopic(name, len, false);
+    if(t){
+        return t;
+    }
+    // las entradas se liberan con la sesin (ver snCleanSession), ya que MQLib mantiene la referencia al nombre
+    for(int i=0;i<MaxSnTopics;i++){
+        if(_sn_topics[i].name == 0){
+            t = &_sn_topics[i];
+            t->name = (char*)Heap::memAlloc(len + 1);
+            if(!t->name){
+                return 0;
+            }
+            memcpy(t->name, name, len);
+            t->name[len] = 0;
+            t->id = _sn_next_id++;
+            t->predefined = false;
+            t->known = false;
+            t->subscribed = false;
+            return t;
+        }
+    }
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+int MQSerialBridge::snWildcard(const char* name, uint16_t len, bool add){
+    int free_slot = -1;
+    for(int i=0;i<MaxSnWildcards;i++){
+        char* w = _sn_wildcards[i];
+        if(w && strlen(w) == len && strncmp(w, name, len) == 0){
+            return i;
+        }
+        if(!w && free_slot < 0){
+            free_slot = i;
+        }
+    }
+    if(!add || free_slot < 0){
+        return -1;
+    }
+    char* w = (char*)Heap::memAlloc(len + 1);
+    if(!w){
+        return -1;
+    }
+    memcpy(w, name, len);
+    w[len] = 0;
+    _sn_wildcards[free_slot] = w;
+    return free_slot;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snCleanSession(){
+    // las publicaciones almacenadas referencian topics que se van a liberar
+    for(int i=0;i<_sn_sleep_count;i++){
+        Heap::memFree(_sn_sleep[i].data);
+    }
+    _sn_sleep_count = 0;
+    for(int i=0;i<MaxSnWildcards;i++){
+        if(_sn_wildcards[i]){
+            MQ::MQClient::unsubscribe(_sn_wildcards[i], &_subscriptionCb);
+            Heap::memFree(_sn_wildcards[i]);
+            _sn_wildcards[i] = 0;
+        }
+    }
+    for(int i=0;i<MaxSnTopics;i++){
+        SnTopic_t* t = &_sn_topics[i];
+        if(!t->name){
+            continue;
+        }
+        if(t->subscribed){
+            MQ::MQClient::unsubscribe(t->name, &_subscriptionCb);
+            t->subscribed = false;
+        }
+        if(!t->predefined){
+            Heap::memFree(t->name);
+            t->name = 0;
+            t->known = false;
+        }
+    }
+    _sn_next_id = 1;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBridge::snFlushSleepMessages(){
+    for(int i=0;i<_sn_sleep_count;i++){
+        snPublish(_sn_sleep[i].topic, _sn_sleep[i].data, _sn_sleep[i].len);
+        Heap::memFree(_sn_sleep[i].data);
+    }
+    _sn_sleep_count = 0;
+}
@@ -18,12 +18,35 @@
  *      MENSAJE: Mensaje en el que pueden agruparse parmetros separados por comas, ej: "mensaje,arg0,arg1,arg2"
  *      \0: La trama siempre debe terminar con el caracter NULL.
  *
+ *      Si el mensaje contiene varios argumentos separados por espacios, ej: "topic 12 -0.5 on #0A0B", se publican
+ *      codificados con su tipo (entero, float, string o blob) segn el formato descrito en MQSerialArgs.h.
+ *
  *
  *      MODO MIXTO: "TOPIC<\n>MENSAJE<\n><\0>"
  *
  *      TOPIC: Cadena de texto con el nombre del topic, ej: "este/ess/un/topic"
  *      MENSAJE: Mensaje en el que pueden agruparse parmetros separados por comas, ej: "mensaje,arg0,arg1,arg2"
  *      \0: La trama siempre debe terminar con el caracter NULL.
+ *
+ *
+ *      MODO MQTT-SN: "LONGITUD TIPO CUERPO" (binario, MQTT-SN v1.2)
+ *
+ *      El puente acta como gateway MQTT-SN de un nico cliente conectado al puerto serie. Soporta CONNECT,
+ *      REGISTER/REGACK, PUBLISH con QoS -1/0/1, SUBSCRIBE/UNSUBSCRIBE, PINGREQ y DISCONNECT (incluyendo el
+ *      modo sleep, durante el cual las publicaciones hacia el cliente se almacenan hasta que despierta).
+ *      Los topics se traducen directamente a publicaciones/suscripciones MQLib.
+ *
+ *
+ *  ENLACE FIABLE (opcional, ver enableLink): "TIPO SEQ ACK DATOS CRC16"
+ *
+ *      Cualquiera de los modos anteriores puede encapsularse en un enlace con nmeros de secuencia, ack
+ *      acumulativo, ventana configurable y retransmisin selectiva. Ambos extremos deben activarlo. Las tramas
+ *      que no caben en la ventana esperan en una cola de emisin del mismo tamao hasta que los ack la desplazan.
+ *      TIPO: 0x01 trama de datos, 0x02 trama de ack
+ *      SEQ: En datos, nmero de secuencia (mdulo 256). En ack, siguiente secuencia esperada.
+ *      ACK: En datos, 0. En ack, bitmap de las tramas posteriores ya recibidas (bit0 = SEQ+1).
+ *      DATOS: Trama en el formato del modo configurado (slo en tramas de datos)
+ *      CRC16: CRC16-CCITT de todos los bytes anteriores (MSB primero)
  */
  
  
@@ -35,6 +58,8 @@
 #include "SerialTerminal.h"
 #include "MQLib.h"
   
+
+class MQSerialHub;
   
   
 //---------------------------------------------------------------------------------
@@ -44,6 +69,8 @@
 
 class MQSerialBridge : public SerialTerminal {
 
+    friend class MQSerialHub;
+
 public:
     
     /** ModeType 
@@ -52,8 +79,25 @@ public:
     enum ModeType{
         TextMode,   /// Modo texto (token separador es el espacio ' ')
         MixMode,    /// Modo mixto (token separador es el caracter '\n')
+        SnMode,     /// Modo gateway MQTT-SN (tramas binarias)
     };
-    
+
+    /** Stats_t
+     *  Contadores de actividad del puerto, para diagnstico
+     */
+    struct Stats_t{
+        uint32_t rx_frames;                     /// Tramas recibidas
+        uint32_t rx_published;                  /// Publicaciones generadas desde el enlace serie
+        uint32_t rx_timeout;                    /// Tramas descartadas por timeout en recepcin
+        uint32_t rx_overflow;                   /// Tramas descartadas por overflow del buffer de recepcin
+        uint32_t rx_format;                     /// Tramas con formato incoherente
+        uint32_t rx_size;                       /// Tramas (modo mixto) con tamao de datos incorrecto
+        uint32_t rx_crc;                        /// Tramas con CRC incorrecto (modo mixto o enlace fiable)
+        uint32_t tx_frames;                     /// Tramas enviadas
+        uint32_t tx_dropped;                    /// Tramas no enviadas (sin buffer, cola del enlace llena, demasiado grandes o topic MQTT-SN sin registrar)
+        uint32_t link_retx;                     /// Retransmisiones del enlace fiable
+    };
+
     /** MQSerialBridge()
      *  Crea el objeto asignando un puerto serie para la interfaz con el equipo digital
      *  @param tx Lnea tx del Puerto serie asignado
@@ -73,11 +117,115 @@ public:
      */
     void addSubscription(const char* topic, uint32_t msg_size);
 
-      
+
+    /** addPredefinedTopic()
+     *  Registra un topic predefinido para el modo MQTT-SN (necesario para publicaciones QoS -1)
+     *  @param topic_id Identificador del topic predefinido
+     *  @param topic Topic MQLib asociado
+     *  @return true si se registra, false si la tabla de topics est llena
+     */
+    bool addPredefinedTopic(uint16_t topic_id, const char* topic);
+
+
+    /** enableLink()
+     *  Activa el enlace fiable (ARQ de ventana deslizante) sobre el puerto serie. Las tramas corruptas o
+     *  perdidas se retransmiten hasta recibir su confirmacin.
+     *  @param window Tamao de la ventana: 1, 2, 4 u 8 (MaxLinkWindow). Debe ser potencia de dos para que el slot
+     *      de cada secuencia se mantenga al pasar de 255 a 0. Reserva 3*window buffers de recv_buf_size (2*window
+     *      para la ventana y la cola de emisin, window para la recepcin fuera de orden). En los puertos de un
+     *      MQSerialHub no se reserva ninguno: los slots ocupados toman sus buffers del pool del hub.
+     *  @param rto_ms Tiempo de retransmisin en milisegundos
+     *  @return true si se activa, false en caso de error o si ya estaba activo
+     */
+    bool enableLink(uint8_t window = 4, uint32_t rto_ms = 100);
+
+
+    /** getStats()
+     *  Obtiene los contadores de actividad del puerto
+     *  @return Contadores acumulados desde la creacin del puerto
+     */
+    const Stats_t& getStats() { return _stats; }
+
+
 protected:
 
-    /** Mximo nmero de argumentos que pueden ir asociados a una publicacin desde el enlace serie */
-    static const uint8_t MaxNumArguments = 4;
+    /** MQSerialBridge()
+     *  Crea un puerto gestionado por un MQSerialHub. No dispone de hilo ni de buffers propios, utiliza
+     *  el buffer de recepcin compartido del hub y toma los de envo de su pool bajo demanda.
+     *  @param hub Hub al que pertenece el puerto
+     *  @param port ndice del puerto en el hub
+     *  @param tx Lnea tx del Puerto serie asignado
+     *  @param rx Lnea rx del Puerto serie asignado
+     *  @param baud Velocidad del puerto serie
+     *  @param recv_buf_size Tamao mximo de trama
+     *  @param cfg_topic Topic de configuracin, para ajuste de parmetros propios
+     *  @param mode Modo de funcionamiento
+     */
+    MQSerialBridge(MQSerialHub* hub, uint8_t port, PinName tx, PinName rx, uint32_t baud, uint16_t recv_buf_size, const char* cfg_topic, ModeType mode);
+
+
+    /** argBufferSize()
+     *  Tamao del buffer de codificacin de argumentos. En el peor caso (floats de dos caracteres, ej: "1.")
+     *  la codificacin ocupa 5/3 del texto recibido.
+     *  @param recv_buf_size Tamao mximo de trama
+     *  @return Tamao del buffer
+     */
+    static uint16_t argBufferSize(uint16_t recv_buf_size) { return (recv_buf_size < 0x8000)? (2 * recv_buf_size) : 0xffff; }
+
+    /** Mximo nmero de topics registrados en modo MQTT-SN */
+    static const uint8_t MaxSnTopics = 16;
+
+    /** Mximo nmero de suscripciones MQTT-SN con comodines */
+    static const uint8_t MaxSnWildcards = 8;
+
+    /** Mximo nmero de publicaciones almacenadas mientras el cliente MQTT-SN duerme */
+    static const uint8_t MaxSnSleepMessages = 8;
+
+    /** Tamao mximo de la ventana del enlace fiable (limitado por el bitmap de ack de 8 bits) */
+    static const uint8_t MaxLinkWindow = 8;
+
+    /** Tamao de una trama de ack del enlace fiable */
+    static const uint8_t LinkAckFrameSize = 5;
+
+    /** Mxima espera por hueco en la cola de emisin, en mltiplos del tiempo de retransmisin. Se espera antes
+     *  de tomar _tx_mutex (ver linkReserve), y el hilo que procesa los ack no espera nunca. */
+    static const uint8_t LinkTxMaxRto = 4;
+
+    /** Slot de la ventana del enlace fiable */
+    struct LinkSlot_t{
+        uint8_t* buf;                           /// Trama completa (tx) o datos de la trama (rx)
+        uint16_t len;                           /// Tamao de la trama o de los datos
+        uint8_t seq;                            /// Nmero de secuencia
+        bool used;                              /// Flag de slot ocupado
+        bool sent;                              /// Flag de trama enviada al menos una vez (tx)
+        bool acked;                             /// Flag de trama confirmada selectivamente (tx)
+        bool fast_retx;                         /// Flag de retransmisin rpida ya realizada (tx)
+        uint32_t sent_ms;                       /// Instante del ltimo envo (tx)
+    };
+
+    /** Estado del cliente MQTT-SN */
+    enum SnStateType{
+        SnDisconnected,     /// Sin conexin
+        SnActive,           /// Conectado y despierto
+        SnAsleep,           /// Dormido, las publicaciones se almacenan
+        SnAwake,            /// Despierto temporalmente para recoger las publicaciones almacenadas
+    };
+
+    /** Entrada de la tabla de topics MQTT-SN */
+    struct SnTopic_t{
+        uint16_t id;                            /// Identificador del topic
+        bool predefined;                        /// Flag de topic predefinido
+        bool known;                             /// Flag indicando si el cliente conoce el identificador
+        bool subscribed;                        /// Flag de suscripcin MQLib activa con este nombre
+        char* name;                             /// Nombre del topic (0 si la entrada est libre)
+    };
+
+    /** Publicacin almacenada mientras el cliente duerme */
+    struct SnSleepMessage_t{
+        SnTopic_t* topic;                       /// Topic de la publicacin
+        uint16_t len;                           /// Tamao de los datos
+        uint8_t* data;                          /// Datos de la publicacin
+    };
 
 
     /** task()
@@ -85,6 +233,68 @@ protected:
      */
     void task(); 
 
+
+    /** init()
+     *  Inicializacin comn a los constructores
+     *  @param baud Velocidad del puerto serie
+     *  @param recv_buf_size Tamao a reservar para el buffer de recepcin
+     *  @param cfg_topic Topic de configuracin
+     *  @param mode Modo de funcionamiento
+     *  @return true si la inicializacin es correcta
+     */
+    bool init(uint32_t baud, uint16_t recv_buf_size, const char* cfg_topic, ModeType mode);
+
+
+    /** start()
+     *  Se suscribe a los topics de configuracin e inicia la recepcin serie
+     */
+    void start();
+
+
+    /** dispatch()
+     *  Procesa los eventos pendientes del puerto
+     *  @param sig Flags de eventos (SigEventFlags)
+     */
+    void dispatch(uint32_t sig);
+
+
+    /** poll()
+     *  Realiza las tareas peridicas del puerto (retransmisiones, liberacin de buffers)
+     *  @return Tiempo mximo de espera hasta la siguiente llamada, u osWaitForever
+     */
+    uint32_t poll();
+
+
+    /** notify()
+     *  Notifica eventos (desde ISR) al hilo que gestiona el puerto
+     *  @param flags Flags de eventos (SigEventFlags)
+     */
+    void notify(uint32_t flags);
+
+
+    /** txBuffer()
+     *  Espera a que finalice el envo en curso y obtiene el buffer de envo. Debe invocarse con _tx_mutex tomado.
+     *  En modo hub el buffer se toma del pool y se devuelve al finalizar la transmisin, o pasa a la ventana del
+     *  enlace fiable si est activo.
+     *  @return Buffer de envo, o 0 si no hay buffers disponibles en el pool del hub
+     */
+    char* txBuffer();
+
+
+    /** releaseTxBuffer()
+     *  En modo hub, devuelve el buffer de envo al pool si no hay una transmisin en curso
+     */
+    void releaseTxBuffer();
+
+
+    /** getCRC()
+     *  Calcula el CRC de los datos de una trama en modo mixto
+     *  @param data Datos
+     *  @param size Tamao de los datos
+     *  @return CRC
+     */
+    static uint16_t getCRC(void* data, uint32_t size);
+
                 
 	/** subscriptionCb()
      *  Callback invocada al recibir una actualizacin de un topic al que est suscrito
@@ -136,13 +346,182 @@ protected:
     bool onRxData(uint8_t* buf, uint16_t size);   
 
 
+    /** processFrame()
+     *  Procesa una trama recibida segn el modo de funcionamiento
+     *  @param buf Buffer de datos recibidos
+     *  @param bufsize Tamao de la trama
+     */
+    void processFrame(char* buf, uint16_t bufsize);
+
+
+    /** sendFrame()
+     *  Enva una trama por el puerto serie, a travs del enlace fiable si est activo
+     *  @param buf Trama a enviar
+     *  @param size Tamao de la trama
+     *  @return true si la trama se ha enviado (o encolado en el enlace), false si se ha descartado
+     */
+    bool sendFrame(void* buf, uint16_t size);
+
+
+    /** linkSend()
+     *  Encapsula una trama en el enlace fiable y la enva si cabe en la ventana, o la deja en la cola de emisin
+     *  hasta que los ack la desplacen. Ocupa un hueco reservado con linkReserve() o, si no queda ninguno, uno
+     *  libre sin esperar. Debe invocarse con _tx_mutex tomado.
+     *  En modo hub, la trama debe estar en el buffer de envo (txBuffer()), que pasa al slot hasta su ack.
+     *  @param data Trama a enviar
+     *  @param size Tamao de la trama
+     *  @return true si la trama se ha enviado o encolado, false si no cabe en un slot o la cola est llena
+     */
+    bool linkSend(const uint8_t* data, uint16_t size);
+
+
+    /** linkReserve()
+     *  Reserva huecos en la cola de emisin, esperando si est llena. Debe invocarse antes de tomar _tx_mutex:
+     *  el hilo que procesa los ack lo necesita en modo MQTT-SN, y mientras esperase la cola no podra
+     *  liberarse. Ese mismo hilo no espera nunca, por lo que no reserva.
+     *  Tras tomar _tx_mutex, la reserva se cede a linkSend() asignando el resultado a _link_credits, y lo que
+     *  no se utilice se devuelve con linkUnreserve() antes de liberarlo.
+     *  @param count Nmero de tramas a enviar
+     *  @return Huecos reservados (0 si el enlace no est activo)
+     */
+    uint8_t linkReserve(uint8_t count);
+
+
+    /** linkUnreserve()
+     *  Devuelve a la cola de emisin los huecos reservados que no se han utilizado. Debe invocarse con _tx_mutex
+     *  tomado.
+     */
+    void linkUnreserve();
+
+
+    /** linkTransmit()
+     *  Enva (o reenva) una trama de la ventana de emisin. Debe invocarse con _link_mutex tomado.
+     *  @param slot Slot de la ventana
+     */
+    void linkTransmit(LinkSlot_t* slot);
+
+
+    /** linkFlush()
+     *  Enva las tramas de la cola de emisin que han entrado en la ventana. Debe invocarse con _link_mutex tomado.
+     */
+    void linkFlush();
+
+
+    /** linkRecv()
+     *  Procesa una trama recibida del enlace fiable (datos o ack)
+     *  @param buf Trama recibida
+     *  @param size Tamao de la trama
+     */
+    void linkRecv(uint8_t* buf, uint16_t size);
+
+
+    /** linkPoll()
+     *  Retransmite las tramas cuyo tiempo de retransmisin ha vencido
+     *  @return Tiempo hasta la prxima retransmisin, u osWaitForever si no hay tramas pendientes
+     */
+    uint32_t linkPoll();
+
+
+    /** snProcess()
+     *  Procesa una trama recibida en modo MQTT-SN. La trama puede contener varios mensajes consecutivos.
+     *  @param buf Buffer de datos recibidos
+     *  @param size Tamao de la trama
+     */
+    void snProcess(uint8_t* buf, uint16_t size);
+
+
+    /** snForward()
+     *  Enva al cliente MQTT-SN una publicacin MQLib, o la almacena si el cliente est dormido
+     *  @param topic Identificador del topic
+     *  @param msg Mensaje recibido
+     *  @param msg_len Tamao del mensaje
+     */
+    void snForward(const char* topic, void* msg, uint16_t msg_len);
+
+
+    /** snPublish()
+     *  Enva una publicacin QoS0 al cliente MQTT-SN, registrando antes el topic si el cliente no lo conoce.
+     *  Debe invocarse con _tx_mutex tomado.
+     *  @param t Topic de la publicacin
+     *  @param msg Mensaje a enviar
+     *  @param msg_len Tamao del mensaje
+     */
+    void snPublish(SnTopic_t* t, const void* msg, uint16_t msg_len);
+
+
+    /** snSend()
+     *  Construye y enva un mensaje MQTT-SN. Debe invocarse con _tx_mutex tomado.
+     *  @param type Tipo de mensaje MQTT-SN
+     *  @param hdr Cabecera variable del mensaje
+     *  @param hdr_len Tamao de la cabecera variable
+     *  @param data Datos adicionales (topic o payload), puede ser 0
+     *  @param data_len Tamao de los datos adicionales
+     */
+    void snSend(uint8_t type, const uint8_t* hdr, uint16_t hdr_len, const void* data, uint16_t data_len);
+
+
+    /** snFindTopic()
+     *  Busca un topic en la tabla MQTT-SN por nombre
+     *  @param name Nombre del topic
+     *  @param len Longitud del nombre
+     *  @param predefined Incluye en la bsqueda los topics predefinidos
+     *  @return Entrada de la tabla o 0 si no existe
+     */
+    SnTopic_t* snFindTopic(const char* name, uint16_t len, bool predefined = true);
+
+
+    /** snFindTopicId()
+     *  Busca un topic en la tabla MQTT-SN por identificador
+     *  @param id Identificador del topic
+     *  @param predefined Tipo de identificador (predefinido o normal)
+     *  @return Entrada de la tabla o 0 si no existe
+     */
+    SnTopic_t* snFindTopicId(uint16_t id, bool predefined);
+
+
+    /** snRegisterTopic()
+     *  Registra un topic en la tabla MQTT-SN, asignndole un identificador si no exista
+     *  @param name Nombre del topic
+     *  @param len Longitud del nombre
+     *  @return Entrada de la tabla o 0 si la tabla est llena
+     */
+    SnTopic_t* snRegisterTopic(const char* name, uint16_t len);
+
+
+    /** snWildcard()
+     *  Busca una suscripcin con comodines, o la aade a la tabla si add es true
+     *  @param name Filtro de la suscripcin
+     *  @param len Longitud del filtro
+     *  @param add Aade el filtro si no existe
+     *  @return Posicin en la tabla o -1 si no existe (o la tabla est llena)
+     */
+    int snWildcard(const char* name, uint16_t len, bool add);
+
+
+    /** snCleanSession()
+     *  Descarta la sesin del cliente MQTT-SN: cancela sus suscripciones, libera los topics registrados y las
+     *  publicaciones almacenadas. Los topics predefinidos se conservan. Debe invocarse con _tx_mutex tomado.
+     */
+    void snCleanSession();
+
+
+    /** snFlushSleepMessages()
+     *  Enva al cliente las publicaciones almacenadas mientras dorma. Debe invocarse con _tx_mutex tomado.
+     */
+    void snFlushSleepMessages();
+
+
     /** Flags de tarea (asociados a la mquina de estados) */
     enum SigEventFlags{
         ReceivedData   = (1<<0),
         SentData       = (1<<1),
         TimeoutOnRecv  = (1<<2),
         OverflowOnRecv = (1<<3),
+        LinkTxPending  = (1<<4),
     };
+
+    /** Nmero de flags de eventos por puerto (utilizado por MQSerialHub) */
+    static const uint8_t NumSigEventFlags = 5;
       
     
     Thread      _th;                            /// Manejador del thread
@@ -153,10 +532,37 @@ protected:
     
     char* _tbuf;                                /// Buffer para el envo de datos
     char* _rbuf;                                /// Buffer para la recepcin de datos
+    uint8_t* _abuf;                             /// Buffer para la codificacin de argumentos (modo texto)
     uint16_t _rbufsize;                         /// Tamao del buffer
     char* _token;                               /// Caracter de separacin de argumentos
     char* _cfg_topic;                           /// Topic de configuracin     
     ModeType _mode;                             /// Modo de funcionamiento
+    MQSerialHub* _hub;                          /// Hub que gestiona el puerto (0 si dispone de hilo propio)
+    uint8_t _port;                              /// ndice del puerto en el hub
+    Stats_t _stats;                             /// Contadores de actividad
+
+    uint8_t _link_window;                       /// Tamao de la ventana del enlace fiable (0: desactivado)
+    uint32_t _link_rto;                         /// Tiempo de retransmisin (ms)
+    Mutex _link_mutex;                          /// Acceso exclusivo a la ventana de emisin y al puerto serie
+    Semaphore* _link_sem;                       /// Huecos libres en la cola de emisin
+    LinkSlot_t* _link_tx;                       /// Ventana y cola de emisin, indexadas por secuencia
+    uint8_t _link_tx_size;                      /// Slots de emisin (2 * _link_window)
+    LinkSlot_t* _link_rx;                       /// Ventana de recepcin (tramas fuera de orden)
+    uint8_t _link_tx_base;                      /// Secuencia ms antigua sin confirmar
+    uint8_t _link_tx_next;                      /// Siguiente secuencia a emitir
+    uint8_t _link_rx_expected;                  /// Siguiente secuencia esperada en recepcin
+    uint8_t _link_credits;                      /// Huecos reservados por el hilo que tiene _tx_mutex
+    uint8_t _link_ack[LinkAckFrameSize];     /// Buffer para el envo de tramas de ack
+    Timer _link_tm;                             /// Base de tiempos de las retransmisiones
+
+    Mutex _tx_mutex;                            /// Acceso exclusivo a _tbuf (tambin desde el hilo del hub) y al estado MQTT-SN
+    SnStateType _sn_state;                      /// Estado del cliente MQTT-SN
+    SnTopic_t* _sn_topics;                      /// Tabla de topics MQTT-SN
+    char** _sn_wildcards;                       /// Filtros de las suscripciones con comodines (0 si libre)
+    uint16_t _sn_next_id;                       /// Siguiente identificador de topic a asignar
+    uint16_t _sn_msgid;                         /// Siguiente MsgId de los mensajes generados por el gateway
+    SnSleepMessage_t* _sn_sleep;                /// Publicaciones almacenadas durante el modo sleep
+    uint8_t _sn_sleep_count;                    /// Nmero de publicaciones almacenadas
 
 };
 
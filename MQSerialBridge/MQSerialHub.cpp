@@ -0,0 +1,146 @@
+/*
+ * MQSerialHub.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+
+#include "MQSerialHub.h"
+
+
+//------------------------------------------------------------------------------------
+//-- MQSerialBufferPool ---------------------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+MQSerialBufferPool::MQSerialBufferPool(uint16_t block_size, uint8_t max_blocks) : _avail(max_blocks) {
+    _block_size = block_size;
+    _max_blocks = max_blocks;
+    _num_free = 0;
+    _num_alloc = 0;
+    _free = (char**)Heap::memAlloc(max_blocks * sizeof(char*));
+}
+
+
+//------------------------------------------------------------------------------------
+char* MQSerialBufferPool::alloc(uint32_t millis){
+    if(!_free || _avail.wait(millis) <= 0){
+        return 0;
+    }
+    char* block = 0;
+    _mutex.lock();
+    if(_num_free){
+        block = _free[--_num_free];
+    }
+    else{
+        // primer uso de este buffer, se reserva en el heap
+        block = (char*)Heap::memAlloc(_block_size);
+        if(block){
+            _num_alloc++;
+        }
+    }
+    _mutex.unlock();
+    if(!block){
+        _avail.release();
+    }
+    return block;
+}
+
+
+//------------------------------------------------------------------------------------
+void MQSerialBufferPool::free(char* block){
+    _mutex.lock();
+    _free[_num_free++] = block;
+    _mutex.unlock();
+    _avail.release();
+}
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+MQSerialHub::MQSerialHub(uint16_t recv_buf_size, uint8_t tx_buffers) {
+    _num_ports = 0;
+    _timeout = osWaitForever;
+    _rbufsize = recv_buf_size;
+    _rbuf = (char*)Heap::memAlloc(_rbufsize);
+    _abuf = (uint8_t*)Heap::memAlloc(MQSerialBridge::argBufferSize(_rbufsize));
+    _pool = new MQSerialBufferPool(_rbufsize, tx_buffers);
+    if(_rbuf && _abuf){
+        memset(_rbuf, 0, _rbufsize);
+
+        // Inicializa parmetros del hilo de ejecucin propio
+        _th.start(callback(this, &MQSerialHub::task));
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+MQSerialBridge* MQSerialHub::addPort(PinName tx, PinName rx, uint32_t baud, const char* cfg_topic, MQSerialBridge::ModeType mode){
+    if(!_rbuf || !_abuf || _num_ports >= MaxPorts){
+        return 0;
+    }
+    MQSerialBridge* port = new MQSerialBridge(this, _num_ports, tx, rx, baud, _rbufsize, cfg_topic, mode);
+    if(!port->_rbuf){
+        delete(port);
+        return 0;
+    }
+    // el puerto se publica al hilo del hub antes de habilitar su recepcin
+    _ports[_num_ports] = port;
+    _num_ports++;
+    port->start();
+    return port;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- PROTECTED METHODS IMPLEMENTATION ------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+//---------------------------------------------------------------------------------
+void MQSerialHub::notify(uint8_t port, uint32_t flags){
+    _th.signal_set(flags << (port * MQSerialBridge::NumSigEventFlags));
+}
+
+
+//---------------------------------------------------------------------------------
+char* MQSerialHub::allocTxBuffer(){
+    char* buf = _pool->alloc(0);
+    if(buf){
+        return buf;
+    }
+    // recupera los buffers de los puertos que ya han terminado de transmitir
+    for(uint8_t i=0;i<_num_ports;i++){
+        if(_ports[i]->_tbuf){
+            _ports[i]->releaseTxBuffer();
+        }
+    }
+    // el hilo del hub no espera: es el que procesa los ack que devuelven al pool los buffers del enlace fiable
+    return _pool->alloc((Thread::gettid() == _th.get_id())? 0 : TxAllocTimeoutMillis);
+}
+
+
+//---------------------------------------------------------------------------------
+void MQSerialHub::task(){
+    for(;;){
+        osEvent evt = _th.signal_wait(0, _timeout);
+        uint32_t sig = (evt.status == osEventSignal)? evt.value.signals : 0;
+        uint32_t timeout = osWaitForever;
+        for(uint8_t i=0;i<_num_ports;i++){
+            uint32_t port_sig = (sig >> (i * MQSerialBridge::NumSigEventFlags)) & PortSignalMask;
+            if(port_sig){
+                _ports[i]->dispatch(port_sig);
+            }
+            uint32_t port_timeout = _ports[i]->poll();
+            if(port_timeout < timeout){
+                timeout = port_timeout;
+            }
+        }
+        _timeout = timeout;
+    }
+}
+
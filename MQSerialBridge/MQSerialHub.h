@@ -0,0 +1,159 @@
+/*
+ * MQSerialHub.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  MQSerialHub es el mdulo C++ que gestiona varios puertos MQSerialBridge desde un nico hilo de ejecucin.
+ *  Cada puerto mantiene su propio modo de funcionamiento (TextMode, MixMode, SnMode) y, opcionalmente, su
+ *  enlace fiable, pero todos comparten:
+ *
+ *      - Un nico hilo, que recibe los eventos de cada puerto como flags desplazados segn su ndice.
+ *      - Un nico buffer de recepcin, ya que las tramas se procesan de una en una.
+ *      - Un pool de buffers de envo que se asignan bajo demanda y se liberan al finalizar la transmisin,
+ *        de forma que la memoria crece con el trfico activo y no con el nmero de puertos. Los puertos con
+ *        enlace fiable toman tambin del pool los buffers de las tramas pendientes de ack y de las recibidas
+ *        fuera de orden.
+ *
+ *  Ejemplo de uso:
+ *
+ *      MQSerialHub* hub = new MQSerialHub(256);
+ *      hub->addPort(PA_9, PA_10, 115200, "port0");
+ *      hub->addPort(PC_10, PC_11, 115200, "port1", MQSerialBridge::SnMode);
+ */
+
+
+#ifndef _MQSERIALHUB_H
+#define _MQSERIALHUB_H
+
+
+#include "mbed.h"
+#include "MQLib.h"
+#include "MQSerialBridge.h"
+
+
+
+//---------------------------------------------------------------------------------
+//- class MQSerialBufferPool ------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+class MQSerialBufferPool {
+
+public:
+
+    /** MQSerialBufferPool()
+     *  Crea un pool de buffers de tamao fijo. Los buffers se reservan en el heap la primera vez que se
+     *  necesitan y se reutilizan a partir de entonces.
+     *  @param block_size Tamao de cada buffer
+     *  @param max_blocks Nmero mximo de buffers
+     */
+    MQSerialBufferPool(uint16_t block_size, uint8_t max_blocks);
+
+
+    /** alloc()
+     *  Obtiene un buffer del pool
+     *  @param millis Tiempo mximo de espera si no hay buffers libres
+     *  @return Buffer o 0 si no hay buffers disponibles
+     */
+    char* alloc(uint32_t millis);
+
+
+    /** free()
+     *  Devuelve un buffer al pool
+     *  @param block Buffer obtenido con alloc()
+     */
+    void free(char* block);
+
+protected:
+
+    Mutex _mutex;                               /// Acceso exclusivo a la lista de buffers libres
+    Semaphore _avail;                           /// Buffers disponibles (libres o sin reservar)
+    char** _free;                               /// Lista de buffers libres
+    uint8_t _num_free;                          /// Nmero de buffers libres
+    uint8_t _num_alloc;                         /// Nmero de buffers reservados en el heap
+    uint8_t _max_blocks;                        /// Nmero mximo de buffers
+    uint16_t _block_size;                       /// Tamao de cada buffer
+};
+
+
+
+//---------------------------------------------------------------------------------
+//- class MQSerialHub --------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+class MQSerialHub {
+
+    friend class MQSerialBridge;
+
+public:
+
+    /** Mximo nmero de puertos (limitado por los flags de sealizacin del hilo) */
+    static const uint8_t MaxPorts = 31 / MQSerialBridge::NumSigEventFlags;
+
+    /** MQSerialHub()
+     *  Crea el hub e inicia su hilo de ejecucin
+     *  @param recv_buf_size Tamao mximo de trama (buffer de recepcin compartido y buffers del pool)
+     *  @param tx_buffers Nmero mximo de buffers en el pool (envo y slots ocupados de los enlaces fiables)
+     */
+    MQSerialHub(uint16_t recv_buf_size, uint8_t tx_buffers = 2);
+
+
+    /** addPort()
+     *  Aade un puerto serie al hub
+     *  @param tx Lnea tx del Puerto serie asignado
+     *  @param rx Lnea rx del Puerto serie asignado
+     *  @param baud Velocidad del puerto serie
+     *  @param cfg_topic Topic de configuracin del puerto
+     *  @param mode Modo de funcionamiento del puerto
+     *  @return Puerto creado (permite configurar enableLink, addPredefinedTopic...) o 0 en caso de error
+     */
+    MQSerialBridge* addPort(PinName tx, PinName rx, uint32_t baud, const char* cfg_topic, MQSerialBridge::ModeType mode = MQSerialBridge::TextMode);
+
+protected:
+
+    /** Mscara de los flags de eventos de un puerto */
+    static const uint32_t PortSignalMask = (1 << MQSerialBridge::NumSigEventFlags) - 1;
+
+    /** Periodo de comprobacin de los buffers de envo pendientes de liberar */
+    static const uint32_t TxReleasePollMillis = 5;
+
+    /** Mxima espera por un buffer de envo */
+    static const uint32_t TxAllocTimeoutMillis = 100;
+
+
+    /** task()
+     *  Hilo de ejecucin que atiende los eventos de todos los puertos
+     */
+    void task();
+
+
+    /** notify()
+     *  Notifica eventos de un puerto al hilo del hub (invocada desde ISR)
+     *  @param port ndice del puerto
+     *  @param flags Flags de eventos del puerto
+     */
+    void notify(uint8_t port, uint32_t flags);
+
+
+    /** allocTxBuffer()
+     *  Obtiene un buffer de envo del pool. Si no hay ninguno libre, recupera los de los puertos que ya han
+     *  finalizado su transmisin antes de esperar. Desde el hilo del hub no espera.
+     *  @return Buffer de envo, o 0 si no hay disponibles
+     */
+    char* allocTxBuffer();
+
+
+    Thread _th;                                 /// Manejador del thread
+    uint32_t _timeout;                          /// Manejador de timming en la tarea
+    MQSerialBridge* _ports[MaxPorts];           /// Puertos gestionados
+    uint8_t _num_ports;                         /// Nmero de puertos
+    char* _rbuf;                                /// Buffer compartido para la recepcin de datos
+    uint8_t* _abuf;                             /// Buffer compartido para la codificacin de argumentos
+    uint16_t _rbufsize;                         /// Tamao de trama
+    MQSerialBufferPool* _pool;                  /// Pool de buffers de envo
+};
+
+#endif  /** _MQSERIALHUB_H */
+
@@ -0,0 +1,93 @@
+/*
+ * MQLib.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+
+#include "MQLib.h"
+#include <string>
+#include <vector>
+
+
+/** Suscripcin registrada */
+struct Subscription {
+    std::string filter;
+    MQ::SubscribeCallback* cb;
+};
+
+static std::recursive_mutex s_mutex;
+static std::vector<Subscription> s_subscriptions;
+
+
+//------------------------------------------------------------------------------------
+int32_t MQ::MQClient::publish(const char* topic, void* data, uint32_t size, PublishCallback* publisher) {
+    // se copia la lista de destinatarios, ya que un suscriptor puede modificarla durante la entrega
+    std::vector<SubscribeCallback*> targets;
+    s_mutex.lock();
+    for(size_t i=0;i<s_subscriptions.size();i++){
+        if(isTopicToken(s_subscriptions[i].filter.c_str(), topic)){
+            targets.push_back(s_subscriptions[i].cb);
+        }
+    }
+    s_mutex.unlock();
+    for(size_t i=0;i<targets.size();i++){
+        targets[i]->call(topic, data, (uint16_t)size);
+    }
+    if(publisher){
+        publisher->call(topic, 0);
+    }
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t MQ::MQClient::subscribe(const char* topic, SubscribeCallback* subscriber) {
+    Subscription s;
+    s.filter = topic;
+    s.cb = subscriber;
+    s_mutex.lock();
+    s_subscriptions.push_back(s);
+    s_mutex.unlock();
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+int32_t MQ::MQClient::unsubscribe(const char* topic, SubscribeCallback* subscriber) {
+    s_mutex.lock();
+    for(size_t i=0;i<s_subscriptions.size();i++){
+        if(s_subscriptions[i].cb == subscriber && s_subscriptions[i].filter == topic){
+            s_subscriptions.erase(s_subscriptions.begin() + i);
+            break;
+        }
+    }
+    s_mutex.unlock();
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------
+bool MQ::MQClient::isTopicToken(const char* filter, const char* topic) {
+    while(*filter){
+        if(*filter == '#'){
+            return true;
+        }
+        if(*filter == '+'){
+            // el comodn ocupa un nivel completo del topic
+            while(*topic && *topic != '/'){
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if(*filter != *topic){
+            // "a/#" tambin coincide con "a"
+            return (*topic == 0 && strcmp(filter, "/#") == 0);
+        }
+        filter++;
+        topic++;
+    }
+    return (*topic == 0);
+}
@@ -0,0 +1,41 @@
+/*
+ * MQLib.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Sustituto de MQLib para Linux. Mantiene las suscripciones en memoria y entrega cada publicacin de forma
+ *  sncrona, en el contexto del publicador, a todas las suscripciones cuyo topic coincide (admite los
+ *  comodines '+' y '#').
+ */
+
+#ifndef _HOST_MQLIB_H
+#define _HOST_MQLIB_H
+
+#include "mbed.h"
+
+
+struct Heap {
+    static void* memAlloc(size_t size) { return malloc(size); }
+    static void memFree(void* ptr) { free(ptr); }
+};
+
+
+namespace MQ {
+
+typedef Callback<void(const char*, void*, uint16_t)> SubscribeCallback;
+typedef Callback<void(const char*, int32_t)> PublishCallback;
+
+class MQClient {
+public:
+    static int32_t publish(const char* topic, void* data, uint32_t size, PublishCallback* publisher);
+    static int32_t subscribe(const char* topic, SubscribeCallback* subscriber);
+    static int32_t unsubscribe(const char* topic, SubscribeCallback* subscriber);
+
+    /** Comprueba si un topic coincide con un filtro de suscripcin */
+    static bool isTopicToken(const char* filter, const char* topic);
+};
+
+}
+
+#endif  /** _HOST_MQLIB_H */
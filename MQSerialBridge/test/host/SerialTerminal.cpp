@@ -0,0 +1,202 @@
+/*
+ * SerialTerminal.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ */
+
+
+#include "SerialTerminal.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+/** Periodo de comprobacin de la parada del receptor cuando no hay datos */
+#define RX_IDLE_POLL_US     100000
+
+
+//------------------------------------------------------------------------------------
+//-- PUBLIC METHODS IMPLEMENTATION ---------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+SerialTerminal::SerialTerminal(PinName tx, PinName rx, uint16_t buf_size, uint32_t baud, RecvMode mode) {
+    _bufsize = buf_size;
+    _buf = (uint8_t*)malloc(_bufsize);
+    _len = 0;
+    _ready = false;
+    _running = false;
+    _break_us = 500;
+    _rx_th = 0;
+    memset(&_hstats, 0, sizeof(HostStats));
+
+    // crea el par de pseudo-terminales en modo raw (sin eco ni traduccin de caracteres)
+    _slave = -1;
+    _master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(_master < 0 || grantpt(_master) != 0 || unlockpt(_master) != 0){
+        return;
+    }
+    _slave = open(ptsname(_master), O_RDWR | O_NOCTTY);
+    if(_slave < 0){
+        return;
+    }
+    struct termios tio;
+    tcgetattr(_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(_slave, TCSANOW, &tio);
+}
+
+
+//------------------------------------------------------------------------------------
+SerialTerminal::~SerialTerminal() {
+    stopReceiver();
+    if(_slave >= 0){
+        close(_slave);
+    }
+    if(_master >= 0){
+        close(_master);
+    }
+    free(_buf);
+}
+
+
+//------------------------------------------------------------------------------------
+void SerialTerminal::config(Callback<void()> rx_done, Callback<void()> rx_timeout, Callback<void()> rx_ovf, uint32_t break_time_us, char eof) {
+    _rx_done = rx_done;
+    _rx_timeout = rx_timeout;
+    _rx_ovf = rx_ovf;
+    _break_us = break_time_us;
+}
+
+
+//------------------------------------------------------------------------------------
+void SerialTerminal::startReceiver() {
+    if(_running || _slave < 0){
+        return;
+    }
+    _running = true;
+    _rx_th = new std::thread(&SerialTerminal::rxTask, this);
+}
+
+
+//------------------------------------------------------------------------------------
+void SerialTerminal::stopReceiver() {
+    if(!_running){
+        return;
+    }
+    _running = false;
+    _rx_th->join();
+    delete(_rx_th);
+    _rx_th = 0;
+}
+
+
+//------------------------------------------------------------------------------------
+uint16_t SerialTerminal::recv(void* buf, uint16_t size) {
+    std::lock_guard<std::mutex> lk(_m);
+    uint16_t len = (_len < size)? _len : size;
+    if(buf && _ready){
+        memcpy(buf, _buf, len);
+    }
+    _ready = false;
+    _len = 0;
+    return (buf)? len : 0;
+}
+
+
+//------------------------------------------------------------------------------------
+void SerialTerminal::send(void* data, uint16_t size, Callback<void()> cb) {
+    const uint8_t* p = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t n = write(_slave, p, size);
+        if(n <= 0){
+            break;
+        }
+        p += n;
+        size -= n;
+    }
+    if(cb){
+        cb();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+bool SerialTerminal::busy() {
+    return false;
+}
+
+
+//------------------------------------------------------------------------------------
+//-- PRIVATE METHODS IMPLEMENTATION --------------------------------------------------
+//------------------------------------------------------------------------------------
+
+
+void SerialTerminal::rxTask() {
+    uint8_t chunk[256];
+    uint16_t count = 0;
+    bool discard = false;
+    bool overflow = false;
+    struct pollfd pfd;
+    pfd.fd = _slave;
+    pfd.events = POLLIN;
+
+    while(_running){
+        // mientras hay una trama en curso se espera el tiempo de break, en otro caso se comprueba
+        // peridicamente si se ha detenido el receptor
+        uint32_t wait_us = (count)? _break_us : RX_IDLE_POLL_US;
+        struct timespec ts;
+        ts.tv_sec = wait_us / 1000000;
+        ts.tv_nsec = (wait_us % 1000000) * 1000;
+        int rc = ppoll(&pfd, 1, &ts, 0);
+        if(rc > 0 && (pfd.revents & POLLIN)){
+            ssize_t n = read(_slave, chunk, sizeof(chunk));
+            if(n <= 0){
+                continue;
+            }
+            std::lock_guard<std::mutex> lk(_m);
+            // al comenzar una trama, se descarta si la anterior todava no se ha ledo
+            if(count == 0){
+                discard = _ready;
+                overflow = false;
+            }
+            if(!discard && !overflow){
+                if(count + n > _bufsize){
+                    overflow = true;
+                }
+                else{
+                    memcpy(&_buf[count], chunk, n);
+                }
+            }
+            count += n;
+            continue;
+        }
+        if(rc != 0 || count == 0){
+            continue;
+        }
+        // fin de trama por tiempo de break
+        if(discard){
+            _hstats.busy_drops++;
+        }
+        else if(overflow){
+            _hstats.overflows++;
+            if(_rx_ovf){
+                _rx_ovf();
+            }
+        }
+        else{
+            {
+                std::lock_guard<std::mutex> lk(_m);
+                _len = count;
+                _ready = true;
+            }
+            _hstats.frames++;
+            if(_rx_done){
+                _rx_done();
+            }
+        }
+        count = 0;
+    }
+}
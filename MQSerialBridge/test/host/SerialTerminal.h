@@ -0,0 +1,78 @@
+/*
+ * SerialTerminal.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Sustituto de SerialTerminal para Linux. Cada instancia crea un par de pseudo-terminales: el extremo esclavo
+ *  lo utiliza el terminal y el extremo maestro queda disponible (masterFd) para que el generador de carga
+ *  escriba y lea tramas. La recepcin reproduce el modo ReceiveAfterBreakTime: una trama finaliza cuando no
+ *  se reciben datos durante el tiempo de break configurado.
+ */
+
+#ifndef _HOST_SERIALTERMINAL_H
+#define _HOST_SERIALTERMINAL_H
+
+#include "mbed.h"
+
+
+class SerialTerminal {
+
+public:
+
+    enum RecvMode{
+        ReceiveAfterBreakTime,      /// Fin de trama por tiempo de silencio
+        ReceiveWithEofCharacter,    /// Fin de trama por caracter (no soportado en host)
+    };
+
+    /** Contadores propios del sustituto host */
+    struct HostStats{
+        uint32_t frames;            /// Tramas completas notificadas
+        uint32_t busy_drops;        /// Tramas descartadas porque la anterior no se haba ledo
+        uint32_t overflows;         /// Tramas mayores que el buffer de recepcin
+    };
+
+    SerialTerminal(PinName tx, PinName rx, uint16_t buf_size, uint32_t baud, RecvMode mode);
+    virtual ~SerialTerminal();
+
+    void config(Callback<void()> rx_done, Callback<void()> rx_timeout, Callback<void()> rx_ovf, uint32_t break_time_us, char eof);
+    void startReceiver();
+    void stopReceiver();
+
+    /** Copia la trama recibida en buf y rearma la recepcin. Con buf == 0 la trama se descarta. */
+    uint16_t recv(void* buf, uint16_t size);
+
+    /** Enva los datos de forma sncrona por el pseudo-terminal */
+    void send(void* data, uint16_t size, Callback<void()> cb);
+    bool busy();
+
+    /** Descriptor del extremo maestro del pseudo-terminal, para el generador de carga */
+    int masterFd() { return _master; }
+
+    const HostStats& hostStats() { return _hstats; }
+
+protected:
+
+    Callback<void()> _cb_tx;
+
+private:
+
+    void rxTask();
+
+    int _master;
+    int _slave;
+    uint16_t _bufsize;
+    uint8_t* _buf;
+    uint16_t _len;
+    bool _ready;
+    volatile bool _running;
+    uint32_t _break_us;
+    Callback<void()> _rx_done;
+    Callback<void()> _rx_timeout;
+    Callback<void()> _rx_ovf;
+    std::mutex _m;
+    std::thread* _rx_th;
+    HostStats _hstats;
+};
+
+#endif  /** _HOST_SERIALTERMINAL_H */
@@ -0,0 +1,244 @@
+/*
+ * bench_MQSerialBridge.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Banco de pruebas de MQSerialBridge en Linux. El puente se compila contra los sustitutos de este directorio
+ *  (mbed.h sobre pthreads, SerialTerminal sobre un pseudo-terminal y MQLib en memoria), de forma que el camino
+ *  serie -> MQLib puede medirse sin hardware.
+ *
+ *  Un generador de carga escribe tramas en el extremo maestro del pseudo-terminal, con el formato del modo
+ *  seleccionado, y un suscriptor MQLib mide la latencia de cada una hasta su publicacin. Al finalizar se
+ *  muestra el throughput (tramas/s), la latencia (p50/p99/max) y las tramas perdidas segn su causa:
+ *
+ *      busy        El terminal recibe una trama antes de que el puente haya ledo la anterior
+ *      timeout, overflow, format, size, crc
+ *                  Contadores de MQSerialBridge::getStats()
+ *      lost        Tramas no publicadas sin causa registrada. Normalmente son tramas que el terminal ha unido a
+ *                  la anterior porque la separacin entre ambas fue menor que el tiempo de break.
+ *
+ *  Uso: bench_MQSerialBridge [-m text|mix] [-r tramas/s] [-s bytes] [-n tramas] [-b baudios] [-B bytes] [-a args]
+ *
+ *      -m  Modo del puente (por defecto text)
+ *      -r  Tasa de envo. Con 0 (por defecto) cada trama se enva en cuanto el puente ha ledo la anterior,
+ *          para medir el throughput mximo.
+ *      -s  Tamao de los datos de cada publicacin (por defecto 32)
+ *      -n  Nmero de tramas (por defecto 10000)
+ *      -b  Velocidad del puerto, determina el tiempo de break entre tramas (por defecto 115200)
+ *      -B  Tamao del buffer de recepcin del puente (por defecto 256)
+ *      -a  En modo texto, nmero de argumentos adicionales (entero, float, string y blob alternativamente)
+ *          tras el nmero de secuencia, para medir la codificacin de argumentos (por defecto 0)
+ *
+ *  Compilacin: make (en este directorio)
+ */
+
+
+#include "mbed.h"
+#include "MQLib.h"
+#include "MQSerialBridge.h"
+#include "MQSerialArgs.h"
+#include <algorithm>
+#include <unistd.h>
+#include <vector>
+
+
+/** Topic en el que se publican las tramas del generador */
+#define BENCH_TOPIC         "bench/data"
+
+/** Tiempo sin recibir publicaciones tras el que se da por finalizada la prueba */
+#define BENCH_DRAIN_MS      500
+
+
+/** Acceso a los contadores del terminal y al CRC del modo mixto (protegidos en MQSerialBridge) */
+class BenchBridge : public MQSerialBridge {
+public:
+    BenchBridge(uint32_t baud, uint16_t bufsize, ModeType mode) : MQSerialBridge(0, 0, baud, bufsize, "mqserialbridge", mode) {}
+    const SerialTerminal::HostStats& terminalStats() { return hostStats(); }
+    using MQSerialBridge::getCRC;
+};
+
+
+static MQSerialBridge::ModeType s_mode = MQSerialBridge::TextMode;
+static uint32_t s_args = 0;
+static std::vector<int64_t> s_sent_us;
+static std::vector<int64_t> s_latency_us;
+static volatile uint32_t s_received = 0;
+static MQ::SubscribeCallback s_subscriptionCb;
+
+
+//------------------------------------------------------------------------------------
+static int64_t nowUs(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Construye la trama de la publicacin nmero seq. Los datos comienzan con el nmero de secuencia. */
+static uint16_t buildFrame(char* frame, uint32_t seq, uint16_t size){
+    if(s_mode == MQSerialBridge::TextMode){
+        // "TOPIC SEQ,xxxx<\0>" o, con argumentos adicionales, "TOPIC SEQ ARG0 ... ARGn xxxx<\0>"
+        static const char* args[] = { "-1234", "3.25", "on", "#0A0B0C0D" };
+        int len = sprintf(frame, "%s %u%s", BENCH_TOPIC, seq, (s_args)? " " : ",");
+        for(uint32_t i=0;i<s_args;i++){
+            len += sprintf(&frame[len], "%s ", args[i % 4]);
+        }
+        int data_len = len - (int)strlen(BENCH_TOPIC " ");
+        while(data_len < size){
+            frame[len++] = 'x';
+            data_len++;
+        }
+        frame[len++] = 0;
+        return len;
+    }
+    // "TOPIC<\n>SIZE<\n>CRC<\n><\0>DATOS"
+    std::vector<uint8_t> data(size, 'x');
+    memcpy(&data[0], &seq, (size < sizeof(seq))? size : sizeof(seq));
+    int len = sprintf(frame, "%s\n%u\n%u\n", BENCH_TOPIC, size, BenchBridge::getCRC(&data[0], size));
+    frame[len++] = 0;
+    memcpy(&frame[len], &data[0], size);
+    return len + size;
+}
+
+
+//------------------------------------------------------------------------------------
+static void subscriptionCb(const char* topic, void* msg, uint16_t msg_len){
+    int64_t now = nowUs();
+    uint32_t seq = 0;
+    if(s_mode == MQSerialBridge::TextMode && s_args){
+        MQSerialArgReader args(msg, msg_len);
+        MQSerialArg_t arg;
+        if(args.next(&arg) && arg.type == MQSerialArgInt){
+            seq = (uint32_t)arg.ival;
+        }
+    }
+    else if(s_mode == MQSerialBridge::TextMode){
+        seq = (uint32_t)strtoul((const char*)msg, 0, 10);
+    }
+    else if(msg_len >= sizeof(seq)){
+        memcpy(&seq, msg, sizeof(seq));
+    }
+    if(seq < s_sent_us.size()){
+        s_latency_us.push_back(now - s_sent_us[seq]);
+    }
+    s_received++;
+}
+
+
+//------------------------------------------------------------------------------------
+static uint32_t percentile(std::vector<int64_t>& v, uint32_t pc){
+    if(v.empty()){
+        return 0;
+    }
+    size_t i = (v.size() * pc) / 100;
+    return (uint32_t)v[(i < v.size())? i : v.size() - 1];
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    uint32_t rate = 0;
+    uint32_t size = 32;
+    uint32_t count = 10000;
+    uint32_t baud = 115200;
+    uint32_t bufsize = 256;
+    int opt;
+    while((opt = getopt(argc, argv, "m:r:s:n:b:B:a:")) != -1){
+        switch(opt){
+            case 'm': s_mode = (strcmp(optarg, "mix") == 0)? MQSerialBridge::MixMode : MQSerialBridge::TextMode; break;
+            case 'r': rate = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'B': bufsize = atoi(optarg); break;
+            case 'a': s_args = atoi(optarg); break;
+            default:
+                fprintf(stderr, "uso: %s [-m text|mix] [-r tramas/s] [-s bytes] [-n tramas] [-b baudios] [-B bytes] [-a args]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(size < 4 || count == 0 || baud == 0){
+        fprintf(stderr, "parmetros incorrectos\n");
+        return 1;
+    }
+
+    s_sent_us.assign(count, 0);
+    s_latency_us.reserve(count);
+    s_subscriptionCb = callback(subscriptionCb);
+    MQ::MQClient::subscribe(BENCH_TOPIC, &s_subscriptionCb);
+
+    BenchBridge* bridge = new BenchBridge(baud, bufsize, s_mode);
+    int fd = bridge->masterFd();
+    if(fd < 0){
+        fprintf(stderr, "no se ha podido crear el pseudo-terminal\n");
+        return 1;
+    }
+    // espera a que el puente inicie la recepcin
+    Thread::wait(100);
+
+    char* frame = (char*)malloc(size + 64 + 16 * s_args);
+    int64_t period_us = (rate)? (1000000 / rate) : 0;
+    // mismo tiempo de break que configura MQSerialBridge, con margen
+    int64_t min_gap_us = 2 * (((4 * (10000000/baud)) < 500)? 500 : (4 * (10000000/baud)));
+    int64_t t_last_write = 0;
+    int64_t t_start = nowUs();
+    for(uint32_t i=0;i<count;i++){
+        if(rate){
+            // envo a tasa fija. Si el generador se retrasa, mantiene la separacin mnima entre tramas
+            // para que el terminal no las agrupe
+            int64_t wait_us = t_start + i * period_us - nowUs();
+            int64_t gap_us = t_last_write + min_gap_us - nowUs();
+            wait_us = (gap_us > wait_us)? gap_us : wait_us;
+            if(wait_us > 0){
+                std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+            }
+        }
+        else{
+            // envo en lazo cerrado, en cuanto el puente ha ledo (o descartado) la trama anterior
+            int64_t t_wait = nowUs();
+            for(;;){
+                const MQSerialBridge::Stats_t& st = bridge->getStats();
+                const SerialTerminal::HostStats& hs = bridge->terminalStats();
+                if(st.rx_frames + st.rx_overflow + hs.busy_drops >= i || nowUs() - t_wait > BENCH_DRAIN_MS * 1000){
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        uint16_t len = buildFrame(frame, i, size);
+        s_sent_us[i] = nowUs();
+        t_last_write = s_sent_us[i];
+        if(write(fd, frame, len) != len){
+            fprintf(stderr, "error de escritura en el pseudo-terminal\n");
+            return 1;
+        }
+    }
+
+    // espera a que se procesen las ltimas tramas
+    uint32_t last = s_received;
+    int64_t t_last = nowUs();
+    while(s_received < count && nowUs() - t_last < BENCH_DRAIN_MS * 1000){
+        Thread::wait(10);
+        if(s_received != last){
+            last = s_received;
+            t_last = nowUs();
+        }
+    }
+    int64_t t_end = (s_received == count)? nowUs() : t_last;
+
+    const MQSerialBridge::Stats_t& st = bridge->getStats();
+    const SerialTerminal::HostStats& hs = bridge->terminalStats();
+    uint32_t received = s_received;
+    uint32_t dropped = hs.busy_drops + st.rx_timeout + st.rx_overflow + st.rx_format + st.rx_size + st.rx_crc;
+    int32_t lost = (int32_t)count - (int32_t)received - (int32_t)dropped;
+    std::sort(s_latency_us.begin(), s_latency_us.end());
+    double elapsed = (t_end - t_start) / 1000000.0;
+
+    printf("modo=%s size=%u rate=%u count=%u baud=%u bufsize=%u\n", (s_mode == MQSerialBridge::TextMode)? "text" : "mix", size, rate, count, baud, bufsize);
+    printf("recibidas: %u/%u en %.3f s\n", received, count, elapsed);
+    printf("throughput: %.1f tramas/s\n", (elapsed > 0)? (received / elapsed) : 0.0);
+    printf("latencia (us): p50=%u p99=%u max=%u\n", percentile(s_latency_us, 50), percentile(s_latency_us, 99), (s_latency_us.empty())? 0 : (uint32_t)s_latency_us.back());
+    printf("descartes: busy=%u timeout=%u overflow=%u format=%u size=%u crc=%u lost=%d\n", hs.busy_drops, st.rx_timeout, st.rx_overflow, st.rx_format, st.rx_size, st.rx_crc, (lost > 0)? lost : 0);
+    free(frame);
+    return 0;
+}
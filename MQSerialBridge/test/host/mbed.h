@@ -0,0 +1,227 @@
+/*
+ * mbed.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Sustituto de mbed.h para compilar MQSerialBridge en Linux (ver bench_MQSerialBridge.cpp). Implementa sobre
+ *  pthreads el subconjunto de la API mbed-os 5 (Callback, Thread con signals, Mutex, Semaphore, Timer) que
+ *  utiliza el mdulo.
+ */
+
+#ifndef _HOST_MBED_H
+#define _HOST_MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+typedef int PinName;
+typedef void* osThreadId;
+
+#define osWaitForever 0xFFFFFFFFu
+
+typedef enum {
+    osOK            = 0,
+    osEventSignal   = 0x08,
+    osEventMessage  = 0x10,
+    osEventTimeout  = 0x40,
+    osErrorResource = 0x81,
+} osStatus;
+
+typedef struct {
+    osStatus status;
+    union {
+        uint32_t v;
+        void* p;
+        int32_t signals;
+    } value;
+} osEvent;
+
+
+
+//---------------------------------------------------------------------------------
+//- Callback ----------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+template<typename F> class Callback;
+
+template<typename R, typename... Args>
+class Callback<R(Args...)> {
+public:
+    Callback() {}
+    Callback(R (*func)(Args...)) : _fn(func) {}
+    template<class T>
+    Callback(T* obj, R (T::*method)(Args...)) : _fn([obj, method](Args... args) -> R { return (obj->*method)(args...); }) {}
+
+    R call(Args... args) const { return _fn(args...); }
+    R operator()(Args... args) const { return _fn(args...); }
+    operator bool() const { return (bool)_fn; }
+
+private:
+    std::function<R(Args...)> _fn;
+};
+
+template<typename R, typename... Args>
+Callback<R(Args...)> callback(R (*func)(Args...)) {
+    return Callback<R(Args...)>(func);
+}
+
+template<class T, typename R, typename... Args>
+Callback<R(Args...)> callback(T* obj, R (T::*method)(Args...)) {
+    return Callback<R(Args...)>(obj, method);
+}
+
+
+
+//---------------------------------------------------------------------------------
+//- Timer -------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+class Timer {
+public:
+    Timer() : _running(false), _acc(0) {}
+    void start() { if(!_running){ _t0 = std::chrono::steady_clock::now(); _running = true; } }
+    void stop() { if(_running){ _acc += elapsed(); _running = false; } }
+    void reset() { _acc = 0; _t0 = std::chrono::steady_clock::now(); }
+    int read_ms() { return (int)(read_us() / 1000); }
+    int read_us() { return (int)(_acc + ((_running)? elapsed() : 0)); }
+
+private:
+    int64_t elapsed() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _t0).count(); }
+    bool _running;
+    int64_t _acc;
+    std::chrono::steady_clock::time_point _t0;
+};
+
+
+
+//---------------------------------------------------------------------------------
+//- Mutex, Semaphore --------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+class Mutex {
+public:
+    osStatus lock(uint32_t millis = osWaitForever) {
+        if(millis == osWaitForever){
+            _m.lock();
+            return osOK;
+        }
+        return (_m.try_lock_for(std::chrono::milliseconds(millis)))? osOK : osErrorResource;
+    }
+    bool trylock() { return _m.try_lock(); }
+    osStatus unlock() { _m.unlock(); return osOK; }
+
+private:
+    std::recursive_timed_mutex _m;
+};
+
+
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0) : _count(count) {}
+
+    /** Devuelve el nmero de tokens disponibles antes de tomar uno, o 0 si vence el timeout */
+    int32_t wait(uint32_t millis = osWaitForever) {
+        std::unique_lock<std::mutex> lk(_m);
+        if(millis == osWaitForever){
+            _cv.wait(lk, [this]{ return _count > 0; });
+        }
+        else if(!_cv.wait_for(lk, std::chrono::milliseconds(millis), [this]{ return _count > 0; })){
+            return 0;
+        }
+        return _count--;
+    }
+
+    osStatus release() {
+        std::lock_guard<std::mutex> lk(_m);
+        _count++;
+        _cv.notify_one();
+        return osOK;
+    }
+
+private:
+    std::mutex _m;
+    std::condition_variable _cv;
+    int32_t _count;
+};
+
+
+
+//---------------------------------------------------------------------------------
+//- Thread ------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+class Thread {
+public:
+    Thread() : _signals(0), _th(0) {}
+
+    osStatus start(Callback<void()> task) {
+        _task = task;
+        _th = new std::thread(&Thread::entry, this);
+        _th->detach();
+        return osOK;
+    }
+
+    int32_t signal_set(int32_t signals) {
+        std::lock_guard<std::mutex> lk(_m);
+        _signals |= signals;
+        _cv.notify_one();
+        return _signals;
+    }
+
+    /** Espera seales en el hilo actual. Con signals == 0 retorna ante cualquier seal y las borra todas. */
+    static osEvent signal_wait(int32_t signals, uint32_t millis = osWaitForever) {
+        Thread* self = current();
+        osEvent evt;
+        std::unique_lock<std::mutex> lk(self->_m);
+        auto ready = [self, signals]{ return (signals == 0)? (self->_signals != 0) : ((self->_signals & signals) == signals); };
+        bool ok = true;
+        if(millis == osWaitForever){
+            self->_cv.wait(lk, ready);
+        }
+        else{
+            ok = self->_cv.wait_for(lk, std::chrono::milliseconds(millis), ready);
+        }
+        if(!ok){
+            evt.status = osEventTimeout;
+            evt.value.signals = 0;
+            return evt;
+        }
+        int32_t mask = (signals == 0)? 0x7fffffff : signals;
+        evt.status = osEventSignal;
+        evt.value.signals = self->_signals & mask;
+        self->_signals &= ~mask;
+        return evt;
+    }
+
+    /** Identificador del hilo, y del hilo actual (0 si no es un Thread) */
+    osThreadId get_id() { return this; }
+    static osThreadId gettid() { return current(); }
+
+    static void yield() { std::this_thread::yield(); }
+    static void wait(uint32_t millis) { std::this_thread::sleep_for(std::chrono::milliseconds(millis)); }
+
+private:
+    static Thread*& current() { static thread_local Thread* th = 0; return th; }
+    static void entry(Thread* th) { current() = th; th->_task(); }
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    int32_t _signals;
+    Callback<void()> _task;
+    std::thread* _th;
+};
+
+
+inline void wait_ms(int millis) { Thread::wait(millis); }
+
+#endif  /** _HOST_MBED_H */
@@ -0,0 +1,228 @@
+/*
+ * test_MQSerialArgs.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQSerialArgWriter y MQSerialArgReader. Se comprueba que:
+ *
+ *      - los enteros (positivos y negativos) se recuperan con su valor y ocupan lo previsto en cada lmite de
+ *        anchura (1, 2, 3, 5 y 9 bytes)
+ *      - los floats, strings y blobs se recuperan con su tipo y contenido, incluidos los floats de 64 bits
+ *      - un entero que no cabe en 64 bits se codifica como float
+ *      - el writer no escribe fuera del buffer: cada argumento cabe con el tamao exacto y falla con un byte menos
+ *      - el reader detecta los mensajes truncados en cualquier punto sin leer fuera de ellos, as como las
+ *        cabeceras y longitudes no vlidas
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "mbed.h"
+#include "MQSerialArgs.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+/** Enteros en cada lmite de anchura y tamao esperado de su codificacin (cabecera incluida) */
+static const struct { const char* token; int64_t value; uint8_t size; } s_ints[] = {
+    { "0", 0, 1 },
+    { "23", 23, 1 },
+    { "24", 24, 2 },
+    { "255", 255, 2 },
+    { "256", 256, 3 },
+    { "65535", 65535, 3 },
+    { "65536", 65536, 5 },
+    { "4294967295", 4294967295LL, 5 },
+    { "4294967296", 4294967296LL, 9 },
+    { "9223372036854775807", INT64_MAX, 9 },
+    { "-1", -1, 1 },
+    { "-24", -24, 1 },
+    { "-25", -25, 2 },
+    { "-256", -256, 2 },
+    { "-257", -257, 3 },
+    { "-65536", -65536, 3 },
+    { "-65537", -65537, 5 },
+    { "-4294967296", -4294967296LL, 5 },
+    { "-4294967297", -4294967297LL, 9 },
+    { "-9223372036854775808", INT64_MIN, 9 },
+    { "+7", 7, 1 },
+    { "0x1F", 31, 2 },
+    { "-0x100", -256, 2 },
+};
+
+
+//------------------------------------------------------------------------------------
+/** Codifica una lista de argumentos, devuelve el tamao del mensaje o 0 */
+static uint16_t encode(const std::vector<const char*>& tokens, uint8_t* buf, uint16_t size){
+    MQSerialArgWriter w(buf, size);
+    for(size_t i=0;i<tokens.size();i++){
+        w.addToken(tokens[i]);
+    }
+    return w.finish();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Decodifica un mensaje de un nico argumento, en una copia de su tamao exacto */
+static bool decodeOne(const uint8_t* msg, uint16_t len, MQSerialArg_t* arg){
+    std::vector<uint8_t> copy(msg, msg + len);
+    MQSerialArgReader r(&copy[0], len);
+    if(!r.next(arg)){
+        return false;
+    }
+    MQSerialArg_t end;
+    return (!r.next(&end) && !r.error());
+}
+
+
+//------------------------------------------------------------------------------------
+static void testInts(){
+    for(size_t i=0;i<sizeof(s_ints)/sizeof(s_ints[0]);i++){
+        uint8_t buf[32];
+        uint16_t len = encode(std::vector<const char*>(1, s_ints[i].token), buf, sizeof(buf));
+        MQSerialArg_t arg;
+        CHECK(len == 2 + s_ints[i].size);
+        CHECK(decodeOne(buf, len, &arg));
+        CHECK(arg.type == MQSerialArgInt);
+        if(arg.ival != s_ints[i].value){
+            printf("ERROR: %s decodificado como %lld\n", s_ints[i].token, (long long)arg.ival);
+            s_errors++;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void testTypes(){
+    const char* tokens[] = { "1.5", "-0.25", "1e3", "hola", "inf", "12abc", "#0A1b2C", "#ABC", "#" };
+    uint8_t buf[128];
+    uint16_t len = encode(std::vector<const char*>(tokens, tokens + 9), buf, sizeof(buf));
+    CHECK(len > 0);
+    MQSerialArgReader r(buf, len);
+    MQSerialArg_t arg;
+    CHECK(r.next(&arg) && arg.type == MQSerialArgFloat && arg.fval == 1.5f);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgFloat && arg.fval == -0.25f);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgFloat && arg.fval == 1000.0f);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgString && arg.len == 4 && memcmp(arg.data, "hola", 4) == 0);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgString && arg.len == 3 && memcmp(arg.data, "inf", 3) == 0);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgString && arg.len == 5 && memcmp(arg.data, "12abc", 5) == 0);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgBlob && arg.len == 3 && memcmp(arg.data, "\x0a\x1b\x2c", 3) == 0);
+    // un nmero impar de dgitos, o ninguno, no es un blob
+    CHECK(r.next(&arg) && arg.type == MQSerialArgString && arg.len == 4 && memcmp(arg.data, "#ABC", 4) == 0);
+    CHECK(r.next(&arg) && arg.type == MQSerialArgString && arg.len == 1 && arg.data[0] == '#');
+    CHECK(!r.next(&arg) && !r.error());
+
+    // los enteros fuera de rango de 64 bits se codifican como float
+    len = encode(std::vector<const char*>(1, "18446744073709551616"), buf, sizeof(buf));
+    CHECK(len == 7 && decodeOne(buf, len, &arg) && arg.type == MQSerialArgFloat && arg.fval == 18446744073709551616.0f);
+
+    // float de 64 bits (no lo genera el writer, pero es CBOR vlido)
+    double d = -2.5;
+    uint64_t raw;
+    memcpy(&raw, &d, sizeof(raw));
+    uint8_t f64[11] = { 0x9F, 0xFB };
+    for(int i=0;i<8;i++){
+        f64[2 + i] = (uint8_t)(raw >> (8 * (7 - i)));
+    }
+    f64[10] = 0xFF;
+    CHECK(decodeOne(f64, sizeof(f64), &arg) && arg.type == MQSerialArgFloat && arg.fval == -2.5f);
+
+    // string con la longitud en 2 bytes, no cabe en 128 bytes pero s en 400
+    std::vector<char> s300(301, 'x');
+    s300[300] = 0;
+    len = encode(std::vector<const char*>(1, &s300[0]), buf, sizeof(buf));
+    CHECK(len == 0);
+    std::vector<uint8_t> big(400);
+    len = encode(std::vector<const char*>(1, &s300[0]), &big[0], big.size());
+    CHECK(len == 2 + 3 + 300 && decodeOne(&big[0], len, &arg) && arg.type == MQSerialArgString && arg.len == 300);
+}
+
+
+//------------------------------------------------------------------------------------
+static void testWriterOverflow(){
+    const char* tokens[] = { "5", "1000", "-70000", "4294967296", "2.5", "texto", "#DEADBEEF" };
+    for(size_t t=0;t<sizeof(tokens)/sizeof(tokens[0]);t++){
+        std::vector<const char*> list(1, tokens[t]);
+        uint8_t buf[64];
+        uint16_t need = encode(list, buf, sizeof(buf));
+        CHECK(need > 0);
+        for(uint16_t size=0;size<=need;size++){
+            // los bytes de guarda detectan escrituras fuera del tamao indicado
+            uint8_t guard[64];
+            memset(guard, 0xA5, sizeof(guard));
+            uint16_t len = encode(list, guard, size);
+            CHECK(len == ((size == need)? need : 0));
+            for(uint16_t i=size;i<sizeof(guard);i++){
+                if(guard[i] != 0xA5){
+                    printf("ERROR: %s con buffer de %u escribe en el byte %u\n", tokens[t], size, i);
+                    s_errors++;
+                    break;
+                }
+            }
+        }
+    }
+    // tras un argumento que no cabe, los siguientes tambin fallan aunque quepan
+    uint8_t buf[8];
+    MQSerialArgWriter w(buf, sizeof(buf));
+    CHECK(w.addToken("1"));
+    CHECK(!w.addToken("un_texto_largo"));
+    CHECK(!w.addToken("2"));
+    CHECK(w.finish() == 0);
+}
+
+
+//------------------------------------------------------------------------------------
+static void testReaderTruncated(){
+    const char* tokens[] = { "-70000", "4294967296", "2.5", "texto", "#DEADBEEF", "7" };
+    uint8_t buf[64];
+    uint16_t len = encode(std::vector<const char*>(tokens, tokens + 6), buf, sizeof(buf));
+    CHECK(len > 0);
+    // cualquier truncado se detecta como error, nunca como fin de lista
+    for(uint16_t n=0;n<len;n++){
+        std::vector<uint8_t> copy(buf, buf + n);
+        MQSerialArgReader r((n)? &copy[0] : buf, n);
+        MQSerialArg_t arg;
+        int count = 0;
+        while(r.next(&arg) && count < 10){
+            count++;
+        }
+        CHECK(r.error());
+        CHECK(count <= 6);
+    }
+    // cabecera, longitudes y tipos no vlidos
+    const uint8_t no_array[] = { 0x01, 0xFF };
+    const uint8_t long_text[] = { 0x9F, 0x65, 'a', 'b', 0xFF };
+    const uint8_t long_blob[] = { 0x9F, 0x5A, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF };
+    const uint8_t bad_info[] = { 0x9F, 0x1C, 0xFF };
+    const uint8_t bad_major[] = { 0x9F, 0x80, 0xFF };
+    const uint8_t* bad[] = { no_array, long_text, long_blob, bad_info, bad_major };
+    const uint16_t bad_len[] = { sizeof(no_array), sizeof(long_text), sizeof(long_blob), sizeof(bad_info), sizeof(bad_major) };
+    for(int i=0;i<5;i++){
+        MQSerialArgReader r(bad[i], bad_len[i]);
+        MQSerialArg_t arg;
+        CHECK(!r.next(&arg) && r.error());
+    }
+    // una lista vaca es vlida
+    const uint8_t empty[] = { 0x9F, 0xFF };
+    MQSerialArgReader r(empty, sizeof(empty));
+    MQSerialArg_t arg;
+    CHECK(!r.next(&arg) && !r.error());
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    testInts();
+    testTypes();
+    testWriterOverflow();
+    testReaderTruncated();
+    printf("test_MQSerialArgs: %s\n", (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
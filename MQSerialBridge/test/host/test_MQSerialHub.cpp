@@ -0,0 +1,214 @@
+/*
+ * test_MQSerialHub.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQSerialHub con tres puertos que comparten el hilo, el buffer de recepcin y un pool de dos buffers
+ *  de envo, con un equipo remoto simulado (SerialPeer) en el extremo maestro de cada pseudo-terminal. Se
+ *  comprueba que:
+ *
+ *      - las tramas recibidas a la vez por varios puertos se publican todas con su topic
+ *      - cada publicacin MQLib se enva slo por el puerto suscrito, en su modo (texto, mixto o enlace fiable)
+ *      - las publicaciones que no caben en un buffer del pool (o en un slot del enlace) se descartan sin
+ *        escribir en l y cuentan en tx_dropped
+ *      - mientras las tramas del enlace fiable pendientes de ack ocupan todo el pool, los dems puertos
+ *        descartan sus envos (tx_dropped) y el enlace las retransmite; al recibir el ack el pool se recupera
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQLib.h"
+#include "MQSerialHub.h"
+#include <vector>
+
+
+/** Tamao de trama y de los buffers del pool */
+#define BUF_SIZE            64
+
+/** Buffers del pool */
+#define POOL_BLOCKS         2
+
+/** Puertos del hub */
+#define NUM_PORTS           3
+
+
+/** Acceso al CRC del modo mixto (protegido en MQSerialBridge) */
+class MixBridge : public MQSerialBridge {
+public:
+    using MQSerialBridge::getCRC;
+};
+
+
+static std::vector<std::string> s_topics;
+static std::vector<std::string> s_payloads;
+static MQ::SubscribeCallback s_recorderCb;
+
+
+//------------------------------------------------------------------------------------
+static void recorderCb(const char* topic, void* msg, uint16_t msg_len){
+    s_topics.push_back(topic);
+    s_payloads.push_back(std::string((const char*)msg, msg_len));
+}
+
+
+//------------------------------------------------------------------------------------
+/** Publica un texto (con su '\0') en MQLib */
+static void publish(const char* topic, const std::string& msg){
+    MQ::MQClient::publish(topic, (void*)msg.c_str(), msg.size() + 1, 0);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Trama en modo texto tal y como la enva el puerto */
+static std::string textFrame(const char* topic, const std::string& msg){
+    return std::string(topic) + " " + std::string(1, 0) + msg + std::string(1, 0);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Trama en modo mixto, con el texto y su '\0' como datos */
+static std::string mixFrame(const char* topic, const std::string& msg){
+    std::string data = msg + std::string(1, 0);
+    char hdr[32];
+    sprintf(hdr, "%s\n%u\n%u\n", topic, (unsigned)data.size(), (unsigned)MixBridge::getCRC((void*)data.data(), data.size()));
+    return std::string(hdr) + std::string(1, 0) + data;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Datos de las tramas del enlace fiable recibidas en in */
+static std::vector<std::string> linkData(std::string& in){
+    std::vector<std::string> out;
+    std::string frame;
+    while(SerialPeer::nextLinkFrame(in, &frame)){
+        if(frame[0] == TEST_LINK_DATA){
+            out.push_back(frame.substr(3, frame.size() - 5));
+        }
+    }
+    return out;
+}
+
+
+//------------------------------------------------------------------------------------
+static void testRouting(MQSerialBridge** ports, SerialPeer** peers){
+    // recepcin simultnea en los tres puertos
+    s_topics.clear();
+    s_payloads.clear();
+    peers[0]->send(peers[0]->linkData(std::string("i0 a") + std::string(1, 0)));
+    peers[1]->send(std::string("i1 b") + std::string(1, 0));
+    peers[2]->send(mixFrame("i2", "c"));
+    Thread::wait(50);
+    CHECK(s_topics.size() == 3);
+    for(size_t i=0;i<s_topics.size() && i<3;i++){
+        int n = s_topics[i][1] - '0';
+        CHECK(s_topics[i].size() == 2 && s_topics[i][0] == 'i' && n >= 0 && n < 3 && s_payloads[i][0] == "abc"[n]);
+    }
+    std::string ack = peers[0]->recv(20);
+    CHECK(ack == SerialPeer::linkAck(1, 0));
+
+    // envo: cada publicacin slo por su puerto
+    publish("o1", "v1");
+    CHECK(peers[1]->recv(20) == textFrame("o1", "v1"));
+    publish("o2", "v2");
+    CHECK(peers[2]->recv(20) == mixFrame("o2", "v2"));
+    publish("o0", "v0");
+    std::string in = peers[0]->recv(20);
+    std::vector<std::string> data = linkData(in);
+    CHECK(data.size() == 1 && data[0] == textFrame("o0", "v0"));
+    peers[0]->send(SerialPeer::linkAck(1, 0));
+    CHECK(peers[1]->recv(20).empty() && peers[2]->recv(20).empty());
+    for(int i=0;i<NUM_PORTS;i++){
+        CHECK(ports[i]->getStats().tx_dropped == 0);
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void testOversize(MQSerialBridge** ports, SerialPeer** peers){
+    // no cabe en un buffer del pool
+    uint32_t dropped = ports[1]->getStats().tx_dropped;
+    publish("o1", std::string(3 * BUF_SIZE, 'x'));
+    CHECK(ports[1]->getStats().tx_dropped == dropped + 1);
+    CHECK(peers[1]->recv(20).empty());
+    // cabe en un buffer del pool pero no en un slot del enlace
+    dropped = ports[0]->getStats().tx_dropped;
+    publish("o0", std::string(BUF_SIZE - 5, 'x'));
+    CHECK(ports[0]->getStats().tx_dropped == dropped + 1);
+    CHECK(peers[0]->recv(20).empty());
+    // los buffers del pool siguen intactos
+    publish("o1", "v3");
+    CHECK(peers[1]->recv(20) == textFrame("o1", "v3"));
+}
+
+
+//------------------------------------------------------------------------------------
+/** @return Tiempo en ms que el puerto sin buffer espera al pool antes de descartar */
+static int testExhaustion(MQSerialBridge** ports, SerialPeer** peers){
+    // el puerto 1 libera su buffer al terminar de transmitir
+    Thread::wait(50);
+    uint32_t retx = ports[0]->getStats().link_retx;
+    uint32_t dropped = ports[1]->getStats().tx_dropped;
+    // dos tramas sin ack ocupan los dos buffers del pool
+    publish("o0", "w0");
+    publish("o0", "w1");
+    Timer tm;
+    tm.start();
+    publish("o1", "v4");
+    int waited = tm.read_ms();
+    CHECK(ports[1]->getStats().tx_dropped == dropped + 1);
+    CHECK(waited >= 50);
+    // el enlace retransmite cada rto, se lee durante un tiempo fijo
+    std::string in;
+    while(tm.read_ms() < waited + 100){
+        in += peers[0]->recv(5);
+    }
+    std::vector<std::string> data = linkData(in);
+    CHECK(data.size() >= 2 && data[0] == textFrame("o0", "w0") && data[1] == textFrame("o0", "w1"));
+    CHECK(ports[0]->getStats().link_retx > retx);
+    CHECK(peers[1]->recv(20).empty());
+
+    // el ack devuelve los buffers al pool
+    peers[0]->send(SerialPeer::linkAck(3, 0));
+    Thread::wait(50);
+    peers[0]->recv(20);
+    publish("o1", "v5");
+    CHECK(peers[1]->recv(20) == textFrame("o1", "v5"));
+    CHECK(ports[1]->getStats().tx_dropped == dropped + 1);
+    return waited;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    s_recorderCb = callback(recorderCb);
+    MQ::MQClient::subscribe("i0", &s_recorderCb);
+    MQ::MQClient::subscribe("i1", &s_recorderCb);
+    MQ::MQClient::subscribe("i2", &s_recorderCb);
+    MQSerialHub* hub = new MQSerialHub(BUF_SIZE, POOL_BLOCKS);
+    MQSerialBridge* ports[NUM_PORTS];
+    SerialPeer* peers[NUM_PORTS];
+    ports[0] = hub->addPort(0, 0, 115200, "h0");
+    ports[1] = hub->addPort(0, 0, 115200, "h1");
+    ports[2] = hub->addPort(0, 0, 115200, "h2", MQSerialBridge::MixMode);
+    CHECK(ports[0] && ports[1] && ports[2]);
+    CHECK(ports[0]->enableLink(2, 30));
+    for(int i=0;i<NUM_PORTS;i++){
+        peers[i] = new SerialPeer(ports[i]->masterFd());
+        char topic[16], sub[4];
+        sprintf(topic, "h%d/suscr", i);
+        sprintf(sub, "o%d", i);
+        MQ::MQClient::publish(topic, sub, strlen(sub) + 1, 0);
+    }
+    Thread::wait(100);
+
+    testRouting(ports, peers);
+    testOversize(ports, peers);
+    int waited = testExhaustion(ports, peers);
+
+    printf("test_MQSerialHub: %d puertos, pool de %d buffers agotado durante %d ms con %u retransmisiones: %s\n",
+           NUM_PORTS, POOL_BLOCKS, waited, ports[0]->getStats().link_retx, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * test_MQSerialLink.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba del enlace fiable de MQSerialBridge sobre el pseudo-terminal del puerto, con prdidas, desorden y
+ *  duplicados inyectados por el equipo remoto (SerialPeer). Se comprueba que:
+ *
+ *      - las tramas recibidas fuera de orden se almacenan y se publican en orden, una sola vez, y el ack indica
+ *        en su bitmap las que esperan; los duplicados, las tramas corruptas y las que quedan fuera de la ventana
+ *        no se publican
+ *      - las tramas enviadas cuyo ack no llega se retransmiten (link_retx) y el equipo remoto las recibe todas
+ *        en orden, sin descartes, aunque la secuencia pase de 255 a 0 y lleguen acks duplicados
+ *      - en modo MQTT-SN, un hilo que publica con la cola de emisin llena no impide que la tarea del puerto
+ *        procese los mensajes recibidos y los ack que la liberan
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQLib.h"
+#include "MQSerialBridge.h"
+#include <map>
+#include <thread>
+#include <vector>
+
+
+#define SN_PUBLISH          0x0C
+#define SN_PINGREQ          0x16
+
+/** Publicaciones enviadas hacia el equipo remoto (la secuencia da ms de una vuelta) */
+#define OUT_COUNT           300
+
+/** Publicaciones desde otro hilo hacia el cliente MQTT-SN */
+#define SN_COUNT            20
+
+
+static std::vector<int> s_in;
+static MQ::SubscribeCallback s_inCb;
+
+
+//------------------------------------------------------------------------------------
+static void inCb(const char* topic, void* msg, uint16_t msg_len){
+    s_in.push_back(atoi((const char*)msg));
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string textFrame(int n){
+    char buf[16];
+    int len = sprintf(buf, "in %d", n);
+    return std::string(buf, len + 1);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Recibe las tramas del puerto hasta que pasan millis ms sin datos y devuelve el ltimo ack */
+static std::string lastAck(SerialPeer& peer, int millis){
+    std::string in = peer.recv(millis);
+    std::string frame, ack;
+    while(SerialPeer::nextLinkFrame(in, &frame)){
+        if(frame[0] == TEST_LINK_ACK){
+            ack = frame;
+        }
+    }
+    return ack;
+}
+
+
+//------------------------------------------------------------------------------------
+static void testReceive(MQSerialBridge* bridge, SerialPeer& peer){
+    // 1 antes que 0, 0 duplicada
+    peer.send(SerialPeer::linkData(1, textFrame(1)));
+    peer.send(SerialPeer::linkData(0, textFrame(0)));
+    peer.send(SerialPeer::linkData(0, textFrame(0)));
+    CHECK(lastAck(peer, 20) == SerialPeer::linkAck(2, 0));
+    // 3 y 4 esperan a la 2, que primero llega corrupta
+    peer.send(SerialPeer::linkData(3, textFrame(3)));
+    CHECK(lastAck(peer, 20) == SerialPeer::linkAck(2, 0x01));
+    peer.send(SerialPeer::linkData(3, textFrame(3)));
+    std::string bad = SerialPeer::linkData(2, textFrame(2));
+    bad[bad.size() - 1] ^= 0xff;
+    peer.send(bad);
+    peer.send(SerialPeer::linkData(4, textFrame(4)));
+    CHECK(lastAck(peer, 20) == SerialPeer::linkAck(2, 0x03));
+    CHECK(s_in.size() == 2);
+    peer.send(SerialPeer::linkData(2, textFrame(2)));
+    // fuera de la ventana
+    peer.send(SerialPeer::linkData(200, textFrame(200)));
+    for(int i=5;i<10;i++){
+        peer.send(SerialPeer::linkData(i, textFrame(i)));
+    }
+    CHECK(lastAck(peer, 20) == SerialPeer::linkAck(10, 0));
+    bool ordered = (s_in.size() == 10);
+    for(size_t i=0;ordered && i<s_in.size();i++){
+        ordered = (s_in[i] == (int)i);
+    }
+    CHECK(ordered);
+    CHECK(bridge->getStats().rx_crc == 1);
+}
+
+
+//------------------------------------------------------------------------------------
+static void publishOut(){
+    for(int i=0;i<OUT_COUNT;i++){
+        char msg[8];
+        int len = sprintf(msg, "%d", i);
+        MQ::MQClient::publish("out", msg, len + 1, 0);
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** El equipo remoto pierde la primera copia de una de cada 7 tramas, almacena las que llegan fuera de orden y
+ *  duplica uno de cada 5 acks
+ *  @return Publicaciones recibidas en orden
+ */
+static int testSend(MQSerialBridge* bridge, SerialPeer& peer){
+    char sub[] = "out";
+    MQ::MQClient::publish("link/suscr", sub, sizeof(sub), 0);
+    std::thread publisher(publishOut);
+    std::vector<int> received;
+    std::vector<bool> lost(OUT_COUNT, false);
+    std::map<uint8_t, int> held;
+    uint8_t expected = 0;
+    std::string in, frame;
+    Timer tm;
+    tm.start();
+    while((int)received.size() < OUT_COUNT && tm.read_ms() < 10000){
+        in += peer.recv(2);
+        while(SerialPeer::nextLinkFrame(in, &frame)){
+            if(frame[0] != TEST_LINK_DATA || frame.size() < 3 + 5 + 2){
+                continue;
+            }
+            uint8_t seq = frame[1];
+            int n = atoi(&frame[3 + 5]);
+            if(n >= 0 && n < OUT_COUNT && n % 7 == 3 && !lost[n]){
+                lost[n] = true;
+                continue;
+            }
+            if(seq == expected){
+                received.push_back(n);
+                expected++;
+                while(held.count(expected)){
+                    received.push_back(held[expected]);
+                    held.erase(expected);
+                    expected++;
+                }
+            }
+            else if((uint8_t)(seq - expected) < 4){
+                held[seq] = n;
+            }
+            uint8_t bitmap = 0;
+            for(int i=0;i<3;i++){
+                bitmap |= (held.count((uint8_t)(expected + 1 + i)))? (1 << i) : 0;
+            }
+            peer.send(SerialPeer::linkAck(expected, bitmap));
+            if(n % 5 == 0){
+                peer.send(SerialPeer::linkAck(expected, bitmap));
+            }
+        }
+    }
+    publisher.join();
+    bool ordered = ((int)received.size() == OUT_COUNT);
+    for(size_t i=0;ordered && i<received.size();i++){
+        ordered = (received[i] == (int)i);
+    }
+    CHECK(ordered);
+    CHECK(bridge->getStats().tx_dropped == 0);
+    CHECK(bridge->getStats().link_retx >= OUT_COUNT / 7);
+    return (int)received.size();
+}
+
+
+//------------------------------------------------------------------------------------
+static void publishSn(){
+    for(int i=0;i<SN_COUNT;i++){
+        MQ::MQClient::publish("sn/a", (void*)"x", 1, 0);
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Con una ventana de 1, el hilo publicador llena la cola mientras el equipo remoto enva un PINGREQ antes de
+ *  cada ack: la tarea del puerto debe procesar ambos sin esperar al publicador
+ *  @return Tiempo empleado por el publicador en ms
+ */
+static int testSnQueueFull(){
+    MQSerialBridge* bridge = new MQSerialBridge(0, 0, 115200, 64, "sncfg", MQSerialBridge::SnMode);
+    CHECK(bridge->enableLink(1, 50));
+    SerialPeer peer(bridge->masterFd());
+    Thread::wait(100);
+    std::string in, frame, msg;
+    uint8_t expected = 0;
+    // CONNECT y SUBSCRIBE, se confirman el CONNACK y el SUBACK
+    peer.send(peer.linkData(SerialPeer::snMessage(0x04, std::string("\x04\x01\x00\x3c", 4) + "c1")));
+    peer.send(peer.linkData(SerialPeer::snMessage(0x12, std::string("\x00\x00\x01", 3) + "sn/a")));
+    for(int i=0;i<2;i++){
+        in += peer.recv(20);
+        while(SerialPeer::nextLinkFrame(in, &frame)){
+            if(frame[0] == TEST_LINK_DATA && (uint8_t)frame[1] == expected){
+                expected++;
+                peer.send(SerialPeer::linkAck(expected, 0));
+            }
+        }
+    }
+    CHECK(expected == 2);
+
+    Timer tm;
+    tm.start();
+    int elapsed = -1;
+    std::thread publisher([&](){ publishSn(); elapsed = tm.read_ms(); });
+    int published = 0;
+    while(published < SN_COUNT && tm.read_ms() < 5000){
+        in += peer.recv(2);
+        while(SerialPeer::nextLinkFrame(in, &frame)){
+            if(frame[0] != TEST_LINK_DATA){
+                continue;
+            }
+            if((uint8_t)frame[1] == expected){
+                expected++;
+                std::string sn = frame.substr(3, frame.size() - 5);
+                while(SerialPeer::nextSnMessage(sn, &msg)){
+                    published += (msg[1] == SN_PUBLISH)? 1 : 0;
+                }
+            }
+            peer.send(peer.linkData(SerialPeer::snMessage(SN_PINGREQ, "")));
+            peer.send(SerialPeer::linkAck(expected, 0));
+        }
+    }
+    publisher.join();
+    CHECK(published == SN_COUNT);
+    // sin descartes ni esperas del publicador, menos de un tiempo de retransmisin por publicacin
+    CHECK(elapsed >= 0 && elapsed < SN_COUNT * 50);
+    CHECK(bridge->getStats().link_retx == 0);
+    return elapsed;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    s_inCb = callback(inCb);
+    MQ::MQClient::subscribe("in", &s_inCb);
+    MQSerialBridge* bridge = new MQSerialBridge(0, 0, 115200, 64, "link", MQSerialBridge::TextMode);
+    CHECK(!bridge->enableLink(3, 30));
+    CHECK(bridge->enableLink(4, 30));
+    SerialPeer peer(bridge->masterFd());
+    Thread::wait(100);
+
+    testReceive(bridge, peer);
+    int sent = testSend(bridge, peer);
+    int sn_ms = testSnQueueFull();
+
+    printf("test_MQSerialLink: %d recibidas en orden, %d enviadas con %u retransmisiones, %d publicaciones MQTT-SN con la cola llena en %d ms: %s\n",
+           (int)s_in.size(), sent, bridge->getStats().link_retx, SN_COUNT, sn_ms, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * test_MQSerialSn.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba del modo gateway MQTT-SN de MQSerialBridge, con un cliente simulado (SerialPeer) en el extremo maestro
+ *  del pseudo-terminal del puerto. Se comprueba que:
+ *
+ *      - las publicaciones QoS -1 a un topic predefinido se aceptan sin conexin, y las QoS0 no
+ *      - REGISTER asigna un identificador, el mismo si el nombre se registra de nuevo
+ *      - las publicaciones QoS0 y QoS1 (con su PUBACK) llegan a MQLib, tambin con nombre corto, y las dirigidas
+ *        a un identificador desconocido o con QoS2 se rechazan en el PUBACK
+ *      - SUBSCRIBE a un topic normal, con comodines o predefinido (por identificador o por nombre) entrega las
+ *        publicaciones MQLib con el identificador que corresponde, registrndolo antes si el cliente no lo conoce,
+ *        y una suscripcin repetida no duplica las entregas
+ *      - un SUBSCRIBE predefinido sin los dos bytes del identificador se descarta, y UNSUBSCRIBE cancela la entrega
+ *      - mientras el cliente duerme las publicaciones se almacenan y se entregan con el PINGREQ que lo despierta
+ *      - CONNECT sin CleanSession conserva las suscripciones, y con CleanSession las cancela y olvida los topics
+ *        registrados, pero no los predefinidos
+ *      - con la tabla de topics llena, las publicaciones que no pueden registrarse cuentan en tx_dropped
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQLib.h"
+#include "MQSerialBridge.h"
+#include <vector>
+
+
+#define SN_CONNECT          0x04
+#define SN_CONNACK          0x05
+#define SN_REGISTER         0x0A
+#define SN_REGACK           0x0B
+#define SN_PUBLISH          0x0C
+#define SN_PUBACK           0x0D
+#define SN_SUBSCRIBE        0x12
+#define SN_SUBACK           0x13
+#define SN_UNSUBSCRIBE      0x14
+#define SN_UNSUBACK         0x15
+#define SN_PINGREQ          0x16
+#define SN_PINGRESP         0x17
+#define SN_DISCONNECT       0x18
+
+/** Flags de PUBLISH y SUBSCRIBE */
+#define FLAG_QOS_M1         0x60
+#define FLAG_QOS1           0x20
+#define FLAG_QOS2           0x40
+#define FLAG_CLEAN          0x04
+#define FLAG_PREDEFINED     0x01
+#define FLAG_SHORT          0x02
+
+/** Identificador del topic predefinido */
+#define PREDEFINED_ID       5
+
+
+static std::vector<std::string> s_topics;
+static std::vector<std::string> s_payloads;
+static MQ::SubscribeCallback s_recorderCb;
+
+
+//------------------------------------------------------------------------------------
+static void recorderCb(const char* topic, void* msg, uint16_t msg_len){
+    s_topics.push_back(topic);
+    s_payloads.push_back(std::string((const char*)msg, msg_len));
+}
+
+
+//------------------------------------------------------------------------------------
+static void clearRecorder(){
+    s_topics.clear();
+    s_payloads.clear();
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string u16(uint16_t v){
+    std::string s;
+    s += (char)(v >> 8);
+    s += (char)(v & 0xff);
+    return s;
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string sn(uint8_t type, const std::string& body){
+    return SerialPeer::snMessage(type, body);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Enva un mensaje (si no est vaco) y devuelve los mensajes recibidos del gateway */
+static std::vector<std::string> request(SerialPeer& peer, const std::string& msg){
+    if(!msg.empty()){
+        peer.send(msg);
+    }
+    std::string in = peer.recv(20);
+    std::vector<std::string> out;
+    std::string m;
+    while(SerialPeer::nextSnMessage(in, &m)){
+        out.push_back(m);
+    }
+    CHECK(in.empty());
+    return out;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Publica en MQLib y devuelve los mensajes que el gateway enva al cliente */
+static std::vector<std::string> forward(SerialPeer& peer, const char* topic, const char* msg){
+    MQ::MQClient::publish(topic, (void*)msg, strlen(msg), 0);
+    return request(peer, "");
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string publishMsg(uint8_t flags, uint16_t id, uint16_t msgid, const std::string& data){
+    return sn(SN_PUBLISH, std::string(1, (char)flags) + u16(id) + u16(msgid) + data);
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string subscribeMsg(uint8_t type, uint8_t flags, uint16_t msgid, const std::string& topic){
+    return sn(type, std::string(1, (char)flags) + u16(msgid) + topic);
+}
+
+
+//------------------------------------------------------------------------------------
+static std::string connectMsg(uint8_t flags){
+    return sn(SN_CONNECT, std::string(1, (char)flags) + "\x01" + u16(60) + "c1");
+}
+
+
+//------------------------------------------------------------------------------------
+/** Identificador del PUBLISH que entrega un mensaje al cliente, o -1 si no est (o el contenido no coincide) */
+static int deliveredId(const std::vector<std::string>& msgs, uint8_t flags, const char* data){
+    for(size_t i=0;i<msgs.size();i++){
+        const std::string& m = msgs[i];
+        if(m[1] == SN_PUBLISH && m.size() >= 7 && m[2] == (char)flags && m.substr(7) == data){
+            return (((uint8_t)m[3]) << 8) | (uint8_t)m[4];
+        }
+    }
+    return -1;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Nombre registrado con un identificador en los REGISTER recibidos, o "" */
+static std::string registered(const std::vector<std::string>& msgs, uint16_t id){
+    for(size_t i=0;i<msgs.size();i++){
+        const std::string& m = msgs[i];
+        if(m[1] == SN_REGISTER && m.size() >= 6 && m.substr(2, 2) == u16(id)){
+            return m.substr(6);
+        }
+    }
+    return "";
+}
+
+
+//------------------------------------------------------------------------------------
+static void testPublish(SerialPeer& peer){
+    // sin conexin slo se acepta QoS -1
+    clearRecorder();
+    CHECK(request(peer, publishMsg(FLAG_QOS_M1 | FLAG_PREDEFINED, PREDEFINED_ID, 0, "m1")).empty());
+    CHECK(request(peer, publishMsg(0x00 | FLAG_PREDEFINED, PREDEFINED_ID, 0, "m0")).empty());
+    CHECK(s_topics.size() == 1 && s_topics[0] == "pre/t" && s_payloads[0] == "m1");
+
+    std::vector<std::string> rsp = request(peer, connectMsg(FLAG_CLEAN));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_CONNACK, std::string(1, 0)));
+
+    // REGISTER, dos veces con el mismo nombre
+    rsp = request(peer, sn(SN_REGISTER, u16(0) + u16(0x11) + "r/1"));
+    CHECK(rsp.size() == 1 && rsp[0].size() == 7 && rsp[0][1] == SN_REGACK && rsp[0].substr(4) == u16(0x11) + std::string(1, 0));
+    std::string id = (rsp.size() == 1)? rsp[0].substr(2, 2) : "";
+    rsp = request(peer, sn(SN_REGISTER, u16(0) + u16(0x12) + "r/1"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_REGACK, id + u16(0x12) + std::string(1, 0)));
+    uint16_t rid = (id.size() == 2)? ((((uint8_t)id[0]) << 8) | (uint8_t)id[1]) : 0;
+
+    // QoS0, QoS1 y nombre corto
+    clearRecorder();
+    CHECK(request(peer, publishMsg(0x00, rid, 0, "v0")).empty());
+    rsp = request(peer, publishMsg(FLAG_QOS1, rid, 0x22, "v1"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_PUBACK, id + u16(0x22) + std::string(1, 0)));
+    CHECK(request(peer, publishMsg(FLAG_SHORT, ('s' << 8) | 'x', 0, "v2")).empty());
+    CHECK(s_topics.size() == 3 && s_topics[0] == "r/1" && s_payloads[0] == "v0" && s_topics[1] == "r/1" && s_payloads[1] == "v1" &&
+          s_topics[2] == "sx" && s_payloads[2] == "v2");
+
+    // identificador desconocido y QoS2
+    clearRecorder();
+    rsp = request(peer, publishMsg(FLAG_QOS1, 99, 0x23, "x"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_PUBACK, u16(99) + u16(0x23) + "\x02"));
+    rsp = request(peer, publishMsg(FLAG_QOS2, rid, 0x24, "x"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_PUBACK, id + u16(0x24) + "\x03"));
+    CHECK(s_topics.empty());
+}
+
+
+//------------------------------------------------------------------------------------
+static void testSubscribe(SerialPeer& peer){
+    // topic normal: el SUBACK lleva su identificador y las publicaciones se entregan con l
+    std::vector<std::string> rsp = request(peer, subscribeMsg(SN_SUBSCRIBE, 0, 0x31, "a/b"));
+    CHECK(rsp.size() == 1 && rsp[0].size() == 8 && rsp[0][1] == SN_SUBACK && rsp[0].substr(5) == u16(0x31) + std::string(1, 0));
+    int id = (rsp.size() == 1)? ((((uint8_t)rsp[0][3]) << 8) | (uint8_t)rsp[0][4]) : -1;
+    CHECK(id > 0);
+    rsp = forward(peer, "a/b", "hi");
+    CHECK(deliveredId(rsp, 0, "hi") == id);
+    CHECK(rsp.size() == 1 || registered(rsp, id) == "a/b");
+    // repetida, no se duplica la entrega
+    request(peer, subscribeMsg(SN_SUBSCRIBE, 0, 0x32, "a/b"));
+    rsp = forward(peer, "a/b", "hi");
+    CHECK(rsp.size() == 1 && deliveredId(rsp, 0, "hi") == id);
+
+    // comodines: cada topic que coincide se registra antes de su primera publicacin
+    rsp = request(peer, subscribeMsg(SN_SUBSCRIBE, 0, 0x33, "w/+"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_SUBACK, std::string(1, 0) + u16(0) + u16(0x33) + std::string(1, 0)));
+    rsp = forward(peer, "w/x", "wx");
+    int wid = deliveredId(rsp, 0, "wx");
+    CHECK(wid > 0 && wid != id && registered(rsp, wid) == "w/x");
+    rsp = forward(peer, "w/x", "wx");
+    CHECK(rsp.size() == 1 && deliveredId(rsp, 0, "wx") == wid);
+
+    // predefinido por identificador y por nombre: una sola entrega, sin REGISTER
+    rsp = request(peer, subscribeMsg(SN_SUBSCRIBE, FLAG_PREDEFINED, 0x34, u16(PREDEFINED_ID)));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_SUBACK, std::string(1, 0) + u16(PREDEFINED_ID) + u16(0x34) + std::string(1, 0)));
+    rsp = request(peer, subscribeMsg(SN_SUBSCRIBE, 0, 0x35, "pre/t"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_SUBACK, std::string(1, 0) + u16(PREDEFINED_ID) + u16(0x35) + std::string(1, 0)));
+    rsp = forward(peer, "pre/t", "p");
+    CHECK(rsp.size() == 1 && deliveredId(rsp, FLAG_PREDEFINED, "p") == PREDEFINED_ID);
+
+    // identificador predefinido incompleto: se descarta sin respuesta
+    CHECK(request(peer, subscribeMsg(SN_SUBSCRIBE, FLAG_PREDEFINED, 0x36, std::string(1, 0))).empty());
+    CHECK(request(peer, subscribeMsg(SN_UNSUBSCRIBE, FLAG_PREDEFINED, 0x37, std::string(1, 0))).empty());
+
+    // UNSUBSCRIBE
+    rsp = request(peer, subscribeMsg(SN_UNSUBSCRIBE, 0, 0x38, "w/+"));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_UNSUBACK, u16(0x38)));
+    CHECK(forward(peer, "w/y", "wy").empty());
+}
+
+
+//------------------------------------------------------------------------------------
+static void testSleep(SerialPeer& peer){
+    std::vector<std::string> rsp = request(peer, sn(SN_DISCONNECT, u16(60)));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_DISCONNECT, ""));
+    CHECK(forward(peer, "a/b", "z1").empty());
+    CHECK(forward(peer, "pre/t", "z2").empty());
+    // el PINGREQ con el ClientId entrega las almacenadas y despus responde
+    rsp = request(peer, sn(SN_PINGREQ, "c1"));
+    CHECK(rsp.size() == 3 && deliveredId(rsp, 0, "z1") > 0 && deliveredId(rsp, FLAG_PREDEFINED, "z2") == PREDEFINED_ID &&
+          rsp.back() == sn(SN_PINGRESP, ""));
+    // sigue dormido
+    CHECK(forward(peer, "a/b", "z3").empty());
+    // al conectar sin CleanSession se entrega lo almacenado y se conservan las suscripciones
+    rsp = request(peer, connectMsg(0));
+    CHECK(rsp.size() == 2 && rsp[0] == sn(SN_CONNACK, std::string(1, 0)) && deliveredId(rsp, 0, "z3") > 0);
+    CHECK(deliveredId(forward(peer, "a/b", "z4"), 0, "z4") > 0);
+}
+
+
+//------------------------------------------------------------------------------------
+/** @return Publicaciones descartadas con la tabla de topics llena */
+static uint32_t testTopicTable(MQSerialBridge* bridge, SerialPeer& peer){
+    request(peer, subscribeMsg(SN_SUBSCRIBE, 0, 0x41, "f/#"));
+    uint32_t dropped = bridge->getStats().tx_dropped;
+    int delivered = 0;
+    for(int i=0;i<20;i++){
+        char topic[8];
+        sprintf(topic, "f/%d", i);
+        delivered += (deliveredId(forward(peer, topic, "f"), 0, "f") > 0)? 1 : 0;
+    }
+    dropped = bridge->getStats().tx_dropped - dropped;
+    CHECK(delivered > 0 && dropped > 0 && delivered + (int)dropped == 20);
+
+    // CleanSession libera la tabla y cancela las suscripciones, el predefinido se mantiene
+    std::vector<std::string> rsp = request(peer, connectMsg(FLAG_CLEAN));
+    CHECK(rsp.size() == 1 && rsp[0] == sn(SN_CONNACK, std::string(1, 0)));
+    CHECK(forward(peer, "a/b", "c").empty());
+    CHECK(forward(peer, "pre/t", "c").empty());
+    CHECK(forward(peer, "f/1", "c").empty());
+    rsp = request(peer, sn(SN_REGISTER, u16(0) + u16(0x42) + "f/19"));
+    CHECK(rsp.size() == 1 && rsp[0].size() == 7 && rsp[0][6] == 0);
+    clearRecorder();
+    CHECK(request(peer, publishMsg(FLAG_QOS_M1 | FLAG_PREDEFINED, PREDEFINED_ID, 0, "m2")).empty());
+    CHECK(s_topics.size() == 1 && s_topics[0] == "pre/t");
+    return dropped;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    s_recorderCb = callback(recorderCb);
+    MQ::MQClient::subscribe("#", &s_recorderCb);
+    MQSerialBridge* bridge = new MQSerialBridge(0, 0, 115200, 128, "sn", MQSerialBridge::SnMode);
+    CHECK(bridge->addPredefinedTopic(PREDEFINED_ID, "pre/t"));
+    SerialPeer peer(bridge->masterFd());
+    Thread::wait(100);
+
+    testPublish(peer);
+    testSubscribe(peer);
+    testSleep(peer);
+    uint32_t dropped = testTopicTable(bridge, peer);
+
+    printf("test_MQSerialSn: %u tramas recibidas, %u enviadas, %u descartadas con la tabla de topics llena: %s\n",
+           bridge->getStats().rx_frames, bridge->getStats().tx_frames, dropped, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
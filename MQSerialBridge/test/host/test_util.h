@@ -0,0 +1,189 @@
+/*
+ * test_util.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Utilidades comunes de las pruebas de MQSerialBridge en Linux: la macro CHECK, el CRC del enlace fiable y
+ *  SerialPeer, el equipo remoto que escribe y lee tramas en el extremo maestro del pseudo-terminal de un puerto.
+ */
+
+#ifndef _HOST_TEST_UTIL_H
+#define _HOST_TEST_UTIL_H
+
+#include "mbed.h"
+#include <poll.h>
+#include <unistd.h>
+#include <string>
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+/** Tipos de trama del enlace fiable (ver MQSerialBridge.h) */
+#define TEST_LINK_DATA      0x01
+#define TEST_LINK_ACK       0x02
+
+/** Separacin entre tramas escritas: el tiempo de break del puerto a 115200 baudios es de 500 us, el resto es
+ *  margen para los retrasos del planificador */
+#define TEST_BREAK_US       5000
+
+
+//---------------------------------------------------------------------------------
+//- class SerialPeer --------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+class SerialPeer {
+
+public:
+
+    SerialPeer(int fd) : _fd(fd), _seq(0) {}
+
+
+    /** CRC16-CCITT del enlace fiable */
+    static uint16_t linkCRC(const uint8_t* data, uint32_t size){
+        uint16_t crc = 0xFFFF;
+        for(uint32_t i=0;i<size;i++){
+            crc ^= ((uint16_t)data[i]) << 8;
+            for(int b=0;b<8;b++){
+                crc = (crc & 0x8000)? ((crc << 1) ^ 0x1021) : (crc << 1);
+            }
+        }
+        return crc;
+    }
+
+
+    /** Trama de datos del enlace con la secuencia indicada */
+    static std::string linkData(uint8_t seq, const std::string& data){
+        std::string f;
+        f += (char)TEST_LINK_DATA;
+        f += (char)seq;
+        f += (char)0;
+        f += data;
+        return appendCRC(f);
+    }
+
+
+    /** Trama de datos del enlace con la siguiente secuencia del equipo remoto */
+    std::string linkData(const std::string& data){
+        return linkData(_seq++, data);
+    }
+
+
+    /** Trama de ack del enlace */
+    static std::string linkAck(uint8_t expected, uint8_t bitmap){
+        std::string f;
+        f += (char)TEST_LINK_ACK;
+        f += (char)expected;
+        f += (char)bitmap;
+        return appendCRC(f);
+    }
+
+
+    /** Mensaje MQTT-SN con longitud de un byte */
+    static std::string snMessage(uint8_t type, const std::string& body){
+        std::string m;
+        m += (char)(body.size() + 2);
+        m += (char)type;
+        m += body;
+        return m;
+    }
+
+
+    /** Escribe una trama y espera el tiempo de break, para que el puerto no la una a la siguiente */
+    void send(const std::string& frame){
+        const char* p = frame.data();
+        size_t size = frame.size();
+        while(size > 0){
+            ssize_t n = write(_fd, p, size);
+            if(n <= 0){
+                break;
+            }
+            p += n;
+            size -= n;
+        }
+        usleep(TEST_BREAK_US);
+    }
+
+
+    /** Lee lo recibido hasta que pasan millis ms sin datos */
+    std::string recv(int millis){
+        std::string out;
+        struct pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = POLLIN;
+        while(poll(&pfd, 1, millis) > 0){
+            char buf[512];
+            ssize_t n = read(_fd, buf, sizeof(buf));
+            if(n <= 0){
+                break;
+            }
+            out.append(buf, n);
+        }
+        return out;
+    }
+
+
+    /** Extrae de in la primera trama completa del enlace. Las tramas de datos no indican su longitud, as que
+     *  se delimitan por el primer CRC vlido seguido del comienzo de otra trama (o del final de lo recibido).
+     *  Los bytes que no pueden iniciar una trama se descartan.
+     *  @return true si hay una trama completa
+     */
+    static bool nextLinkFrame(std::string& in, std::string* frame){
+        while(!in.empty() && in[0] != TEST_LINK_DATA && in[0] != TEST_LINK_ACK){
+            in.erase(0, 1);
+        }
+        const uint8_t* p = (const uint8_t*)in.data();
+        size_t len = 0;
+        if(in.size() >= 5 && p[0] == TEST_LINK_ACK){
+            len = 5;
+        }
+        for(size_t n=5;len == 0 && p[0] == TEST_LINK_DATA && p[2] == 0 && n<=in.size();n++){
+            if(linkCRC(p, n - 2) == ((((uint16_t)p[n - 2]) << 8) | p[n - 1]) &&
+               (n == in.size() || p[n] == TEST_LINK_DATA || p[n] == TEST_LINK_ACK)){
+                len = n;
+            }
+        }
+        if(len == 0){
+            return false;
+        }
+        frame->assign(in, 0, len);
+        in.erase(0, len);
+        return true;
+    }
+
+
+    /** Extrae de in el primer mensaje MQTT-SN completo (longitud de uno o tres bytes)
+     *  @return true si hay un mensaje completo
+     */
+    static bool nextSnMessage(std::string& in, std::string* msg){
+        const uint8_t* p = (const uint8_t*)in.data();
+        if(in.size() < 2){
+            return false;
+        }
+        size_t len = (p[0] == 0x01)? ((in.size() >= 3)? ((((size_t)p[1]) << 8) | p[2]) : 0) : p[0];
+        if(len < 2 || len > in.size()){
+            return false;
+        }
+        msg->assign(in, 0, len);
+        in.erase(0, len);
+        return true;
+    }
+
+private:
+
+    static std::string appendCRC(std::string& f){
+        uint16_t crc = linkCRC((const uint8_t*)f.data(), f.size());
+        f += (char)(crc >> 8);
+        f += (char)(crc & 0xff);
+        return f;
+    }
+
+    int _fd;
+    uint8_t _seq;
+};
+
+#endif  /** _HOST_TEST_UTIL_H */
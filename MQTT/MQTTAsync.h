@@ -17,221 +17,358 @@
 #if !defined(MQTTASYNC_H)
 #define MQTTASYNC_H
 
-#include "FP.h"
-#include "MQTTPacket.h"
-#include "stdio.h"
+#include "MQTTClient.h"
+#include <string.h>
 
 namespace MQTT
 {
 
 
-enum QoS { QOS0, QOS1, QOS2 };
-
-
-struct Message
-{
-    enum QoS qos;
-    bool retained;
-    bool dup;
-    unsigned short id;
-    void *payload;
-    size_t payloadlen;
-};
-
-
-class PacketId
-{
-public:
-    PacketId();
-    
-    int getNext();
-   
-private:
-    static const int MAX_PACKET_ID = 65535;
-    int next;
-};
-
-typedef void (*messageHandler)(Message*);
-
 typedef struct limits
 {
-	int MAX_MQTT_PACKET_SIZE; // 
-	int MAX_MESSAGE_HANDLERS;  // each subscription requires a message handler
-	int MAX_CONCURRENT_OPERATIONS;  // each command which runs concurrently can have a result handler, when we are in multi-threaded mode
-	int command_timeout_ms;
-		
-	limits()
-	{
-		MAX_MQTT_PACKET_SIZE = 100;
-		MAX_MESSAGE_HANDLERS = 5;
-		MAX_CONCURRENT_OPERATIONS = 1; // 1 indicates single-threaded mode - set to >1 for multithreaded mode
-		command_timeout_ms = 30000;
-	}
+    int MAX_MQTT_PACKET_SIZE;       // size of the send and of the receive buffer
+    int MAX_MESSAGE_HANDLERS;       // each subscription requires a message handler
+    int MAX_CONCURRENT_OPERATIONS;  // commands waiting for their acks at the same time (publish QoS1/2, subscribe, unsubscribe)
+    int command_timeout_ms;         // time for a command to be acknowledged, its result is FAILURE after that
+
+    limits()
+    {
+        MAX_MQTT_PACKET_SIZE = 100;
+        MAX_MESSAGE_HANDLERS = 5;
+        MAX_CONCURRENT_OPERATIONS = 16;
+        command_timeout_ms = 30000;
+    }
 } Limits;
-  
+
 
 /**
  * @class Async
  * @brief non-blocking, threaded MQTT client API
- * @param Network a network class which supports send, receive
- * @param Timer a timer class with the methods: 
- */ 
+ *
+ * connect() starts a background thread which reads the network, completes the commands as their acks
+ * arrive, delivers the incoming messages and sends the keepalive pings.  publish, subscribe and unsubscribe
+ * only send their packet and return, so any number of them (up to MAX_CONCURRENT_OPERATIONS) can be in
+ * flight, and their result handlers are called later from the background thread.
+ *
+ * The packet id of a command encodes its entry of the operations table, so an ack finds its command with
+ * a modulo.  Free entries are kept in a free list, and the pending ones in a list in the order they were
+ * sent, which is also the order of their deadlines: only the oldest one has to be checked for timeout.
+ *
+ * Handlers are called from the background thread without the lock held.  They can issue new commands,
+ * but must not call disconnect().  isBackgroundThread() tells them apart from the other threads, for
+ * wrappers which have to wait for a result.
+ * @param Network a network class which supports read and write, one thread reading while another writes
+ * @param Timer a timer class with the methods: countdown_ms, countdown, expired, left_ms
+ * @param Thread a thread class constructed from a function void(void const*) and its argument, with join()
+ *     and a static gettid() which identifies the calling thread with a pointer, as mbed's Thread
+ * @param Mutex a mutex class with lock and unlock
+ */
 template<class Network, class Timer, class Thread, class Mutex> class Async
 {
-    
-public:    
-
-	struct Result
-	{
-    	/* success or failure result data */
-    	Async<Network, Timer, Thread, Mutex>* client;
-		int rc;
-	};
-
-	typedef void (*resultHandler)(Result*);	
-   
-    Async(Network* network, const Limits limits = Limits()); 
-        
+
+public:
+
+    struct Result
+    {
+        /* success or failure result data */
+        Async<Network, Timer, Thread, Mutex>* client;
+        int rc;                 // SUCCESS or FAILURE, the connack return code for connect
+        unsigned short id;      // packet id of the command, 0 if it has none
+        int grantedQoS;         // subscribe: 0, 1, 2 or 0x80 if the subscription was refused
+        void* context;          // as passed to the command
+    };
+
+    typedef void (*resultHandler)(Result*);
+    typedef void (*messageHandler)(MessageData&);
+    typedef Delegate<void, MessageData&> messageHandlerFP;
+
+    /** Construct the client
+     *  @param network - pointer to an instance of the Network class - must be connected to the endpoint
+     *      before calling MQTT connect
+     *  @param limits an instance of the Limit class - to alter limits as required
+     */
+    Async(Network* network, const Limits limits = Limits());
+
+    ~Async();
+
     typedef struct
     {
         Async* client;
         Network* network;
     } connectionLostInfo;
-    
+
     typedef int (*connectionLostHandlers)(connectionLostInfo*);
-    
-    /** Set the connection lost callback - called whenever the connection is lost and we should be connected
+
+    /** Set the connection lost callback - called from the background thread whenever the connection is lost
+     *  and we should be connected.  The pending commands have already failed by then
      *  @param clh - pointer to the callback function
      */
     void setConnectionLostHandler(connectionLostHandlers clh)
     {
         connectionLostHandler.attach(clh);
     }
-    
+
     /** Set the default message handling callback - used for any message which does not match a subscription message handler
-     *  @param mh - pointer to the callback function
+     *  @param mh - pointer to the callback function.  Set to 0 to remove.
      */
     void setDefaultMessageHandler(messageHandler mh)
     {
-        defaultMessageHandler.attach(mh);
+        setDefaultMessageHandler(messageHandlerFP(mh));
+    }
+
+    /** Set the default message handling callback to a member function or a function object
+     *  @param mh - the callback.  Detached to remove.
+     */
+    void setDefaultMessageHandler(const messageHandlerFP& mh)
+    {
+        mutex.lock();
+        defaultMessageHandler = mh;
+        mutex.unlock();
+    }
+
+    /** Hand the messages to a dispatcher which calls their handlers, instead of calling them from the background thread
+     *  @param md - the dispatcher.  Set to 0 to remove.
+     */
+    void setDispatcher(MessageDispatcher* md)
+    {
+        mutex.lock();
+        dispatcher = md;
+        mutex.unlock();
     }
-           
+
+    /** Set a message handling callback.  This can be used outside of the the subscribe method.
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @param mh - pointer to the callback function. If 0, removes the callback if any
+     */
+    int setMessageHandler(const char* topicFilter, messageHandler mh)
+    {
+        return setMessageHandler(topicFilter, messageHandlerFP(mh));
+    }
+
+    /** Set a message handling callback which is a member function or a function object
+     *  @param mh - the callback.  If detached, removes the callback if any
+     */
+    int setMessageHandler(const char* topicFilter, const messageHandlerFP& mh);
+
+    /** MQTT Connect - send an MQTT connect packet and start the background thread
+     *  @param fn - called with the connack return code.  If 0, connect waits for the connack
+     *  @param options - connect options, the defaults if 0
+     *  @return SUCCESS once sent, or the connack return code if fn is 0
+     */
     int connect(resultHandler fn, MQTTPacket_connectData* options = 0);
-    
-     template<class T>
+
+    template<class T>
     int connect(void(T::*method)(Result *), MQTTPacket_connectData* options = 0, T *item = 0);  // alternative to pass in pointer to member function
-        
-    int publish(resultHandler rh, const char* topic, Message* message);
-    
-    int subscribe(resultHandler rh, const char* topicFilter, enum QoS qos, messageHandler mh);
-    
-    int unsubscribe(resultHandler rh, const char* topicFilter);
-    
+
+    /** MQTT Publish - send an MQTT publish packet, without waiting for the acks
+     *  @param rh - called when the last ack arrives, or on timeout.  For QoS0 it is called before publish returns
+     *  @param topic - the topic to publish to
+     *  @param message - the message to send, for QoS1 and QoS2 its id is set to the packet id of the command
+     *  @param context - passed back to rh in the result
+     *  @return SUCCESS if sent, FAILURE if not, in which case rh is not called
+     */
+    int publish(resultHandler rh, const char* topic, Message* message, void* context = 0);
+
+    /** MQTT Subscribe - send an MQTT subscribe packet, without waiting for the suback.  The message handler is
+     *  set at once, and removed again if the subscription is refused or times out
+     *  @param topicFilter - a topic pattern which can include wildcards, it must remain valid while subscribed
+     *  @return SUCCESS if sent, FAILURE if not, in which case rh is not called
+     */
+    int subscribe(resultHandler rh, const char* topicFilter, enum QoS qos, messageHandler mh, void* context = 0)
+    {
+        return subscribe(rh, topicFilter, qos, messageHandlerFP(mh), context);
+    }
+
+    int subscribe(resultHandler rh, const char* topicFilter, enum QoS qos, const messageHandlerFP& mh, void* context = 0);
+
+    /** MQTT Unsubscribe - send an MQTT unsubscribe packet, without waiting for the unsuback.  The message
+     *  handler is removed when the unsuback arrives
+     *  @return SUCCESS if sent, FAILURE if not, in which case rh is not called
+     */
+    int unsubscribe(resultHandler rh, const char* topicFilter, void* context = 0);
+
+    /** MQTT Disconnect - send an MQTT disconnect packet and stop the background thread.  The commands still
+     *  pending fail, then rh is called
+     *  @return SUCCESS if sent, FAILURE if not
+     */
     int disconnect(resultHandler rh);
-    
+
+    bool isConnected()
+    {
+        return isconnected;
+    }
+
+    /** True when called from the background thread, that is from a handler (unless a dispatcher runs them) */
+    bool isBackgroundThread()
+    {
+        mutex.lock();
+        bool rc = (reader != 0 && reader == (void*)Thread::gettid());
+        mutex.unlock();
+        return rc;
+    }
+
 private:
 
-    void run(void const *argument);
+    typedef Delegate<void, Result*> resultHandlerFP;
+    typedef Delegate<int, connectionLostInfo*> connectionLostFP;
+
+    static void threadfn(void const* arg);
+    int start(resultHandlerFP& fp, MQTTPacket_connectData* options);
+    void run();
     int cycle(int timeout);
-    int waitfor(int packet_type, Timer& atimer);
-	int keepalive();
-	int findFreeOperation();
+    int keepalive();
+    int expire();
+    void connectionLost();
 
-    int decodePacket(int* value, int timeout);
+    int decodePacket(int* value, Timer& timer);
     int readPacket(int timeout);
-    int sendPacket(int length, int timeout);
-	int deliverMessage(MQTTString* topic, Message* message);
-    
+    int sendPacket(int length);
+    int deliverMessage(MQTTString& topic, Message& message);
+    static bool isTopicMatched(const char* topicFilter, MQTTString& topicName);
+    int setHandler(const char* topicFilter, const messageHandlerFP& mh);
+
+    int allocOperation(resultHandler rh, int ack, const char* topic, void* context);
+    int findOperation(unsigned short id);
+    void freeOperation(int index);
+    void complete(int index, int rc, int grantedQoS);
+
     Thread* thread;
     Network* ipstack;
-    
+    Mutex mutex;                // send buffer, operations and message handlers
+
     Limits limits;
-    
-    char* buf;  
-    char* readbuf;
+
+    unsigned char* buf;
+    unsigned char* readbuf;     // only used by the background thread
 
     Timer ping_timer, connect_timer;
     unsigned int keepAliveInterval;
-	bool ping_outstanding;
-    
-    PacketId packetid;
-    
-    typedef FP<void, Result*> resultHandlerFP;    
-    resultHandlerFP connectHandler; 
-    
-    typedef FP<void, Message*> messageHandlerFP;
+    bool ping_outstanding;
+    bool isconnected;
+    bool running;
+    void* reader;               // id of the background thread while it runs
+
+    resultHandlerFP connectHandler;
+
     struct MessageHandlers
     {
-    	const char* topic;
-    	messageHandlerFP fp;
-    } *messageHandlers;      // Message handlers are indexed by subscription topic
-    
+        const char* topicFilter;
+        messageHandlerFP fp;
+    } *messageHandlers;         // Message handlers are indexed by subscription topic
+    messageHandlerFP* matched;  // handlers of the message being delivered
+
     // how many concurrent operations should we allow?  Each one will require a function pointer
     struct Operations
     {
-    	unsigned short id;
-    	resultHandlerFP fp;
-    	const char* topic;         // if this is a publish, store topic name in case republishing is required
-    	Message* message;    // for publish, 
-    	Timer timer;         // to check if the command has timed out
-    } *operations;           // result handlers are indexed by packet ids
-
-	static void threadfn(void* arg);
-	
-	messageHandlerFP defaultMessageHandler;
-    
-    typedef FP<int, connectionLostInfo*> connectionLostFP;
-    
+        unsigned short id;      // packet id, 0 if free
+        int seq;                // times the entry has been used, gives the next packet id
+        int ack;                // packet type expected: PUBACK, PUBREC, PUBCOMP, SUBACK or UNSUBACK
+        resultHandlerFP fp;
+        const char* topic;      // subscribe and unsubscribe: the topic filter
+        void* context;
+        Timer timer;            // to check if the command has timed out
+        int prev, next;         // pending list, or free list (next)
+    } *operations;              // result handlers are indexed by packet ids
+    int free_op;
+    int oldest_op, newest_op;
+
+    messageHandlerFP defaultMessageHandler;
+    MessageDispatcher* dispatcher;
+
     connectionLostFP connectionLostHandler;
-    
+
 };
 
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::threadfn(void* arg)
+template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::threadfn(void const* arg)
 {
-    ((Async<Network, Timer, Thread, Mutex>*) arg)->run(NULL);
+    ((Async<Network, Timer, Thread, Mutex>*) arg)->run();
+}
+
+
+template<class Network, class Timer, class Thread, class Mutex> MQTT::Async<Network, Timer, Thread, Mutex>::Async(Network* network, Limits limits)  : limits(limits)
+{
+    this->thread = 0;
+    this->ipstack = network;
+    this->keepAliveInterval = 0;
+    this->ping_outstanding = false;
+    this->isconnected = false;
+    this->running = false;
+    this->reader = 0;
+    this->dispatcher = 0;
+
+    // packet ids are 16 bits, and each entry needs at least one of them
+    if (this->limits.MAX_CONCURRENT_OPERATIONS < 1)
+        this->limits.MAX_CONCURRENT_OPERATIONS = 1;
+    else if (this->limits.MAX_CONCURRENT_OPERATIONS > 65535)
+        this->limits.MAX_CONCURRENT_OPERATIONS = 65535;
+
+    // How to make these memory allocations portable?  I was hoping to avoid the heap
+    buf = new unsigned char[limits.MAX_MQTT_PACKET_SIZE];
+    readbuf = new unsigned char[limits.MAX_MQTT_PACKET_SIZE];
+    this->operations = new struct Operations[this->limits.MAX_CONCURRENT_OPERATIONS];
+    for (int i = 0; i < this->limits.MAX_CONCURRENT_OPERATIONS; ++i)
+    {
+        operations[i].id = 0;
+        operations[i].seq = 0;
+        operations[i].next = (i + 1 < this->limits.MAX_CONCURRENT_OPERATIONS) ? i + 1 : -1;
+    }
+    free_op = 0;
+    oldest_op = newest_op = -1;
+    this->messageHandlers = new struct MessageHandlers[limits.MAX_MESSAGE_HANDLERS];
+    for (int i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
+        messageHandlers[i].topicFilter = 0;
+    matched = new messageHandlerFP[limits.MAX_MESSAGE_HANDLERS];
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> MQTT::Async<Network, Timer, Thread, Mutex>::Async(Network* network, Limits limits)  : limits(limits), packetid()
+template<class Network, class Timer, class Thread, class Mutex> MQTT::Async<Network, Timer, Thread, Mutex>::~Async()
 {
-	this->thread = 0;
-	this->ipstack = network;
-	this->ping_timer = Timer();
-	this->ping_outstanding = 0;
-	   
-	// How to make these memory allocations portable?  I was hoping to avoid the heap
-	buf = new char[limits.MAX_MQTT_PACKET_SIZE];
-	readbuf = new char[limits.MAX_MQTT_PACKET_SIZE];
-	this->operations = new struct Operations[limits.MAX_CONCURRENT_OPERATIONS];
-	for (int i = 0; i < limits.MAX_CONCURRENT_OPERATIONS; ++i)
-		operations[i].id = 0;
-	this->messageHandlers = new struct MessageHandlers[limits.MAX_MESSAGE_HANDLERS];
-	for (int i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
-		messageHandlers[i].topic = 0;
+    if (thread)
+        disconnect(0);
+    delete[] buf;
+    delete[] readbuf;
+    delete[] operations;
+    delete[] messageHandlers;
+    delete[] matched;
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::sendPacket(int length, int timeout)
+// called with the lock held, as the send buffer is shared by all the threads
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::sendPacket(int length)
 {
-    int sent = 0;
-    
-    while (sent < length)
-        sent += ipstack->write(&buf[sent], length, timeout);
-	if (sent == length)
-	    ping_timer.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet    
-    return sent;
+    int rc = FAILURE,
+        sent = 0;
+    Timer timer;
+
+    timer.countdown_ms(limits.command_timeout_ms);
+    while (sent < length && !timer.expired())
+    {
+        rc = ipstack->write(&buf[sent], length - sent, timer.left_ms());
+        if (rc < 0)  // there was an error writing the data
+            break;
+        sent += rc;
+    }
+    if (sent == length)
+    {
+        if (this->keepAliveInterval > 0)
+            ping_timer.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet
+        rc = SUCCESS;
+    }
+    else
+        rc = FAILURE;
+    return rc;
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::decodePacket(int* value, int timeout)
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::decodePacket(int* value, Timer& timer)
 {
-    char c;
+    unsigned char c;
     int multiplier = 1;
     int len = 0;
-	const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
+    const int MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
 
     *value = 0;
     do
@@ -243,9 +380,12 @@ template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<
             rc = MQTTPACKET_READ_ERROR; /* bad data */
             goto exit;
         }
-        rc = ipstack->read(&c, 1, timeout);
+        rc = ipstack->read(&c, 1, timer.left_ms());
         if (rc != 1)
+        {
+            len = MQTTPACKET_READ_ERROR;
             goto exit;
+        }
         *value += (c & 127) * multiplier;
         multiplier *= 128;
     } while ((c & 128) != 0);
@@ -256,28 +396,51 @@ exit:
 
 /**
  * If any read fails in this method, then we should disconnect from the network, as on reconnect
- * the packets can be retried. 
- * @param timeout the max time to wait for the packet read to complete, in milliseconds
- * @return the MQTT packet type, or -1 if none
+ * the packets can be retried.  Packets larger than the receive buffer are read and discarded.
+ * @param timeout the max time to wait for the start of a packet, in milliseconds.  Once it has
+ * started, the rest of the packet has the command timeout to arrive
+ * @return the MQTT packet type, 0 if none, or FAILURE if the connection has to be closed
  */
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::readPacket(int timeout) 
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::readPacket(int timeout)
 {
-    int rc = -1;
+    int rc = FAILURE;
     MQTTHeader header = {0};
     int len = 0;
     int rem_len = 0;
+    Timer timer;
 
     /* 1. read the header byte.  This has the packet type in it */
-    if (ipstack->read(readbuf, 1, timeout) != 1)
+    rc = ipstack->read(readbuf, 1, timeout);
+    if (rc != 1)
+    {
+        rc = (rc == 0) ? 0 : FAILURE;
         goto exit;
+    }
 
+    timer.countdown_ms(limits.command_timeout_ms);
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
-    decodePacket(&rem_len, timeout);
+    rc = FAILURE;
+    if (decodePacket(&rem_len, timer) < 0)
+        goto exit;
     len += MQTTPacket_encode(readbuf + 1, rem_len); /* put the original remaining length back into the buffer */
 
+    if (len + rem_len > limits.MAX_MQTT_PACKET_SIZE)
+    {
+        // too big for us, skip it without losing the stream
+        while (rem_len > 0)
+        {
+            int chunk = (rem_len < limits.MAX_MQTT_PACKET_SIZE) ? rem_len : limits.MAX_MQTT_PACKET_SIZE;
+            if (ipstack->read(readbuf, chunk, timer.left_ms()) != chunk)
+                goto exit;
+            rem_len -= chunk;
+        }
+        rc = 0;
+        goto exit;
+    }
+
     /* 3. read the rest of the buffer using a callback to supply the rest of the data */
-    if (ipstack->read(readbuf + len, rem_len, timeout) != rem_len)
+    if (rem_len > 0 && ipstack->read(readbuf + len, rem_len, timer.left_ms()) != rem_len)
         goto exit;
 
     header.byte = readbuf[0];
@@ -287,25 +450,219 @@ exit:
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::deliverMessage(MQTTString* topic, Message* message)
+// assume topic filter and name is in correct format
+// # can only be at end
+// + and # can only be next to separator
+template<class Network, class Timer, class Thread, class Mutex> bool MQTT::Async<Network, Timer, Thread, Mutex>::isTopicMatched(const char* topicFilter, MQTTString& topicName)
 {
-	int rc = -1;
-
-	// we have to find the right message handler - indexed by topic
-	for (int i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
-	{
-		if (messageHandlers[i].topic != 0 && MQTTPacket_equals(topic, (char*)messageHandlers[i].topic))
-		{
-			messageHandlers[i].fp(message);
-			rc = 0;
-			break;
-		}
-	}
-	
-	return rc;
+    const char* curf = topicFilter;
+    const char* curn = topicName.lenstring.data;
+    const char* curn_end = curn + topicName.lenstring.len;
+
+    while (*curf && curn < curn_end)
+    {
+        if (*curn == '/' && *curf != '/')
+            break;
+        if (*curf != '+' && *curf != '#' && *curf != *curn)
+            break;
+        if (*curf == '+')
+        {   // skip until we meet the next separator, or end of string
+            const char* nextpos = curn + 1;
+            while (nextpos < curn_end && *nextpos != '/')
+                nextpos = ++curn + 1;
+        }
+        else if (*curf == '#')
+            curn = curn_end - 1;    // skip until end of string
+        curf++;
+        curn++;
+    };
+
+    return (curn == curn_end) && (*curf == '\0');
 }
 
 
+// every handler whose filter matches the topic gets the message, the default handler if none does
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::deliverMessage(MQTTString& topic, Message& message)
+{
+    int count = 0;
+
+    mutex.lock();
+    for (int i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
+    {
+        const char* filter = messageHandlers[i].topicFilter;
+        if (filter != 0 && (MQTTPacket_equals(&topic, (char*)filter) || isTopicMatched(filter, topic)))
+            matched[count++] = messageHandlers[i].fp;
+    }
+    if (count == 0 && defaultMessageHandler.attached())
+        matched[count++] = defaultMessageHandler;
+    MessageDispatcher* d = dispatcher;
+    mutex.unlock();
+
+    MessageData md(topic, message);
+    for (int i = 0; i < count; ++i)
+    {
+        if (d)
+            d->dispatch(matched[i], md);
+        else
+            matched[i](md);
+        matched[i].detach();    // releases the captures of a function object now
+    }
+
+    return (count > 0) ? SUCCESS : FAILURE;
+}
+
+
+// called with the lock held
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::setHandler(const char* topicFilter, const messageHandlerFP& messageHandler)
+{
+    int rc = FAILURE;
+    int i = -1;
+
+    // first check for an existing matching slot
+    for (i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+        {
+            if (!messageHandler.attached()) // remove existing
+            {
+                messageHandlers[i].topicFilter = 0;
+                messageHandlers[i].fp.detach();
+            }
+            rc = SUCCESS; // return i when adding new subscription
+            break;
+        }
+    }
+    // if no existing, look for empty slot (unless we are removing)
+    if (messageHandler.attached()) {
+        if (rc == FAILURE)
+        {
+            for (i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
+            {
+                if (messageHandlers[i].topicFilter == 0)
+                {
+                    rc = SUCCESS;
+                    break;
+                }
+            }
+        }
+        if (i < limits.MAX_MESSAGE_HANDLERS)
+        {
+            messageHandlers[i].topicFilter = topicFilter;
+            messageHandlers[i].fp = messageHandler;
+        }
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::setMessageHandler(const char* topicFilter, const messageHandlerFP& messageHandler)
+{
+    mutex.lock();
+    int rc = setHandler(topicFilter, messageHandler);
+    mutex.unlock();
+    return rc;
+}
+
+
+// takes an entry from the free list and appends it to the pending list.  Called with the lock held
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::allocOperation(resultHandler rh, int ack, const char* topic, void* context)
+{
+    int index = free_op;
+    if (index < 0)
+        return FAILURE;
+    struct Operations& op = operations[index];
+    free_op = op.next;
+
+    // the packet ids of entry i are i + 1, i + 1 + n, i + 1 + 2n... so that the ack gives back the entry with
+    // a modulo, and a late ack of an earlier use of the entry does not match
+    unsigned long n = limits.MAX_CONCURRENT_OPERATIONS;
+    if (index + 1 + (op.seq + 1) * n > 65535)
+        op.seq = 0;
+    else
+        ++op.seq;
+    op.id = (unsigned short)(index + 1 + op.seq * n);
+    op.ack = ack;
+    op.topic = topic;
+    op.context = context;
+    op.fp.detach();
+    if (rh != 0)
+        op.fp.attach(rh);
+    op.timer.countdown_ms(limits.command_timeout_ms);
+
+    op.prev = newest_op;
+    op.next = -1;
+    if (newest_op >= 0)
+        operations[newest_op].next = index;
+    else
+        oldest_op = index;
+    newest_op = index;
+    return index;
+}
+
+
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::findOperation(unsigned short id)
+{
+    if (id == 0)
+        return -1;
+    int index = (id - 1) % limits.MAX_CONCURRENT_OPERATIONS;
+    return (operations[index].id == id) ? index : -1;
+}
+
+
+// moves an entry from the pending list to the free list.  Called with the lock held
+template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::freeOperation(int index)
+{
+    struct Operations& op = operations[index];
+    if (op.prev >= 0)
+        operations[op.prev].next = op.next;
+    else
+        oldest_op = op.next;
+    if (op.next >= 0)
+        operations[op.next].prev = op.prev;
+    else
+        newest_op = op.prev;
+    op.id = 0;
+    op.next = free_op;
+    free_op = index;
+}
+
+
+// finishes a command and calls its result handler.  Called with the lock held, returns with it released
+template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::complete(int index, int rc, int grantedQoS)
+{
+    struct Operations& op = operations[index];
+    Result res = {this, rc, op.id, grantedQoS, op.context};
+    resultHandlerFP fp = op.fp;
+
+    if (op.ack == SUBACK && (rc != SUCCESS || grantedQoS == 0x80))
+        setHandler(op.topic, messageHandlerFP());    // the subscription was refused or has timed out
+    else if (op.ack == UNSUBACK && rc == SUCCESS)
+        setHandler(op.topic, messageHandlerFP());
+    freeOperation(index);
+    mutex.unlock();
+
+    fp(&res);
+}
+
+
+// fails the commands whose time is up, the oldest first
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::expire()
+{
+    int rc = SUCCESS;
+
+    while (true)
+    {
+        mutex.lock();
+        if (oldest_op < 0 || !operations[oldest_op].timer.expired())
+            break;
+        complete(oldest_op, FAILURE, 0);
+    }
+    if (connectHandler.attached() && connect_timer.expired())
+        rc = FAILURE;   // no connack
+    mutex.unlock();
+    return rc;
+}
+
 
 template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::cycle(int timeout)
 {
@@ -313,295 +670,406 @@ template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<
 
     // read the socket, see what work is due
     int packet_type = readPacket(timeout);
-    
-	int len, rc;
+
+    int len = 0,
+        rc = SUCCESS;
     switch (packet_type)
     {
+        case FAILURE:
+            rc = FAILURE;
+            break;
         case CONNACK:
-			if (this->thread)
-			{
-				Result res = {this, 0};
-            	if (MQTTDeserialize_connack(&res.rc, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-                	;
-				connectHandler(&res);
-				connectHandler.detach(); // only invoke the callback once
-			}
-			break;
+        {
+            unsigned char connack_rc = 255;
+            unsigned char sessionPresent = 0;
+            if (MQTTDeserialize_connack(&sessionPresent, &connack_rc, readbuf, limits.MAX_MQTT_PACKET_SIZE) != 1)
+                connack_rc = 255;
+            Result res = {this, connack_rc, 0, 0, 0};
+            mutex.lock();
+            resultHandlerFP fp = connectHandler;
+            connectHandler.detach(); // only invoke the callback once
+            isconnected = (connack_rc == 0);
+            mutex.unlock();
+            fp(&res);
+            if (connack_rc != 0)
+                rc = FAILURE;
+            break;
+        }
         case PUBACK:
-        	if (this->thread)
-        		; //call resultHandler
+        case PUBREC:
+        case PUBCOMP:
         case SUBACK:
+        case UNSUBACK:
+        {
+            unsigned short mypacketid = 0;
+            unsigned char dup, type;
+            int count = 0, grantedQoS = -1;
+            if (packet_type == SUBACK)
+            {
+                rc = (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1) ? SUCCESS : FAILURE;
+                grantedQoS &= 0xFF;     // read as a char, 0x80 would be negative where char is signed
+            }
+            else if (packet_type == UNSUBACK)
+                rc = (MQTTDeserialize_unsuback(&mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1) ? SUCCESS : FAILURE;
+            else
+                rc = (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1) ? SUCCESS : FAILURE;
+            if (rc != SUCCESS)
+                break;
+
+            mutex.lock();
+            int index = findOperation(mypacketid);
+            if (packet_type == PUBREC)
+            {
+                // the second half of a QoS2 publish, unknown ids are released too so that the server can forget them
+                if (index >= 0 && operations[index].ack == PUBREC)
+                    operations[index].ack = PUBCOMP;
+                len = MQTTSerialize_ack(buf, limits.MAX_MQTT_PACKET_SIZE, PUBREL, 0, mypacketid);
+                rc = (len <= 0) ? FAILURE : sendPacket(len); // send the PUBREL packet
+                mutex.unlock();
+            }
+            else if (index >= 0 && operations[index].ack == packet_type)
+                complete(index, SUCCESS, grantedQoS);
+            else
+                mutex.unlock();  // a late ack of a command which has timed out
             break;
+        }
         case PUBLISH:
-			MQTTString topicName;
-			Message msg;
-			rc = MQTTDeserialize_publish((int*)&msg.dup, (int*)&msg.qos, (int*)&msg.retained, (int*)&msg.id, &topicName,
-								 (char**)&msg.payload, (int*)&msg.payloadlen, readbuf, limits.MAX_MQTT_PACKET_SIZE);;
-			if (msg.qos == QOS0)
-				deliverMessage(&topicName, &msg);
-            break;
-        case PUBREC:
-   	        int type, dup, mypacketid;
-   	        if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-   	            ; 
-   	        // must lock this access against the application thread, if we are multi-threaded
-			len = MQTTSerialize_ack(buf, limits.MAX_MQTT_PACKET_SIZE, PUBREL, 0, mypacketid);
-		    rc = sendPacket(len, timeout); // send the PUBREL packet
-			if (rc != len) 
-				goto exit; // there was a problem
-
+        {
+            MQTTString topicName = MQTTString_initializer;
+            Message msg;
+            int intQoS;
+            msg.payloadlen = 0; /* this is a size_t, but deserialize publish sets this as int */
+            if (MQTTDeserialize_publish((unsigned char*)&msg.dup, &intQoS, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
+                                 (unsigned char**)&msg.payload, (int*)&msg.payloadlen, readbuf, limits.MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                break;
+            }
+            msg.qos = (enum QoS)intQoS;
+            deliverMessage(topicName, msg);
+            if (msg.qos != QOS0)
+            {
+                mutex.lock();
+                if (msg.qos == QOS1)
+                    len = MQTTSerialize_ack(buf, limits.MAX_MQTT_PACKET_SIZE, PUBACK, 0, msg.id);
+                else
+                    len = MQTTSerialize_ack(buf, limits.MAX_MQTT_PACKET_SIZE, PUBREC, 0, msg.id);
+                rc = (len <= 0) ? FAILURE : sendPacket(len);
+                mutex.unlock();
+            }
             break;
-        case PUBCOMP:
+        }
+        case PUBREL:
+        {
+            unsigned short mypacketid = 0;
+            unsigned char dup, type;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                break;
+            }
+            mutex.lock();
+            len = MQTTSerialize_ack(buf, limits.MAX_MQTT_PACKET_SIZE, PUBCOMP, 0, mypacketid);
+            rc = (len <= 0) ? FAILURE : sendPacket(len); // send the PUBCOMP packet
+            mutex.unlock();
             break;
+        }
         case PINGRESP:
-			ping_outstanding = false;
+            ping_outstanding = false;
             break;
     }
-	keepalive();
-exit:
-    return packet_type;
+    return rc;
 }
 
 
 template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::keepalive()
 {
-	int rc = 0;
-
-	if (keepAliveInterval == 0)
-		goto exit;
-
-	if (ping_timer.expired())
-	{
-		if (ping_outstanding)
-			rc = -1;
-		else
-		{
-			int len = MQTTSerialize_pingreq(buf, limits.MAX_MQTT_PACKET_SIZE);
-			rc = sendPacket(len, 1000); // send the ping packet
-			if (rc != len) 
-				rc = -1; // indicate there's a problem
-			else
-				ping_outstanding = true;
-		}
-	}
+    int rc = SUCCESS;
+
+    if (keepAliveInterval == 0)
+        goto exit;
+
+    mutex.lock();
+    if (ping_timer.expired())
+    {
+        if (ping_outstanding)
+            rc = FAILURE; // no pingresp within a whole keepalive interval
+        else
+        {
+            int len = MQTTSerialize_pingreq(buf, limits.MAX_MQTT_PACKET_SIZE);
+            if (len > 0 && (rc = sendPacket(len)) == SUCCESS) // send the ping packet
+                ping_outstanding = true;
+        }
+    }
+    mutex.unlock();
 
 exit:
-	return rc;
+    return rc;
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::run(void const *argument)
+template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::connectionLost()
 {
-	while (true)
-		cycle(ping_timer.left_ms());
+    mutex.lock();
+    isconnected = false;
+    resultHandlerFP fp = connectHandler;
+    connectHandler.detach();
+    while (oldest_op >= 0)
+    {
+        complete(oldest_op, FAILURE, 0);
+        mutex.lock();
+    }
+    bool stopped = !running;
+    running = false;
+    mutex.unlock();
+
+    if (fp.attached())
+    {
+        Result res = {this, FAILURE, 0, 0, 0};
+        fp(&res);
+    }
+    if (!stopped)
+    {
+        connectionLostInfo info = {this, ipstack};
+        connectionLostHandler(&info);
+    }
 }
 
 
-// only used in single-threaded mode where one command at a time is in process
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::waitfor(int packet_type, Timer& atimer)
+// the background thread, until disconnect() or the connection is lost
+template<class Network, class Timer, class Thread, class Mutex> void MQTT::Async<Network, Timer, Thread, Mutex>::run()
 {
-	int rc = -1;
-	
-	do
-    {
-		if (atimer.expired()) 
-			break; // we timed out
-	}
-	while ((rc = cycle(atimer.left_ms())) != packet_type);	
-	
-	return rc;
+    mutex.lock();
+    reader = (void*)Thread::gettid();
+    mutex.unlock();
+    while (true)
+    {
+        // wait for the next packet up to the next deadline, but check now and then if we have to stop
+        mutex.lock();
+        int timeout = 1000;
+        if (keepAliveInterval > 0 && ping_timer.left_ms() < timeout)
+            timeout = ping_timer.left_ms();
+        if (oldest_op >= 0 && operations[oldest_op].timer.left_ms() < timeout)
+            timeout = operations[oldest_op].timer.left_ms();
+        if (connectHandler.attached() && connect_timer.left_ms() < timeout)
+            timeout = connect_timer.left_ms();
+        bool stop = !running;
+        mutex.unlock();
+        if (stop)
+            break;
+
+        if (cycle((timeout > 0) ? timeout : 0) != SUCCESS || keepalive() != SUCCESS || expire() != SUCCESS)
+        {
+            connectionLost();
+            break;
+        }
+    }
+    // the id of a finished thread can be given to a new one
+    mutex.lock();
+    reader = 0;
+    mutex.unlock();
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::connect(resultHandler resultHandler, MQTTPacket_connectData* options)
+// sends the connect packet and starts the background thread.  Without a result handler, waits for the connack first
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::start(resultHandlerFP& fp, MQTTPacket_connectData* options)
 {
-	connect_timer.countdown(limits.command_timeout_ms);
-
+    int rc = FAILURE;
     MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
     if (options == 0)
         options = &default_options; // set default options if none were supplied
-    
+
+    if (thread != 0)
+    {
+        if (running)
+            goto exit; // already connected, or connecting
+        // the connection was lost, the thread has already finished
+        thread->join();
+        delete thread;
+        thread = 0;
+    }
+
+    connect_timer.countdown_ms(limits.command_timeout_ms);
     this->keepAliveInterval = options->keepAliveInterval;
-	ping_timer.countdown(this->keepAliveInterval);
-    int len = MQTTSerialize_connect(buf, limits.MAX_MQTT_PACKET_SIZE, options);
-    int rc = sendPacket(len, connect_timer.left_ms()); // send the connect packet
-	if (rc != len) 
-		goto exit; // there was a problem
-    
-    if (resultHandler == 0)     // wait until the connack is received 
-    {
-        // this will be a blocking call, wait for the connack
-		if (waitfor(CONNACK, connect_timer) == CONNACK)
-		{
-        	int connack_rc = -1;
-        	if (MQTTDeserialize_connack(&connack_rc, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-	        	rc = connack_rc;
-	    }
+    ping_outstanding = false;
+    {
+        int len = MQTTSerialize_connect(buf, limits.MAX_MQTT_PACKET_SIZE, options);
+        if (len <= 0 || (rc = sendPacket(len)) != SUCCESS) // send the connect packet
+            goto exit; // there was a problem
     }
-    else
+
+    if (!fp.attached())     // wait until the connack is received
     {
-        // set connect response callback function
-        connectHandler.attach(resultHandler);
-        
-        // start background thread            
-        this->thread = new Thread((void (*)(void const *argument))&MQTT::Async<Network, Timer, Thread, Mutex>::threadfn, (void*)this);
+        // this will be a blocking call, the background thread does not run yet
+        int packet_type = 0;
+        rc = FAILURE;
+        while (!connect_timer.expired() && (packet_type = readPacket(connect_timer.left_ms())) == 0)
+            ;
+        if (packet_type == CONNACK)
+        {
+            unsigned char connack_rc = 255;
+            unsigned char sessionPresent = 0;
+            if (MQTTDeserialize_connack(&sessionPresent, &connack_rc, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
+                rc = connack_rc;
+        }
+        if (rc != SUCCESS)
+            goto exit;
+        isconnected = true;
     }
-    
+    else
+        connectHandler = fp;   // set connect response callback function
+
+    // start background thread
+    running = true;
+    this->thread = new Thread(&MQTT::Async<Network, Timer, Thread, Mutex>::threadfn, (void*)this);
+
 exit:
     return rc;
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::findFreeOperation()
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::connect(resultHandler resultHandler, MQTTPacket_connectData* options)
 {
-	int found = -1;
-	for (int i = 0; i < limits.MAX_CONCURRENT_OPERATIONS; ++i)
-	{
-		if (operations[i].id == 0)
-		{
-			found = i;
-			break;
-		}
-	}
-	return found;
+    resultHandlerFP fp;
+    if (resultHandler != 0)
+        fp.attach(resultHandler);
+    return start(fp, options);
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::subscribe(resultHandler resultHandler, const char* topicFilter, enum QoS qos, messageHandler messageHandler)
+template<class Network, class Timer, class Thread, class Mutex> template<class T> int MQTT::Async<Network, Timer, Thread, Mutex>::connect(void(T::*method)(Result *), MQTTPacket_connectData* options, T *item)
 {
-	int index = 0;
-	if (this->thread)
-		index = findFreeOperation();	
-	Timer& atimer = operations[index].timer;
-	
-	atimer.countdown(limits.command_timeout_ms);
-    MQTTString topic = {(char*)topicFilter, 0, 0};
-    
-    int len = MQTTSerialize_subscribe(buf, limits.MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic, (int*)&qos);
-    int rc = sendPacket(len, atimer.left_ms()); // send the subscribe packet
-	if (rc != len) 
-		goto exit; // there was a problem
-    
-    /* wait for suback */
-    if (resultHandler == 0)
-    {
-        // this will block
-        if (waitfor(SUBACK, atimer) == SUBACK)
-        {
-            int count = 0, grantedQoS = -1, mypacketid;
-            if (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-                rc = grantedQoS; // 0, 1, 2 or 0x80 
-            if (rc != 0x80)
-            {
-            	for (int i = 0; i < limits.MAX_MESSAGE_HANDLERS; ++i)
-				{
-					if (messageHandlers[i].topic == 0)
-					{
-						messageHandlers[i].topic = topicFilter;
-						messageHandlers[i].fp.attach(messageHandler);
-						rc = 0;
-						break;
-					}
-				}
-            }
-        }
-    }
-    else
+    resultHandlerFP fp;
+    if (item != 0)
+        fp.attach(item, method);
+    return start(fp, options);
+}
+
+
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::subscribe(resultHandler resultHandler, const char* topicFilter, enum QoS qos, const messageHandlerFP& messageHandler, void* context)
+{
+    int rc = FAILURE;
+    int index = -1;
+    int len = 0;
+    MQTTString topic = {(char*)topicFilter, {0, 0}};
+
+    mutex.lock();
+    if (!isconnected)
+        goto exit;
+    if ((index = allocOperation(resultHandler, SUBACK, topicFilter, context)) < 0)
+        goto exit;
+    // set now, as messages may arrive before the suback
+    if (setHandler(topicFilter, messageHandler) != SUCCESS)
+        goto exit;
+
+    len = MQTTSerialize_subscribe(buf, limits.MAX_MQTT_PACKET_SIZE, 0, operations[index].id, 1, &topic, (int*)&qos);
+    if (len <= 0)
+        goto exit;
+    rc = sendPacket(len); // send the subscribe packet
+
+exit:
+    if (rc != SUCCESS && index >= 0)
     {
-        // set subscribe response callback function
-        
+        setHandler(topicFilter, messageHandlerFP());
+        freeOperation(index);
     }
-    
-exit:
+    mutex.unlock();
     return rc;
 }
 
 
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::unsubscribe(resultHandler resultHandler, const char* topicFilter)
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::unsubscribe(resultHandler resultHandler, const char* topicFilter, void* context)
 {
-	int index = 0;
-	if (this->thread)
-		index = findFreeOperation();	
-	Timer& atimer = operations[index].timer;
-
-	atimer.countdown(limits.command_timeout_ms);
-    MQTTString topic = {(char*)topicFilter, 0, 0};
-    
-    int len = MQTTSerialize_unsubscribe(buf, limits.MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic);
-    int rc = sendPacket(len, atimer.left_ms()); // send the subscribe packet
-	if (rc != len) 
-		goto exit; // there was a problem
-    
-    // set unsubscribe response callback function
-        
-    
+    int rc = FAILURE;
+    int index = -1;
+    int len = 0;
+    MQTTString topic = {(char*)topicFilter, {0, 0}};
+
+    mutex.lock();
+    if (!isconnected)
+        goto exit;
+    if ((index = allocOperation(resultHandler, UNSUBACK, topicFilter, context)) < 0)
+        goto exit;
+
+    len = MQTTSerialize_unsubscribe(buf, limits.MAX_MQTT_PACKET_SIZE, 0, operations[index].id, 1, &topic);
+    if (len <= 0)
+        goto exit;
+    rc = sendPacket(len); // send the unsubscribe packet
+
 exit:
+    if (rc != SUCCESS && index >= 0)
+        freeOperation(index);
+    mutex.unlock();
     return rc;
 }
 
 
-   
-template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::publish(resultHandler resultHandler, const char* topicName, Message* message)
+template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::publish(resultHandler resultHandler, const char* topicName, Message* message, void* context)
 {
-	int index = 0;
-	if (this->thread)
-		index = findFreeOperation();	
-	Timer& atimer = operations[index].timer;
-
-	atimer.countdown(limits.command_timeout_ms);
-    MQTTString topic = {(char*)topicName, 0, 0};
-
-	if (message->qos == QOS1 || message->qos == QOS2)
-		message->id = packetid.getNext();
-    
-	int len = MQTTSerialize_publish(buf, limits.MAX_MQTT_PACKET_SIZE, 0, message->qos, message->retained, message->id, topic, (char*)message->payload, message->payloadlen);
-    int rc = sendPacket(len, atimer.left_ms()); // send the subscribe packet
-	if (rc != len) 
-		goto exit; // there was a problem
-    
-    /* wait for acks */
-    if (resultHandler == 0)
-    {
- 		if (message->qos == QOS1)
-		{
-	        if (waitfor(PUBACK, atimer) == PUBACK)
-    	    {
-    	        int type, dup, mypacketid;
-    	        if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-    	            rc = 0; 
-    	    }
-		}
-		else if (message->qos == QOS2)
-		{
-	        if (waitfor(PUBCOMP, atimer) == PUBCOMP)
-	   	    {
-	   	    	int type, dup, mypacketid;
-            	if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, limits.MAX_MQTT_PACKET_SIZE) == 1)
-    	           	rc = 0; 
-			}
-
-		}
-    }
-    else
+    int rc = FAILURE;
+    int index = -1;
+    int len = 0;
+    MQTTString topic = {(char*)topicName, {0, 0}};
+
+    mutex.lock();
+    if (!isconnected)
+        goto exit;
+    if (message->qos == QOS1 || message->qos == QOS2)
     {
-        // set publish response callback function
-        
+        if ((index = allocOperation(resultHandler, (message->qos == QOS1) ? PUBACK : PUBREC, 0, context)) < 0)
+            goto exit;
+        message->id = operations[index].id;
     }
-    
+
+    len = MQTTSerialize_publish(buf, limits.MAX_MQTT_PACKET_SIZE, 0, message->qos, message->retained, message->id,
+              topic, (unsigned char*)message->payload, message->payloadlen);
+    if (len <= 0)
+        goto exit;
+    rc = sendPacket(len); // send the publish packet
+
 exit:
+    if (rc != SUCCESS && index >= 0)
+        freeOperation(index);
+    mutex.unlock();
+
+    if (rc == SUCCESS && index < 0 && resultHandler != 0)
+    {
+        // QoS0 is complete once sent
+        Result res = {this, SUCCESS, 0, 0, context};
+        resultHandler(&res);
+    }
     return rc;
 }
 
 
 template<class Network, class Timer, class Thread, class Mutex> int MQTT::Async<Network, Timer, Thread, Mutex>::disconnect(resultHandler resultHandler)
-{  
-    Timer timer = Timer(limits.command_timeout_ms);     // we might wait for incomplete incoming publishes to complete
+{
+    int rc = FAILURE;
+
+    mutex.lock();
     int len = MQTTSerialize_disconnect(buf, limits.MAX_MQTT_PACKET_SIZE);
-    int rc = sendPacket(len, timer.left_ms());   // send the disconnect packet
-    
-    return (rc == len) ? 0 : -1;
-}
+    if (isconnected && len > 0)
+        rc = sendPacket(len);   // send the disconnect packet
+    isconnected = false;
+    running = false;
+    mutex.unlock();
+
+    // the server closes the connection, so the background thread stops at once
+    if (thread != 0)
+    {
+        thread->join();
+        delete thread;
+        thread = 0;
+    }
+    connectionLost();
 
+    if (resultHandler != 0)
+    {
+        Result res = {this, rc, 0, 0, 0};
+        resultHandler(&res);
+    }
+    return rc;
+}
 
 
-#endif
\ No newline at end of file
+#endif
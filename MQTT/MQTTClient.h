@@ -24,7 +24,9 @@
 #if !defined(MQTTCLIENT_H)
 #define MQTTCLIENT_H
 
-#include "FP.h"
+#include "MQTTDelegate.h"
+#include "MQTTPacketPool.h"
+#include "MQTTMetrics.h"
 #include "MQTTPacket.h"
 #include <stdio.h>
 #include "MQTTLogging.h"
@@ -35,6 +37,22 @@
 #if !defined(MQTTCLIENT_QOS2)
     #define MQTTCLIENT_QOS2 0
 #endif
+#if !defined(MAX_INCOMING_QOS2_MESSAGES)
+    #define MAX_INCOMING_QOS2_MESSAGES 10
+#endif
+#if !defined(MQTTCLIENT_DRAIN_BUDGET)
+    #define MQTTCLIENT_DRAIN_BUDGET 16  // default number of packets processed by one call to drain
+#endif
+#if !defined(MQTTCLIENT_SUBSCRIBE_WINDOW)
+    #define MQTTCLIENT_SUBSCRIBE_WINDOW 16  // packets sent by subscribeMany/unsubscribeMany before waiting for an ack
+#endif
+#if !defined(MQTTCLIENT_TRACE)
+    #if defined(MQTT_DEBUG)
+        #define MQTTCLIENT_TRACE 1
+    #else
+        #define MQTTCLIENT_TRACE 0
+    #endif
+#endif
 
 namespace MQTT
 {
@@ -67,6 +85,32 @@ struct MessageData
 };
 
 
+struct StreamData
+{
+    StreamData(MQTTString &aTopicName, struct Message &aMessage, size_t aOffset, size_t aTotal)  : message(aMessage), topicName(aTopicName),
+        offset(aOffset), total(aTotal)
+    { }
+
+    struct Message &message;    // payload and payloadlen hold this fragment
+    MQTTString &topicName;
+    size_t offset;              // position of the fragment in the whole payload
+    size_t total;               // length of the whole payload
+};
+
+
+/* Takes the incoming messages in place of the client, to run their handlers somewhere else (see WorkerPool
+   in MQTTDispatcher.h).  The message data is only valid during the call, so it has to be copied
+*/
+class MessageDispatcher
+{
+public:
+    virtual ~MessageDispatcher()
+    { }
+
+    virtual void dispatch(Delegate<void, MessageData&>& handler, MessageData& md) = 0;
+};
+
+
 struct connackData
 {
     int rc;
@@ -99,6 +143,262 @@ private:
 };
 
 
+/* Where a Client keeps its packets.  In all cases the publication kept for the session is not copied: the
+   client keeps the buffer it was serialized into, and sends the next packets from another one
+*/
+enum BufferPolicy
+{
+    OWN_BUFFERS,        // a send and a receive buffer in the client, and one for the session with PERSISTENCE
+    SHARED_BUFFER,      // packets are read into the send buffer.  The message data passed to a handler is then
+                        // overwritten when the handler sends a packet
+    POOLED_BUFFERS      // taken from the PacketPool set with setPacketPool, see MQTTPacketPool.h
+};
+
+
+template<int N, int P = 1, bool DONE = (P >= N)>
+struct PowerOf2AtLeast
+{
+    enum { value = PowerOf2AtLeast<N, P * 2>::value };
+};
+
+
+template<int N, int P>
+struct PowerOf2AtLeast<N, P, true>
+{
+    enum { value = P };
+};
+
+
+template<bool CONDITION, class A, class B>
+struct PolicySelect
+{
+    typedef A type;
+};
+
+
+template<class A, class B>
+struct PolicySelect<false, A, B>
+{
+    typedef B type;
+};
+
+
+/* Packet ids of the incoming QoS2 messages which wait for their PUBREL, up to N at the same time.  An open
+   addressing table of at least twice N slots, with robin hood insertion: the ids of a broker are mostly
+   consecutive, so the id itself is the hash, most ids sit in their own slot, and finding, adding or
+   removing one takes a probe or two whatever N is
+*/
+template<int N>
+class QoS2IdSet
+{
+public:
+    QoS2IdSet()
+    {
+        clear();
+    }
+
+    bool contains(unsigned short id) const
+    {
+        return find(id) >= 0;
+    }
+
+    /** @return false if N ids are already waiting */
+    bool insert(unsigned short id)
+    {
+        if (id == 0 || find(id) >= 0)
+            return true;    // 0 is not a valid packet id, never tracked
+        if (count == N)
+            return false;
+        // an id further from its slot takes the place of one which is nearer to its own
+        unsigned int i = id & MASK;
+        for (unsigned int d = 0; ids[i] != 0; i = (i + 1) & MASK, ++d)
+        {
+            unsigned int di = distance(i);
+            if (di < d)
+            {
+                unsigned short displaced = ids[i];
+                ids[i] = id;
+                id = displaced;
+                d = di;
+            }
+        }
+        ids[i] = id;
+        ++count;
+        return true;
+    }
+
+    void erase(unsigned short id)
+    {
+        int found = find(id);
+
+        if (found < 0)
+            return;
+        // move back the following ids which are not in their own slot
+        unsigned int i = found;
+        for (unsigned int j = (i + 1) & MASK; ids[j] != 0 && distance(j) > 0; j = (j + 1) & MASK)
+        {
+            ids[i] = ids[j];
+            i = j;
+        }
+        ids[i] = 0;
+        --count;
+    }
+
+    void clear()
+    {
+        memset(ids, 0, sizeof(ids));
+        count = 0;
+    }
+
+private:
+    enum { SIZE = PowerOf2AtLeast<2 * N>::value, MASK = SIZE - 1 };
+
+    // slots from its own to the one of the id at i
+    unsigned int distance(unsigned int i) const
+    {
+        return (i - (ids[i] & MASK)) & MASK;
+    }
+
+    int find(unsigned short id) const
+    {
+        unsigned int i = id & MASK;
+        for (unsigned int d = 0; ids[i] != 0 && distance(i) >= d; i = (i + 1) & MASK, ++d)
+        {
+            if (ids[i] == id)
+                return i;
+        }
+        return -1;
+    }
+
+    unsigned short ids[SIZE];
+    int count;
+};
+
+
+template<>
+class QoS2IdSet<0>
+{
+public:
+    bool contains(unsigned short id) const
+    {
+        return false;
+    }
+
+    bool insert(unsigned short id)
+    {
+        return false;
+    }
+
+    void erase(unsigned short id)
+    {
+
+    }
+
+    void clear()
+    {
+
+    }
+};
+
+
+/* All the packet ids, one bit each in 8 KB: any number of incoming QoS2 messages can wait for their PUBREL */
+class QoS2IdBitmap
+{
+public:
+    QoS2IdBitmap()
+    {
+        clear();
+    }
+
+    bool contains(unsigned short id) const
+    {
+        return (bits[id >> 3] & (1 << (id & 7))) != 0;
+    }
+
+    bool insert(unsigned short id)
+    {
+        bits[id >> 3] |= (unsigned char)(1 << (id & 7));
+        return true;
+    }
+
+    void erase(unsigned short id)
+    {
+        bits[id >> 3] &= (unsigned char)~(1 << (id & 7));
+    }
+
+    void clear()
+    {
+        memset(bits, 0, sizeof(bits));
+    }
+
+private:
+    unsigned char bits[65536 / 8];
+};
+
+
+/**
+ * Features of a Client chosen at compile time.  The code and the buffers of a feature which is off are not
+ * compiled in that Client, so clients with different policies can be used in the same program, e.g.
+ *
+ *   MQTT::Client<Network, Timer, 100, 2, MQTT::ClientPolicy<0, false, MQTT::SHARED_BUFFER> > sensor(network);  // QoS0 only
+ *   MQTT::Client<Network, Timer, 512, 5, MQTT::ClientPolicy<2> > gateway(network2);
+ *
+ * The defaults follow MQTTCLIENT_QOS1, MQTTCLIENT_QOS2, MAX_INCOMING_QOS2_MESSAGES and MQTT_DEBUG.
+ * @param MAX_QOS highest QoS of the client, 0, 1 or 2.  Publications and subscriptions above it are sent
+ *      at MAX_QOS
+ * @param PERSISTENCE keep the last QoS1/2 publication of a session which is not clean, to send it again on
+ *      reconnect.  It costs a buffer of MAX_MQTT_PACKET_SIZE
+ * @param BUFFERS where the packets are kept, see BufferPolicy
+ * @param TRACE print each packet sent and received
+ * @param INCOMING_QOS2 the ids of the incoming QoS2 messages waiting for their PUBREL: QoS2IdSet<N> holds up
+ *      to N of them, QoS2IdBitmap any number in 8 KB
+ * @param METRICS the counters and latency histograms of the client, ClientMetrics<Clock>, or NoMetrics.
+ *      See MQTTMetrics.h
+ */
+template<int MAX_QOS = (MQTTCLIENT_QOS2 ? 2 : (MQTTCLIENT_QOS1 ? 1 : 0)), bool PERSISTENCE = true,
+    BufferPolicy BUFFERS = OWN_BUFFERS, bool TRACE = (MQTTCLIENT_TRACE != 0),
+    class INCOMING_QOS2 = QoS2IdSet<MAX_INCOMING_QOS2_MESSAGES>, class METRICS = NoMetrics>
+struct ClientPolicy
+{
+    enum
+    {
+        maxQoS = MAX_QOS,
+        persistence = (PERSISTENCE && MAX_QOS > 0),
+        sharedBuffer = (BUFFERS == SHARED_BUFFER),
+        pooledBuffers = (BUFFERS == POOLED_BUFFERS),
+        trace = TRACE
+    };
+
+    typedef typename PolicySelect<(MAX_QOS > 1), INCOMING_QOS2, QoS2IdSet<0> >::type incomingQoS2;
+    typedef METRICS metrics;
+};
+
+
+/* A member array which a policy can leave out.  With N == 0 it has no storage, and the code which uses it
+   is compiled out by the same policy
+*/
+template<class T, int N>
+struct PolicyArray
+{
+    operator T*()
+    {
+        return items;
+    }
+
+    T items[N];
+};
+
+
+template<class T>
+struct PolicyArray<T, 0>
+{
+    operator T*()
+    {
+        return 0;
+    }
+};
+
+
 /**
  * @class Client
  * @brief blocking, non-threaded MQTT client API
@@ -107,14 +407,19 @@ private:
  * MQTT request can be in process at any one time.
  * @param Network a network class which supports send, receive
  * @param Timer a timer class with the methods:
+ * @param Policy the features compiled in, see ClientPolicy
  */
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5>
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5, class Policy = ClientPolicy<> >
 class Client
 {
 
 public:
 
     typedef void (*messageHandler)(MessageData&);
+    typedef void (*streamHandler)(StreamData&);
+    typedef Delegate<void, MessageData&> messageHandlerFP;
+    typedef void (*connectHandler)(connackData&);
+    typedef Delegate<void, connackData&> connectHandlerFP;
 
     /** Construct the client
      *  @param network - pointer to an instance of the Network class - must be connected to the endpoint
@@ -123,22 +428,66 @@ public:
      */
     Client(Network& network, unsigned int command_timeout_ms = 30000);
 
+    ~Client();
+
+    /** Set the pool of a client with POOLED_BUFFERS, before it connects.  The pool must outlive the client
+     *  @param pool - its buffers must hold MAX_MQTT_PACKET_SIZE bytes
+     *  @return success code -
+     */
+    int setPacketPool(PacketPool* pool);
+
     /** Set the default message handling callback - used for any message which does not match a subscription message handler
      *  @param mh - pointer to the callback function.  Set to 0 to remove.
      */
     void setDefaultMessageHandler(messageHandler mh)
     {
-        if (mh != 0)
-            defaultMessageHandler.attach(mh);
+        defaultMessageHandler.attach(mh);
+    }
+
+    /** Set the default message handling callback to a member function or a function object
+     *  @param mh - the callback.  Detached to remove.
+     */
+    void setDefaultMessageHandler(const messageHandlerFP& mh)
+    {
+        defaultMessageHandler = mh;
+    }
+
+    /** Hand the messages to a dispatcher which calls their handlers, instead of calling them from yield.  The
+     *  stream handler is always called directly
+     *  @param md - the dispatcher.  Set to 0 to remove.
+     */
+    void setDispatcher(MessageDispatcher* md)
+    {
+        dispatcher = md;
+    }
+
+    /** Set the callback for incoming publications which do not fit in the packet buffer.  It is called first
+     *  with the topic name and an empty fragment (offset 0), then with each fragment of the payload in order,
+     *  the last one ends at offset + payloadlen == total.  Without it, such publications are discarded.
+     *  @param sh - pointer to the callback function.  Set to 0 to remove.
+     */
+    void setStreamHandler(streamHandler sh)
+    {
+        if (sh != 0)
+            streamMessageHandler.attach(sh);
         else
-            defaultMessageHandler.detach();
+            streamMessageHandler.detach();
     }
 
     /** Set a message handling callback.  This can be used outside of the the subscribe method.
      *  @param topicFilter - a topic pattern which can include wildcards
      *  @param mh - pointer to the callback function. If 0, removes the callback if any
      */
-    int setMessageHandler(const char* topicFilter, messageHandler mh);
+    int setMessageHandler(const char* topicFilter, messageHandler mh)
+    {
+        return setMessageHandler(topicFilter, messageHandlerFP(mh));
+    }
+
+    /** Set a message handling callback which is a member function or a function object, e.g.
+     *  setMessageHandler("a/b", Client::messageHandlerFP(this, &Bridge::onMessage))
+     *  @param mh - the callback.  If detached, removes the callback if any
+     */
+    int setMessageHandler(const char* topicFilter, const messageHandlerFP& mh);
 
     /** MQTT Connect - send an MQTT connect packet down the network and wait for a Connack
      *  The nework object must be connected to the network endpoint before calling this
@@ -162,6 +511,21 @@ public:
      */
     int connect(MQTTPacket_connectData& options, connackData& data);
 
+    /** MQTT Connect without waiting - send an MQTT connect packet and return.  The Connack is processed by
+     *  yield, poll or drain, which call ch with its data.  data.rc is 0 when connected, the return code of
+     *  the broker if it refused the connection, or FAILURE if the network failed or no Connack arrived
+     *  within the command timeout.  Meanwhile isConnecting() is true and the other MQTT operations fail
+     *  @param options - connect options, serialized before returning
+     *  @param ch - the callback, which can call the other MQTT operations
+     *  @return success code - of sending the connect packet, ch is only called on success
+     */
+    int connectAsync(MQTTPacket_connectData& options, connectHandler ch)
+    {
+        return connectAsync(options, connectHandlerFP(ch));
+    }
+
+    int connectAsync(MQTTPacket_connectData& options, const connectHandlerFP& ch);
+
     /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
      *  @param topic - the topic to publish to
      *  @param message - the message to send
@@ -196,7 +560,12 @@ public:
      *  @param mh - the callback function to be invoked when a message is received for this subscription
      *  @return success code -
      */
-    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh);
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh)
+    {
+        return subscribe(topicFilter, qos, messageHandlerFP(mh));
+    }
+
+    int subscribe(const char* topicFilter, enum QoS qos, const messageHandlerFP& mh);
 
     /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
      *  @param topicFilter - a topic pattern which can include wildcards
@@ -205,7 +574,12 @@ public:
      *  @param
      *  @return success code -
      */
-    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh, subackData &data);
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh, subackData &data)
+    {
+        return subscribe(topicFilter, qos, messageHandlerFP(mh), data);
+    }
+
+    int subscribe(const char* topicFilter, enum QoS qos, const messageHandlerFP& mh, subackData &data);
 
     /** MQTT Unsubscribe - send an MQTT unsubscribe packet and wait for the unsuback
      *  @param topicFilter - a topic pattern which can include wildcards
@@ -213,6 +587,35 @@ public:
      */
     int unsubscribe(const char* topicFilter);
 
+    /** Subscribe to many topic filters at once: they are packed into as few SUBSCRIBE packets as fit in
+     *  MAX_MQTT_PACKET_SIZE, and up to MQTTCLIENT_SUBSCRIBE_WINDOW packets are sent before waiting for
+     *  their SUBACKs, so that restoring a large set of subscriptions takes one or two round trips.
+     *  @param count - the number of topic filters
+     *  @param topicFilters - the topic filters, which must stay valid while subscribed, as for subscribe
+     *  @param qos - the MQTT QoS to subscribe at, for all of them
+     *  @param mh - the callback function for all of them.  When it is not attached, no message handler
+     *      is set and the messages go to the default message handler
+     *  @param grantedQoS - count results: the QoS granted to each topic filter, 0x80 if it was refused or
+     *      not acknowledged
+     *  @return success code - BUFFER_OVERFLOW if a topic filter does not fit in a packet, in which case
+     *      nothing is sent, or if there are more of them than free message handlers; on FAILURE the
+     *      client has disconnected
+     */
+    int subscribeMany(int count, const char* const topicFilters[], enum QoS qos, messageHandler mh, int grantedQoS[])
+    {
+        return subscribeMany(count, topicFilters, qos, messageHandlerFP(mh), grantedQoS);
+    }
+
+    int subscribeMany(int count, const char* const topicFilters[], enum QoS qos, const messageHandlerFP& mh, int grantedQoS[]);
+
+    /** Unsubscribe from many topic filters at once, packed and pipelined as by subscribeMany
+     *  @param count - the number of topic filters
+     *  @param topicFilters - the topic filters
+     *  @return success code - BUFFER_OVERFLOW if a topic filter does not fit in a packet, in which case
+     *      nothing is sent; on FAILURE the client has disconnected
+     */
+    int unsubscribeMany(int count, const char* const topicFilters[]);
+
     /** MQTT Disconnect - send an MQTT disconnect packet, and clean up any state
      *  @return success code -
      */
@@ -226,6 +629,31 @@ public:
      */
     int yield(unsigned long timeout_ms = 1000L);
 
+    /** Read and process one packet, for use from an external event loop which drives several clients
+     *  and calls this only when the network is readable, instead of yield.
+     *  @return the MQTT packet type processed, 0 if none, or a failure code - on failure, this means
+     *      the client has disconnected
+     */
+    int poll();
+
+    /** Process a batch of packets: wait up to timeout_ms for the first one, then process those which have
+     *  already arrived, until the network would block or budget packets have been processed.  The keepalive
+     *  is checked once for the whole batch.  Unlike yield, it returns as soon as there is nothing left to
+     *  read, so under bursts the per-packet overhead is lower and an idle client does not hold the caller
+     *  for the rest of the timeout.
+     *  @param timeout_ms the time to wait for the first packet, in milliseconds.  0 does not wait
+     *  @param budget the maximum number of packets to process
+     *  @return the number of packets processed, 0 if none, or a failure code - on failure, this means the
+     *      client has disconnected
+     */
+    int drain(unsigned long timeout_ms = 0, int budget = MQTTCLIENT_DRAIN_BUDGET);
+
+    /** Send a PINGREQ if the keepalive interval has elapsed, and check that the PINGRESP arrives in time.
+     *  Called by yield, poll and drain, an external event loop calls it periodically for idle clients.
+     *  @return success code - on failure, this means the client has disconnected
+     */
+    int keepalive();
+
     /** Is the client connected?
      *  @return flag - is the client connected or not?
      */
@@ -234,28 +662,61 @@ public:
         return isconnected;
     }
 
+    /** Is a connectAsync waiting for its Connack?
+     *  @return flag - is the client connecting or not?
+     */
+    bool isConnecting()
+    {
+        return connecting;
+    }
+
+    /** The metrics of the client, whose snapshot can be taken from any thread while the client runs
+     *  @return the metrics of the policy
+     */
+    const typename Policy::metrics& getMetrics() const
+    {
+        return clientMetrics;
+    }
+
 private:
 
     void closeSession();
     void cleanSession();
     int cycle(Timer& timer);
+    int process(Timer& timer, int wait_ms);
     int waitfor(int packet_type, Timer& timer);
-    int keepalive();
-    int publish(int len, Timer& timer, enum QoS qos);
+    int sendConnect(MQTTPacket_connectData& options, Timer& timer);
+    int connack(connackData& data, Timer& timer, bool wait);
+    void connectFailed();
+    int publish(unsigned char* buf, int len, Timer& timer, enum QoS qos);
+    int sendFilters(int packet_type, int count, const char* const topicFilters[], enum QoS qos,
+        const messageHandlerFP* mh, int grantedQoS[]);
+    int serializeFilters(int packet_type, unsigned short id, int count, const char* const topicFilters[],
+        enum QoS qos, int& packed);
+    bool attachBuffers();
+    void detachBuffers();
+    void keepPublication();
+    void dropPublication();
 
     int decodePacket(int* value, int timeout);
-    int readPacket(Timer& timer);
+    int readPacket(Timer& timer, int wait_ms = -1);
+    int readStream(int& packet_type);
     int sendPacket(int length, Timer& timer);
+    int sendPacket(unsigned char* buf, int length, Timer& timer);
     int deliverMessage(MQTTString& topicName, Message& message);
     bool isTopicMatched(char* topicFilter, MQTTString& topicName);
 
     Network& ipstack;
     unsigned long command_timeout_ms;
 
-    unsigned char sendbuf[MAX_MQTT_PACKET_SIZE];
-    unsigned char readbuf[MAX_MQTT_PACKET_SIZE];
+    // send, receive unless shared, and session buffers, unless they come from the pool
+    PolicyArray<unsigned char, Policy::pooledBuffers ? 0 :
+        MAX_MQTT_PACKET_SIZE * (1 + !Policy::sharedBuffer + Policy::persistence)> buffers;
+    unsigned char* sendbuf;
+    unsigned char* readbuf;     // sendbuf if the policy shares it
+    PacketPool* pool;
 
-    Timer last_sent, last_received;
+    Timer last_sent, last_received, ping_sent;
     unsigned int keepAliveInterval;
     bool ping_outstanding;
     bool cleansession;
@@ -265,57 +726,55 @@ private:
     struct MessageHandlers
     {
         const char* topicFilter;
-        FP<void, MessageData&> fp;
+        messageHandlerFP fp;
     } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
 
-    FP<void, MessageData&> defaultMessageHandler;
+    messageHandlerFP defaultMessageHandler;
+    Delegate<void, StreamData&> streamMessageHandler;
+    MessageDispatcher* dispatcher;
+
+    int overflow_len;       // header length and remaining length of a packet which did not fit in readbuf
+    int overflow_rem_len;
 
     bool isconnected;
+    bool connecting;            // a connectAsync is waiting for its CONNACK
+    Timer connect_timer;
+    connectHandlerFP connackHandler;
 
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    unsigned char pubbuf[MAX_MQTT_PACKET_SIZE];  // store the last publish for sending on reconnect
+    unsigned char* pubbuf;  // the last publish, kept for sending on reconnect
     int inflightLen;
     unsigned short inflightMsgid;
     enum QoS inflightQoS;
-#endif
 
-#if MQTTCLIENT_QOS2
     bool pubrel;
-    #if !defined(MAX_INCOMING_QOS2_MESSAGES)
-        #define MAX_INCOMING_QOS2_MESSAGES 10
-    #endif
-    unsigned short incomingQoS2messages[MAX_INCOMING_QOS2_MESSAGES];
+    typename Policy::incomingQoS2 incomingQoS2messages;
     bool isQoS2msgidFree(unsigned short id);
     bool useQoS2msgid(unsigned short id);
     void freeQoS2msgid(unsigned short id);
-#endif
+
+    typename Policy::metrics clientMetrics;
 
 };
 
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::cleanSession()
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class Policy>
+void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, Policy>::cleanSession()
 {
     for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
         messageHandlers[i].topicFilter = 0;
 
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
     inflightMsgid = 0;
     inflightQoS = QOS0;
-#endif
-
-#if MQTTCLIENT_QOS2
+    dropPublication();
     pubrel = false;
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-        incomingQoS2messages[i] = 0;
-#endif
+    incomingQoS2messages.clear();
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::closeSession()
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class Policy>
+void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, Policy>::closeSession()
 {
     ping_outstanding = false;
     isconnected = false;
@@ -324,67 +783,148 @@ void MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::closeSession()
 }
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::Client(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
 {
     this->command_timeout_ms = command_timeout_ms;
+    pool = 0;
+    sendbuf = readbuf = pubbuf = 0;
+    if (!Policy::pooledBuffers)
+    {
+        sendbuf = buffers;
+        readbuf = Policy::sharedBuffer ? sendbuf : sendbuf + MAX_MQTT_PACKET_SIZE;
+        if (Policy::persistence)
+            pubbuf = readbuf + MAX_MQTT_PACKET_SIZE;
+    }
+    overflow_len = overflow_rem_len = 0;
+    dispatcher = 0;
+    connecting = false;
     cleansession = true;
       closeSession();
 }
 
 
-#if MQTTCLIENT_QOS2
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::isQoS2msgidFree(unsigned short id)
+template<class Network, class Timer, int a, int b, class Policy>
+MQTT::Client<Network, Timer, a, b, Policy>::~Client()
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
-    {
-        if (incomingQoS2messages[i] == id)
-            return false;
-    }
+    detachBuffers();
+    inflightMsgid = 0;
+    dropPublication();
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::setPacketPool(PacketPool* pool)
+{
+    if (!Policy::pooledBuffers || isconnected || (pool != 0 && pool->bufferSize() < MAX_MQTT_PACKET_SIZE))
+        return FAILURE;
+    detachBuffers();
+    inflightMsgid = 0;
+    dropPublication();
+    this->pool = pool;
+    return SUCCESS;
+}
+
+
+// take the send and receive buffers from the pool, if they are not held already
+template<class Network, class Timer, int a, int b, class Policy>
+bool MQTT::Client<Network, Timer, a, b, Policy>::attachBuffers()
+{
+    if (!Policy::pooledBuffers)
+        return true;
+    if (pool == 0)
+        return false;
+    if (sendbuf == 0 && (sendbuf = pool->alloc()) == 0)
+        return false;
+    if (readbuf == 0 && (readbuf = pool->alloc()) == 0)
+        return false;
     return true;
 }
 
 
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::useQoS2msgid(unsigned short id)
+// give the send and receive buffers back to the pool
+template<class Network, class Timer, int a, int b, class Policy>
+void MQTT::Client<Network, Timer, a, b, Policy>::detachBuffers()
+{
+    if (!Policy::pooledBuffers)
+        return;
+    if (sendbuf != 0)
+        pool->release(sendbuf);
+    if (readbuf != 0)
+        pool->release(readbuf);
+    sendbuf = readbuf = 0;
+}
+
+
+// keep the publish just serialized into sendbuf for the session: the buffers are exchanged instead of copied
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+void MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::keepPublication()
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+    unsigned char* buf = pubbuf;
+
+    if (Policy::pooledBuffers)
     {
-        if (incomingQoS2messages[i] == 0)
-        {
-            incomingQoS2messages[i] = id;
-            return true;
-        }
+        if (buf != 0)
+            pool->release(buf);
+        buf = 0;    // another send buffer is taken when needed
     }
-    return false;
+    pubbuf = sendbuf;
+    sendbuf = buf;
+    if (Policy::sharedBuffer)
+        readbuf = sendbuf;
 }
 
 
-template<class Network, class Timer, int a, int b>
-void MQTT::Client<Network, Timer, a, b>::freeQoS2msgid(unsigned short id)
+// the publication kept for the session has been acknowledged, or the session is over
+template<class Network, class Timer, int a, int b, class Policy>
+void MQTT::Client<Network, Timer, a, b, Policy>::dropPublication()
 {
-    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+    if (Policy::pooledBuffers && pubbuf != 0)
     {
-        if (incomingQoS2messages[i] == id)
-        {
-            incomingQoS2messages[i] = 0;
-            return;
-        }
+        pool->release(pubbuf);
+        pubbuf = 0;
     }
 }
-#endif
 
 
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
+template<class Network, class Timer, int a, int b, class Policy>
+bool MQTT::Client<Network, Timer, a, b, Policy>::isQoS2msgidFree(unsigned short id)
+{
+    return !incomingQoS2messages.contains(id);
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+bool MQTT::Client<Network, Timer, a, b, Policy>::useQoS2msgid(unsigned short id)
+{
+    return incomingQoS2messages.insert(id);
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+void MQTT::Client<Network, Timer, a, b, Policy>::freeQoS2msgid(unsigned short id)
+{
+    incomingQoS2messages.erase(id);
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::sendPacket(int length, Timer& timer)
+{
+    return sendPacket(sendbuf, length, timer);
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::sendPacket(unsigned char* buf, int length, Timer& timer)
 {
     int rc = FAILURE,
         sent = 0;
 
     while (sent < length && !timer.expired())
     {
-        rc = ipstack.write(&sendbuf[sent], length - sent, timer.left_ms());
+        rc = ipstack.write(&buf[sent], length - sent, timer.left_ms());
+        clientMetrics.write();
         if (rc < 0)  // there was an error writing the data
             break;
         sent += rc;
@@ -394,21 +934,23 @@ int MQTT::Client<Network, Timer, a, b>::sendPacket(int length, Timer& timer)
         if (this->keepAliveInterval > 0)
             last_sent.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet
         rc = SUCCESS;
+        clientMetrics.sent(buf[0] >> 4, length);
     }
     else
         rc = FAILURE;
 
-#if defined(MQTT_DEBUG)
-    char printbuf[150];
-    DEBUG("Rc %d from sending packet %s\n", rc, 
-        MQTTFormat_toServerString(printbuf, sizeof(printbuf), sendbuf, length));
-#endif
+    if (Policy::trace)
+    {
+        char printbuf[150];
+        DEBUG("Rc %d from sending packet %s\n", rc,
+            MQTTFormat_toServerString(printbuf, sizeof(printbuf), buf, length));
+    }
     return rc;
 }
 
 
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::decodePacket(int* value, int timeout)
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::decodePacket(int* value, int timeout)
 {
     unsigned char c;
     int multiplier = 1;
@@ -426,6 +968,7 @@ int MQTT::Client<Network, Timer, a, b>::decodePacket(int* value, int timeout)
             goto exit;
         }
         rc = ipstack.read(&c, 1, timeout);
+        clientMetrics.read();
         if (rc != 1)
             goto exit;
         *value += (c & 127) * multiplier;
@@ -439,11 +982,13 @@ exit:
 /**
  * If any read fails in this method, then we should disconnect from the network, as on reconnect
  * the packets can be retried.
- * @param timeout the max time to wait for the packet read to complete, in milliseconds
+ * @param timer the max time to wait for the packet read to complete
+ * @param wait_ms if not negative, the time to wait for the first byte instead, and the timer is restarted
+ *      with command_timeout_ms for the rest of the packet once it has arrived
  * @return the MQTT packet type, 0 if none, -1 if error
  */
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& timer)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::readPacket(Timer& timer, int wait_ms)
 {
     int rc = FAILURE;
     MQTTHeader header = {0};
@@ -451,9 +996,12 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& tim
     int rem_len = 0;
 
     /* 1. read the header byte.  This has the packet type in it */
-    rc = ipstack.read(readbuf, 1, timer.left_ms());
+    rc = ipstack.read(readbuf, 1, (wait_ms < 0) ? timer.left_ms() : wait_ms);
+    clientMetrics.read();
     if (rc != 1)
         goto exit;
+    if (wait_ms >= 0)
+        timer.countdown_ms(command_timeout_ms);
 
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
@@ -462,28 +1010,153 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::readPacket(Timer& tim
 
     if (rem_len > (MAX_MQTT_PACKET_SIZE - len))
     {
+        // the body is still unread, cycle streams or skips it
+        overflow_len = len;
+        overflow_rem_len = rem_len;
         rc = BUFFER_OVERFLOW;
+        clientMetrics.bufferOverflow();
+        clientMetrics.received(readbuf[0] >> 4, len + rem_len);
         goto exit;
     }
 
     /* 3. read the rest of the buffer using a callback to supply the rest of the data */
-    if (rem_len > 0 && (ipstack.read(readbuf + len, rem_len, timer.left_ms()) != rem_len))
-        goto exit;
+    if (rem_len > 0)
+    {
+        clientMetrics.read();
+        if (ipstack.read(readbuf + len, rem_len, timer.left_ms()) != rem_len)
+        {
+            rc = FAILURE;
+            goto exit;
+        }
+    }
 
     header.byte = readbuf[0];
     rc = header.bits.type;
+    clientMetrics.received(rc, len + rem_len);
     if (this->keepAliveInterval > 0)
         last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
 exit:
 
-#if defined(MQTT_DEBUG)
-    if (rc >= 0)
+    if (Policy::trace && rc >= 0)
     {
         char printbuf[50];
-        DEBUG("Rc %d receiving packet %s\n", rc, 
+        DEBUG("Rc %d receiving packet %s\n", rc,
             MQTTFormat_toClientString(printbuf, sizeof(printbuf), readbuf, len));
     }
-#endif
+    return rc;
+}
+
+
+/**
+ * Reads the body of a packet which did not fit in readbuf, left on the network by readPacket.
+ * A PUBLISH is passed to the stream handler in fragments of up to readbuf size, and acknowledged
+ * as usual; anything else is skipped, so that the stream stays in sync.
+ * @param packet_type set to PUBLISH once a publication has been streamed, 0 otherwise
+ * @return success code
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::readStream(int& packet_type)
+{
+    int rc = FAILURE;
+    MQTTHeader header = {0};
+    MQTTString topicName = MQTTString_initializer;
+    Message msg;
+    int remaining = overflow_rem_len;
+    int offset = 0;     // where the fragments are read, after the topic name once it is known
+    int total = 0;
+    bool publish = false, deliver = false;
+
+    header.byte = readbuf[0];
+    packet_type = 0;
+
+    if (header.bits.type == PUBLISH)
+    {
+        // variable header: topic name, and packet id if QoS > 0
+        Timer timer(command_timeout_ms);
+        int n = MAX_MQTT_PACKET_SIZE - overflow_len;
+        clientMetrics.read();
+        if (ipstack.read(readbuf + overflow_len, n, timer.left_ms()) != n)
+            goto exit;
+        remaining -= n;
+        unsigned char* p = readbuf + overflow_len;
+        int topiclen = (p[0] << 8) | p[1];
+        int varlen = 2 + topiclen + ((header.bits.qos > 0) ? 2 : 0);
+        if (varlen <= n)
+        {
+            publish = true;
+            msg.qos = (enum QoS)header.bits.qos;
+            msg.retained = header.bits.retain;
+            msg.dup = header.bits.dup;
+            msg.id = (msg.qos > 0) ? ((p[2 + topiclen] << 8) | p[3 + topiclen]) : 0;
+            total = overflow_rem_len - varlen;
+            deliver = streamMessageHandler.attached();
+            if (Policy::maxQoS > 1 && deliver && msg.qos == QOS2)
+            {
+                if (!isQoS2msgidFree(msg.id))
+                    deliver = false;    // duplicate, only acknowledged again
+                else if (!useQoS2msgid(msg.id))
+                {
+                    WARN("Maximum number of incoming QoS2 messages exceeded");
+                    deliver = false;
+                }
+            }
+            // keep the topic name at the start of readbuf, the fragments go after it
+            memmove(readbuf, p + 2, topiclen);
+            topicName.lenstring.data = (char*)readbuf;
+            topicName.lenstring.len = topiclen;
+            offset = topiclen;
+            msg.payload = 0;
+            msg.payloadlen = 0;
+            if (deliver)
+            {
+                StreamData sd(topicName, msg, 0, total);
+                streamMessageHandler(sd);
+            }
+            // the part of the payload read with the variable header
+            if (n > varlen)
+            {
+                memmove(readbuf + offset, p + varlen, n - varlen);
+                msg.payload = readbuf + offset;
+                msg.payloadlen = n - varlen;
+                if (deliver)
+                {
+                    StreamData sd(topicName, msg, 0, total);
+                    streamMessageHandler(sd);
+                }
+            }
+        }
+    }
+
+    // the rest of the packet, a fragment at a time
+    while (remaining > 0)
+    {
+        Timer timer(command_timeout_ms);
+        int n = (remaining < MAX_MQTT_PACKET_SIZE - offset) ? remaining : MAX_MQTT_PACKET_SIZE - offset;
+        clientMetrics.read();
+        if (ipstack.read(readbuf + offset, n, timer.left_ms()) != n)
+            goto exit;
+        if (deliver)
+        {
+            msg.payload = readbuf + offset;
+            msg.payloadlen = n;
+            StreamData sd(topicName, msg, total - remaining, total);
+            streamMessageHandler(sd);
+        }
+        remaining -= n;
+    }
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval);
+    rc = SUCCESS;
+
+    if (Policy::maxQoS > 0 && publish && msg.qos != QOS0)
+    {
+        Timer timer(command_timeout_ms);
+        int len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, (msg.qos == QOS1) ? PUBACK : PUBREC, 0, msg.id);
+        rc = (len > 0) ? sendPacket(len, timer) : FAILURE;
+    }
+    if (publish)
+        packet_type = PUBLISH;
+exit:
     return rc;
 }
 
@@ -491,8 +1164,8 @@ exit:
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
-template<class Network, class Timer, int a, int b>
-bool MQTT::Client<Network, Timer, a, b>::isTopicMatched(char* topicFilter, MQTTString& topicName)
+template<class Network, class Timer, int a, int b, class Policy>
+bool MQTT::Client<Network, Timer, a, b, Policy>::isTopicMatched(char* topicFilter, MQTTString& topicName)
 {
     char* curf = topicFilter;
     char* curn = topicName.lenstring.data;
@@ -521,8 +1194,8 @@ bool MQTT::Client<Network, Timer, a, b>::isTopicMatched(char* topicFilter, MQTTS
 
 
 
-template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTString& topicName, Message& message)
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS, Policy>::deliverMessage(MQTTString& topicName, Message& message)
 {
     int rc = FAILURE;
 
@@ -535,7 +1208,10 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
             if (messageHandlers[i].fp.attached())
             {
                 MessageData md(topicName, message);
-                messageHandlers[i].fp(md);
+                if (dispatcher)
+                    dispatcher->dispatch(messageHandlers[i].fp, md);
+                else
+                    messageHandlers[i].fp(md);
                 rc = SUCCESS;
             }
         }
@@ -544,7 +1220,10 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
     if (rc == FAILURE && defaultMessageHandler.attached())
     {
         MessageData md(topicName, message);
-        defaultMessageHandler(md);
+        if (dispatcher)
+            dispatcher->dispatch(defaultMessageHandler, md);
+        else
+            defaultMessageHandler(md);
         rc = SUCCESS;
     }
 
@@ -553,8 +1232,8 @@ int MQTT::Client<Network, Timer, a, MAX_MESSAGE_HANDLERS>::deliverMessage(MQTTSt
 
 
 
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::yield(unsigned long timeout_ms)
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::yield(unsigned long timeout_ms)
 {
     int rc = SUCCESS;
     Timer timer;
@@ -573,16 +1252,83 @@ int MQTT::Client<Network, Timer, a, b>::yield(unsigned long timeout_ms)
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::poll()
+{
+    // the first byte is expected to be available, the timeout only bounds the rest of the packet
+    Timer timer(command_timeout_ms);
+
+    return cycle(timer);
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::drain(unsigned long timeout_ms, int budget)
+{
+    int count = 0;
+    int wait_ms = timeout_ms;
+
+    while (count < budget)
+    {
+        Timer timer(command_timeout_ms);
+        int rc = process(timer, wait_ms);
+        if (rc < 0)
+            return rc;
+        if (rc == 0)
+            break;  // the network would block
+        ++count;
+        wait_ms = 0;    // the rest of the batch only takes what has already arrived
+    }
+
+    if (keepalive() != SUCCESS)
+    {
+        if (isconnected)
+            closeSession();
+        return FAILURE;
+    }
+    return count;
+}
+
+
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::cycle(Timer& timer)
 {
     // get one piece of work off the wire and one pass through
+    int rc = process(timer, -1);
+
+    if (rc >= 0 && keepalive() != SUCCESS)
+    {
+        //check only keepalive FAILURE status so that previous FAILURE status can be considered as FAULT
+        if (isconnected)
+            closeSession();
+        rc = FAILURE;
+    }
+    return rc;
+}
+
+
+// read and handle one packet, without the keepalive check
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::process(Timer& timer, int wait_ms)
+{
     int len = 0,
         rc = SUCCESS;
+    int packet_type = 0;
 
-    int packet_type = readPacket(timer);    // read the socket, see what work is due
+    if (!attachBuffers())
+    {
+        rc = FAILURE;   // the pool is empty
+        goto exit;
+    }
+    packet_type = readPacket(timer, wait_ms);   // read the socket, see what work is due
 
-    switch (packet_type)
+    if (packet_type == BUFFER_OVERFLOW)
+    {
+        // too large for readbuf: streamed to the stream handler, or skipped
+        if ((rc = readStream(packet_type)) != SUCCESS)
+            goto exit;
+    }
+    else switch (packet_type)
     {
         default:
             // no more data to read, unrecoverable. Or read packet fails due to unexpected network error
@@ -591,8 +1337,34 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
         case 0: // timed out reading packet
             break;
         case CONNACK:
-        case PUBACK:
+            if (connecting)
+            {
+                connackData data;
+                connecting = false;
+                if ((rc = connack(data, timer, false)) < 0)
+                    data.rc = rc;
+                connackHandler(data);
+                if (rc > 0)
+                    rc = SUCCESS;   // refused, which is for the handler
+            }
+            break;
         case SUBACK:
+        case UNSUBACK:
+            break;
+        case PUBACK:
+        case PUBCOMP:
+            if (inflightMsgid > 0)
+            {
+                // the ack of the publication resent by connectAsync, which does not wait for it
+                unsigned short mypacketid;
+                unsigned char dup, type;
+                if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) == 1 &&
+                        inflightMsgid == mypacketid && (type == PUBACK) == (inflightQoS == QOS1))
+                {
+                    inflightMsgid = 0;
+                    dropPublication();
+                }
+            }
             break;
         case PUBLISH:
         {
@@ -604,11 +1376,8 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
                                  (unsigned char**)&msg.payload, (int*)&msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 goto exit;
             msg.qos = (enum QoS)intQoS;
-#if MQTTCLIENT_QOS2
-            if (msg.qos != QOS2)
-#endif
+            if (Policy::maxQoS < 2 || msg.qos != QOS2)
                 deliverMessage(topicName, msg);
-#if MQTTCLIENT_QOS2
             else if (isQoS2msgidFree(msg.id))
             {
                 if (useQoS2msgid(msg.id))
@@ -616,9 +1385,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
                 else
                     WARN("Maximum number of incoming QoS2 messages exceeded");
             }
-#endif
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-            if (msg.qos != QOS0)
+            if (Policy::maxQoS > 0 && msg.qos != QOS0)
             {
                 if (msg.qos == QOS1)
                     len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBACK, 0, msg.id);
@@ -632,14 +1399,14 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
                     goto exit; // there was a problem
             }
             break;
-#endif
         }
-#if MQTTCLIENT_QOS2
         case PUBREC:
         case PUBREL:
             unsigned short mypacketid;
             unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+            if (Policy::maxQoS < 2)
+                rc = FAILURE;   // not sent to a client without QoS2
+            else if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 rc = FAILURE;
             else if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE,
                                  (packet_type == PUBREC) ? PUBREL : PUBCOMP, 0, mypacketid)) <= 0)
@@ -652,34 +1419,39 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::cycle(Timer& timer)
                 freeQoS2msgid(mypacketid);
             break;
 
-        case PUBCOMP:
-            break;
-#endif
         case PINGRESP:
+            if (ping_outstanding)
+                clientMetrics.pingAcked();
             ping_outstanding = false;
             break;
     }
 
-    if (keepalive() != SUCCESS)
-        //check only keepalive FAILURE status so that previous FAILURE status can be considered as FAULT
-        rc = FAILURE;
-
 exit:
     if (rc == SUCCESS)
         rc = packet_type;
     else if (isconnected)
         closeSession();
+    else if (connecting)
+        connectFailed();
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::keepalive()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::keepalive()
 {
     int rc = SUCCESS;
-    static Timer ping_sent;
 
-    if (keepAliveInterval == 0)
+    if (connecting)
+    {
+        if (connect_timer.expired())
+        {
+            rc = FAILURE;   // no CONNACK in time
+            connectFailed();
+        }
+        goto exit;
+    }
+    if (!isconnected || keepAliveInterval == 0)
         goto exit;
     
     if (ping_outstanding)
@@ -687,20 +1459,22 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::keepalive()
         if (ping_sent.expired())
         {
             rc = FAILURE; // session failure
-            #if defined(MQTT_DEBUG)
-                char printbuf[150];
+            clientMetrics.keepaliveTimeout();
+            if (Policy::trace)
                 DEBUG("PINGRESP not received in keepalive interval\n");
-            #endif
         }
     }
     else if (last_sent.expired() || last_received.expired())
     {
         Timer timer(1000);
-        int len = MQTTSerialize_pingreq(sendbuf, MAX_MQTT_PACKET_SIZE);
-        if (len > 0 && (rc = sendPacket(len, timer)) == SUCCESS) // send the ping packet
+        int len = attachBuffers() ? MQTTSerialize_pingreq(sendbuf, MAX_MQTT_PACKET_SIZE) : FAILURE;
+        if (len <= 0)
+            rc = FAILURE;
+        else if ((rc = sendPacket(len, timer)) == SUCCESS) // send the ping packet
         {
             ping_outstanding = true;
             ping_sent.countdown(this->keepAliveInterval);
+            clientMetrics.pingSent();
         }
     }
 exit:
@@ -709,8 +1483,8 @@ exit:
 
 
 // only used in single-threaded mode where one command at a time is in process
-template<class Network, class Timer, int a, int b>
-int MQTT::Client<Network, Timer, a, b>::waitfor(int packet_type, Timer& timer)
+template<class Network, class Timer, int a, int b, class Policy>
+int MQTT::Client<Network, Timer, a, b, Policy>::waitfor(int packet_type, Timer& timer)
 {
     int rc = FAILURE;
 
@@ -726,86 +1500,141 @@ int MQTT::Client<Network, Timer, a, b>::waitfor(int packet_type, Timer& timer)
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options, connackData& data)
+// sends the CONNECT packet of connect and connectAsync
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::sendConnect(MQTTPacket_connectData& options, Timer& timer)
 {
-    Timer connect_timer(command_timeout_ms);
     int rc = FAILURE;
     int len = 0;
 
-    if (isconnected) // don't send connect packet again if we are already connected
+    if (!attachBuffers())
         goto exit;
 
     this->keepAliveInterval = options.keepAliveInterval;
     this->cleansession = options.cleansession;
     if ((len = MQTTSerialize_connect(sendbuf, MAX_MQTT_PACKET_SIZE, &options)) <= 0)
         goto exit;
-    if ((rc = sendPacket(len, connect_timer)) != SUCCESS)  // send the connect packet
+    if ((rc = sendPacket(len, timer)) != SUCCESS)  // send the connect packet
         goto exit; // there was a problem
 
     if (this->keepAliveInterval > 0)
         last_received.countdown(this->keepAliveInterval);
-    // this will be a blocking call, wait for the connack
-    if (waitfor(CONNACK, connect_timer) == CONNACK)
-    {
-        data.rc = 0;
-        data.sessionPresent = false;
-        if (MQTTDeserialize_connack((unsigned char*)&data.sessionPresent,
-                            (unsigned char*)&data.rc, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
-            rc = data.rc;
-        else
-            rc = FAILURE;
-    }
-    else
-        rc = FAILURE;
 
-#if MQTTCLIENT_QOS2
+exit:
+    return rc;
+}
+
+
+// handles the CONNACK in readbuf: resends the publication kept for the session, and waits for its ack if wait,
+// then the client is connected if the broker accepted the connection
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::connack(connackData& data, Timer& timer, bool wait)
+{
+    int rc = FAILURE;
+    int len = 0;
+
+    data.rc = 0;
+    data.sessionPresent = false;
+    if (MQTTDeserialize_connack((unsigned char*)&data.sessionPresent,
+                        (unsigned char*)&data.rc, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+        goto exit;
+    if ((rc = data.rc) != SUCCESS)
+        goto exit;
+
     // resend any inflight publish
-    if (inflightMsgid > 0 && inflightQoS == QOS2 && pubrel)
+    if (Policy::maxQoS > 1 && inflightMsgid > 0 && inflightQoS == QOS2 && pubrel)
     {
         if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREL, 0, inflightMsgid)) <= 0)
             rc = FAILURE;
         else
-            rc = publish(len, connect_timer, inflightQoS);
-    }
-    else
-#endif
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    if (inflightMsgid > 0)
-    {
-        memcpy(sendbuf, pubbuf, MAX_MQTT_PACKET_SIZE);
-        rc = publish(inflightLen, connect_timer, inflightQoS);
+            rc = wait ? publish(sendbuf, len, timer, inflightQoS) : sendPacket(len, timer);
     }
-#endif
+    else if (Policy::persistence && inflightMsgid > 0)
+        rc = wait ? publish(pubbuf, inflightLen, timer, inflightQoS) : sendPacket(pubbuf, inflightLen, timer);
 
 exit:
     if (rc == SUCCESS)
     {
         isconnected = true;
         ping_outstanding = false;
+        clientMetrics.connected();
     }
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect(MQTTPacket_connectData& options)
+// reports to the handler of connectAsync that the connection has failed
+template<class Network, class Timer, int a, int b, class Policy>
+void MQTT::Client<Network, Timer, a, b, Policy>::connectFailed()
+{
+    connackData data;
+
+    connecting = false;
+    data.rc = FAILURE;
+    data.sessionPresent = false;
+    connackHandler(data);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::connect(MQTTPacket_connectData& options, connackData& data)
+{
+    Timer connect_timer(command_timeout_ms);
+    int rc = FAILURE;
+
+    if (isconnected || connecting) // don't send connect packet again if we are already connected
+        goto exit;
+    if ((rc = sendConnect(options, connect_timer)) != SUCCESS)
+        goto exit; // there was a problem
+
+    // this will be a blocking call, wait for the connack
+    if (waitfor(CONNACK, connect_timer) == CONNACK)
+        rc = connack(data, connect_timer, true);
+    else
+        rc = FAILURE;
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::connectAsync(MQTTPacket_connectData& options,
+    const connectHandlerFP& handler)
+{
+    int rc = FAILURE;
+
+    if (isconnected || connecting)
+        goto exit;
+    connect_timer.countdown_ms(command_timeout_ms);
+    if ((rc = sendConnect(options, connect_timer)) != SUCCESS)
+        goto exit; // there was a problem
+    connackHandler = handler;
+    connecting = true;
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::connect(MQTTPacket_connectData& options)
 {
     connackData data;
     return connect(options, data);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::connect()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::connect()
 {
     MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
     return connect(default_options);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::setMessageHandler(const char* topicFilter, messageHandler messageHandler)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::setMessageHandler(const char* topicFilter, const messageHandlerFP& messageHandler)
 {
     int rc = FAILURE;
     int i = -1;
@@ -815,7 +1644,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::se
     {
         if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
         {
-            if (messageHandler == 0) // remove existing
+            if (!messageHandler.attached()) // remove existing
             {
                 messageHandlers[i].topicFilter = 0;
                 messageHandlers[i].fp.detach();
@@ -825,7 +1654,7 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::se
         }
     }
     // if no existing, look for empty slot (unless we are removing)
-    if (messageHandler != 0) {
+    if (messageHandler.attached()) {
         if (rc == FAILURE)
         {
             for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
@@ -840,34 +1669,43 @@ int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::se
         if (i < MAX_MESSAGE_HANDLERS)
         {
             messageHandlers[i].topicFilter = topicFilter;
-            messageHandlers[i].fp.attach(messageHandler);
+            messageHandlers[i].fp = messageHandler;
         }
     }
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter,
-     enum QoS qos, messageHandler messageHandler, subackData& data)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::subscribe(const char* topicFilter,
+     enum QoS qos, const messageHandlerFP& messageHandler, subackData& data)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
     int len = 0;
     MQTTString topic = {(char*)topicFilter, {0, 0}};
+    unsigned long start = 0;
 
-    if (!isconnected)
+    if (!isconnected || !attachBuffers())
         goto exit;
 
+    if ((int)qos > Policy::maxQoS)
+        qos = (enum QoS)Policy::maxQoS;
     len = MQTTSerialize_subscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic, (int*)&qos);
     if (len <= 0)
+    {
+        if (len == MQTTPACKET_BUFFER_TOO_SHORT)
+            clientMetrics.bufferOverflow();
         goto exit;
+    }
+    start = clientMetrics.start();
     if ((rc = sendPacket(len, timer)) != SUCCESS) // send the subscribe packet
         goto exit;             // there was a problem
 
     if (waitfor(SUBACK, timer) == SUBACK)      // wait for suback
     {
         int count = 0;
+        clientMetrics.subscribeAcked(start);
         unsigned short mypacketid;
         data.grantedQoS = 0;
         if (MQTTDeserialize_suback(&mypacketid, 1, &count, &data.grantedQoS, readbuf, MAX_MQTT_PACKET_SIZE) == 1)
@@ -886,27 +1724,31 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::subscribe(const char* topicFilter, enum QoS qos, messageHandler messageHandler)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::subscribe(const char* topicFilter, enum QoS qos, const messageHandlerFP& messageHandler)
 {
     subackData data;
     return subscribe(topicFilter, qos, messageHandler, data);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS>::unsubscribe(const char* topicFilter)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::unsubscribe(const char* topicFilter)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
     MQTTString topic = {(char*)topicFilter, {0, 0}};
     int len = 0;
 
-    if (!isconnected)
+    if (!isconnected || !attachBuffers())
         goto exit;
 
     if ((len = MQTTSerialize_unsubscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, packetid.getNext(), 1, &topic)) <= 0)
+    {
+        if (len == MQTTPACKET_BUFFER_TOO_SHORT)
+            clientMetrics.bufferOverflow();
         goto exit;
+    }
     if ((rc = sendPacket(len, timer)) != SUCCESS) // send the unsubscribe packet
         goto exit; // there was a problem
 
@@ -929,46 +1771,205 @@ exit:
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(int len, Timer& timer, enum QoS qos)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::subscribeMany(int count,
+    const char* const topicFilters[], enum QoS qos, const messageHandlerFP& messageHandler, int grantedQoS[])
+{
+    for (int i = 0; i < count; ++i)
+        grantedQoS[i] = 0x80;
+    if ((int)qos > Policy::maxQoS)
+        qos = (enum QoS)Policy::maxQoS;
+    return sendFilters(SUBSCRIBE, count, topicFilters, qos, &messageHandler, grantedQoS);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::unsubscribeMany(int count,
+    const char* const topicFilters[])
+{
+    return sendFilters(UNSUBSCRIBE, count, topicFilters, QOS0, 0, 0);
+}
+
+
+// packs as many of the topic filters as fit into one SUBSCRIBE or UNSUBSCRIBE packet in sendbuf
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::serializeFilters(int packet_type, unsigned short id,
+    int count, const char* const topicFilters[], enum QoS qos, int& packed)
+{
+    int per_filter = (packet_type == SUBSCRIBE) ? 3 : 2;    // length, and requested QoS
+    int rem_len = 2;    // packet id
+    unsigned char* ptr = sendbuf;
+    MQTTHeader header = {0};
+
+    for (packed = 0; packed < count; ++packed)
+    {
+        int len = per_filter + (int)strlen(topicFilters[packed]);
+        if (MQTTPacket_len(rem_len + len) > MAX_MQTT_PACKET_SIZE)
+            break;
+        rem_len += len;
+    }
+    if (packed == 0)
+        return BUFFER_OVERFLOW;
+
+    header.bits.type = packet_type;
+    header.bits.qos = 1;
+    writeChar(&ptr, header.byte);
+    ptr += MQTTPacket_encode(ptr, rem_len);
+    writeInt(&ptr, id);
+    for (int i = 0; i < packed; ++i)
+    {
+        writeCString(&ptr, topicFilters[i]);
+        if (packet_type == SUBSCRIBE)
+            writeChar(&ptr, qos);
+    }
+    return (int)(ptr - sendbuf);
+}
+
+
+// sends the SUBSCRIBE or UNSUBSCRIBE packets of subscribeMany and unsubscribeMany, with up to
+// MQTTCLIENT_SUBSCRIBE_WINDOW of them waiting for their acks, which are matched by packet id
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, Policy>::sendFilters(int packet_type,
+    int count, const char* const topicFilters[], enum QoS qos, const messageHandlerFP* messageHandler, int grantedQoS[])
+{
+    struct Pending
+    {
+        unsigned short id;
+        int first;      // index of its first topic filter
+        int count;
+        unsigned long start;    // for the metrics
+    } window[MQTTCLIENT_SUBSCRIBE_WINDOW];
+    int ack_type = (packet_type == SUBSCRIBE) ? SUBACK : UNSUBACK;
+    int per_filter = (packet_type == SUBSCRIBE) ? 3 : 2;
+    int rc = FAILURE;
+    int pending = 0;    // packets in the window
+    int sent = 0;       // topic filters sent
+    int acked = 0;      // topic filters acknowledged
+    bool handlers_full = false;
+    Timer timer(command_timeout_ms);
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (MQTTPacket_len(2 + per_filter + (int)strlen(topicFilters[i])) > MAX_MQTT_PACKET_SIZE)
+        {
+            clientMetrics.bufferOverflow();
+            return BUFFER_OVERFLOW;
+        }
+    }
+    if (!isconnected || !attachBuffers())
+        goto exit;
+
+    while (acked < count)
+    {
+        while (sent < count && pending < MQTTCLIENT_SUBSCRIBE_WINDOW)
+        {
+            Pending& p = window[pending];
+            int len = serializeFilters(packet_type, p.id = packetid.getNext(), count - sent, &topicFilters[sent], qos, p.count);
+            p.first = sent;
+            p.start = clientMetrics.start();
+            if ((rc = sendPacket(len, timer)) != SUCCESS)
+                goto exit;
+            sent += p.count;
+            ++pending;
+        }
+
+        if (waitfor(ack_type, timer) != ack_type)
+        {
+            rc = FAILURE;
+            goto exit;
+        }
+        unsigned char* ptr = readbuf + 1;
+        int rem_len = 0;
+        ptr += MQTTPacket_decodeBuf(ptr, &rem_len);
+        unsigned short mypacketid = (unsigned short)readInt(&ptr);
+        int i = 0;
+        while (i < pending && window[i].id != mypacketid)
+            ++i;
+        if (i == pending)
+            continue;   // not one of ours
+        Pending p = window[i];
+        window[i] = window[--pending];
+
+        if (packet_type == SUBSCRIBE)
+        {
+            int granted = 0;
+            clientMetrics.subscribeAcked(p.start);
+            if (MQTTDeserialize_suback(&mypacketid, p.count, &granted, &grantedQoS[p.first], readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                goto exit;
+            }
+            for (int j = p.first; j < p.first + p.count; ++j)
+            {
+                grantedQoS[j] = (j < p.first + granted) ? (grantedQoS[j] & 0xFF) : 0x80;   // read as a char
+                if (grantedQoS[j] != 0x80 && messageHandler->attached() &&
+                        setMessageHandler(topicFilters[j], *messageHandler) != SUCCESS)
+                    handlers_full = true;
+            }
+        }
+        else
+        {
+            // remove the subscription message handlers associated with these topics, if there are any
+            for (int j = p.first; j < p.first + p.count; ++j)
+                setMessageHandler(topicFilters[j], 0);
+        }
+        acked += p.count;
+        timer.countdown_ms(command_timeout_ms);     // the timeout is for each ack
+    }
+    rc = handlers_full ? BUFFER_OVERFLOW : SUCCESS;
+
+exit:
+    if (rc == FAILURE)
+        closeSession();
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::publish(unsigned char* buf, int len, Timer& timer, enum QoS qos)
 {
     int rc;
+    unsigned long start = clientMetrics.start();
 
-    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the publish packet
+    if ((rc = sendPacket(buf, len, timer)) != SUCCESS) // send the publish packet
         goto exit; // there was a problem
 
-#if MQTTCLIENT_QOS1
-    if (qos == QOS1)
+    if (Policy::maxQoS > 0 && qos == QOS1)
     {
         if (waitfor(PUBACK, timer) == PUBACK)
         {
             unsigned short mypacketid;
+            clientMetrics.publishAcked(start);
             unsigned char dup, type;
             if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 rc = FAILURE;
             else if (inflightMsgid == mypacketid)
+            {
                 inflightMsgid = 0;
+                dropPublication();
+            }
         }
         else
             rc = FAILURE;
     }
-#endif
-#if MQTTCLIENT_QOS2
-    else if (qos == QOS2)
+    else if (Policy::maxQoS > 1 && qos == QOS2)
     {
         if (waitfor(PUBCOMP, timer) == PUBCOMP)
         {
             unsigned short mypacketid;
+            clientMetrics.publishAcked(start);
             unsigned char dup, type;
             if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
                 rc = FAILURE;
             else if (inflightMsgid == mypacketid)
+            {
                 inflightMsgid = 0;
+                dropPublication();
+            }
         }
         else
             rc = FAILURE;
     }
-#endif
 
 exit:
     if (rc != SUCCESS)
@@ -978,72 +1979,77 @@ exit:
 
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);
     MQTTString topicString = MQTTString_initializer;
     int len = 0;
+    unsigned char* buf = 0;
 
-    if (!isconnected)
+    if (!isconnected || !attachBuffers())
         goto exit;
 
     topicString.cstring = (char*)topicName;
 
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if ((int)qos > Policy::maxQoS)
+        qos = (enum QoS)Policy::maxQoS;
     if (qos == QOS1 || qos == QOS2)
         id = packetid.getNext();
-#endif
 
     len = MQTTSerialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, 0, qos, retained, id,
               topicString, (unsigned char*)payload, payloadlen);
     if (len <= 0)
+    {
+        if (len == MQTTPACKET_BUFFER_TOO_SHORT)
+            clientMetrics.bufferOverflow();
         goto exit;
+    }
 
-#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
-    if (!cleansession)
+    buf = sendbuf;
+    if (Policy::persistence && !cleansession && qos != QOS0)
     {
-        memcpy(pubbuf, sendbuf, len);
+        keepPublication();
+        buf = pubbuf;
         inflightMsgid = id;
         inflightLen = len;
         inflightQoS = qos;
-#if MQTTCLIENT_QOS2
         pubrel = false;
-#endif
     }
-#endif
 
-    rc = publish(len, timer, qos);
+    rc = publish(buf, len, timer, qos);
 exit:
     return rc;
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
 {
     unsigned short id = 0;  // dummy - not used for anything
     return publish(topicName, payload, payloadlen, id, qos, retained);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::publish(const char* topicName, Message& message)
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::publish(const char* topicName, Message& message)
 {
     return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
 }
 
 
-template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b>
-int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b>::disconnect()
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, class Policy>
+int MQTT::Client<Network, Timer, MAX_MQTT_PACKET_SIZE, b, Policy>::disconnect()
 {
     int rc = FAILURE;
     Timer timer(command_timeout_ms);     // we might wait for incomplete incoming publishes to complete
-    int len = MQTTSerialize_disconnect(sendbuf, MAX_MQTT_PACKET_SIZE);
+    int len = attachBuffers() ? MQTTSerialize_disconnect(sendbuf, MAX_MQTT_PACKET_SIZE) : FAILURE;
     if (len > 0)
         rc = sendPacket(len, timer);            // send the disconnect packet
+    connecting = false;     // a connectAsync is abandoned, without calling its handler
     closeSession();
+    detachBuffers();    // back to the pool until the next connect
     return rc;
 }
 
@@ -0,0 +1,225 @@
+/*******************************************************************************
+ * Callback with inline storage for the handlers of the MQTT clients
+ *
+ * Delegate<R, A> holds a global function, an object with one of its member functions,
+ * or a function object such as a lambda with its captures, in a buffer of its own:
+ * it never allocates.  Calling it is one indirect call to a stub which is specialized
+ * for what it holds, so the call of a function object or of a member bound with bind()
+ * is inlined into that stub.
+ *
+ * Usage:
+ *
+ *   Delegate<void, MessageData&> d(onMessage);                  // global function
+ *   Delegate<void, MessageData&> d(this, &Bridge::onMessage);   // member function
+ *   d = Delegate<void, MessageData&>::bind<Bridge, &Bridge::onMessage>(this);
+ *   Delegate<void, MessageData&> d([this, id](MessageData& md) { ... });   // C++11
+ *
+ * It has the methods of FP (attach, attached, detach, operator()), so it can replace it.
+ * A function object must fit in MQTT_DELEGATE_SIZE bytes, which is checked when it is
+ * attached.
+ *******************************************************************************/
+
+#if !defined(MQTT_DELEGATE_H)
+#define MQTT_DELEGATE_H
+
+#include <new>
+#include <string.h>
+
+#if !defined(MQTT_DELEGATE_SIZE)
+    #define MQTT_DELEGATE_SIZE (4 * sizeof(void*))  // room for an object and a member function pointer, or a few captures
+#endif
+
+namespace MQTT
+{
+
+
+template<class R, class A>
+class Delegate
+{
+public:
+    Delegate() : invoke(0), manage(0)
+    {
+
+    }
+
+    Delegate(R (*function)(A)) : invoke(0), manage(0)
+    {
+        attach(function);
+    }
+
+    template<class T>
+    Delegate(T* item, R (T::*method)(A)) : invoke(0), manage(0)
+    {
+        attach(item, method);
+    }
+
+    template<class F>
+    explicit Delegate(const F& functor) : invoke(0), manage(0)
+    {
+        attach(functor);
+    }
+
+    Delegate(const Delegate& other) : invoke(0), manage(0)
+    {
+        copy(other);
+    }
+
+    ~Delegate()
+    {
+        detach();
+    }
+
+    Delegate& operator=(const Delegate& other)
+    {
+        if (this != &other)
+        {
+            detach();
+            copy(other);
+        }
+        return *this;
+    }
+
+    /** A member function known at compile time: the call is a direct call from the stub
+     *  @param item - the object
+     */
+    template<class T, R (T::*method)(A)>
+    static Delegate bind(T* item)
+    {
+        Delegate d;
+        new (d.storage.bytes) T*(item);
+        d.invoke = &Delegate::callBound<T, method>;
+        return d;
+    }
+
+    /** Attach a global function, 0 detaches */
+    void attach(R (*function)(A))
+    {
+        detach();
+        if (function == 0)
+            return;
+        new (storage.bytes) (R (*)(A))(function);
+        invoke = &Delegate::callFunction;
+    }
+
+    /** Attach an object and one of its member functions */
+    template<class T>
+    void attach(T* item, R (T::*method)(A))
+    {
+        typedef char member_too_large_for_MQTT_DELEGATE_SIZE[(sizeof(Member<T>) <= sizeof(storage)) ? 1 : -1];
+        (void)sizeof(member_too_large_for_MQTT_DELEGATE_SIZE);
+        detach();
+        new (storage.bytes) Member<T>(item, method);
+        invoke = &Delegate::callMember<T>;
+    }
+
+    /** Attach a copy of a function object */
+    template<class F>
+    void attach(const F& functor)
+    {
+        typedef char functor_too_large_for_MQTT_DELEGATE_SIZE[(sizeof(F) <= sizeof(storage)) ? 1 : -1];
+        (void)sizeof(functor_too_large_for_MQTT_DELEGATE_SIZE);
+        detach();
+        new (storage.bytes) F(functor);
+        invoke = &Delegate::callFunctor<F>;
+        manage = &Delegate::manageFunctor<F>;
+    }
+
+    /** Call the attached function
+     *  @return what it returns, 0 if none is attached
+     */
+    R operator()(A arg) const
+    {
+        if (invoke != 0)
+            return invoke(const_cast<unsigned char*>(storage.bytes), arg);
+        return (R)0;
+    }
+
+    bool attached() const
+    {
+        return invoke != 0;
+    }
+
+    void detach()
+    {
+        if (manage != 0)
+            manage(storage.bytes, 0);
+        invoke = 0;
+        manage = 0;
+    }
+
+private:
+
+    class Dummy;
+
+    template<class T>
+    struct Member
+    {
+        Member(T* item, R (T::*method)(A)) : item(item), method(method)
+        {
+
+        }
+
+        T* item;
+        R (T::*method)(A);
+    };
+
+    static R callFunction(void* s, A arg)
+    {
+        return (*(R (**)(A))s)(arg);
+    }
+
+    template<class T>
+    static R callMember(void* s, A arg)
+    {
+        Member<T>* m = (Member<T>*)s;
+        return (m->item->*m->method)(arg);
+    }
+
+    template<class T, R (T::*method)(A)>
+    static R callBound(void* s, A arg)
+    {
+        return ((*(T**)s)->*method)(arg);
+    }
+
+    template<class F>
+    static R callFunctor(void* s, A arg)
+    {
+        return (*(F*)s)(arg);
+    }
+
+    // copies src into dst, or destroys dst if src is 0
+    template<class F>
+    static void manageFunctor(void* dst, const void* src)
+    {
+        if (src != 0)
+            new (dst) F(*(const F*)src);
+        else
+            ((F*)dst)->~F();
+    }
+
+    void copy(const Delegate& other)
+    {
+        if (other.manage != 0)
+            other.manage(storage.bytes, other.storage.bytes);
+        else
+            memcpy(storage.bytes, other.storage.bytes, sizeof(storage));
+        invoke = other.invoke;
+        manage = other.manage;
+    }
+
+    R (*invoke)(void* s, A arg);
+    void (*manage)(void* dst, const void* src);     // 0 if the storage can be copied with memcpy
+    union
+    {
+        void* p;
+        double d;
+        long long ll;
+        void (Dummy::*m)();
+        unsigned char bytes[MQTT_DELEGATE_SIZE];
+    } storage;
+};
+
+
+}
+
+#endif
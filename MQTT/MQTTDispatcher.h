@@ -0,0 +1,217 @@
+/*******************************************************************************
+ * Worker pool for the message handlers of the MQTT clients
+ *
+ * Set with setDispatcher() on MQTT::Client, Async or DuplexClient, WorkerPool copies
+ * each incoming message into the bounded queue of one of its worker threads, which
+ * calls the handler.  The worker is chosen by a hash of the topic name, so the
+ * messages of a topic are handled in the order they arrived, while different topics
+ * are handled in parallel.
+ *
+ * When the queue of the worker is full, dispatch() waits for a free slot: the client
+ * stops reading from the network until then, and TCP flow control holds back the
+ * broker.  Keepalive processing of the client waits too, so the handlers must keep up
+ * on average.  Messages larger than a slot are not copied: dispatch() waits until the
+ * worker has emptied its queue and calls the handler itself, which keeps the order.
+ *
+ * Usage:
+ *
+ *   WorkerPool<LinuxThread, LinuxMutex, LinuxSemaphore> pool(4, 16, 256);
+ *   client.setDispatcher(&pool);
+ *
+ * The pool must outlive the clients which use it.
+ *******************************************************************************/
+
+#if !defined(MQTT_DISPATCHER_H)
+#define MQTT_DISPATCHER_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @param Thread a thread class constructed from a function void(void const*) and its argument, with join()
+ * @param Mutex a mutex class with lock and unlock
+ * @param Semaphore a counting semaphore class constructed with its count, with wait(timeout) and release()
+ */
+template<class Thread, class Mutex, class Semaphore>
+class WorkerPool : public MessageDispatcher
+{
+public:
+    /** Construct the pool and start its threads
+     *  @param workers - number of worker threads
+     *  @param queue_len - messages each worker can hold before dispatch() waits
+     *  @param slot_size - topic name plus payload size which is copied to the queue
+     */
+    WorkerPool(int workers = 2, int queue_len = 8, int slot_size = 256) : nworkers(workers > 0 ? workers : 1),
+        queue_len(queue_len > 0 ? queue_len : 1), slot_size(slot_size)
+    {
+        this->workers = new Worker[nworkers];
+        for (int i = 0; i < nworkers; ++i)
+        {
+            Worker& w = this->workers[i];
+            w.pool = this;
+            w.head = w.tail = w.queued = w.stalled = 0;
+            w.stopping = false;
+            w.slots = new Slot[this->queue_len];
+            w.data = new unsigned char[this->queue_len * slot_size];
+            w.items = new Semaphore(0);
+            w.space = new Semaphore(this->queue_len);
+            w.thread = new Thread(&WorkerPool::run, &w);
+        }
+    }
+
+    /** Stop the threads once they have handled the messages already queued */
+    ~WorkerPool()
+    {
+        for (int i = 0; i < nworkers; ++i)
+        {
+            Worker& w = workers[i];
+            w.lock.lock();
+            w.stopping = true;
+            w.lock.unlock();
+            w.items->release();
+            w.thread->join();
+            delete w.thread;
+            delete w.items;
+            delete w.space;
+            delete[] w.slots;
+            delete[] w.data;
+        }
+        delete[] workers;
+    }
+
+    virtual void dispatch(Delegate<void, MessageData&>& handler, MessageData& md)
+    {
+        MQTTString& topic = md.topicName;
+        int topiclen = (topic.lenstring.data != 0) ? topic.lenstring.len : (int)strlen(topic.cstring);
+        const char* name = (topic.lenstring.data != 0) ? topic.lenstring.data : topic.cstring;
+        Worker& w = workers[hash(name, topiclen) % nworkers];
+
+        if (topiclen + md.message.payloadlen > (size_t)slot_size)
+        {
+            // too big to copy: take every slot, so that the worker is idle, and call the handler here
+            drain.lock();
+            for (int i = 0; i < queue_len; ++i)
+                w.space->wait();
+            handler(md);
+            for (int i = 0; i < queue_len; ++i)
+                w.space->release();
+            drain.unlock();
+            return;
+        }
+
+        bool stalled = (w.space->wait(0) <= 0);
+        if (stalled)
+            w.space->wait();    // backpressure: the queue is full
+        w.lock.lock();
+        if (stalled)
+            ++w.stalled;        // producers of the same worker share its lock
+        Slot& s = w.slots[w.tail];
+        unsigned char* data = &w.data[w.tail * slot_size];
+        w.tail = (w.tail + 1) % queue_len;
+        ++w.queued;
+        s.handler = handler;
+        s.message = md.message;
+        s.topiclen = topiclen;
+        memcpy(data, name, topiclen);
+        memcpy(data + topiclen, md.message.payload, md.message.payloadlen);
+        w.lock.unlock();
+        w.items->release();
+    }
+
+    /** Number of times dispatch() had to wait for a full queue */
+    int stalls()
+    {
+        int count = 0;
+        for (int i = 0; i < nworkers; ++i)
+        {
+            workers[i].lock.lock();
+            count += workers[i].stalled;
+            workers[i].lock.unlock();
+        }
+        return count;
+    }
+
+private:
+
+    struct Slot
+    {
+        Delegate<void, MessageData&> handler;
+        Message message;
+        int topiclen;
+    };
+
+    struct Worker
+    {
+        WorkerPool* pool;
+        Thread* thread;
+        Semaphore* items;       // queued messages
+        Semaphore* space;       // free slots
+        Mutex lock;             // head, tail, queued, stalled and stopping
+        Slot* slots;
+        unsigned char* data;    // topic name and payload of each slot
+        int head, tail, queued;
+        int stalled;            // times dispatch() waited for a free slot
+        bool stopping;
+    };
+
+    // FNV-1a
+    static unsigned long hash(const char* s, int len)
+    {
+        unsigned long h = 2166136261UL;
+        for (int i = 0; i < len; ++i)
+            h = (h ^ (unsigned char)s[i]) * 16777619UL;
+        return h;
+    }
+
+    static void run(void const* arg)
+    {
+        Worker& w = *(Worker*)arg;
+        int queue_len = w.pool->queue_len;
+        int slot_size = w.pool->slot_size;
+
+        while (true)
+        {
+            w.items->wait();
+            w.lock.lock();
+            if (w.queued == 0 && w.stopping)
+            {
+                w.lock.unlock();
+                break;
+            }
+            int index = w.head;
+            w.lock.unlock();
+
+            // the slot is not reused until its space is released
+            Slot& s = w.slots[index];
+            unsigned char* data = &w.data[index * slot_size];
+            MQTTString topic = MQTTString_initializer;
+            topic.lenstring.data = (char*)data;
+            topic.lenstring.len = s.topiclen;
+            Message message = s.message;
+            message.payload = data + s.topiclen;
+            MessageData md(topic, message);
+            s.handler(md);
+
+            w.lock.lock();
+            w.head = (w.head + 1) % queue_len;
+            --w.queued;
+            w.lock.unlock();
+            w.space->release();
+        }
+    }
+
+    int nworkers;
+    int queue_len;
+    int slot_size;
+    Worker* workers;
+    Mutex drain;            // one producer at a time takes all the slots of a worker
+};
+
+
+}
+
+#endif
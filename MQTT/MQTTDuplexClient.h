@@ -0,0 +1,221 @@
+/*******************************************************************************
+ * Full-duplex blocking MQTT client
+ *
+ * DuplexClient has the blocking API of MQTT::Client, but the network is read by a
+ * thread of its own: an MQTT::Async underneath receives, dispatches the messages to
+ * the handlers and completes the commands, while any number of application threads
+ * send theirs.  Each caller serializes its packet into the send buffer under the
+ * lock, then waits on a semaphore of its own until the background thread routes the
+ * ack back to it.  So a slow message handler, or heavy inbound traffic, does not hold
+ * back the publications of other threads, and there is no yield() to call.
+ *
+ * Usage:
+ *
+ *   typedef MQTT::DuplexClient<LinuxNetwork, LinuxCountdown, LinuxThread, LinuxMutex, LinuxSemaphore> Client;
+ *   Client client(network);
+ *   network.connect("localhost", 1883);
+ *   client.connect(data);
+ *   client.subscribe("sensors/#", MQTT::QOS1, onMessage);    // from any thread
+ *   client.publish("cmd/led", payload, len, MQTT::QOS1);
+ *
+ * Message handlers are called from the background thread, which is the one that
+ * reads the acks, so they cannot wait for one: from a handler, QoS0 publishes work,
+ * while QoS1/2 publishes, subscribe, unsubscribe and disconnect return FAILURE at once.
+ * With a dispatcher (setDispatcher) the handlers run on its threads, and can make
+ * any call.
+ *******************************************************************************/
+
+#if !defined(MQTT_DUPLEX_CLIENT_H)
+#define MQTT_DUPLEX_CLIENT_H
+
+#include "MQTTAsync.h"
+
+namespace MQTT
+{
+
+
+/**
+ * @param Network a network class which supports read and write, one thread reading while another writes
+ * @param Timer a timer class with the methods: countdown_ms, countdown, expired, left_ms
+ * @param Thread a thread class constructed from a function void(void const*) and its argument, with join()
+ *     and a static gettid() which identifies the calling thread with a pointer, as mbed's Thread
+ * @param Mutex a mutex class with lock and unlock
+ * @param Semaphore a counting semaphore class constructed with its count, with wait() and release()
+ * @param MAX_CONCURRENT_OPERATIONS commands which can wait for their acks at the same time, one per writer thread
+ */
+template<class Network, class Timer, class Thread, class Mutex, class Semaphore, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5,
+    int MAX_CONCURRENT_OPERATIONS = 8>
+class DuplexClient
+{
+public:
+
+    typedef Async<Network, Timer, Thread, Mutex> AsyncClient;
+    typedef void (*messageHandler)(MessageData&);
+
+    /** Construct the client
+     *  @param network - must be connected to the endpoint before calling MQTT connect
+     *  @param command_timeout_ms - time for a command to be acknowledged
+     */
+    DuplexClient(Network& network, unsigned int command_timeout_ms = 30000) : client(&network, limits(command_timeout_ms))
+    {
+
+    }
+
+    void setDefaultMessageHandler(messageHandler mh)
+    {
+        client.setDefaultMessageHandler(mh);
+    }
+
+    int setMessageHandler(const char* topicFilter, messageHandler mh)
+    {
+        return client.setMessageHandler(topicFilter, mh);
+    }
+
+    void setDispatcher(MessageDispatcher* md)
+    {
+        client.setDispatcher(md);
+    }
+
+    /** MQTT Connect - send an MQTT connect packet, wait for the connack and start the reader thread
+     *  @return success code -
+     */
+    int connect()
+    {
+        MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
+        return connect(default_options);
+    }
+
+    int connect(MQTTPacket_connectData& options)
+    {
+        return client.connect((typename AsyncClient::resultHandler)0, &options);
+    }
+
+    /** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
+     *  @return success code - FAILURE for QoS1/2 from a message handler
+     */
+    int publish(const char* topicName, Message& message)
+    {
+        // QoS0 completes in this call, the others would wait for the thread that runs the handler
+        if (message.qos != QOS0 && client.isBackgroundThread())
+            return FAILURE;
+        Waiter w;
+        if (client.publish(&DuplexClient::onResult, topicName, &message, &w) != SUCCESS)
+            return FAILURE;
+        return w.wait().rc;
+    }
+
+    int publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false)
+    {
+        unsigned short id = 0;
+        return publish(topicName, payload, payloadlen, id, qos, retained);
+    }
+
+    int publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false)
+    {
+        Message message;
+        message.qos = qos;
+        message.retained = retained;
+        message.dup = false;
+        message.id = 0;
+        message.payload = payload;
+        message.payloadlen = payloadlen;
+        int rc = publish(topicName, message);
+        id = message.id;
+        return rc;
+    }
+
+    /** MQTT Subscribe - send an MQTT subscribe packet and wait for the suback
+     *  @return success code - a refused subscription is SUCCESS, with a granted QoS of 0x80.  FAILURE from a
+     *  message handler
+     */
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh)
+    {
+        subackData data;
+        return subscribe(topicFilter, qos, mh, data);
+    }
+
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh, subackData& data)
+    {
+        if (client.isBackgroundThread())
+            return FAILURE;
+        Waiter w;
+        if (client.subscribe(&DuplexClient::onResult, topicFilter, qos, mh, &w) != SUCCESS)
+            return FAILURE;
+        typename AsyncClient::Result& res = w.wait();
+        data.grantedQoS = res.grantedQoS;
+        return res.rc;
+    }
+
+    /** MQTT Unsubscribe - send an MQTT unsubscribe packet and wait for the unsuback
+     *  @return success code - FAILURE from a message handler
+     */
+    int unsubscribe(const char* topicFilter)
+    {
+        if (client.isBackgroundThread())
+            return FAILURE;
+        Waiter w;
+        if (client.unsubscribe(&DuplexClient::onResult, topicFilter, &w) != SUCCESS)
+            return FAILURE;
+        return w.wait().rc;
+    }
+
+    /** MQTT Disconnect - send an MQTT disconnect packet and stop the reader thread.  Commands still waiting fail
+     *  @return success code - FAILURE from a message handler, as the reader thread cannot join itself
+     */
+    int disconnect()
+    {
+        if (client.isBackgroundThread())
+            return FAILURE;
+        return client.disconnect(0);
+    }
+
+    bool isConnected()
+    {
+        return client.isConnected();
+    }
+
+private:
+
+    // a caller waiting for its ack.  The Async client calls the result handler of every command it has sent
+    // exactly once (ack, timeout, disconnection), so the wait always ends
+    struct Waiter
+    {
+        Waiter() : done(0)
+        {
+
+        }
+
+        typename AsyncClient::Result& wait()
+        {
+            done.wait();
+            return result;
+        }
+
+        Semaphore done;
+        typename AsyncClient::Result result;
+    };
+
+    static void onResult(typename AsyncClient::Result* res)
+    {
+        Waiter* w = (Waiter*)res->context;
+        w->result = *res;
+        w->done.release();
+    }
+
+    static Limits limits(unsigned int command_timeout_ms)
+    {
+        Limits l;
+        l.MAX_MQTT_PACKET_SIZE = MAX_MQTT_PACKET_SIZE;
+        l.MAX_MESSAGE_HANDLERS = MAX_MESSAGE_HANDLERS;
+        l.MAX_CONCURRENT_OPERATIONS = MAX_CONCURRENT_OPERATIONS;
+        l.command_timeout_ms = command_timeout_ms;
+        return l;
+    }
+
+    AsyncClient client;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,533 @@
+/*******************************************************************************
+ * Linux backend for MQTT::Client
+ *
+ *   LinuxTick          millisecond clock based on std::chrono::steady_clock
+ *   LinuxMicroTick     microsecond clock for MQTT::ClientMetrics, same base
+ *   LinuxCountdown     Timer parameter, a TickCountdown on LinuxTick
+ *   LinuxNetwork       non-blocking TCP socket, waits for readiness with epoll.  One thread
+ *                      may read while another writes
+ *   LinuxUringNetwork  same socket, transfers through io_uring with registered
+ *                      buffers (only when MQTT_LINUX_IO_URING is defined, needs liburing)
+ *   LinuxThread        Thread parameter of MQTT::Async, on std::thread
+ *   LinuxMutex         Mutex parameter of MQTT::Async
+ *   LinuxSemaphore     Semaphore parameter of MQTT::DuplexClient
+ *
+ * Usage:
+ *
+ *   LinuxNetwork network;
+ *   MQTT::Client<LinuxNetwork, LinuxCountdown> client(network);
+ *   network.connect("localhost", 1883);
+ *
+ * Requires C++11.
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUX_H)
+#define MQTT_LINUX_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "MQTTTimerWheel.h"
+#if defined(MQTT_LINUX_IO_URING)
+#include <liburing.h>
+#endif
+
+// Size of the receive buffer. Reads smaller than this are served from memory, so the Client's
+// 1-byte header and remaining length reads do not each cost a recv system call.
+#if !defined(MQTTLINUX_RX_BUFFER_SIZE)
+    #define MQTTLINUX_RX_BUFFER_SIZE 4096
+#endif
+
+// Size of the registered transmit buffer of LinuxUringNetwork. Larger writes are split.
+#if !defined(MQTTLINUX_TX_BUFFER_SIZE)
+    #define MQTTLINUX_TX_BUFFER_SIZE 4096
+#endif
+
+
+class LinuxTick
+{
+public:
+    static unsigned long now()
+    {
+        return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+class LinuxMicroTick
+{
+public:
+    static unsigned long now()
+    {
+        return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+typedef MQTT::TickCountdown<LinuxTick> LinuxCountdown;
+
+
+class LinuxThread
+{
+public:
+    LinuxThread(void (*task)(void const*), void* argument) : thread(task, argument)
+    {
+
+    }
+
+    void join()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // identifies the calling thread, as mbed's Thread::gettid()
+    static void* gettid()
+    {
+        static thread_local char id;
+        return &id;
+    }
+
+private:
+    std::thread thread;
+};
+
+typedef std::mutex LinuxMutex;
+
+
+// counting semaphore with the wait/release interface of the mbed one
+class LinuxSemaphore
+{
+public:
+    LinuxSemaphore(int count = 0) : count(count)
+    {
+
+    }
+
+    /* waits up to timeout_ms for a token, forever if negative.  Returns the tokens there were, 0 on timeout */
+    int wait(int timeout_ms = -1)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (timeout_ms < 0)
+            cond.wait(lock, [this] { return count > 0; });
+        else if (!cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count > 0; }))
+            return 0;
+        return count--;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++count;
+        cond.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    int count;
+};
+
+
+class LinuxNetwork
+{
+public:
+    LinuxNetwork() : sock(-1), rx_head(0), rx_tail(0)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        wr_epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~LinuxNetwork()
+    {
+        disconnect();
+        if (epfd >= 0)
+            close(epfd);
+        if (wr_epfd >= 0)
+            close(wr_epfd);
+    }
+
+    /* returns 0 once connected, or a negative errno value */
+    int connect(const char* hostname, int port, int timeout_ms = 10000)
+    {
+        disconnect();
+        char service[8];
+        snprintf(service, sizeof(service), "%d", port);
+        struct addrinfo hints, *result = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int rc = getaddrinfo(hostname, service, &hints, &result);
+        if (rc != 0)
+            return (rc == EAI_SYSTEM) ? -errno : -EHOSTUNREACH;
+
+        rc = -EHOSTUNREACH;
+        for (struct addrinfo* ai = result; ai != 0 && rc != 0; ai = ai->ai_next)
+        {
+            sock = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (sock < 0)
+            {
+                rc = -errno;
+                continue;
+            }
+            if ((rc = connectSocket(ai->ai_addr, ai->ai_addrlen, timeout_ms)) != 0)
+                disconnect();
+        }
+        freeaddrinfo(result);
+        return rc;
+    }
+
+    int disconnect()
+    {
+        rx_head = rx_tail = 0;
+        if (sock < 0)
+            return 0;
+        if (epfd >= 0)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, sock, 0);
+        if (wr_epfd >= 0)
+            epoll_ctl(wr_epfd, EPOLL_CTL_DEL, sock, 0);
+        int rc = close(sock);
+        sock = -1;
+        return rc;
+    }
+
+    /* returns the number of bytes read before the timeout expires, which could be 0.
+       A negative errno value if there was an error on the socket or it was closed by the peer
+    */
+    int read(unsigned char* buffer, int len, int timeout_ms)
+    {
+        LinuxCountdown timer(timeout_ms);
+        int bytes = 0;
+        while (bytes < len)
+        {
+            // buffered data first
+            if (rx_head < rx_tail)
+            {
+                int n = rx_tail - rx_head;
+                n = (n < len - bytes) ? n : len - bytes;
+                memcpy(buffer + bytes, &rx_buf[rx_head], n);
+                rx_head += n;
+                bytes += n;
+                continue;
+            }
+            // large reads go straight to the caller, small ones refill the buffer
+            bool direct = (len - bytes >= MQTTLINUX_RX_BUFFER_SIZE);
+            ssize_t rc = direct ? recv(sock, buffer + bytes, len - bytes, 0) : recv(sock, rx_buf, MQTTLINUX_RX_BUFFER_SIZE, 0);
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            {
+                if (!waitEvent(epfd, timer))
+                    break;
+                continue;
+            }
+            if (rc <= 0)
+                return (rc == 0) ? -ENOTCONN : -errno;
+            if (direct)
+                bytes += rc;
+            else
+            {
+                rx_head = 0;
+                rx_tail = rc;
+            }
+        }
+        return bytes;
+    }
+
+    /* returns the number of bytes written before the timeout expires, or a negative errno value */
+    int write(unsigned char* buffer, int len, int timeout_ms)
+    {
+        LinuxCountdown timer(timeout_ms);
+        int bytes = 0;
+        while (bytes < len)
+        {
+            ssize_t rc = send(sock, buffer + bytes, len - bytes, MSG_NOSIGNAL);
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            {
+                if (!waitEvent(wr_epfd, timer))
+                    break;
+                continue;
+            }
+            if (rc < 0)
+                return -errno;
+            bytes += rc;
+        }
+        return bytes;
+    }
+
+    /* socket descriptor, so that an external event loop can wait on several connections */
+    int fd()
+    {
+        return sock;
+    }
+
+    /* true if there is received data that has not been read yet by the Client */
+    bool pending()
+    {
+        return rx_head < rx_tail;
+    }
+
+protected:
+    int connectSocket(const struct sockaddr* addr, socklen_t addrlen, int timeout_ms)
+    {
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        // edge triggered: events are only reported after a recv or send has returned EAGAIN.  Reads and
+        // writes wait on sets of their own, so that a reader thread never takes the event of a writer
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = sock;
+        if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) != 0)
+            return -errno;
+        ev.events = EPOLLOUT | EPOLLET;
+        if (wr_epfd < 0 || epoll_ctl(wr_epfd, EPOLL_CTL_ADD, sock, &ev) != 0)
+            return -errno;
+        if (::connect(sock, addr, addrlen) == 0)
+            return 0;
+        if (errno != EINPROGRESS)
+            return -errno;
+
+        LinuxCountdown timer(timeout_ms);
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        do
+        {
+            if (!waitEvent(wr_epfd, timer))
+                return -ETIMEDOUT;
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0)
+                return -errno;
+        }
+        while (err == 0 && !isConnected());
+        return -err;
+    }
+
+    bool isConnected()
+    {
+        struct sockaddr_storage peer;
+        socklen_t len = sizeof(peer);
+        return getpeername(sock, (struct sockaddr*)&peer, &len) == 0;
+    }
+
+    // waits for a socket event until the deadline, returns false once it has expired
+    bool waitEvent(int fd, LinuxCountdown& timer)
+    {
+        struct epoll_event ev;
+        int left = timer.left_ms();
+        if (left <= 0)
+            return false;
+        int rc = epoll_wait(fd, &ev, 1, left);
+        return rc > 0 || (rc < 0 && errno == EINTR);
+    }
+
+    int epfd;       // read events
+    int wr_epfd;    // write events
+    int sock;
+    unsigned char rx_buf[MQTTLINUX_RX_BUFFER_SIZE];
+    int rx_head;
+    int rx_tail;
+};
+
+
+#if defined(MQTT_LINUX_IO_URING)
+
+// Connects like LinuxNetwork, then moves data through an io_uring: the receive and transmit
+// buffers are registered once with the kernel (READ_FIXED/WRITE_FIXED, no per-call page pinning),
+// the socket is a registered file, and every transfer is linked to a timeout so read and write
+// keep the deadline semantics of LinuxNetwork with a single io_uring_enter call.
+class LinuxUringNetwork : public LinuxNetwork
+{
+public:
+    // entries is the submission queue size; each transfer takes two (the transfer and its timeout)
+    LinuxUringNetwork(unsigned entries = 8) : ready(false), owed(0)
+    {
+        if (io_uring_queue_init((entries < 2) ? 2 : entries, &ring, 0) != 0)
+            return;
+        struct iovec iov[2];
+        iov[RxBuffer].iov_base = rx_buf;
+        iov[RxBuffer].iov_len = sizeof(rx_buf);
+        iov[TxBuffer].iov_base = tx_buf;
+        iov[TxBuffer].iov_len = sizeof(tx_buf);
+        if (io_uring_register_buffers(&ring, iov, 2) != 0)
+        {
+            io_uring_queue_exit(&ring);
+            return;
+        }
+        ready = true;
+    }
+
+    ~LinuxUringNetwork()
+    {
+        disconnect();
+        if (ready)
+            io_uring_queue_exit(&ring);
+    }
+
+    int connect(const char* hostname, int port, int timeout_ms = 10000)
+    {
+        if (!ready)
+            return -ENOSYS;
+        // LinuxNetwork::connect would close the previous socket without unregistering it, and
+        // registering the new one would then fail with -EBUSY
+        disconnect();
+        int rc = LinuxNetwork::connect(hostname, port, timeout_ms);
+        if (rc != 0)
+            return rc;
+        // io_uring waits for readiness itself, a non-blocking socket would just return -EAGAIN
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+        if ((rc = io_uring_register_files(&ring, &sock, 1)) != 0)
+            disconnect();
+        return rc;
+    }
+
+    int disconnect()
+    {
+        if (ready && sock >= 0)
+            io_uring_unregister_files(&ring);
+        return LinuxNetwork::disconnect();
+    }
+
+    int read(unsigned char* buffer, int len, int timeout_ms)
+    {
+        LinuxCountdown timer(timeout_ms);
+        int bytes = 0;
+        while (bytes < len)
+        {
+            if (rx_head < rx_tail)
+            {
+                int n = rx_tail - rx_head;
+                n = (n < len - bytes) ? n : len - bytes;
+                memcpy(buffer + bytes, &rx_buf[rx_head], n);
+                rx_head += n;
+                bytes += n;
+                continue;
+            }
+            int left = timer.left_ms();
+            if (left <= 0 && bytes > 0)
+                break;
+            int rc = transfer(RxBuffer, rx_buf, sizeof(rx_buf), left);
+            if (rc == -ETIME || rc == -ECANCELED || rc == -EINTR)
+                break;
+            if (rc <= 0)
+                return (rc == 0) ? -ENOTCONN : rc;
+            rx_head = 0;
+            rx_tail = rc;
+        }
+        return bytes;
+    }
+
+    int write(unsigned char* buffer, int len, int timeout_ms)
+    {
+        LinuxCountdown timer(timeout_ms);
+        int bytes = 0;
+        while (bytes < len)
+        {
+            int n = (len - bytes < (int)sizeof(tx_buf)) ? len - bytes : (int)sizeof(tx_buf);
+            memcpy(tx_buf, buffer + bytes, n);
+            int rc = transfer(TxBuffer, tx_buf, n, timer.left_ms());
+            if (rc == -ETIME || rc == -ECANCELED || rc == -EINTR)
+                break;
+            if (rc < 0)
+                return rc;
+            bytes += rc;
+        }
+        return bytes;
+    }
+
+private:
+    enum { RxBuffer, TxBuffer };
+    enum { TransferTag = 1, TimeoutTag = 2 };
+
+    // submits a read (RxBuffer) or write (TxBuffer) of the registered buffer linked to a timeout,
+    // and returns its result: bytes transferred, or -ECANCELED if the timeout fired first
+    int transfer(int index, unsigned char* buf, unsigned len, int timeout_ms)
+    {
+        int rc = settle();
+        if (rc != 0)
+            return rc;
+        // the ring is empty after settle(), but io_uring_get_sqe() returns NULL whenever it is
+        // full: never use a NULL entry, and never submit a transfer without its timeout
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        struct io_uring_sqe* tsqe = (sqe != 0) ? io_uring_get_sqe(&ring) : 0;
+        if (tsqe == 0)
+        {
+            if (sqe != 0)
+            {
+                io_uring_prep_nop(sqe);
+                owed = 1;
+            }
+            return -EBUSY;
+        }
+        if (index == RxBuffer)
+            io_uring_prep_read_fixed(sqe, 0, buf, len, 0, RxBuffer);
+        else
+            io_uring_prep_write_fixed(sqe, 0, buf, len, 0, TxBuffer);
+        sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        io_uring_sqe_set_data(sqe, (void*)TransferTag);
+        struct __kernel_timespec ts;
+        timeout_ms = (timeout_ms > 0) ? timeout_ms : 0;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        io_uring_prep_link_timeout(tsqe, &ts, 0);
+        io_uring_sqe_set_data(tsqe, (void*)TimeoutTag);
+        // both entries always complete: the transfer, and the timeout (fired or cancelled)
+        owed = 2;
+
+        // the wait is bounded by the timeout, so a signal only restarts it
+        do
+            rc = io_uring_submit_and_wait(&ring, 2);
+        while (rc == -EINTR);
+        if (rc < 0)
+            return rc;
+        int result = -ECANCELED;
+        while (owed > 0)
+        {
+            struct io_uring_cqe* cqe = 0;
+            if ((rc = io_uring_wait_cqe(&ring, &cqe)) == -EINTR)
+                continue;
+            if (rc != 0)
+                return rc;
+            if (io_uring_cqe_get_data(cqe) == (void*)TransferTag)
+                result = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            --owed;
+        }
+        return result;
+    }
+
+    // reaps the completions of a transfer that failed before collecting them (submitting its
+    // entries if they are still queued), so they are not taken as results of the next one
+    int settle()
+    {
+        while (owed > 0)
+        {
+            int rc = io_uring_submit(&ring);
+            if (rc < 0 && rc != -EINTR)
+                return rc;
+            struct io_uring_cqe* cqe = 0;
+            if ((rc = io_uring_wait_cqe(&ring, &cqe)) == -EINTR)
+                continue;
+            if (rc != 0)
+                return rc;
+            io_uring_cqe_seen(&ring, cqe);
+            --owed;
+        }
+        return 0;
+    }
+
+    struct io_uring ring;
+    bool ready;
+    unsigned owed;                      // completions not yet reaped
+    unsigned char tx_buf[MQTTLINUX_TX_BUFFER_SIZE];
+};
+
+#endif
+
+#endif
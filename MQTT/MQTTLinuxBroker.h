@@ -0,0 +1,1238 @@
+/*******************************************************************************
+ * Embedded MQTT 3.1.1 broker for Linux gateways
+ *
+ * A LinuxBroker serves many client connections from the thread which calls run(), with
+ * a single epoll set for the listening socket and all the connections.  It is built on
+ * the server side of the MQTTPacket codec, and supports:
+ *
+ *   - clean and persistent sessions, with session takeover by client id
+ *   - QoS0 and QoS1 delivery.  QoS2 publications are accepted (PUBREC, PUBREL and
+ *     PUBCOMP, without duplicates) and delivered at QoS1 at most
+ *   - retained messages and wills
+ *   - keepalive, and a deadline for the CONNECT of a new connection
+ *
+ * The subscriptions are kept in a trie with a level of the topic at each node, so a
+ * publication only visits the branches it can match, whatever the number of
+ * subscriptions.  Its topic and payload are copied once into a reference-counted
+ * Message: each subscriber gets a header of its own (QoS and packet id) and shares the
+ * rest, which is gathered into the same sendmsg, and the Message is freed when the last subscriber
+ * has been sent it, or has acknowledged it.  The writes of a round of run() are
+ * gathered, so a fan-out costs one system call per subscriber connection, not per
+ * message.
+ *
+ * Usage:
+ *
+ *   LinuxBroker broker;
+ *   if (broker.listen("0.0.0.0", 1883) != 0) ...
+ *   while (running)
+ *       broker.run(1000);
+ *
+ * There is no authentication: it is meant for a trusted local network.  Requires C++11.
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUX_BROKER_H)
+#define MQTT_LINUX_BROKER_H
+
+#include "MQTTLinux.h"
+#include "MQTTPacket.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/uio.h>
+
+
+class LinuxBroker
+{
+public:
+    struct Options
+    {
+        Options() : max_connections(1024), max_packet(256 * 1024), max_inflight(32), max_queued(1000),
+            max_output(1024 * 1024), connect_timeout_ms(10000)
+        {
+        }
+
+        int max_connections;
+        int max_packet;         // larger packets close their connection
+        int max_inflight;       // QoS1 messages sent to a client and not yet acknowledged
+        int max_queued;         // QoS1 messages waiting for the window or for the client to come back, then dropped
+        size_t max_output;      // bytes waiting to be written to a client, then its QoS0 messages are dropped
+        int connect_timeout_ms;
+    };
+
+    struct Stats
+    {
+        unsigned long connections;  // open now
+        unsigned long sessions;
+        unsigned long published;    // PUBLISH packets received, and calls to publish()
+        unsigned long delivered;    // PUBLISH packets queued to the clients
+        unsigned long dropped;      // deliveries dropped by max_output or max_queued
+        unsigned long retained;     // retained messages
+    };
+
+    LinuxBroker(const Options& options = Options()) : options(options), listener(-1), epoch(0), wheel(100)
+    {
+        memset(&stats, 0, sizeof(stats));
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~LinuxBroker()
+    {
+        close();
+        while (!sessions.empty())
+            freeSession(sessions.begin()->second);
+        for (std::unordered_map<std::string, Retained>::iterator r = retainedMessages.begin(); r != retainedMessages.end(); ++r)
+            release(r->second.msg);
+        freeNode(&root);
+        if (epfd >= 0)
+            ::close(epfd);
+    }
+
+    /** Listen for connections
+     *  @param address - local address, e.g. "0.0.0.0" or "127.0.0.1"
+     *  @param port - 0 for any free port, see port()
+     *  @return 0 on success, or a negative errno value
+     */
+    int listen(const char* address, int port, int backlog = 128)
+    {
+        char service[8];
+        struct addrinfo hints, *result = 0;
+        int rc;
+
+        if (listener >= 0)
+            return -EALREADY;
+        snprintf(service, sizeof(service), "%d", port);
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if ((rc = getaddrinfo(address, service, &hints, &result)) != 0)
+            return (rc == EAI_SYSTEM) ? -errno : -EADDRNOTAVAIL;
+
+        rc = -EADDRNOTAVAIL;
+        for (struct addrinfo* ai = result; ai != 0 && rc != 0; ai = ai->ai_next)
+        {
+            int on = 1;
+            listener = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listener < 0)
+            {
+                rc = -errno;
+                continue;
+            }
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = 0;    // the listener
+            if (::bind(listener, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(listener, backlog) != 0 ||
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) != 0)
+            {
+                rc = -errno;
+                ::close(listener);
+                listener = -1;
+            }
+            else
+                rc = 0;
+        }
+        freeaddrinfo(result);
+        return rc;
+    }
+
+    /** @return the port it listens on, or a negative errno value */
+    int port()
+    {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (listener < 0 || getsockname(listener, (struct sockaddr*)&addr, &len) != 0)
+            return -ENOTCONN;
+        return ntohs((addr.ss_family == AF_INET6) ? ((struct sockaddr_in6*)&addr)->sin6_port :
+            ((struct sockaddr_in*)&addr)->sin_port);
+    }
+
+    /** Stop listening and close all the connections.  The sessions and retained messages are kept */
+    void close()
+    {
+        if (listener >= 0)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, listener, 0);
+            ::close(listener);
+            listener = -1;
+        }
+        for (size_t i = 0; i < connections.size(); ++i)
+            closeConnection(connections[i], true);
+        freeClosed();
+    }
+
+    /** Wait for network events up to timeout_ms, process them, write what they produced and run the
+     *  keepalive checks that are due
+     *  @return number of events, or a negative errno value
+     */
+    int run(int timeout_ms)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, (int)wheel.next_ms(timeout_ms > 0 ? timeout_ms : 0));
+        if (n < 0)
+            return (errno == EINTR) ? 0 : -errno;
+        for (int i = 0; i < n; ++i)
+        {
+            Connection* c = (Connection*)events[i].data.ptr;
+            if (c == 0)
+                accept();
+            else if (c->fd >= 0)
+            {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    receive(c);
+                if (c->fd >= 0 && (events[i].events & EPOLLOUT))
+                    markDirty(c);
+            }
+        }
+        wheel.run();
+        flush();
+        freeClosed();
+        return n;
+    }
+
+    /** Publish from the gateway itself, as a client would
+     *  @return 0, or -EINVAL if the topic is not valid
+     */
+    int publish(const char* topic, const void* payload, size_t payloadlen, int qos = 0, bool retained = false)
+    {
+        if (!validTopic(topic, (int)strlen(topic)))
+            return -EINVAL;
+        ++stats.published;
+        Message* m = newMessage(topic, (int)strlen(topic), (const unsigned char*)payload, (int)payloadlen);
+        forward(m, (qos > 1) ? 1 : qos, retained);
+        release(m);
+        return 0;
+    }
+
+    Stats getStats() const
+    {
+        Stats s = stats;
+        s.connections = (unsigned long)(connections.size() - closed.size());
+        s.sessions = (unsigned long)sessions.size();
+        s.retained = (unsigned long)retainedMessages.size();
+        return s;
+    }
+
+private:
+    enum { MAX_EVENTS = 64, MAX_IOV = 64 };
+
+    // the topic and payload of a publication, shared by all its deliveries
+    struct Message
+    {
+        int refs;
+        int topiclen;
+        std::vector<unsigned char> data;    // the topic name with its length, then the payload
+    };
+
+    // a packet waiting to be written
+    struct Out
+    {
+        Message* msg;           // a PUBLISH: hdr, the topic of msg, the id if withId, the payload of msg
+        unsigned char hdr[5];
+        unsigned char id[2];
+        int hlen;
+        bool withId;
+        std::vector<unsigned char> raw;    // any other packet
+        size_t sent;
+    };
+
+    struct Session;
+
+    struct Connection
+    {
+        LinuxBroker* broker;
+        int fd;
+        Session* session;       // once connected
+        std::vector<unsigned char> in;
+        size_t inlen;
+        std::deque<Out> out;
+        size_t outBytes;
+        bool pollout;
+        bool dirty;
+        unsigned long keepalive_ms;
+        MQTT::WheelTimer timer;
+    };
+
+    struct Inflight
+    {
+        unsigned short id;
+        Message* msg;
+        bool retained;
+    };
+
+    struct Queued
+    {
+        Message* msg;
+        bool retained;
+    };
+
+    struct Retained
+    {
+        Message* msg;
+        int qos;
+    };
+
+    struct Session
+    {
+        std::string clientID;
+        bool clean;
+        Connection* conn;
+        std::vector<std::string> filters;
+        std::deque<Inflight> inflight;
+        std::deque<Queued> queue;
+        unsigned short lastId;
+        std::unordered_set<unsigned short> incomingQoS2;
+        Message* will;
+        int willQoS;
+        bool willRetained;
+        unsigned long epoch;    // of the last fan-out which matched it
+        int matchQoS;
+    };
+
+    struct Subscriber
+    {
+        Session* session;
+        int qos;
+    };
+
+    // a level of the topic tree, its children by the name of the next level, "+" and "#" included
+    struct Node
+    {
+        Node* parent;
+        std::string name;
+        std::unordered_map<std::string, Node*> children;
+        std::vector<Subscriber> subscribers;
+    };
+
+    // connections
+
+    void accept()
+    {
+        for (;;)
+        {
+            int fd = accept4(listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            if ((int)(connections.size() - closed.size()) >= options.max_connections)
+            {
+                ::close(fd);
+                continue;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            Connection* c = new Connection();
+            c->broker = this;
+            c->fd = fd;
+            c->session = 0;
+            c->inlen = 0;
+            c->outBytes = 0;
+            c->pollout = false;
+            c->dirty = false;
+            c->keepalive_ms = 0;
+            c->timer.attach(&LinuxBroker::onTimeout, c);
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = c;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+            {
+                ::close(fd);
+                delete c;
+                continue;
+            }
+            connections.push_back(c);
+            wheel.start(c->timer, options.connect_timeout_ms);
+        }
+    }
+
+    static void onTimeout(MQTT::WheelTimer& timer, void* context)
+    {
+        Connection* c = (Connection*)context;
+        c->broker->closeConnection(c, false);
+    }
+
+    // the will is published unless the client disconnected
+    void closeConnection(Connection* c, bool graceful)
+    {
+        if (c->fd < 0)
+            return;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, 0);
+        ::close(c->fd);
+        c->fd = -1;
+        wheel.stop(c->timer);
+        for (size_t i = 0; i < c->out.size(); ++i)
+        {
+            if (c->out[i].msg)
+                release(c->out[i].msg);
+        }
+        c->out.clear();
+        c->outBytes = 0;
+        closed.push_back(c);
+
+        Session* s = c->session;
+        if (s == 0)
+            return;
+        c->session = 0;
+        s->conn = 0;
+        if (s->will)
+        {
+            Message* will = s->will;
+            s->will = 0;
+            if (!graceful)
+            {
+                ++stats.published;
+                forward(will, s->willQoS, s->willRetained);
+            }
+            release(will);
+        }
+        if (s->clean)
+            freeSession(s);
+    }
+
+    // connections are freed at the end of a round, when no event refers to them
+    void freeClosed()
+    {
+        for (size_t i = 0; i < closed.size(); ++i)
+        {
+            for (size_t j = 0; j < connections.size(); ++j)
+            {
+                if (connections[j] == closed[i])
+                {
+                    connections[j] = connections.back();
+                    connections.pop_back();
+                    break;
+                }
+            }
+            for (size_t j = 0; j < dirty.size(); ++j)
+            {
+                if (dirty[j] == closed[i])
+                    dirty[j] = 0;
+            }
+            delete closed[i];
+        }
+        closed.clear();
+    }
+
+    void receive(Connection* c)
+    {
+        for (int reads = 0; reads < 16 && c->fd >= 0; ++reads)
+        {
+            if (c->in.size() - c->inlen < 4096)
+                c->in.resize(c->inlen + 4096);
+            ssize_t rc = recv(c->fd, &c->in[c->inlen], c->in.size() - c->inlen, 0);
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                break;
+            if (rc <= 0)
+            {
+                closeConnection(c, false);
+                return;
+            }
+            c->inlen += rc;
+            parse(c);
+        }
+    }
+
+    void parse(Connection* c)
+    {
+        size_t start = 0;
+        while (c->fd >= 0 && c->inlen - start >= 2)
+        {
+            // fixed header: type and remaining length
+            int rem_len = 0, multiplier = 1;
+            size_t hlen = 1;
+            unsigned char b;
+            do
+            {
+                if (hlen > 4)
+                {
+                    closeConnection(c, false);  // malformed
+                    return;
+                }
+                if (start + hlen >= c->inlen)
+                    goto incomplete;
+                b = c->in[start + hlen++];
+                rem_len += (b & 127) * multiplier;
+                multiplier *= 128;
+            }
+            while (b & 128);
+            if (rem_len > options.max_packet)
+            {
+                closeConnection(c, false);
+                return;
+            }
+            if (c->inlen - start < hlen + rem_len)
+                break;
+            handle(c, &c->in[start], (int)(hlen + rem_len));
+            start += hlen + rem_len;
+        }
+incomplete:
+        if (c->fd >= 0 && start > 0)
+        {
+            memmove(&c->in[0], &c->in[start], c->inlen - start);
+            c->inlen -= start;
+        }
+    }
+
+    // output
+
+    void markDirty(Connection* c)
+    {
+        if (!c->dirty)
+        {
+            c->dirty = true;
+            dirty.push_back(c);
+        }
+    }
+
+    void sendRaw(Connection* c, const unsigned char* buf, int len)
+    {
+        if (c == 0 || c->fd < 0 || len <= 0)
+            return;
+        c->out.push_back(Out());
+        Out& o = c->out.back();
+        o.msg = 0;
+        o.hlen = 0;
+        o.withId = false;
+        o.raw.assign(buf, buf + len);
+        o.sent = 0;
+        c->outBytes += len;
+        markDirty(c);
+    }
+
+    void sendAck(Connection* c, int type, unsigned short id)
+    {
+        unsigned char ack[4];
+        sendRaw(c, ack, MQTTSerialize_ack(ack, sizeof(ack), type, 0, id));
+    }
+
+    void sendPublish(Connection* c, Message* m, int qos, bool retained, unsigned short id, bool dup)
+    {
+        c->out.push_back(Out());
+        Out& o = c->out.back();
+        o.msg = m;
+        ++m->refs;
+        o.hdr[0] = (unsigned char)((PUBLISH << 4) | (dup ? 0x08 : 0) | (qos << 1) | (retained ? 1 : 0));
+        o.hlen = 1 + MQTTPacket_encode(&o.hdr[1], (int)m->data.size() + ((qos > 0) ? 2 : 0));
+        o.withId = (qos > 0);
+        o.id[0] = (unsigned char)(id >> 8);
+        o.id[1] = (unsigned char)(id & 0xFF);
+        o.sent = 0;
+        c->outBytes += size(o);
+        ++stats.delivered;
+        markDirty(c);
+    }
+
+    static size_t size(const Out& o)
+    {
+        return o.msg ? o.hlen + o.msg->data.size() + (o.withId ? 2 : 0) : o.raw.size();
+    }
+
+    // the pieces of a packet, without its first skip bytes
+    static int pieces(Out& o, struct iovec* iov, size_t skip)
+    {
+        struct iovec all[4];
+        int n = 0, count = 0;
+        if (o.msg == 0)
+        {
+            all[n].iov_base = &o.raw[0];
+            all[n++].iov_len = o.raw.size();
+        }
+        else
+        {
+            all[n].iov_base = o.hdr;
+            all[n++].iov_len = o.hlen;
+            all[n].iov_base = &o.msg->data[0];
+            all[n++].iov_len = 2 + o.msg->topiclen;
+            if (o.withId)
+            {
+                all[n].iov_base = o.id;
+                all[n++].iov_len = 2;
+            }
+            if (o.msg->data.size() > (size_t)(2 + o.msg->topiclen))
+            {
+                all[n].iov_base = &o.msg->data[2 + o.msg->topiclen];
+                all[n++].iov_len = o.msg->data.size() - 2 - o.msg->topiclen;
+            }
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            if (skip >= all[i].iov_len)
+            {
+                skip -= all[i].iov_len;
+                continue;
+            }
+            iov[count].iov_base = (unsigned char*)all[i].iov_base + skip;
+            iov[count++].iov_len = all[i].iov_len - skip;
+            skip = 0;
+        }
+        return count;
+    }
+
+    // writes what the round produced, a sendmsg per connection
+    void flush()
+    {
+        for (size_t i = 0; i < dirty.size(); ++i)
+        {
+            Connection* c = dirty[i];
+            if (c == 0 || c->fd < 0)
+                continue;
+            c->dirty = false;
+            write(c);
+        }
+        dirty.clear();
+    }
+
+    void write(Connection* c)
+    {
+        while (!c->out.empty())
+        {
+            struct iovec iov[MAX_IOV];
+            int n = 0;
+            for (size_t i = 0; i < c->out.size() && n <= MAX_IOV - 4; ++i)
+                n += pieces(c->out[i], &iov[n], (i == 0) ? c->out[0].sent : 0);
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            ssize_t rc = sendmsg(c->fd, &msg, MSG_NOSIGNAL);   // no SIGPIPE from a client gone
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                break;
+            if (rc < 0)
+            {
+                closeConnection(c, false);
+                return;
+            }
+            c->outBytes -= rc;
+            size_t written = rc;
+            while (written > 0)
+            {
+                Out& o = c->out.front();
+                size_t left = size(o) - o.sent;
+                if (written < left)
+                {
+                    o.sent += written;
+                    break;
+                }
+                written -= left;
+                if (o.msg)
+                    release(o.msg);
+                c->out.pop_front();
+            }
+        }
+        // wait for the socket only while there is something left
+        bool pollout = !c->out.empty();
+        if (pollout != c->pollout)
+        {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = pollout ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            ev.data.ptr = c;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+            c->pollout = pollout;
+        }
+    }
+
+    // the packets from the clients
+
+    void handle(Connection* c, unsigned char* buf, int len)
+    {
+        int type = buf[0] >> 4;
+        Session* s = c->session;
+
+        if (type == CONNECT)
+        {
+            if (s)
+                closeConnection(c, false);  // a second CONNECT
+            else
+                connect(c, buf, len);
+            return;
+        }
+        if (s == 0)
+        {
+            closeConnection(c, false);
+            return;
+        }
+        if (c->keepalive_ms > 0)
+            wheel.start(c->timer, c->keepalive_ms);
+
+        switch (type)
+        {
+            case PUBLISH:
+                publish(c, buf, len);
+                break;
+
+            case PUBACK:
+            case PUBREL:
+            {
+                unsigned char acktype, dup;
+                unsigned short id;
+                if (MQTTDeserialize_ack(&acktype, &dup, &id, buf, len) != 1)
+                    closeConnection(c, false);
+                else if (type == PUBREL)
+                {
+                    s->incomingQoS2.erase(id);
+                    sendAck(c, PUBCOMP, id);
+                }
+                else
+                    acknowledged(s, id);
+                break;
+            }
+
+            case SUBSCRIBE:
+                subscribe(c, buf, len);
+                break;
+
+            case UNSUBSCRIBE:
+                unsubscribe(c, buf, len);
+                break;
+
+            case PINGREQ:
+            {
+                // the codec has no PINGRESP serializer
+                const unsigned char pingresp[2] = {PINGRESP << 4, 0};
+                sendRaw(c, pingresp, sizeof(pingresp));
+                break;
+            }
+
+            case DISCONNECT:
+                if (s->will)
+                {
+                    release(s->will);
+                    s->will = 0;
+                }
+                closeConnection(c, true);
+                break;
+
+            default:
+                closeConnection(c, false);     // it sends QoS1 at most, so no PUBREC nor PUBCOMP is expected
+                break;
+        }
+    }
+
+    void connect(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        unsigned char connack[4];
+        Session* s = 0;
+        bool present = false;
+
+        int rc = 0;
+        if (MQTTDeserialize_connect(&data, buf, len) != 1)
+        {
+            // the codec only parses the protocol levels it knows: the others get the CONNACK which refuses them
+            int start = 1;
+            while (start < len && (buf[start++] & 128))
+                ;
+            if (start + 7 > len || memcmp(&buf[start], "\0\4MQTT", 6) != 0)
+            {
+                closeConnection(c, false);
+                return;
+            }
+            rc = 1;
+        }
+        std::string clientID = (rc == 0) ? toString(data.clientID) : std::string();
+        if (rc == 0 && clientID.empty() && !data.cleansession)
+            rc = 2;
+        if (rc != 0)
+        {
+            sendRaw(c, connack, MQTTSerialize_connack(connack, sizeof(connack), rc, 0));
+            write(c);
+            closeConnection(c, false);
+            return;
+        }
+        if (clientID.empty())
+        {
+            char id[32];
+            snprintf(id, sizeof(id), "auto-%lu", ++epoch);
+            clientID = id;
+        }
+
+        std::unordered_map<std::string, Session*>::iterator it = sessions.find(clientID);
+        if (it != sessions.end())
+        {
+            s = it->second;
+            if (s->conn)
+            {
+                // taken over, which frees a clean session
+                bool clean = s->clean;
+                closeConnection(s->conn, false);
+                if (clean)
+                    s = 0;
+            }
+            if (s && (s->clean || data.cleansession))
+            {
+                freeSession(s);
+                s = 0;
+            }
+        }
+        if (s)
+            present = true;
+        else
+        {
+            s = new Session();
+            s->clientID = clientID;
+            s->lastId = 0;
+            s->will = 0;
+            s->epoch = 0;
+            sessions[clientID] = s;
+        }
+        s->clean = data.cleansession;
+        s->conn = c;
+        c->session = s;
+        if (data.willFlag)
+        {
+            std::string topic = toString(data.will.topicName);
+            std::string message = toString(data.will.message);
+            if (!validTopic(topic.c_str(), (int)topic.size()))
+            {
+                closeConnection(c, false);
+                return;
+            }
+            s->will = newMessage(topic.c_str(), (int)topic.size(), (const unsigned char*)message.data(), (int)message.size());
+            s->willQoS = (data.will.qos > 1) ? 1 : data.will.qos;
+            s->willRetained = data.will.retained;
+        }
+        c->keepalive_ms = data.keepAliveInterval * 1500UL;
+        if (c->keepalive_ms > 0)
+            wheel.start(c->timer, c->keepalive_ms);
+        else
+            wheel.stop(c->timer);
+        sendRaw(c, connack, MQTTSerialize_connack(connack, sizeof(connack), 0, present));
+
+        // what the client did not acknowledge, then what it missed
+        for (size_t i = 0; i < s->inflight.size(); ++i)
+            sendPublish(c, s->inflight[i].msg, 1, s->inflight[i].retained, s->inflight[i].id, true);
+        pump(s);
+    }
+
+    void publish(Connection* c, unsigned char* buf, int len)
+    {
+        unsigned char dup, retained;
+        int qos, payloadlen;
+        unsigned short id;
+        MQTTString topicName;
+        unsigned char* payload;
+        Session* s = c->session;
+
+        if (MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topicName, &payload, &payloadlen, buf, len) != 1 ||
+                !validTopic(topicName.lenstring.data, topicName.lenstring.len))
+        {
+            closeConnection(c, false);
+            return;
+        }
+        if (qos == 2)
+        {
+            sendAck(c, PUBREC, id);
+            if (!s->incomingQoS2.insert(id).second)
+                return;     // a duplicate, already forwarded
+        }
+        else if (qos == 1)
+            sendAck(c, PUBACK, id);
+
+        ++stats.published;
+        Message* m = newMessage(topicName.lenstring.data, topicName.lenstring.len, payload, payloadlen);
+        forward(m, (qos > 1) ? 1 : qos, retained != 0);
+        release(m);
+    }
+
+    void acknowledged(Session* s, unsigned short id)
+    {
+        for (size_t i = 0; i < s->inflight.size(); ++i)
+        {
+            if (s->inflight[i].id == id)
+            {
+                release(s->inflight[i].msg);
+                s->inflight.erase(s->inflight.begin() + i);
+                pump(s);
+                return;
+            }
+        }
+    }
+
+    void subscribe(Connection* c, unsigned char* buf, int len)
+    {
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+        int max = len / 3 + 1;      // each filter takes 3 bytes at least
+        std::vector<MQTTString> filters(max);
+        std::vector<int> qos(max);
+        Session* s = c->session;
+
+        if (MQTTDeserialize_subscribe(&dup, &id, max, &count, &filters[0], &qos[0], buf, len) != 1 || count == 0)
+        {
+            closeConnection(c, false);
+            return;
+        }
+        std::vector<std::string> names(count);
+        for (int i = 0; i < count; ++i)
+        {
+            names[i] = toString(filters[i]);
+            if (!validFilter(names[i]) || qos[i] < 0 || qos[i] > 2)
+                qos[i] = 0x80;
+            else
+            {
+                qos[i] = (qos[i] > 1) ? 1 : qos[i];
+                addSubscription(s, names[i], qos[i]);
+            }
+        }
+        std::vector<unsigned char> suback(count + 8);
+        sendRaw(c, &suback[0], MQTTSerialize_suback(&suback[0], (int)suback.size(), id, count, &qos[0]));
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (qos[i] == 0x80)
+                continue;
+            for (std::unordered_map<std::string, Retained>::iterator r = retainedMessages.begin();
+                    r != retainedMessages.end(); ++r)
+            {
+                if (matches(names[i], r->first))
+                    deliver(s, r->second.msg, (r->second.qos < qos[i]) ? r->second.qos : qos[i], true);
+            }
+        }
+    }
+
+    void unsubscribe(Connection* c, unsigned char* buf, int len)
+    {
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+        int max = len / 2 + 1;
+        std::vector<MQTTString> filters(max);
+        unsigned char unsuback[4];
+
+        if (MQTTDeserialize_unsubscribe(&dup, &id, max, &count, &filters[0], buf, len) != 1)
+        {
+            closeConnection(c, false);
+            return;
+        }
+        for (int i = 0; i < count; ++i)
+            removeSubscription(c->session, toString(filters[i]));
+        sendRaw(c, unsuback, MQTTSerialize_unsuback(unsuback, sizeof(unsuback), id));
+    }
+
+    // the fan-out
+
+    Message* newMessage(const char* topic, int topiclen, const unsigned char* payload, int payloadlen)
+    {
+        Message* m = new Message();
+        m->refs = 1;
+        m->topiclen = topiclen;
+        m->data.resize(2 + topiclen + payloadlen);
+        m->data[0] = (unsigned char)(topiclen >> 8);
+        m->data[1] = (unsigned char)(topiclen & 0xFF);
+        memcpy(&m->data[2], topic, topiclen);
+        if (payloadlen > 0)
+            memcpy(&m->data[2 + topiclen], payload, payloadlen);
+        return m;
+    }
+
+    static void release(Message* m)
+    {
+        if (--m->refs == 0)
+            delete m;
+    }
+
+    void forward(Message* m, int qos, bool retained)
+    {
+        std::string topic((const char*)&m->data[2], m->topiclen);
+
+        if (retained)
+        {
+            std::unordered_map<std::string, Retained>::iterator r = retainedMessages.find(topic);
+            if (r != retainedMessages.end())
+            {
+                release(r->second.msg);
+                retainedMessages.erase(r);
+            }
+            // an empty retained message clears the topic
+            if (m->data.size() > (size_t)(2 + m->topiclen))
+            {
+                Retained kept = { m, qos };
+                ++m->refs;
+                retainedMessages[topic] = kept;
+            }
+        }
+
+        // the sessions whose subscriptions match, each once at the highest of their QoS
+        std::vector<std::string> levels;
+        split(topic, levels);
+        ++epoch;
+        matched.clear();
+        collect(&root, levels, 0, topic[0] == '$');
+        for (size_t i = 0; i < matched.size(); ++i)
+        {
+            Session* s = matched[i];
+            deliver(s, m, (qos < s->matchQoS) ? qos : s->matchQoS, false);
+        }
+    }
+
+    void collect(Node* node, const std::vector<std::string>& levels, size_t i, bool system)
+    {
+        std::unordered_map<std::string, Node*>::iterator child;
+        bool wildcards = !(system && i == 0);   // wildcards do not match the $ topics
+
+        // "a/#" matches "a" and all below it
+        if (wildcards && (child = node->children.find("#")) != node->children.end())
+            match(child->second);
+        if (i == levels.size())
+        {
+            match(node);
+            return;
+        }
+        if ((child = node->children.find(levels[i])) != node->children.end())
+            collect(child->second, levels, i + 1, system);
+        if (wildcards && (child = node->children.find("+")) != node->children.end())
+            collect(child->second, levels, i + 1, system);
+    }
+
+    void match(Node* node)
+    {
+        for (size_t i = 0; i < node->subscribers.size(); ++i)
+        {
+            Session* s = node->subscribers[i].session;
+            if (s->epoch != epoch)
+            {
+                s->epoch = epoch;
+                s->matchQoS = node->subscribers[i].qos;
+                matched.push_back(s);
+            }
+            else if (node->subscribers[i].qos > s->matchQoS)
+                s->matchQoS = node->subscribers[i].qos;
+        }
+    }
+
+    void deliver(Session* s, Message* m, int qos, bool retained)
+    {
+        Connection* c = s->conn;
+        if (qos == 0)
+        {
+            if (c && c->outBytes < options.max_output)
+                sendPublish(c, m, 0, retained, 0, false);
+            else if (c)
+                ++stats.dropped;
+            return;
+        }
+        if ((int)s->queue.size() >= options.max_queued)
+        {
+            ++stats.dropped;
+            return;
+        }
+        Queued q = { m, retained };
+        ++m->refs;
+        s->queue.push_back(q);
+        pump(s);
+    }
+
+    // sends the queued QoS1 messages that fit in the window
+    void pump(Session* s)
+    {
+        while (s->conn && !s->queue.empty() && (int)s->inflight.size() < options.max_inflight)
+        {
+            Queued q = s->queue.front();
+            s->queue.pop_front();
+            Inflight f = { nextId(s), q.msg, q.retained };
+            s->inflight.push_back(f);   // takes the reference of the queue
+            sendPublish(s->conn, q.msg, 1, q.retained, f.id, false);
+        }
+    }
+
+    unsigned short nextId(Session* s)
+    {
+        for (;;)
+        {
+            if (++s->lastId == 0)
+                s->lastId = 1;
+            size_t i = 0;
+            while (i < s->inflight.size() && s->inflight[i].id != s->lastId)
+                ++i;
+            if (i == s->inflight.size())
+                return s->lastId;
+        }
+    }
+
+    // the subscription trie
+
+    static void split(const std::string& topic, std::vector<std::string>& levels)
+    {
+        size_t start = 0;
+        for (;;)
+        {
+            size_t end = topic.find('/', start);
+            levels.push_back(topic.substr(start, (end == std::string::npos) ? std::string::npos : end - start));
+            if (end == std::string::npos)
+                break;
+            start = end + 1;
+        }
+    }
+
+    void addSubscription(Session* s, const std::string& filter, int qos)
+    {
+        std::vector<std::string> levels;
+        split(filter, levels);
+        Node* node = &root;
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            Node*& child = node->children[levels[i]];
+            if (child == 0)
+            {
+                child = new Node();
+                child->parent = node;
+                child->name = levels[i];
+            }
+            node = child;
+        }
+        for (size_t i = 0; i < node->subscribers.size(); ++i)
+        {
+            if (node->subscribers[i].session == s)
+            {
+                node->subscribers[i].qos = qos;
+                return;
+            }
+        }
+        Subscriber sub = { s, qos };
+        node->subscribers.push_back(sub);
+        s->filters.push_back(filter);
+    }
+
+    void removeSubscription(Session* s, const std::string& filter)
+    {
+        std::vector<std::string> levels;
+        split(filter, levels);
+        Node* node = &root;
+        for (size_t i = 0; i < levels.size() && node; ++i)
+        {
+            std::unordered_map<std::string, Node*>::iterator child = node->children.find(levels[i]);
+            node = (child != node->children.end()) ? child->second : 0;
+        }
+        if (node == 0)
+            return;
+        for (size_t i = 0; i < node->subscribers.size(); ++i)
+        {
+            if (node->subscribers[i].session == s)
+            {
+                node->subscribers[i] = node->subscribers.back();
+                node->subscribers.pop_back();
+                break;
+            }
+        }
+        for (size_t i = 0; i < s->filters.size(); ++i)
+        {
+            if (s->filters[i] == filter)
+            {
+                s->filters[i] = s->filters.back();
+                s->filters.pop_back();
+                break;
+            }
+        }
+        // prune the branch it leaves empty
+        while (node != &root && node->subscribers.empty() && node->children.empty())
+        {
+            Node* parent = node->parent;
+            parent->children.erase(node->name);
+            delete node;
+            node = parent;
+        }
+    }
+
+    void freeSession(Session* s)
+    {
+        while (!s->filters.empty())
+            removeSubscription(s, std::string(s->filters.back()));
+        for (size_t i = 0; i < s->inflight.size(); ++i)
+            release(s->inflight[i].msg);
+        for (size_t i = 0; i < s->queue.size(); ++i)
+            release(s->queue[i].msg);
+        if (s->will)
+            release(s->will);
+        if (s->conn)
+            s->conn->session = 0;
+        sessions.erase(s->clientID);
+        delete s;
+    }
+
+    static void freeNode(Node* node)
+    {
+        for (std::unordered_map<std::string, Node*>::iterator i = node->children.begin(); i != node->children.end(); ++i)
+        {
+            freeNode(i->second);
+            delete i->second;
+        }
+    }
+
+    // topics
+
+    static std::string toString(MQTTString& s)
+    {
+        return s.cstring ? std::string(s.cstring) : std::string(s.lenstring.data, s.lenstring.len);
+    }
+
+    static bool validTopic(const char* topic, int len)
+    {
+        if (len == 0)
+            return false;
+        for (int i = 0; i < len; ++i)
+        {
+            if (topic[i] == '+' || topic[i] == '#' || topic[i] == '\0')
+                return false;
+        }
+        return true;
+    }
+
+    // + and # take a whole level, # only the last one
+    static bool validFilter(const std::string& filter)
+    {
+        if (filter.empty())
+            return false;
+        for (size_t i = 0; i < filter.size(); ++i)
+        {
+            char c = filter[i];
+            if (c == '\0')
+                return false;
+            if ((c == '+' || c == '#') && ((i > 0 && filter[i - 1] != '/') || (i + 1 < filter.size() && filter[i + 1] != '/')))
+                return false;
+            if (c == '#' && i + 1 != filter.size())
+                return false;
+        }
+        return true;
+    }
+
+    // for the retained messages of a new subscription
+    static bool matches(const std::string& filter, const std::string& topic)
+    {
+        std::vector<std::string> f, t;
+        split(filter, f);
+        split(topic, t);
+        if (topic[0] == '$' && (f[0] == "+" || f[0] == "#"))
+            return false;
+        for (size_t i = 0; i < f.size(); ++i)
+        {
+            if (f[i] == "#")
+                return true;
+            if (i == t.size() || (f[i] != "+" && f[i] != t[i]))
+                return false;
+        }
+        return f.size() == t.size();
+    }
+
+    Options options;
+    int epfd;
+    int listener;
+    Stats stats;
+    std::vector<Connection*> connections;
+    std::vector<Connection*> closed;
+    std::vector<Connection*> dirty;
+    std::unordered_map<std::string, Session*> sessions;
+    std::unordered_map<std::string, Retained> retainedMessages;
+    Node root;
+    std::vector<Session*> matched;
+    unsigned long epoch;
+    MQTT::TimerWheel<LinuxTick> wheel;
+};
+
+#endif
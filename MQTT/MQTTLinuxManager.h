@@ -0,0 +1,237 @@
+/*******************************************************************************
+ * Drives many MQTT::Client instances from one thread on Linux
+ *
+ * Each client is added once it is connected, together with its Network, which must
+ * provide fd() and pending() as LinuxNetwork does. run() waits on a single epoll set
+ * for all the sockets, processes the packets of the readable clients with drain(), and
+ * calls keepalive() on every client once per check period. Clients whose network holds
+ * data read by a call made outside run() are processed without waiting. The keepalive checks are
+ * kept on a TimerWheel shared by all the clients, so an idle client costs nothing
+ * until its deadline comes round.
+ *
+ * Usage:
+ *
+ *   typedef MQTT::Client<LinuxNetwork, LinuxCountdown> Client;
+ *   LinuxClientManager<LinuxNetwork, Client> manager;
+ *   ... network[i].connect(...); client[i].connect(...);
+ *   manager.add(network[i], client[i]);
+ *   while (manager.size() > 0)
+ *       manager.run(100);
+ *
+ * Requires C++11.
+ *******************************************************************************/
+
+#if !defined(MQTT_LINUX_MANAGER_H)
+#define MQTT_LINUX_MANAGER_H
+
+#include "MQTTLinux.h"
+#include <vector>
+
+
+template<class Network, class Client>
+class LinuxClientManager
+{
+public:
+    typedef void (*disconnectHandler)(Network&, Client&);
+
+    /** Construct the manager
+     *  @param check_ms - period of the keepalive checks of each client, in milliseconds
+     */
+    LinuxClientManager(int check_ms = 1000) : count(0), handler(0), dispatching(false), check_ms(check_ms > 0 ? check_ms : 1),
+        wheel((check_ms / 64 > 0) ? check_ms / 64 : 1)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~LinuxClientManager()
+    {
+        for (size_t i = 0; i < entries.size(); ++i)
+            delete entries[i];
+        if (epfd >= 0)
+            close(epfd);
+    }
+
+    /** Called with each client removed by the manager after a network or keepalive failure
+     *  @param dh - pointer to the callback function.  Set to 0 to remove.
+     */
+    void setDisconnectHandler(disconnectHandler dh)
+    {
+        handler = dh;
+    }
+
+    /** Add a connected client
+     *  @return 0 on success, or a negative errno value
+     */
+    int add(Network& network, Client& client)
+    {
+        Entry* e = 0;
+        for (size_t i = 0; i < entries.size() && e == 0; ++i)
+        {
+            if (entries[i]->idle)
+                e = entries[i];
+        }
+        if (e == 0)
+        {
+            e = new Entry();
+            e->manager = this;
+            e->timer.attach(&LinuxClientManager::onCheck, e);
+            entries.push_back(e);
+        }
+        e->network = &network;
+        e->client = &client;
+        e->idle = false;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = e;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, network.fd(), &ev) != 0)
+        {
+            e->client = 0;
+            e->idle = true;
+            return -errno;
+        }
+        // spread the checks of the clients over the period
+        wheel.start(e->timer, (count % 64) * check_ms / 64);
+        ++count;
+        return 0;
+    }
+
+    /** Remove a client, without disconnecting it
+     *  @return 0 on success, -ENOENT if the client is not managed
+     */
+    int remove(Client& client)
+    {
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (entries[i]->client == &client)
+            {
+                release(entries[i]);
+                return 0;
+            }
+        }
+        return -ENOENT;
+    }
+
+    /** Number of managed clients */
+    int size()
+    {
+        return count;
+    }
+
+    /** Wait for network events up to timeout_ms, process them and run the keepalive checks that are due
+     *  @return number of clients which had network events, or a negative errno value
+     */
+    int run(int timeout_ms)
+    {
+        // data that a call made outside run() (a QoS1 publish waiting for its PUBACK, for instance) left
+        // buffered in a network raises no epoll event: do not wait if there is any
+        bool buffered = false;
+        for (size_t i = 0; i < entries.size() && !buffered; ++i)
+            buffered = (entries[i]->client != 0 && entries[i]->network->pending());
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, buffered ? 0 : (int)wheel.next_ms(timeout_ms > 0 ? timeout_ms : 0));
+        if (n < 0)
+            return (errno == EINTR) ? 0 : -errno;
+        // entries released while the events are dispatched are not reused until the end of the batch, so an
+        // event still queued for a removed client never reaches a client added in its place
+        dispatching = true;
+        for (int i = 0; i < n; ++i)
+            process((Entry*)events[i].data.ptr);
+        for (size_t i = 0; buffered && i < entries.size(); ++i)
+        {
+            if (entries[i]->client != 0 && entries[i]->network->pending())
+                process(entries[i]);
+        }
+        dispatching = false;
+        for (size_t i = 0; i < released.size(); ++i)
+            released[i]->idle = true;
+        released.clear();
+
+        // keepalive checks that are due
+        wheel.run();
+
+        // handlers run last, so that they can add or remove clients
+        for (size_t i = 0; i < dropped.size(); ++i)
+        {
+            if (handler)
+                handler(*dropped[i].network, *dropped[i].client);
+        }
+        dropped.clear();
+        return n;
+    }
+
+private:
+    enum { MAX_EVENTS = 64 };
+
+    struct Entry
+    {
+        LinuxClientManager* manager;
+        Network* network;
+        Client* client;
+        bool idle;                      // free for add()
+        MQTT::WheelTimer timer;
+    };
+
+    struct Dropped
+    {
+        Network* network;
+        Client* client;
+    };
+
+    // a batch per client and round, so that a busy client does not hold back the others.  Data already
+    // buffered by the network is not seen by epoll, it is taken now.  A message handler may remove the
+    // client at any point, so it is checked before each step
+    void process(Entry* e)
+    {
+        int rc = 0;
+        while (e->client != 0)
+        {
+            rc = e->client->drain(0, MQTTCLIENT_DRAIN_BUDGET);
+            if (rc < 0 || e->client == 0 || !e->network->pending())
+                break;
+        }
+        if (rc < 0 && e->client != 0)
+            drop(e);
+    }
+
+    static void onCheck(MQTT::WheelTimer& timer, void* context)
+    {
+        Entry* e = (Entry*)context;
+        if (e->client->keepalive() < 0 || !e->client->isConnected())
+            e->manager->drop(e);
+        else
+            e->manager->wheel.start(timer, e->manager->check_ms);
+    }
+
+    void release(Entry* e)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, e->network->fd(), 0);
+        wheel.stop(e->timer);
+        e->client = 0;
+        if (dispatching)
+            released.push_back(e);
+        else
+            e->idle = true;
+        --count;
+    }
+
+    void drop(Entry* e)
+    {
+        Dropped d = { e->network, e->client };
+        dropped.push_back(d);
+        release(e);
+    }
+
+    int epfd;
+    int count;
+    disconnectHandler handler;
+    std::vector<Entry*> entries;
+    std::vector<Dropped> dropped;
+    std::vector<Entry*> released;       // released during the current batch of events
+    bool dispatching;
+    int check_ms;
+    MQTT::TimerWheel<LinuxTick> wheel;
+};
+
+#endif
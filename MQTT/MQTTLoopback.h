@@ -0,0 +1,1244 @@
+/*******************************************************************************
+ * In-process loopback broker for tests and benchmarks of MQTT::Client
+ *
+ *   LoopbackBroker     a small broker built on the server side of the MQTTPacket codec:
+ *                      sessions (clean or not), QoS0, 1 and 2 both ways, retained
+ *                      messages, wills, and + and # wildcards
+ *   LoopbackNetwork    Network parameter of the Client, a link to a LoopbackBroker with
+ *                      the latency, bandwidth and loss of a LinkProfile
+ *   LoopbackClock      virtual millisecond clock, LoopbackCountdown the Timer parameter,
+ *                      LoopbackMicroTick the microsecond clock of ClientMetrics
+ *
+ * Usage:
+ *
+ *   MQTT::LoopbackBroker broker;
+ *   MQTT::LoopbackNetwork network;
+ *   MQTT::Client<MQTT::LoopbackNetwork, MQTT::LoopbackCountdown> client(network);
+ *   network.connect(broker, MQTT::LinkProfile(10000, 125000));   // 10 ms each way, 1 Mbit/s
+ *   client.connect(options);
+ *
+ * Nothing runs in the background: the broker handles the packets which have arrived
+ * whenever a LoopbackNetwork reads, and the clock only moves forward when a read has to
+ * wait, straight to the time of the next packet.  So a run does not depend on the load of
+ * the machine, and is repeated exactly by the same program with the same seed, whatever
+ * the latencies, in a fraction of their real time.  Everything must be used from a
+ * single thread, and the broker must outlive its networks.
+ *
+ * A write is not lost but delayed: with probability loss the segment arrives
+ * retransmit_us later, and holds back those behind it, as with TCP.
+ *******************************************************************************/
+
+#if !defined(MQTT_LOOPBACK_H)
+#define MQTT_LOOPBACK_H
+
+#include <string.h>
+#include "MQTTPacket.h"
+#include "MQTTTimerWheel.h"
+
+namespace MQTT
+{
+
+
+/* Virtual time of all the loopback brokers of the program */
+class LoopbackClock
+{
+public:
+    /** @return milliseconds, the Clock of a TickCountdown */
+    static unsigned long now()
+    {
+        return (unsigned long)(time() / 1000);
+    }
+
+    static unsigned long long micros()
+    {
+        return time();
+    }
+
+    static void advanceTo(unsigned long long us)
+    {
+        if (us > time())
+            time() = us;
+    }
+
+private:
+    static unsigned long long& time()
+    {
+        static unsigned long long t = 0;
+        return t;
+    }
+};
+
+
+class LoopbackMicroTick
+{
+public:
+    static unsigned long now()
+    {
+        return (unsigned long)LoopbackClock::micros();
+    }
+};
+
+
+typedef TickCountdown<LoopbackClock> LoopbackCountdown;
+
+
+/* The conditions of a link, the same both ways */
+struct LinkProfile
+{
+    /** @param latency_us - one way delay
+     *  @param bandwidth - bytes per second, 0 for no limit
+     *  @param loss - probability that a write has to be retransmitted, from 0 to 1
+     *  @param retransmit_us - the delay of a retransmission
+     */
+    LinkProfile(unsigned long latency_us = 0, unsigned long bandwidth = 0, double loss = 0.0,
+        unsigned long retransmit_us = 200000) : latency_us(latency_us), bandwidth(bandwidth), loss(loss),
+        retransmit_us(retransmit_us)
+    {
+    }
+
+    unsigned long latency_us;
+    unsigned long bandwidth;
+    double loss;
+    unsigned long retransmit_us;
+};
+
+
+class LoopbackNetwork;
+
+
+class LoopbackBroker
+{
+public:
+    /** Construct the broker
+     *  @param maxQoS - highest QoS granted to the subscriptions
+     *  @param seed - of the losses, any value but 0
+     *  @param maxQueued - QoS1/2 messages kept for each session while they are unacknowledged or the client is
+     *      away, the next ones are dropped
+     */
+    LoopbackBroker(int maxQoS = 2, unsigned long long seed = 1, int maxQueued = 1000) : maxQoS(maxQoS),
+        maxQueued(maxQueued), random(seed ? seed : 1), seq(0), links(0), sessions(0), retained(0), scratch(0),
+        scratch_size(0), published_count(0), delivered_count(0), dropped_count(0), lost_count(0)
+    {
+    }
+
+    ~LoopbackBroker()
+    {
+        while (links)
+            freeLink(links);
+        while (sessions)
+            freeSession(sessions);
+        while (retained)
+        {
+            Retained* r = retained;
+            retained = r->next;
+            delete[] r->topic;
+            delete[] r->payload;
+            delete r;
+        }
+        delete[] scratch;
+    }
+
+    /** Move the clock forward, handling the packets which arrive meanwhile
+     *  @param ms - time to move
+     */
+    void advance(unsigned long ms)
+    {
+        unsigned long long end = LoopbackClock::micros() + ms * 1000ULL;
+        for (;;)
+        {
+            unsigned long long next = nextArrival();
+            if (next > end)
+                break;
+            LoopbackClock::advanceTo(next);
+            run(next);
+        }
+        LoopbackClock::advanceTo(end);
+    }
+
+    /** Move the clock forward to the next time a packet arrives, at the broker or at a client, so that an
+     *  event loop of several clients can poll them all with drain(0) in between
+     *  @return false if nothing is on its way
+     */
+    bool step()
+    {
+        unsigned long long now = LoopbackClock::micros();
+        unsigned long long next = nextArrival();
+        for (Link* l = links; l; l = l->next)
+        {
+            for (Pipe::Segment* s = l->down.head; s; s = s->next)
+            {
+                if (s->due > now)
+                {
+                    if (s->due < next)
+                        next = s->due;
+                    break;
+                }
+            }
+        }
+        if (next == NEVER)
+            return false;
+        LoopbackClock::advanceTo(next);
+        run(next);
+        return true;
+    }
+
+    /** PUBLISH packets received from the clients */
+    unsigned long published() const
+    {
+        return published_count;
+    }
+
+    /** PUBLISH packets sent to the clients, retained ones and retries included */
+    unsigned long delivered() const
+    {
+        return delivered_count;
+    }
+
+    /** QoS1/2 messages dropped because the queue of their session was full */
+    unsigned long dropped() const
+    {
+        return dropped_count;
+    }
+
+    /** Writes retransmitted by the loss of the links */
+    unsigned long lost() const
+    {
+        return lost_count;
+    }
+
+private:
+    friend class LoopbackNetwork;
+
+    static const unsigned long long NEVER = ~0ULL;
+
+    // one way of a link, the segments in the order they arrive
+    struct Pipe
+    {
+        struct Segment
+        {
+            Segment* next;
+            unsigned long long due;
+            unsigned long seq;
+            int len;
+            int offset;
+            bool fin;
+            unsigned char* data;
+        };
+
+        Pipe() : head(0), tail(0), busy_until(0), last_due(0)
+        {
+        }
+
+        ~Pipe()
+        {
+            while (head)
+                pop();
+        }
+
+        unsigned long long nextDue() const
+        {
+            return head ? head->due : NEVER;
+        }
+
+        void pop()
+        {
+            Segment* s = head;
+            head = s->next;
+            if (head == 0)
+                tail = 0;
+            delete[] s->data;
+            delete s;
+        }
+
+        // copies the bytes which have arrived by now, -1 if the other end has closed
+        int take(unsigned char* buf, int len, unsigned long long now)
+        {
+            int got = 0;
+            while (got < len && head && head->due <= now)
+            {
+                if (head->fin)
+                    return got > 0 ? got : -1;
+                int n = head->len - head->offset;
+                n = (n < len - got) ? n : len - got;
+                memcpy(buf + got, head->data + head->offset, n);
+                got += n;
+                if ((head->offset += n) == head->len)
+                    pop();
+            }
+            return got;
+        }
+
+        Segment* head;
+        Segment* tail;
+        unsigned long long busy_until;      // the last byte written leaves then
+        unsigned long long last_due;
+    };
+
+    struct Session;
+
+    struct Link
+    {
+        Link() : session(0), pkt(0), pktlen(0), pktcap(0), closed(false), fin_due(NEVER), next(0)
+        {
+        }
+
+        ~Link()
+        {
+            delete[] pkt;
+        }
+
+        Pipe up;            // client to broker
+        Pipe down;          // broker to client
+        LinkProfile profile;
+        Session* session;
+        unsigned char* pkt; // the start of a packet received by the broker
+        int pktlen;
+        int pktcap;
+        bool closed;        // by the broker
+        unsigned long long fin_due;
+        Link* next;
+    };
+
+    struct Subscription
+    {
+        Subscription* next;
+        char* filter;
+        int qos;
+    };
+
+    // a QoS1/2 message to a client, until it is acknowledged
+    struct Inflight
+    {
+        Inflight* next;
+        unsigned short id;
+        int qos;
+        bool released;      // PUBREC received, PUBREL sent
+        unsigned char* packet;
+        int len;
+    };
+
+    struct IncomingId
+    {
+        IncomingId* next;
+        unsigned short id;
+    };
+
+    struct Session
+    {
+        Session() : next(0), clientID(0), clean(true), link(0), subs(0), out(0), queued(0), lastid(0), incoming(0),
+            willTopic(0), willPayload(0), willLen(0), willQoS(0), willRetained(false)
+        {
+        }
+
+        Session* next;
+        char* clientID;
+        bool clean;
+        Link* link;         // 0 while the client is away
+        Subscription* subs;
+        Inflight* out;
+        int queued;
+        unsigned short lastid;
+        IncomingId* incoming;   // QoS2 messages from the client waiting for their PUBREL
+        char* willTopic;        // 0 if there is no will
+        unsigned char* willPayload;
+        int willLen;
+        int willQoS;
+        bool willRetained;
+    };
+
+    struct Retained
+    {
+        Retained* next;
+        char* topic;
+        unsigned char* payload;
+        int len;
+        int qos;
+    };
+
+    // used by LoopbackNetwork
+
+    Link* open(const LinkProfile& profile)
+    {
+        Link* link = new Link();
+        link->profile = profile;
+        link->next = links;
+        links = link;
+        return link;
+    }
+
+    // the client closes its end, the broker frees the link once the close arrives
+    void close(Link* link)
+    {
+        push(link->up, link->profile, 0, 0, LoopbackClock::micros(), true);
+    }
+
+    int write(Link* link, const unsigned char* buf, int len)
+    {
+        if (link->closed && LoopbackClock::micros() >= link->fin_due)
+            return -1;
+        push(link->up, link->profile, buf, len, LoopbackClock::micros(), false);
+        return len;
+    }
+
+    int read(Link* link, unsigned char* buf, int len, int timeout_ms)
+    {
+        unsigned long long deadline = LoopbackClock::micros() + ((timeout_ms > 0) ? timeout_ms : 0) * 1000ULL;
+        int got = 0;
+
+        for (;;)
+        {
+            unsigned long long now = LoopbackClock::micros();
+            run(now);
+            int n = link->down.take(buf + got, len - got, now);
+            if (n < 0)
+                return (got > 0) ? got : -1;
+            if ((got += n) == len)
+                break;
+            // nothing else can arrive before the next packet
+            unsigned long long next = nextArrival();
+            if (link->down.nextDue() < next)
+                next = link->down.nextDue();
+            if (next > deadline)
+                next = deadline;
+            if (next <= now)
+                break;
+            LoopbackClock::advanceTo(next);
+        }
+        return got;
+    }
+
+    bool pending(Link* link)
+    {
+        run(LoopbackClock::micros());
+        return link->down.nextDue() <= LoopbackClock::micros();
+    }
+
+    // the links
+
+    double uniform()
+    {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return (random >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    void push(Pipe& pipe, const LinkProfile& profile, const unsigned char* buf, int len, unsigned long long at, bool fin)
+    {
+        Pipe::Segment* s = new Pipe::Segment;
+        unsigned long long start = (at > pipe.busy_until) ? at : pipe.busy_until;
+
+        pipe.busy_until = start + (profile.bandwidth ? (len * 1000000ULL + profile.bandwidth - 1) / profile.bandwidth : 0);
+        s->due = pipe.busy_until + profile.latency_us;
+        if (profile.loss > 0 && len > 0 && uniform() < profile.loss)
+        {
+            s->due += profile.retransmit_us;
+            ++lost_count;
+        }
+        if (s->due < pipe.last_due)
+            s->due = pipe.last_due;     // in order
+        pipe.last_due = s->due;
+        s->next = 0;
+        s->seq = seq++;
+        s->len = len;
+        s->offset = 0;
+        s->fin = fin;
+        s->data = 0;
+        if (len > 0)
+        {
+            s->data = new unsigned char[len];
+            memcpy(s->data, buf, len);
+        }
+        if (pipe.tail)
+            pipe.tail->next = s;
+        else
+            pipe.head = s;
+        pipe.tail = s;
+    }
+
+    unsigned long long nextArrival() const
+    {
+        unsigned long long next = NEVER;
+        for (Link* l = links; l; l = l->next)
+        {
+            if (l->up.nextDue() < next)
+                next = l->up.nextDue();
+        }
+        return next;
+    }
+
+    // handles what has arrived at the broker by now, in the order it arrived
+    void run(unsigned long long now)
+    {
+        for (;;)
+        {
+            Link* link = 0;
+            for (Link* l = links; l; l = l->next)
+            {
+                if (l->up.head && l->up.head->due <= now &&
+                        (link == 0 || l->up.head->due < link->up.head->due ||
+                        (l->up.head->due == link->up.head->due && l->up.head->seq < link->up.head->seq)))
+                    link = l;
+            }
+            if (link == 0)
+                break;
+
+            Pipe::Segment* s = link->up.head;
+            unsigned long long at = s->due;
+            if (s->fin)
+            {
+                closeLink(link, at, false);
+                freeLink(link);
+                continue;
+            }
+            if (!link->closed)
+                receive(link, s->data, s->len, at);
+            link->up.pop();
+        }
+    }
+
+    void receive(Link* link, const unsigned char* data, int len, unsigned long long at)
+    {
+        if (link->pktlen + len > link->pktcap)
+        {
+            int cap = (link->pktcap > 0) ? link->pktcap : 256;
+            while (cap < link->pktlen + len)
+                cap *= 2;
+            unsigned char* pkt = new unsigned char[cap];
+            if (link->pktlen > 0)
+                memcpy(pkt, link->pkt, link->pktlen);
+            delete[] link->pkt;
+            link->pkt = pkt;
+            link->pktcap = cap;
+        }
+        memcpy(link->pkt + link->pktlen, data, len);
+        link->pktlen += len;
+
+        int start = 0;
+        while (!link->closed && link->pktlen - start >= 2)
+        {
+            // fixed header: type and remaining length
+            int rem_len = 0, multiplier = 1, hlen = 1;
+            unsigned char c;
+            do
+            {
+                if (hlen > 4)
+                {
+                    closeLink(link, at, false);     // malformed
+                    return;
+                }
+                if (start + hlen >= link->pktlen)
+                    goto incomplete;
+                c = link->pkt[start + hlen++];
+                rem_len += (c & 127) * multiplier;
+                multiplier *= 128;
+            }
+            while (c & 128);
+            if (link->pktlen - start < hlen + rem_len)
+                break;
+            handle(link, link->pkt + start, hlen + rem_len, at);
+            start += hlen + rem_len;
+        }
+incomplete:
+        if (link->closed)
+            link->pktlen = 0;   // the rest is ignored
+        else if (start > 0)
+        {
+            memmove(link->pkt, link->pkt + start, link->pktlen - start);
+            link->pktlen -= start;
+        }
+    }
+
+    // the broker closes the connection, the will is published unless the client disconnected
+    void closeLink(Link* link, unsigned long long at, bool graceful)
+    {
+        if (link->closed)
+            return;
+        link->closed = true;
+        push(link->down, link->profile, 0, 0, at, true);
+        link->fin_due = link->down.last_due;
+
+        Session* session = link->session;
+        if (session == 0)
+            return;
+        link->session = 0;
+        session->link = 0;
+        if (session->willTopic)
+        {
+            if (!graceful)
+                forward(session->willTopic, (int)strlen(session->willTopic), session->willPayload, session->willLen,
+                    session->willQoS, session->willRetained, at);
+            clearWill(session);
+        }
+        if (session->clean)
+            freeSession(session);
+    }
+
+    void freeLink(Link* link)
+    {
+        for (Link** l = &links; *l; l = &(*l)->next)
+        {
+            if (*l == link)
+            {
+                *l = link->next;
+                break;
+            }
+        }
+        if (link->session)
+            link->session->link = 0;
+        delete link;
+    }
+
+    void send(Link* link, const unsigned char* buf, int len, unsigned long long at)
+    {
+        if (link && !link->closed)
+            push(link->down, link->profile, buf, len, at, false);
+    }
+
+    void sendAck(Link* link, int type, unsigned short id, unsigned long long at)
+    {
+        unsigned char ack[4];
+        int len = MQTTSerialize_ack(ack, sizeof(ack), type, 0, id);
+        if (len > 0)
+            send(link, ack, len, at);
+    }
+
+    unsigned char* reserve(int size)
+    {
+        if (size > scratch_size)
+        {
+            delete[] scratch;
+            scratch = new unsigned char[size];
+            scratch_size = size;
+        }
+        return scratch;
+    }
+
+    // the packets from the clients
+
+    void handle(Link* link, unsigned char* buf, int len, unsigned long long at)
+    {
+        int type = buf[0] >> 4;
+        Session* session = link->session;
+
+        if (type == CONNECT)
+        {
+            if (session)
+                closeLink(link, at, false);     // a second CONNECT
+            else
+                connect(link, buf, len, at);
+            return;
+        }
+        if (session == 0)
+        {
+            closeLink(link, at, false);
+            return;
+        }
+
+        switch (type)
+        {
+            case PUBLISH:
+                publish(link, buf, len, at);
+                break;
+
+            case PUBACK:
+            case PUBREC:
+            case PUBREL:
+            case PUBCOMP:
+            {
+                unsigned char acktype, dup;
+                unsigned short id;
+                if (MQTTDeserialize_ack(&acktype, &dup, &id, buf, len) != 1)
+                    closeLink(link, at, false);
+                else
+                    ack(session, type, id, at);
+                break;
+            }
+
+            case SUBSCRIBE:
+                subscribe(link, buf, len, at);
+                break;
+
+            case UNSUBSCRIBE:
+                unsubscribe(link, buf, len, at);
+                break;
+
+            case PINGREQ:
+            {
+                // the codec has no PINGRESP serializer
+                const unsigned char pingresp[2] = {PINGRESP << 4, 0};
+                send(link, pingresp, sizeof(pingresp), at);
+                break;
+            }
+
+            case DISCONNECT:
+                clearWill(session);
+                closeLink(link, at, true);
+                break;
+
+            default:
+                closeLink(link, at, false);
+                break;
+        }
+    }
+
+    void connect(Link* link, unsigned char* buf, int len, unsigned long long at)
+    {
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        unsigned char connack[4];
+        Session* session = 0;
+        bool present = false;
+
+        if (MQTTDeserialize_connect(&data, buf, len) != 1)
+        {
+            closeLink(link, at, false);
+            return;
+        }
+        char* clientID = copyString(data.clientID);
+        if (clientID[0] == '\0' && !data.cleansession)
+        {
+            // identifier rejected
+            delete[] clientID;
+            send(link, connack, MQTTSerialize_connack(connack, sizeof(connack), 2, 0), at);
+            closeLink(link, at, false);
+            return;
+        }
+
+        if (clientID[0] != '\0')
+        {
+            for (session = sessions; session && strcmp(session->clientID, clientID) != 0; session = session->next)
+                ;
+        }
+        if (session && session->link)
+        {
+            // taken over, which frees a clean session
+            bool clean = session->clean;
+            closeLink(session->link, at, false);
+            if (clean)
+                session = 0;
+        }
+        if (session && data.cleansession)
+        {
+            freeSession(session);
+            session = 0;
+        }
+        if (session)
+        {
+            present = true;
+            delete[] clientID;
+        }
+        else
+        {
+            session = new Session();
+            session->clientID = clientID;
+            session->next = sessions;
+            sessions = session;
+        }
+        session->clean = data.cleansession;
+        session->link = link;
+        link->session = session;
+        if (data.willFlag)
+        {
+            session->willTopic = copyString(data.will.topicName);
+            session->willLen = MQTTstrlen(data.will.message);
+            session->willPayload = new unsigned char[session->willLen + 1];
+            memcpy(session->willPayload, data.will.message.cstring ? data.will.message.cstring :
+                data.will.message.lenstring.data, session->willLen);
+            session->willQoS = data.will.qos;
+            session->willRetained = data.will.retained;
+        }
+        send(link, connack, MQTTSerialize_connack(connack, sizeof(connack), 0, present), at);
+
+        // what the client missed, and what it did not acknowledge
+        for (Inflight* m = session->out; m; m = m->next)
+        {
+            if (m->released)
+                sendAck(link, PUBREL, m->id, at);
+            else
+            {
+                m->packet[0] |= 0x08;   // dup
+                send(link, m->packet, m->len, at);
+                ++delivered_count;
+            }
+        }
+    }
+
+    void publish(Link* link, unsigned char* buf, int len, unsigned long long at)
+    {
+        unsigned char dup, retain;
+        int qos, payloadlen;
+        unsigned short id;
+        MQTTString topicName;
+        unsigned char* payload;
+        Session* session = link->session;
+
+        if (MQTTDeserialize_publish(&dup, &qos, &retain, &id, &topicName, &payload, &payloadlen, buf, len) != 1 ||
+                !validTopic(topicName.lenstring.data, topicName.lenstring.len))
+        {
+            closeLink(link, at, false);
+            return;
+        }
+        ++published_count;
+
+        if (qos == 2)
+        {
+            IncomingId* i = session->incoming;
+            while (i && i->id != id)
+                i = i->next;
+            sendAck(link, PUBREC, id, at);
+            if (i)
+                return;     // a duplicate, already forwarded
+            i = new IncomingId;
+            i->id = id;
+            i->next = session->incoming;
+            session->incoming = i;
+        }
+        else if (qos == 1)
+            sendAck(link, PUBACK, id, at);
+
+        // null terminated, for the retained messages
+        char* topic = new char[topicName.lenstring.len + 1];
+        memcpy(topic, topicName.lenstring.data, topicName.lenstring.len);
+        topic[topicName.lenstring.len] = '\0';
+        forward(topic, topicName.lenstring.len, payload, payloadlen, qos, retain != 0, at);
+        delete[] topic;
+    }
+
+    void ack(Session* session, int type, unsigned short id, unsigned long long at)
+    {
+        if (type == PUBREL)
+        {
+            for (IncomingId** i = &session->incoming; *i; i = &(*i)->next)
+            {
+                if ((*i)->id == id)
+                {
+                    IncomingId* done = *i;
+                    *i = done->next;
+                    delete done;
+                    break;
+                }
+            }
+            sendAck(session->link, PUBCOMP, id, at);
+            return;
+        }
+
+        for (Inflight** m = &session->out; *m; m = &(*m)->next)
+        {
+            Inflight* msg = *m;
+            if (msg->id != id)
+                continue;
+            if (type == PUBREC && msg->qos == 2)
+            {
+                msg->released = true;
+                delete[] msg->packet;
+                msg->packet = 0;
+                sendAck(session->link, PUBREL, id, at);
+            }
+            else if ((type == PUBACK && msg->qos == 1) || (type == PUBCOMP && msg->qos == 2 && msg->released))
+            {
+                *m = msg->next;
+                delete[] msg->packet;
+                delete msg;
+                --session->queued;
+            }
+            break;
+        }
+    }
+
+    void subscribe(Link* link, unsigned char* buf, int len, unsigned long long at)
+    {
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+        int max = len / 3 + 1;      // each filter takes 3 bytes at least
+        MQTTString* filters = new MQTTString[max];
+        int* qos = new int[max];
+        Session* session = link->session;
+
+        if (MQTTDeserialize_subscribe(&dup, &id, max, &count, filters, qos, buf, len) != 1 || count == 0)
+            closeLink(link, at, false);
+        else
+        {
+            char** copies = new char*[count];
+            for (int i = 0; i < count; ++i)
+            {
+                copies[i] = copyString(filters[i]);
+                if (!validFilter(copies[i]) || qos[i] < 0 || qos[i] > 2)
+                    qos[i] = 0x80;
+                else
+                {
+                    if (qos[i] > maxQoS)
+                        qos[i] = maxQoS;
+                    addSubscription(session, copies[i], qos[i]);
+                }
+            }
+            unsigned char* suback = reserve(count + 8);
+            send(link, suback, MQTTSerialize_suback(suback, count + 8, id, count, qos), at);
+
+            for (int i = 0; i < count; ++i)
+            {
+                for (Retained* r = retained; r && qos[i] != 0x80; r = r->next)
+                {
+                    if (matches(copies[i], r->topic, (int)strlen(r->topic)))
+                        deliver(session, r->topic, (int)strlen(r->topic), r->payload, r->len,
+                            (r->qos < qos[i]) ? r->qos : qos[i], true, at);
+                }
+                delete[] copies[i];
+            }
+            delete[] copies;
+        }
+        delete[] filters;
+        delete[] qos;
+    }
+
+    void unsubscribe(Link* link, unsigned char* buf, int len, unsigned long long at)
+    {
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+        int max = len / 2 + 1;
+        MQTTString* filters = new MQTTString[max];
+
+        if (MQTTDeserialize_unsubscribe(&dup, &id, max, &count, filters, buf, len) != 1)
+            closeLink(link, at, false);
+        else
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                for (Subscription** s = &link->session->subs; *s; s = &(*s)->next)
+                {
+                    if (MQTTPacket_equals(&filters[i], (*s)->filter))
+                    {
+                        Subscription* sub = *s;
+                        *s = sub->next;
+                        delete[] sub->filter;
+                        delete sub;
+                        break;
+                    }
+                }
+            }
+            unsigned char unsuback[4];
+            send(link, unsuback, MQTTSerialize_unsuback(unsuback, sizeof(unsuback), id), at);
+        }
+        delete[] filters;
+    }
+
+    // the fan-out
+
+    void forward(const char* topic, int topiclen, unsigned char* payload, int payloadlen, int qos, bool retain,
+        unsigned long long at)
+    {
+        if (retain)
+            keepRetained(topic, payload, payloadlen, qos);
+
+        for (Session* s = sessions; s; s = s->next)
+        {
+            // overlapping subscriptions deliver once, at the highest of their QoS
+            int granted = -1;
+            for (Subscription* sub = s->subs; sub; sub = sub->next)
+            {
+                if (sub->qos > granted && matches(sub->filter, topic, topiclen))
+                    granted = sub->qos;
+            }
+            if (granted >= 0)
+                deliver(s, topic, topiclen, payload, payloadlen, (qos < granted) ? qos : granted, false, at);
+        }
+    }
+
+    void deliver(Session* session, const char* topic, int topiclen, unsigned char* payload, int payloadlen, int qos,
+        bool retain, unsigned long long at)
+    {
+        MQTTString topicString = MQTTString_initializer;
+        unsigned short id = 0;
+        int size = MQTTPacket_len(2 + topiclen + ((qos > 0) ? 2 : 0) + payloadlen);
+
+        if (qos == 0 && session->link == 0)
+            return;
+        if (qos > 0)
+        {
+            if (session->queued >= maxQueued)
+            {
+                ++dropped_count;
+                return;
+            }
+            id = nextId(session);
+        }
+
+        topicString.lenstring.data = (char*)topic;
+        topicString.lenstring.len = topiclen;
+        unsigned char* packet = (qos > 0) ? new unsigned char[size] : reserve(size);
+        int len = MQTTSerialize_publish(packet, size, 0, qos, retain, id, topicString, payload, payloadlen);
+
+        if (qos > 0)
+        {
+            Inflight* msg = new Inflight;
+            msg->next = 0;
+            msg->id = id;
+            msg->qos = qos;
+            msg->released = false;
+            msg->packet = packet;
+            msg->len = len;
+            Inflight** tail = &session->out;
+            while (*tail)
+                tail = &(*tail)->next;
+            *tail = msg;
+            ++session->queued;
+        }
+        if (session->link)
+        {
+            send(session->link, packet, len, at);
+            ++delivered_count;
+        }
+    }
+
+    unsigned short nextId(Session* session)
+    {
+        for (;;)
+        {
+            if (++session->lastid == 0)
+                session->lastid = 1;
+            Inflight* m = session->out;
+            while (m && m->id != session->lastid)
+                m = m->next;
+            if (m == 0)
+                return session->lastid;
+        }
+    }
+
+    void keepRetained(const char* topic, unsigned char* payload, int payloadlen, int qos)
+    {
+        Retained** r = &retained;
+        while (*r && strcmp((*r)->topic, topic) != 0)
+            r = &(*r)->next;
+        if (*r)
+        {
+            Retained* old = *r;
+            *r = old->next;
+            delete[] old->topic;
+            delete[] old->payload;
+            delete old;
+        }
+        if (payloadlen == 0)
+            return;     // an empty retained message clears the topic
+        Retained* n = new Retained;
+        n->topic = new char[strlen(topic) + 1];
+        strcpy(n->topic, topic);
+        n->payload = new unsigned char[payloadlen];
+        memcpy(n->payload, payload, payloadlen);
+        n->len = payloadlen;
+        n->qos = qos;
+        n->next = retained;
+        retained = n;
+    }
+
+    void addSubscription(Session* session, const char* filter, int qos)
+    {
+        Subscription* s = session->subs;
+        while (s && strcmp(s->filter, filter) != 0)
+            s = s->next;
+        if (s == 0)
+        {
+            s = new Subscription;
+            s->filter = new char[strlen(filter) + 1];
+            strcpy(s->filter, filter);
+            s->next = session->subs;
+            session->subs = s;
+        }
+        s->qos = qos;
+    }
+
+    void clearWill(Session* session)
+    {
+        delete[] session->willTopic;
+        delete[] session->willPayload;
+        session->willTopic = 0;
+        session->willPayload = 0;
+    }
+
+    void freeSession(Session* session)
+    {
+        for (Session** s = &sessions; *s; s = &(*s)->next)
+        {
+            if (*s == session)
+            {
+                *s = session->next;
+                break;
+            }
+        }
+        if (session->link)
+            session->link->session = 0;
+        while (session->subs)
+        {
+            Subscription* sub = session->subs;
+            session->subs = sub->next;
+            delete[] sub->filter;
+            delete sub;
+        }
+        while (session->out)
+        {
+            Inflight* m = session->out;
+            session->out = m->next;
+            delete[] m->packet;
+            delete m;
+        }
+        while (session->incoming)
+        {
+            IncomingId* i = session->incoming;
+            session->incoming = i->next;
+            delete i;
+        }
+        clearWill(session);
+        delete[] session->clientID;
+        delete session;
+    }
+
+    // topics
+
+    static char* copyString(MQTTString& s)
+    {
+        int len = MQTTstrlen(s);
+        char* copy = new char[len + 1];
+        if (len > 0)
+            memcpy(copy, s.cstring ? s.cstring : s.lenstring.data, len);
+        copy[len] = '\0';
+        return copy;
+    }
+
+    static bool validTopic(const char* topic, int len)
+    {
+        if (len == 0)
+            return false;
+        for (int i = 0; i < len; ++i)
+        {
+            if (topic[i] == '+' || topic[i] == '#')
+                return false;
+        }
+        return true;
+    }
+
+    // + and # take a whole level, # only the last one
+    static bool validFilter(const char* filter)
+    {
+        if (filter[0] == '\0')
+            return false;
+        for (const char* p = filter; *p; ++p)
+        {
+            if ((*p == '+' || *p == '#') && ((p > filter && p[-1] != '/') || (p[1] != '\0' && p[1] != '/')))
+                return false;
+            if (*p == '#' && p[1] != '\0')
+                return false;
+        }
+        return true;
+    }
+
+    static bool matches(const char* filter, const char* topic, int topiclen)
+    {
+        const char* end = topic + topiclen;
+
+        if (topiclen > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+            return false;   // wildcards do not match the $ topics
+        while (*filter)
+        {
+            if (*filter == '#')
+                return true;    // this level and those below, or none: "a/#" matches "a"
+            if (*filter == '+')
+            {
+                while (topic < end && *topic != '/')
+                    ++topic;
+                ++filter;
+            }
+            else
+            {
+                while (*filter && *filter != '/')
+                {
+                    if (topic == end || *topic++ != *filter++)
+                        return false;
+                }
+                if (topic < end && *topic != '/')
+                    return false;
+            }
+            // the separator after the level, on both sides
+            if (*filter == '\0')
+                return topic == end;
+            if (topic == end)
+                return filter[1] == '#' && filter[2] == '\0';
+            ++filter;
+            ++topic;
+        }
+        return topic == end;
+    }
+
+    int maxQoS;
+    int maxQueued;
+    unsigned long long random;
+    unsigned long seq;          // of the segments, which arrive in order when they are due at the same time
+    Link* links;
+    Session* sessions;
+    Retained* retained;
+    unsigned char* scratch;     // the QoS0 packets
+    int scratch_size;
+    unsigned long published_count;
+    unsigned long delivered_count;
+    unsigned long dropped_count;
+    unsigned long lost_count;
+};
+
+
+class LoopbackNetwork
+{
+public:
+    LoopbackNetwork() : broker(0), link(0)
+    {
+    }
+
+    ~LoopbackNetwork()
+    {
+        disconnect();
+    }
+
+    /* connects to the broker at once, the CONNECT of the Client is what takes the latency */
+    int connect(LoopbackBroker& b, const LinkProfile& profile = LinkProfile())
+    {
+        disconnect();
+        broker = &b;
+        link = broker->open(profile);
+        return 0;
+    }
+
+    int disconnect()
+    {
+        if (link)
+            broker->close(link);
+        link = 0;
+        return 0;
+    }
+
+    /* returns the number of bytes read before the timeout expires, which could be 0, moving the clock
+       forward to the time they arrive.  -1 once the broker has closed the connection
+    */
+    int read(unsigned char* buffer, int len, int timeout_ms)
+    {
+        return link ? broker->read(link, buffer, len, timeout_ms) : -1;
+    }
+
+    /* never waits: the bytes leave as the bandwidth of the link allows */
+    int write(unsigned char* buffer, int len, int timeout_ms)
+    {
+        return link ? broker->write(link, buffer, len) : -1;
+    }
+
+    /* true if there is received data that has not been read yet by the Client */
+    bool pending()
+    {
+        return link && broker->pending(link);
+    }
+
+private:
+    LoopbackBroker* broker;
+    LoopbackBroker::Link* link;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,350 @@
+/*******************************************************************************
+ * Metrics of an MQTT::Client
+ *
+ * A Client whose policy has ClientMetrics counts the packets and bytes it sends and
+ * receives by packet type, its calls to the read and write of the Network, the packets
+ * which did not fit in MAX_MQTT_PACKET_SIZE, its connections and the keepalive
+ * timeouts, and records the round trips of publish to PUBACK or PUBCOMP, subscribe to
+ * SUBACK and PINGREQ to PINGRESP in LatencyHistograms, in microseconds.  The default
+ * policy has NoMetrics, which compiles all of this out.
+ *
+ * Usage:
+ *
+ *   typedef MQTT::ClientPolicy<1, true, MQTT::OWN_BUFFERS, false,
+ *       MQTT::QoS2IdSet<0>, MQTT::ClientMetrics<LinuxMicroTick> > Measured;
+ *   MQTT::Client<Network, Timer, 256, 5, Measured> client(network);
+ *   ...
+ *   Measured::metrics::Data data;
+ *   client.getMetrics().snapshot(data);     // from any thread
+ *   printf("p99 %lu us\n", data.publishAck.percentile(99.0));
+ *
+ * The counters are written by the thread of the client, snapshot() copies them from
+ * any thread without a lock: it tries again when the copy overlaps an update, so the
+ * counters of a snapshot are always consistent with each other.  They are never
+ * reset, the difference between two snapshots gives a rate.
+ *******************************************************************************/
+
+#if !defined(MQTT_METRICS_H)
+#define MQTT_METRICS_H
+
+#include <string.h>
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+    #define MQTT_METRICS_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+    #define MQTT_METRICS_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#elif defined(__GNUC__)
+    #define MQTT_METRICS_RELEASE() __sync_synchronize()
+    #define MQTT_METRICS_ACQUIRE() __sync_synchronize()
+#else
+    #define MQTT_METRICS_RELEASE()
+    #define MQTT_METRICS_ACQUIRE()
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * Histogram of latencies with a bounded relative error, as HdrHistogram: values below 2^(SUB_BITS+1) have
+ * a bucket each, above that each power of two is split in 2^SUB_BITS buckets, so a value is known to
+ * within 1/2^SUB_BITS of itself whatever its magnitude
+ * @param SUB_BITS 3 gives 12.5%
+ * @param MAX_BITS values from 2^MAX_BITS up are counted in the last bucket
+ */
+template<int SUB_BITS = 3, int MAX_BITS = 24>
+class LatencyHistogram
+{
+public:
+    enum { SUB_BUCKETS = 1 << SUB_BITS, BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS };
+
+    LatencyHistogram()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        minimum = maximum = 0;
+    }
+
+    void record(unsigned long value)
+    {
+        if (value > MAX_VALUE)
+            value = MAX_VALUE;
+        ++counts[index(value)];
+        if (total == 0 || value < minimum)
+            minimum = value;
+        if (value > maximum)
+            maximum = value;
+        ++total;
+        sum += value;
+    }
+
+    unsigned long count() const
+    {
+        return total;
+    }
+
+    unsigned long min() const
+    {
+        return minimum;
+    }
+
+    unsigned long max() const
+    {
+        return maximum;
+    }
+
+    unsigned long mean() const
+    {
+        return (total == 0) ? 0 : (unsigned long)(sum / total);
+    }
+
+    /** @return the value which percent of the recorded values do not exceed, rounded up to the last value
+     *      of its bucket, 0 if none has been recorded
+     */
+    unsigned long percentile(double percent) const
+    {
+        unsigned long long target = (unsigned long long)(percent * total / 100.0 + 0.5);
+        unsigned long long seen = 0;
+
+        if (total == 0)
+            return 0;
+        if (target == 0)
+            target = 1;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            if ((seen += counts[i]) >= target)
+            {
+                unsigned long highest = highestEquivalent(i);
+                return (highest < maximum) ? highest : maximum;
+            }
+        }
+        return maximum;
+    }
+
+    /** Number of values recorded in a bucket, with the range of values it stands for */
+    unsigned long bucket(int i, unsigned long& lowest, unsigned long& highest) const
+    {
+        lowest = lowestEquivalent(i);
+        highest = highestEquivalent(i);
+        return counts[i];
+    }
+
+private:
+    static const unsigned long MAX_VALUE = (1UL << MAX_BITS) - 1;
+
+    static int index(unsigned long value)
+    {
+        int shift = 0;
+        for (unsigned long v = value >> (SUB_BITS + 1); v != 0; v >>= 1)
+            ++shift;
+        return (shift == 0) ? (int)value : shift * SUB_BUCKETS + (int)(value >> shift);
+    }
+
+    static unsigned long lowestEquivalent(int i)
+    {
+        if (i < 2 * SUB_BUCKETS)
+            return i;
+        int shift = i / SUB_BUCKETS - 1;
+        return (unsigned long)(i - shift * SUB_BUCKETS) << shift;
+    }
+
+    static unsigned long highestEquivalent(int i)
+    {
+        int shift = (i < 2 * SUB_BUCKETS) ? 0 : i / SUB_BUCKETS - 1;
+        return lowestEquivalent(i) + (1UL << shift) - 1;
+    }
+
+    unsigned long counts[BUCKETS];
+    unsigned long total;
+    unsigned long long sum;
+    unsigned long minimum, maximum;
+};
+
+
+/**
+ * @param Clock a class with a static now() in microseconds, e.g. LinuxMicroTick or MbedMicroTick
+ * @param Histogram the histogram of each round trip
+ */
+template<class Clock, class Histogram = LatencyHistogram<> >
+class ClientMetrics
+{
+public:
+    struct Data
+    {
+        unsigned long packetsSent[16];          // by packet type, CONNECT (1) to DISCONNECT (14)
+        unsigned long packetsReceived[16];
+        unsigned long long bytesSent[16];
+        unsigned long long bytesReceived[16];
+        unsigned long reads;                    // calls to the read and write of the Network
+        unsigned long writes;
+        unsigned long bufferOverflows;          // packets which did not fit in MAX_MQTT_PACKET_SIZE, either way
+        unsigned long connects;
+        unsigned long reconnects;               // connects after the first one
+        unsigned long keepaliveTimeouts;        // PINGRESPs not received in the keepalive interval
+        Histogram publishAck;                   // QoS1 and 2 publish to PUBACK or PUBCOMP
+        Histogram subscribeAck;                 // SUBSCRIBE to SUBACK
+        Histogram pingResponse;                 // PINGREQ to PINGRESP
+    };
+
+    ClientMetrics() : sequence(0), ping_start(0), data()
+    {
+    }
+
+    /** Copy the counters, from any thread.  It does not wait for the client, but tries again if the
+     *  client updates them during the copy
+     */
+    void snapshot(Data& copy) const
+    {
+        unsigned long before, after;
+
+        do
+        {
+            before = sequence;
+            MQTT_METRICS_ACQUIRE();
+            memcpy(&copy, (const void*)&data, sizeof(Data));
+            MQTT_METRICS_ACQUIRE();
+            after = sequence;
+        }
+        while (before != after || (before & 1) != 0);
+    }
+
+    // the updates, called by the Client
+
+    unsigned long start()
+    {
+        return Clock::now();
+    }
+
+    void read()
+    {
+        begin();
+        ++data.reads;
+        end();
+    }
+
+    void write()
+    {
+        begin();
+        ++data.writes;
+        end();
+    }
+
+    void sent(int packet_type, int len)
+    {
+        begin();
+        ++data.packetsSent[packet_type & 15];
+        data.bytesSent[packet_type & 15] += len;
+        end();
+    }
+
+    void received(int packet_type, int len)
+    {
+        begin();
+        ++data.packetsReceived[packet_type & 15];
+        data.bytesReceived[packet_type & 15] += len;
+        end();
+    }
+
+    void bufferOverflow()
+    {
+        begin();
+        ++data.bufferOverflows;
+        end();
+    }
+
+    void connected()
+    {
+        begin();
+        if (data.connects++ > 0)
+            ++data.reconnects;
+        end();
+    }
+
+    void keepaliveTimeout()
+    {
+        begin();
+        ++data.keepaliveTimeouts;
+        end();
+    }
+
+    void publishAcked(unsigned long since)
+    {
+        unsigned long now = Clock::now();
+        begin();
+        data.publishAck.record(now - since);
+        end();
+    }
+
+    void subscribeAcked(unsigned long since)
+    {
+        unsigned long now = Clock::now();
+        begin();
+        data.subscribeAck.record(now - since);
+        end();
+    }
+
+    void pingSent()
+    {
+        ping_start = Clock::now();
+    }
+
+    void pingAcked()
+    {
+        unsigned long now = Clock::now();
+        begin();
+        data.pingResponse.record(now - ping_start);
+        end();
+    }
+
+private:
+
+    // odd while data is being updated
+    void begin()
+    {
+        sequence = sequence + 1;
+        MQTT_METRICS_RELEASE();
+    }
+
+    void end()
+    {
+        MQTT_METRICS_RELEASE();
+        sequence = sequence + 1;
+    }
+
+    volatile unsigned long sequence;
+    unsigned long ping_start;
+    Data data;
+};
+
+
+/* The default: no metrics, no code */
+class NoMetrics
+{
+public:
+    unsigned long start()
+    {
+        return 0;
+    }
+
+    void read() { }
+    void write() { }
+    void sent(int packet_type, int len) { }
+    void received(int packet_type, int len) { }
+    void bufferOverflow() { }
+    void connected() { }
+    void keepaliveTimeout() { }
+    void publishAcked(unsigned long since) { }
+    void subscribeAcked(unsigned long since) { }
+    void pingSent() { }
+    void pingAcked() { }
+};
+
+
+}
+
+#endif
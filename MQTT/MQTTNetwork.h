@@ -1,11 +1,18 @@
 #ifndef _MQTTNETWORK_H_
 #define _MQTTNETWORK_H_
 
+#include "mbed.h"
 #include "NetworkInterface.h"
 
+// Size of the receive buffer. Reads smaller than this are served from memory, so the Client's
+// 1-byte header and remaining length reads do not each cost a socket recv call.
+#if !defined(MQTTNETWORK_RX_BUFFER_SIZE)
+    #define MQTTNETWORK_RX_BUFFER_SIZE 128
+#endif
+
 class MQTTNetwork {
 public:
-    MQTTNetwork(NetworkInterface* aNetwork) : network(aNetwork) {
+    MQTTNetwork(NetworkInterface* aNetwork) : network(aNetwork), rx_event(0), tx_event(0), blocking(true), rx_head(0), rx_tail(0) {
         socket = new TCPSocket();
     }
 
@@ -13,44 +20,113 @@ public:
         delete socket;
     }
 
+    /* returns the number of bytes read before the timeout expires, which could be 0.
+       A negative value if there was an error on the socket or it was closed by the peer
+    */
     int read(unsigned char* buffer, int len, int timeout) {
-        int rc = socket->recv(buffer, len);
-        if(rc == NSAPI_ERROR_WOULD_BLOCK){
-            rc = 0;
+        Timer timer;
+        timer.start();
+        int bytes = 0;
+        while (bytes < len) {
+            // buffered data first
+            if (rx_head < rx_tail) {
+                int n = rx_tail - rx_head;
+                n = (n < len - bytes) ? n : len - bytes;
+                memcpy(buffer + bytes, &rx_buf[rx_head], n);
+                rx_head += n;
+                bytes += n;
+                continue;
+            }
+            // large reads go straight to the caller, small ones refill the buffer
+            bool direct = (len - bytes >= MQTTNETWORK_RX_BUFFER_SIZE);
+            int rc = direct ? socket->recv(buffer + bytes, len - bytes) : socket->recv(rx_buf, MQTTNETWORK_RX_BUFFER_SIZE);
+            if (rc == NSAPI_ERROR_WOULD_BLOCK) {
+                if (!waitEvent(rx_event, timer, timeout))
+                    break;
+                continue;
+            }
+            if (rc <= 0)
+                return (rc == 0) ? NSAPI_ERROR_NO_CONNECTION : rc;
+            if (direct)
+                bytes += rc;
+            else {
+                rx_head = 0;
+                rx_tail = rc;
+            }
         }
-        return rc;
+        return bytes;
     }
 
+    /* returns the number of bytes written before the timeout expires, or a negative error code */
     int write(unsigned char* buffer, int len, int timeout) {
-        return socket->send(buffer, len);
+        Timer timer;
+        timer.start();
+        int bytes = 0;
+        while (bytes < len) {
+            int rc = socket->send(buffer + bytes, len - bytes);
+            if (rc == NSAPI_ERROR_WOULD_BLOCK) {
+                if (!waitEvent(tx_event, timer, timeout))
+                    break;
+                continue;
+            }
+            if (rc < 0)
+                return rc;
+            bytes += rc;
+        }
+        return bytes;
     }
 
     int connect(const char* hostname, int port) {
+        rx_head = rx_tail = 0;
         socket->open(network);
-        return socket->connect(hostname, port);
+        socket->sigio(callback(this, &MQTTNetwork::onSocketEvent));
+        socket->set_blocking(blocking);
+        int rc = socket->connect(hostname, port);
+        // read and write are always non-blocking with their own deadlines
+        socket->set_blocking(false);
+        return rc;
     }
 
     int disconnect() {
+        rx_head = rx_tail = 0;
         return socket->close();
     }
-    
-    /** Set blocking or non-blocking mode of the socket
+
+    /** Set blocking or non-blocking mode of the socket during connect()
      *
-     *  Initially all sockets are in blocking mode. In non-blocking mode
-     *  blocking operations such as send/recv/accept return
-     *  NSAPI_ERROR_WOULD_BLOCK if they can not continue.
+     *  Initially the socket connects in blocking mode. In non-blocking mode
+     *  connect() returns NSAPI_ERROR_IN_PROGRESS (or WOULD_BLOCK) if it can
+     *  not complete immediately.
      *
-     *  set_blocking(false) is equivalent to set_timeout(-1)
-     *  set_blocking(true) is equivalent to set_timeout(0)
+     *  read() and write() do not depend on this setting: they always wait
+     *  for socket events up to the timeout passed by the caller.
      *
      *  @param blocking true for blocking mode, false for non-blocking mode.
      */
-    void set_blocking(bool blocking){ socket->set_blocking(blocking); }
-    
+    void set_blocking(bool blocking){ this->blocking = blocking; }
+
 private:
+    // signalled by the network stack when the socket becomes readable/writable
+    // both waits are released, so that a reader thread never takes the event of a writer
+    void onSocketEvent() {
+        rx_event.release();
+        tx_event.release();
+    }
+
+    // waits for a socket event until the deadline, returns false once it has expired
+    bool waitEvent(Semaphore& event, Timer& timer, int timeout) {
+        int left = timeout - timer.read_ms();
+        return (left > 0 && event.wait(left) > 0);
+    }
+
     NetworkInterface* network;
     TCPSocket* socket;
+    Semaphore rx_event;
+    Semaphore tx_event;
+    bool blocking;
+    unsigned char rx_buf[MQTTNETWORK_RX_BUFFER_SIZE];
+    int rx_head;
+    int rx_tail;
 };
 
 #endif
-
@@ -110,10 +110,21 @@ int bufchar(unsigned char* c, int count)
 }
 
 
+/* reads straight from buf instead of through bufchar, whose static pointer is shared by all threads */
 int MQTTPacket_decodeBuf(unsigned char* buf, int* value)
 {
-	bufptr = buf;
-	return MQTTPacket_decode(bufchar, value);
+	int multiplier = 1;
+	int len = 0;
+
+	*value = 0;
+	do
+	{
+		if (++len > MAX_NO_OF_REMAINING_LENGTH_BYTES)
+			break;	/* bad data */
+		*value += (*buf & 127) * multiplier;
+		multiplier *= 128;
+	} while ((*buf++ & 128) != 0);
+	return len;
 }
 
 
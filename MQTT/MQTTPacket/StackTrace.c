@@ -0,0 +1,319 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    raulMrello - profiler behind the FUNC_ENTRY/FUNC_EXIT hooks
+ *******************************************************************************/
+
+/*
+ * Built with -DMQTT_STACKTRACE, each FUNC_ENTRY/FUNC_EXIT pair counts a call of its function and the clock
+ * ticks spent in it, including the functions it calls.  Each thread owns its counters, found by a hash of the
+ * address of __func__, so a probe takes no lock and shares no cache line with other threads.  The counters of
+ * a thread are kept after it ends.  StackTrace_dump writes them, one line per thread and function:
+ *
+ *   # StackTrace ticks_per_second <n>
+ *   thread <id> <function> <calls> <ticks> <max ticks>
+ *
+ * which report_StackTrace (MQTT/test/host) sums up by function.  The clock is the cycle counter on x86 and
+ * aarch64, or CLOCK_MONOTONIC elsewhere on POSIX.  On other targets define STACKTRACE_CLOCK() and
+ * STACKTRACE_TICKS_PER_SECOND, e.g. DWT->CYCCNT and SystemCoreClock on a Cortex-M; without them only the
+ * calls are counted.  Where there is no thread-local storage, all the threads share one set of counters and
+ * the profiler must only be used from one of them.
+ */
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L	/* clock_gettime, nanosleep */
+#endif
+
+#include "StackTrace.h"
+
+#if !defined(NOSTACKTRACE)
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(STACKTRACE_MAX_DEPTH)
+#define STACKTRACE_MAX_DEPTH 16		/* nested calls recorded per thread */
+#endif
+#if !defined(STACKTRACE_MAX_FUNCTIONS)
+#define STACKTRACE_MAX_FUNCTIONS 64	/* functions counted per thread, a power of 2 */
+#endif
+
+#if !defined(STACKTRACE_TLS)
+	#if defined(_MSC_VER)
+		#define STACKTRACE_TLS __declspec(thread)
+	#elif defined(__GNUC__) && (defined(__linux__) || defined(__APPLE__) || defined(_WIN32))
+		#define STACKTRACE_TLS __thread
+	#else
+		#define STACKTRACE_TLS
+	#endif
+#endif
+
+#if defined(STACKTRACE_CLOCK)
+	#define stackTraceClock() ((unsigned long long)(STACKTRACE_CLOCK()))
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define stackTraceClock() ((unsigned long long)__builtin_ia32_rdtsc())
+	#define STACKTRACE_CALIBRATE 1
+#elif defined(__GNUC__) && defined(__aarch64__)
+	static unsigned long long stackTraceClock(void)
+	{
+		unsigned long long t;
+		__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+		return t;
+	}
+#elif defined(__unix__) || defined(__APPLE__)
+	#include <time.h>
+	static unsigned long long stackTraceClock(void)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+	#define STACKTRACE_TICKS_PER_SECOND 1000000000ULL
+#else
+	#define stackTraceClock() 0ULL
+	#define STACKTRACE_TICKS_PER_SECOND 0ULL
+#endif
+
+#if defined(STACKTRACE_CALIBRATE)
+	#include <time.h>
+#endif
+
+#if defined(__GNUC__)
+	#define stackTraceAdd(p, v) __sync_add_and_fetch(p, v)
+	#define stackTraceCas(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#else
+	#define stackTraceAdd(p, v) (*(p) += (v))
+	#define stackTraceCas(p, o, n) (*(p) = (n), 1)
+#endif
+
+
+typedef struct
+{
+	const char* name;
+	unsigned long long calls;
+	unsigned long long ticks;
+	unsigned long long max;
+} Function;
+
+typedef struct
+{
+	Function* function;
+	int line;
+	unsigned long long start;
+} Frame;
+
+typedef struct Thread
+{
+	struct Thread* next;
+	unsigned long id;
+	unsigned long generation;	/* counters cleared by the owner when StackTrace_reset changes it */
+	int depth;
+	Frame stack[STACKTRACE_MAX_DEPTH];
+	Function functions[STACKTRACE_MAX_FUNCTIONS];
+} Thread;
+
+static Thread* threads = NULL;
+static unsigned long thread_count = 0;
+static volatile unsigned long generation = 0;
+static STACKTRACE_TLS Thread* current = NULL;
+
+
+static Thread* StackTrace_thread(void)
+{
+	Thread* t = current;
+
+	if (t == NULL)
+	{
+		if ((t = (Thread*)calloc(1, sizeof(Thread))) == NULL)
+			return NULL;
+		t->id = stackTraceAdd(&thread_count, 1);
+		t->generation = generation;
+		do
+			t->next = threads;
+		while (!stackTraceCas(&threads, t->next, t));
+		current = t;
+	}
+	else if (t->generation != generation)
+	{
+		t->generation = generation;
+		t->depth = 0;
+		memset(t->functions, 0, sizeof(t->functions));
+	}
+	return t;
+}
+
+
+static Function* StackTrace_function(Thread* t, const char* name)
+{
+	/* __func__ is one array per function, its address is the key */
+	unsigned int i = (unsigned int)(((size_t)name >> 3) & (STACKTRACE_MAX_FUNCTIONS - 1));
+	int n;
+
+	for (n = 0; n < STACKTRACE_MAX_FUNCTIONS; ++n)
+	{
+		Function* f = &t->functions[i];
+		if (f->name == name)
+			return f;
+		if (f->name == NULL)
+		{
+			f->name = name;
+			return f;
+		}
+		i = (i + 1) & (STACKTRACE_MAX_FUNCTIONS - 1);
+	}
+	return NULL;
+}
+
+
+void StackTrace_entry(const char* name, int line, int trace)
+{
+	Thread* t = StackTrace_thread();
+	Function* f;
+	Frame* fr;
+
+	if (t == NULL || t->depth >= STACKTRACE_MAX_DEPTH || (f = StackTrace_function(t, name)) == NULL)
+		return;	/* not timed, its FUNC_EXIT finds no frame */
+	fr = &t->stack[t->depth++];
+	fr->function = f;
+	fr->line = line;
+	fr->start = stackTraceClock();
+}
+
+
+void StackTrace_exit(const char* name, int line, void* rc, int trace)
+{
+	unsigned long long now = stackTraceClock();
+	Thread* t = current;
+	int depth;
+
+	if (t == NULL || t->generation != generation)
+		return;
+	/* unwind to the frame of the function, in case a function has returned without FUNC_EXIT */
+	for (depth = t->depth - 1; depth >= 0; --depth)
+	{
+		if (t->stack[depth].function->name == name)
+		{
+			Function* f = t->stack[depth].function;
+			unsigned long long ticks = now - t->stack[depth].start;
+			++f->calls;
+			f->ticks += ticks;
+			if (ticks > f->max)
+				f->max = ticks;
+			t->depth = depth;
+			break;
+		}
+	}
+}
+
+
+void StackTrace_printStack(FILE* dest)
+{
+	Thread* t = current;
+	int i;
+
+	if (t == NULL)
+		return;
+	fprintf(dest, "=========== Start of stack trace for thread %lu ==========\n", t->id);
+	for (i = t->depth - 1; i >= 0; --i)
+		fprintf(dest, "   at %s (%d)\n", t->stack[i].function->name, t->stack[i].line);
+	fprintf(dest, "=========== End of stack trace for thread %lu ==========\n\n", t->id);
+}
+
+
+/* not reentrant: the string is overwritten by the next call */
+char* StackTrace_get(unsigned long id)
+{
+	static char buf[256];
+	Thread* t;
+	int i, len = 0;
+
+	buf[0] = '\0';
+	for (t = threads; t != NULL && t->id != id; t = t->next)
+		;
+	if (t == NULL)
+		return buf;
+	for (i = t->depth - 1; i >= 0 && len < (int)sizeof(buf); --i)
+		len += snprintf(&buf[len], sizeof(buf) - len, "%s%s", (i == t->depth - 1) ? "" : " <- ",
+			t->stack[i].function->name);
+	return buf;
+}
+
+
+unsigned long long StackTrace_ticksPerSecond(void)
+{
+#if defined(STACKTRACE_CALIBRATE)
+	static unsigned long long ticks_per_second = 0;
+
+	if (ticks_per_second == 0)
+	{
+		struct timespec t0, t1, wait = {0, 20000000};
+		unsigned long long c0, c1, ns;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		c0 = stackTraceClock();
+		nanosleep(&wait, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		c1 = stackTraceClock();
+		ns = (unsigned long long)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+		ticks_per_second = (c1 - c0) * 1000000000ULL / ns;
+	}
+	return ticks_per_second;
+#elif defined(__GNUC__) && defined(__aarch64__) && !defined(STACKTRACE_CLOCK)
+	unsigned long long f;
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(f));
+	return f;
+#else
+	return (unsigned long long)(STACKTRACE_TICKS_PER_SECOND);
+#endif
+}
+
+
+/**
+ * Writes the counters of all the threads.  The counters being updated by their threads at the time can be one
+ * call behind
+ * @param dest the file to write to
+ * @return the number of lines written, not counting the header
+ */
+int StackTrace_dump(FILE* dest)
+{
+	Thread* t;
+	int i, lines = 0;
+
+	fprintf(dest, "# StackTrace ticks_per_second %llu\n", StackTrace_ticksPerSecond());
+	for (t = threads; t != NULL; t = t->next)
+	{
+		if (t->generation != generation)
+			continue;	/* cleared by StackTrace_reset, not used since */
+		for (i = 0; i < STACKTRACE_MAX_FUNCTIONS; ++i)
+		{
+			Function* f = &t->functions[i];
+			if (f->name != NULL && f->calls > 0)
+			{
+				fprintf(dest, "thread %lu %s %llu %llu %llu\n", t->id, f->name, f->calls, f->ticks, f->max);
+				++lines;
+			}
+		}
+	}
+	return lines;
+}
+
+
+/**
+ * Clears the counters of all the threads.  Each thread clears its own on its next FUNC_ENTRY, so that no
+ * counter is written by two threads
+ */
+void StackTrace_reset(void)
+{
+	stackTraceAdd(&generation, 1);
+}
+
+#endif
@@ -13,13 +13,19 @@
  * Contributors:
  *    Ian Craggs - initial API and implementation and/or initial documentation
  *    Ian Craggs - fix for bug #434081
+ *    raulMrello - profiler implementation in StackTrace.c, enabled with MQTT_STACKTRACE
  *******************************************************************************/
 
 #ifndef STACKTRACE_H_
 #define STACKTRACE_H_
 
 #include <stdio.h>
+
+/* Build with -DMQTT_STACKTRACE to count the calls and time of each function of the packet
+   codec (see StackTrace.c) */
+#if !defined(MQTT_STACKTRACE)
 #define NOSTACKTRACE 1
+#endif
 
 #if defined(NOSTACKTRACE)
 #define FUNC_ENTRY
@@ -36,6 +42,12 @@
 
 #else
 
+#if !defined(TRACE_MAXIMUM)
+#define TRACE_MAXIMUM 1
+#define TRACE_MEDIUM 2
+#define TRACE_MINIMUM 3
+#endif
+
 #if defined(WIN32)
 #define inline __inline
 #define FUNC_ENTRY StackTrace_entry(__FUNCTION__, __LINE__, TRACE_MINIMUM)
@@ -43,7 +55,7 @@
 #define FUNC_ENTRY_MED StackTrace_entry(__FUNCTION__, __LINE__, TRACE_MEDIUM)
 #define FUNC_ENTRY_MAX StackTrace_entry(__FUNCTION__, __LINE__, TRACE_MAXIMUM)
 #define FUNC_EXIT StackTrace_exit(__FUNCTION__, __LINE__, NULL, TRACE_MINIMUM)
-#define FUNC_EXIT_NOLOG StackTrace_exit(__FUNCTION__, __LINE__, -1)
+#define FUNC_EXIT_NOLOG StackTrace_exit(__FUNCTION__, __LINE__, NULL, -1)
 #define FUNC_EXIT_MED StackTrace_exit(__FUNCTION__, __LINE__, NULL, TRACE_MEDIUM)
 #define FUNC_EXIT_MAX StackTrace_exit(__FUNCTION__, __LINE__, NULL, TRACE_MAXIMUM)
 #define FUNC_EXIT_RC(x) StackTrace_exit(__FUNCTION__, __LINE__, &x, TRACE_MINIMUM)
@@ -62,12 +74,24 @@
 #define FUNC_EXIT_MED_RC(x) StackTrace_exit(__func__, __LINE__, &x, TRACE_MEDIUM)
 #define FUNC_EXIT_MAX_RC(x) StackTrace_exit(__func__, __LINE__, &x, TRACE_MAXIMUM)
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 void StackTrace_entry(const char* name, int line, int trace);
 void StackTrace_exit(const char* name, int line, void* return_value, int trace);
 
 void StackTrace_printStack(FILE* dest);
 char* StackTrace_get(unsigned long);
 
+int StackTrace_dump(FILE* dest);
+void StackTrace_reset(void);
+unsigned long long StackTrace_ticksPerSecond(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
 #endif
 
 #endif
@@ -0,0 +1,111 @@
+/*******************************************************************************
+ * Reference-counted packet buffers for the MQTT clients
+ *
+ * A Client whose policy has POOLED_BUFFERS has no packet buffers of its own: it takes
+ * its send and receive buffers from a PacketPool when it connects, and gives them back
+ * when it disconnects.  A QoS1/2 publication which has to be kept for the session is
+ * not copied: the client keeps a reference to the buffer it was serialized into and
+ * takes another one to send, and the buffer returns to the pool once the publication
+ * is acknowledged.  So the clients of a program share count buffers, instead of having
+ * three each.
+ *
+ * Usage:
+ *
+ *   typedef MQTT::ClientPolicy<1, true, MQTT::POOLED_BUFFERS> Pooled;
+ *   MQTT::PacketPool pool(8, 256);
+ *   MQTT::Client<Network, Timer, 256, 5, Pooled> client(network);
+ *   client.setPacketPool(&pool);
+ *
+ * A pool is not locked: it must be used from one thread.  Each connected client holds
+ * two buffers, plus one while the publication kept for its session is unacknowledged.
+ *******************************************************************************/
+
+#if !defined(MQTT_PACKET_POOL_H)
+#define MQTT_PACKET_POOL_H
+
+namespace MQTT
+{
+
+
+class PacketPool
+{
+public:
+    /** Construct the pool
+     *  @param count - number of buffers
+     *  @param size - size of each buffer, at least the MAX_MQTT_PACKET_SIZE of the clients which use it
+     */
+    PacketPool(int count, int size) : count(count > 0 ? count : 1), size(size), nfree(0)
+    {
+        data = new unsigned char[this->count * size];
+        refs = new int[this->count];
+        freelist = new int[this->count];
+        for (int i = this->count - 1; i >= 0; --i)
+        {
+            refs[i] = 0;
+            freelist[nfree++] = i;
+        }
+    }
+
+    ~PacketPool()
+    {
+        delete[] data;
+        delete[] refs;
+        delete[] freelist;
+    }
+
+    /** Take a buffer, with one reference
+     *  @return the buffer, 0 if there is none free
+     */
+    unsigned char* alloc()
+    {
+        if (nfree == 0)
+            return 0;
+        int i = freelist[--nfree];
+        refs[i] = 1;
+        return &data[i * size];
+    }
+
+    /** Add a reference to a buffer taken from this pool */
+    void retain(unsigned char* buf)
+    {
+        ++refs[index(buf)];
+    }
+
+    /** Drop a reference to a buffer, which returns to the pool with its last one */
+    void release(unsigned char* buf)
+    {
+        int i = index(buf);
+        if (--refs[i] == 0)
+            freelist[nfree++] = i;
+    }
+
+    int bufferSize() const
+    {
+        return size;
+    }
+
+    /** Number of free buffers */
+    int available() const
+    {
+        return nfree;
+    }
+
+private:
+
+    int index(unsigned char* buf) const
+    {
+        return (int)((buf - data) / size);
+    }
+
+    int count;
+    int size;
+    unsigned char* data;
+    int* refs;
+    int* freelist;      // indexes of the free buffers, a stack
+    int nfree;
+};
+
+
+}
+
+#endif
@@ -8,7 +8,7 @@
 class MQTTSocket
 {
 public:
-    MQTTSocket(EthernetInterface *anet)
+    MQTTSocket(EthernetInterface *anet) : event(0)
     {
         net = anet;
         open = false;
@@ -23,40 +23,40 @@ public:
         mysock.set_blocking(true);
         mysock.set_timeout((unsigned int)timeout);  
         rc = mysock.connect(hostname, port);
+        // from now on the socket is non-blocking and readiness is signalled through sigio
+        mysock.sigio(callback(this, &MQTTSocket::onSocketEvent));
         mysock.set_blocking(false);  // blocking timeouts seem not to work
         return rc;
     }
 
-    // common read/write routine, avoiding blocking timeouts
+    // common read/write routine, avoiding blocking timeouts: the socket is non-blocking and, whenever it
+    // would block, the caller sleeps until the stack signals an event or the deadline expires
     int common(unsigned char* buffer, int len, int timeout, bool read)
     {
+        timer.reset();
         timer.start();
-        mysock.set_blocking(false); // blocking timeouts seem not to work
         int bytes = 0;
-        bool first = true;
-        do 
+        while (bytes < len)
         {
-            if (first)
-                first = false;
-            else
-                wait_ms(timeout < 100 ? timeout : 100);
             int rc;
             if (read)
-                rc = mysock.recv((char*)buffer, len);
+                rc = mysock.recv((char*)buffer + bytes, len - bytes);
             else
-                rc = mysock.send((char*)buffer, len);
-            if (rc < 0)
+                rc = mysock.send((char*)buffer + bytes, len - bytes);
+            if (rc < 0 && rc != NSAPI_ERROR_WOULD_BLOCK)
+            {
+                bytes = -1;
+                break;
+            }
+            if (rc > 0)
             {
-                if (rc != NSAPI_ERROR_WOULD_BLOCK)
-                {
-                    bytes = -1;
-                    break;
-                }
-            } 
-            else
                 bytes += rc;
+                continue;
+            }
+            int left = timeout - timer.read_ms();
+            if (left <= 0 || event.wait(left) <= 0)
+                break;
         }
-        while (bytes < len && timer.read_ms() < timeout);
         timer.stop();
         return bytes;
     }
@@ -87,10 +87,19 @@ public:
 
 private:
 
+    // called by the network stack (possibly from interrupt context) when the socket state changes.
+    // Events that arrive while nobody is waiting stay in the semaphore, so none is lost between a
+    // WOULD_BLOCK result and the following wait.
+    void onSocketEvent()
+    {
+        event.release();
+    }
+
     bool open;
     TCPSocket mysock;
     EthernetInterface *net;
     Timer timer;
+    Semaphore event;
 
 };
 
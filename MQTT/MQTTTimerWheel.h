@@ -0,0 +1,266 @@
+/*******************************************************************************
+ * Tick based timers for MQTT clients
+ *
+ *   TickCountdown<Clock>   Timer parameter of MQTT::Client. It only stores its deadline
+ *                          and reads the shared Clock, so constructing one per operation
+ *                          costs nothing
+ *   TimerWheel<Clock>      hierarchical timer wheel for deadlines that must fire a callback
+ *                          (command timeouts, keepalive checks, retransmissions of many
+ *                          clients). Insert, cancel and expiry are O(1)
+ *
+ * Clock is a class with a static unsigned long now() returning a monotonic count of
+ * milliseconds, which may wrap (see MbedTick in MQTTmbed.h and LinuxTick in MQTTLinux.h).
+ *******************************************************************************/
+
+#if !defined(MQTT_TIMER_WHEEL_H)
+#define MQTT_TIMER_WHEEL_H
+
+namespace MQTT
+{
+
+
+template<class Clock>
+class TickCountdown
+{
+public:
+    TickCountdown() : end(Clock::now())
+    {
+
+    }
+
+    TickCountdown(int ms)
+    {
+        countdown_ms(ms);
+    }
+
+    bool expired()
+    {
+        return (long)(Clock::now() - end) >= 0;
+    }
+
+    void countdown_ms(unsigned long ms)
+    {
+        end = Clock::now() + ms;
+    }
+
+    void countdown(int seconds)
+    {
+        countdown_ms((unsigned long)seconds * 1000L);
+    }
+
+    int left_ms()
+    {
+        return (int)(long)(end - Clock::now());
+    }
+
+private:
+    unsigned long end;
+};
+
+
+/* A deadline registered in a TimerWheel. The owner keeps it (usually as a member of the
+   object it refers to) for as long as it may be pending: the wheel only links it in.
+*/
+class WheelTimer
+{
+public:
+    typedef void (*expiryHandler)(WheelTimer&, void*);
+
+    WheelTimer() : handler(0), context(0), expiry(0), level(0), prev(0), next(0), pending(false)
+    {
+
+    }
+
+    WheelTimer(expiryHandler handler, void* context) : handler(handler), context(context), expiry(0), level(0), prev(0), next(0), pending(false)
+    {
+
+    }
+
+    void attach(expiryHandler handler, void* context)
+    {
+        this->handler = handler;
+        this->context = context;
+    }
+
+    bool isPending()
+    {
+        return pending;
+    }
+
+private:
+    template<class Clock> friend class TimerWheel;
+
+    expiryHandler handler;
+    void* context;
+    unsigned long expiry;   // in ticks
+    int level;
+    WheelTimer* prev;
+    WheelTimer* next;
+    bool pending;
+};
+
+
+template<class Clock>
+class TimerWheel
+{
+public:
+    /** Construct the wheel
+     *  @param tick_ms - resolution of the wheel, timers never fire early and up to two ticks late.  With 4 levels of 64 slots
+     *      the wheel holds deadlines of up to 2^24 ticks, later ones are clamped
+     */
+    TimerWheel(unsigned long tick_ms = 10) : tick_ms(tick_ms ? tick_ms : 1), last_ms(Clock::now()), now_tick(0), current(0), pending(0)
+    {
+        for (int l = 0; l < LEVELS; ++l)
+            for (int s = 0; s < SLOTS; ++s)
+                wheel[l][s] = 0;
+    }
+
+    /** Arm (or re-arm) a timer
+     *  @param timer - the timer, its handler is called from run() once the time has elapsed
+     *  @param ms - time from now, in milliseconds
+     */
+    void start(WheelTimer& timer, unsigned long ms)
+    {
+        if (timer.pending)
+            unlink(timer);
+        // rounded up plus the part of the current tick already elapsed, so that a timer never fires early
+        timer.expiry = ticks() + (ms + tick_ms - 1) / tick_ms + 1;
+        link(timer);
+    }
+
+    /** Cancel a timer, it is safe to call it on a timer which is not pending */
+    void stop(WheelTimer& timer)
+    {
+        if (timer.pending)
+            unlink(timer);
+    }
+
+    /** Number of pending timers */
+    int size()
+    {
+        return pending;
+    }
+
+    /** Milliseconds until run() may have work to do, capped to max_ms.  Meant for the timeout of the
+     *  event wait of the loop which calls run()
+     */
+    unsigned long next_ms(unsigned long max_ms)
+    {
+        if (pending == 0)
+            return max_ms;
+        if ((long)(ticks() - current) > 0)
+            return 0;
+        // the next occupied slot of the first level, or the next cascade from the second one
+        unsigned long n = SLOTS - (current & (SLOTS - 1));
+        for (unsigned long t = 1; t < n; ++t)
+        {
+            if (wheel[0][(current + t) & (SLOTS - 1)] != 0)
+            {
+                n = t;
+                break;
+            }
+        }
+        unsigned long ms = n * tick_ms - (Clock::now() - last_ms);
+        return (ms < max_ms) ? ms : max_ms;
+    }
+
+    /** Advance the wheel up to the current time and call the handlers of the timers that have expired
+     *  @return number of expired timers
+     */
+    int run()
+    {
+        unsigned long now = ticks();
+        int fired = 0;
+
+        if (pending == 0)
+            current = now;
+        while ((long)(now - current) > 0 && pending > 0)
+        {
+            ++current;
+            // when a level wraps, the next slot of the level above moves down
+            for (int l = 1; l < LEVELS && ((current >> (l * BITS)) << (l * BITS)) == current; ++l)
+                cascade(l, (current >> (l * BITS)) & (SLOTS - 1));
+
+            WheelTimer* timer;
+            while ((timer = wheel[0][current & (SLOTS - 1)]) != 0)
+            {
+                unlink(*timer);
+                ++fired;
+                if (timer->handler)
+                    timer->handler(*timer, timer->context);   // may restart this or any other timer
+            }
+        }
+        if (pending == 0)
+            current = now;
+        return fired;
+    }
+
+private:
+    enum { BITS = 6, SLOTS = 1 << BITS, LEVELS = 4 };
+
+    // ticks elapsed since construction, counted from the differences of the clock so that its wrap is harmless
+    unsigned long ticks()
+    {
+        unsigned long n = (Clock::now() - last_ms) / tick_ms;
+        last_ms += n * tick_ms;
+        now_tick += n;
+        return now_tick;
+    }
+
+    void link(WheelTimer& timer)
+    {
+        unsigned long delta = timer.expiry - current;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1UL << ((level + 1) * BITS)))
+            ++level;
+        if (delta >= (1UL << (LEVELS * BITS)))
+            timer.expiry = current + (1UL << (LEVELS * BITS)) - 1;
+        WheelTimer** slot = &wheel[level][(timer.expiry >> (level * BITS)) & (SLOTS - 1)];
+        timer.level = level;
+        timer.prev = 0;
+        timer.next = *slot;
+        if (*slot)
+            (*slot)->prev = &timer;
+        *slot = &timer;
+        timer.pending = true;
+        ++pending;
+    }
+
+    void unlink(WheelTimer& timer)
+    {
+        if (timer.prev)
+            timer.prev->next = timer.next;
+        else
+            wheel[timer.level][(timer.expiry >> (timer.level * BITS)) & (SLOTS - 1)] = timer.next;
+        if (timer.next)
+            timer.next->prev = timer.prev;
+        timer.prev = timer.next = 0;
+        timer.pending = false;
+        --pending;
+    }
+
+    void cascade(int level, unsigned long slot)
+    {
+        WheelTimer* timer = wheel[level][slot];
+        wheel[level][slot] = 0;
+        while (timer != 0)
+        {
+            WheelTimer* next = timer->next;
+            --pending;
+            link(*timer);
+            timer = next;
+        }
+    }
+
+    unsigned long tick_ms;
+    unsigned long last_ms;  // clock value at the start of now_tick
+    unsigned long now_tick;
+    unsigned long current;  // last tick processed
+    int pending;
+    WheelTimer* wheel[LEVELS][SLOTS];
+};
+
+
+}
+
+#endif
@@ -2,48 +2,41 @@
 #define MQTT_MBED_H
 
 #include "mbed.h"
+#include "MQTTTimerWheel.h"
 
-class Countdown
+// Microsecond clock of the ClientMetrics, on a single hardware Timer started on first use
+class MbedMicroTick
 {
 public:
-    Countdown() : t()
+    static unsigned long now()
     {
-  
+        return (unsigned long)timer().read_high_resolution_us();
     }
-    
-    Countdown(int ms) : t()
-    {
-        countdown_ms(ms);   
-    }
-    
-    
-    bool expired()
-    {
-        return t.read_ms() >= interval_end_ms;
-    }
-    
-    void countdown_ms(unsigned long ms)  
-    {
-        t.stop();
-        interval_end_ms = ms;
-        t.reset();
-        t.start();
-    }
-    
-    void countdown(int seconds)
+
+    static Timer& timer()
     {
-        countdown_ms((unsigned long)seconds * 1000L);
+        static Timer t;
+        static bool started = false;
+        if (!started)
+        {
+            t.start();
+            started = true;
+        }
+        return t;
     }
-    
-    int left_ms()
+};
+
+// Time base shared by all the Countdowns, on the same Timer
+class MbedTick
+{
+public:
+    static unsigned long now()
     {
-        return interval_end_ms - t.read_ms();
+        return (unsigned long)(MbedMicroTick::timer().read_high_resolution_us() / 1000);
     }
-    
-private:
-    Timer t;
-    unsigned long interval_end_ms; 
 };
 
-#endif
+// Only stores its deadline, so the Client can construct one per operation for free
+typedef MQTT::TickCountdown<MbedTick> Countdown;
 
+#endif
@@ -0,0 +1,146 @@
+/*
+ * bench_Delegate.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Microbenchmark de la llamada a un manejador de mensajes: FP, MQTT::Delegate y, segn la plataforma,
+ *  std::function (Linux) o mbed::Callback (mbed). Cada caso llama N veces a un manejador que slo incrementa un
+ *  contador, a travs de una funcin no inline, de modo que el compilador no puede resolver la llamada.
+ *
+ *  Uso: bench_Delegate [-n llamadas]
+ *
+ *  Compilacin: make bench_Delegate (en este directorio), o en un proyecto mbed junto a la librera MQTT
+ */
+
+
+#if defined(__MBED__)
+#include "mbed.h"
+#else
+#include <chrono>
+#include <functional>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include "FP.h"
+#include "MQTTClient.h"
+
+
+#if defined(__MBED__)
+#define BENCH_CALLS     1000000
+#else
+#define BENCH_CALLS     100000000
+#endif
+
+#define NOINLINE __attribute__((noinline))
+
+
+static volatile unsigned s_count = 0;
+
+
+//------------------------------------------------------------------------------------
+NOINLINE static void handler(MQTT::MessageData& md){
+    s_count++;
+}
+
+
+//------------------------------------------------------------------------------------
+struct Bridge {
+    NOINLINE void onMessage(MQTT::MessageData& md){
+        s_count += step;
+    }
+    unsigned step;
+};
+
+
+//------------------------------------------------------------------------------------
+template<class H>
+NOINLINE static void callMany(H& h, MQTT::MessageData& md, unsigned n){
+    for(unsigned i=0;i<n;i++){
+        h(md);
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+#if defined(__MBED__)
+static Timer s_timer;
+static double nowNs(){
+    return s_timer.read_us() * 1000.0;
+}
+#else
+static double nowNs(){
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+
+//------------------------------------------------------------------------------------
+template<class H>
+static void run(const char* name, H& h, MQTT::MessageData& md, unsigned n){
+    s_count = 0;
+    double t0 = nowNs();
+    callMany(h, md, n);
+    double t1 = nowNs();
+    printf("%-34s %8.2f ns/llamada %s\n", name, (t1 - t0) / n, (s_count >= n)? "" : "ERROR");
+}
+
+
+//------------------------------------------------------------------------------------
+#if defined(__MBED__)
+int main(){
+    unsigned n = BENCH_CALLS;
+    s_timer.start();
+#else
+int main(int argc, char** argv){
+    unsigned n = BENCH_CALLS;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        if(opt == 'n'){
+            n = atoi(optarg);
+        }
+        else{
+            fprintf(stderr, "uso: %s [-n llamadas]\n", argv[0]);
+            return 1;
+        }
+    }
+#endif
+    MQTTString topic = MQTTString_initializer;
+    topic.cstring = (char*)"bench/data";
+    MQTT::Message message;
+    MQTT::MessageData md(topic, message);
+    Bridge bridge;
+    bridge.step = 1;
+    unsigned step = 1;
+
+    typedef MQTT::Delegate<void, MQTT::MessageData&> Delegate;
+    FP<void, MQTT::MessageData&> fp_fn;
+    fp_fn.attach(handler);
+    FP<void, MQTT::MessageData&> fp_member;
+    fp_member.attach(&bridge, &Bridge::onMessage);
+    Delegate d_fn(handler);
+    Delegate d_member(&bridge, &Bridge::onMessage);
+    Delegate d_bind = Delegate::bind<Bridge, &Bridge::onMessage>(&bridge);
+
+    printf("%u llamadas, Delegate de %d bytes, FP de %d bytes\n", n, (int)sizeof(Delegate), (int)sizeof(fp_fn));
+    run("FP funcin", fp_fn, md, n);
+    run("FP miembro", fp_member, md, n);
+    run("Delegate funcin", d_fn, md, n);
+    run("Delegate miembro", d_member, md, n);
+    run("Delegate bind<miembro>", d_bind, md, n);
+#if defined(__MBED__)
+    mbed::Callback<void(MQTT::MessageData&)> cb_fn(handler);
+    mbed::Callback<void(MQTT::MessageData&)> cb_member(&bridge, &Bridge::onMessage);
+    run("mbed::Callback funcin", cb_fn, md, n);
+    run("mbed::Callback miembro", cb_member, md, n);
+#else
+    Delegate d_lambda([&step](MQTT::MessageData& md){ s_count += step; });
+    std::function<void(MQTT::MessageData&)> f_fn(handler);
+    std::function<void(MQTT::MessageData&)> f_lambda([&step](MQTT::MessageData& md){ s_count += step; });
+    run("Delegate lambda con capturas", d_lambda, md, n);
+    run("std::function funcin", f_fn, md, n);
+    run("std::function lambda con capturas", f_lambda, md, n);
+#endif
+    return 0;
+}
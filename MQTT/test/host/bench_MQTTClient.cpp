@@ -0,0 +1,370 @@
+/*
+ * bench_MQTTClient.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Banco de pruebas de MQTT::Client en Linux, con el backend de MQTTLinux.h (LinuxNetwork y LinuxCountdown).
+ *
+ *  Un broker mnimo, en el propio proceso, acepta las conexiones en 127.0.0.1 y responde a CONNECT, SUBSCRIBE y
+ *  PINGREQ. Cada PUBLISH recibido se devuelve tal cual al cliente que lo enva, que est suscrito al mismo topic,
+ *  de forma que se mide el camino completo publish -> socket -> cycle() -> handler. Cada cliente mantiene como
+ *  mximo una ventana de publicaciones pendientes de recibir y al finalizar se muestra el throughput (mensajes/s)
+ *  y la latencia de ida y vuelta (p50/p99/max).
+ *
+ *  Con un cliente, ste recibe mediante yield(), o mediante drain() con -d. Con varios (-c), todos se atienden
+ *  desde un nico thread con LinuxClientManager.
+ *
+ *  Uso: bench_MQTTClient [-n mensajes] [-s bytes] [-q 0|1] [-w ventana] [-c clientes] [-u] [-d]
+ *
+ *      -n  Nmero de mensajes (por defecto 100000)
+ *      -s  Tamao de los datos de cada publicacin (por defecto 32)
+ *      -q  QoS de las publicaciones (por defecto 0)
+ *      -w  Publicaciones pendientes de recibir como mximo en cada cliente (por defecto 32)
+ *      -c  Nmero de clientes (por defecto 1)
+ *      -u  Utiliza LinuxUringNetwork (compilar con make URING=1)
+ *      -d  Con un cliente, procesa los paquetes por lotes con drain() en lugar de yield()
+ *
+ *  Compilado con make STACKTRACE=1, escribe al final en stacktrace.txt los contadores del codec MQTTPacket, que
+ *  muestra report_StackTrace.
+ *
+ *  Compilacin: make (en este directorio)
+ */
+
+
+#include "MQTTLinux.h"
+#include "MQTTClient.h"
+#include "MQTTLinuxManager.h"
+#if defined(MQTT_STACKTRACE)
+#include "StackTrace.h"
+#endif
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+/** Topic de las publicaciones */
+#define BENCH_TOPIC         "bench/data"
+
+/** Tamao mximo de los paquetes MQTT del cliente */
+#define BENCH_PACKET_SIZE   1024
+
+
+static std::vector<int64_t> s_sent_us;
+static std::vector<int64_t> s_latency_us;
+static uint32_t s_received = 0;
+static std::vector<uint32_t> s_client_received;
+
+
+//------------------------------------------------------------------------------------
+static int64_t nowUs(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//------------------------------------------------------------------------------------
+static bool readAll(int fd, unsigned char* buf, int len){
+    while(len > 0){
+        ssize_t rc = recv(fd, buf, len, 0);
+        if(rc <= 0){
+            return false;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Sesin del broker con un cliente. Devuelve al cliente cada PUBLISH que recibe. */
+static void brokerSession(int fd){
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    std::vector<unsigned char> pkt(BENCH_PACKET_SIZE);
+    unsigned char out[16];
+    for(;;){
+        // cabecera fija: tipo y longitud restante
+        int hlen = 1, rem_len = 0, mult = 1;
+        if(!readAll(fd, &pkt[0], 1)){
+            break;
+        }
+        do{
+            if(hlen > 4 || !readAll(fd, &pkt[hlen], 1)){
+                goto exit;
+            }
+            rem_len += (pkt[hlen] & 127) * mult;
+            mult *= 128;
+        }while(pkt[hlen++] & 128);
+        if(hlen + rem_len > (int)pkt.size()){
+            pkt.resize(hlen + rem_len);
+        }
+        if(!readAll(fd, &pkt[hlen], rem_len)){
+            break;
+        }
+
+        int len = 0;
+        switch(pkt[0] >> 4){
+            case CONNECT:
+                len = MQTTSerialize_connack(out, sizeof(out), 0, 0);
+                break;
+            case SUBSCRIBE:{
+                unsigned char dup;
+                unsigned short id;
+                int count, qos[4];
+                MQTTString topics[4];
+                if(MQTTDeserialize_subscribe(&dup, &id, 4, &count, topics, qos, &pkt[0], hlen + rem_len) == 1){
+                    len = MQTTSerialize_suback(out, sizeof(out), id, count, qos);
+                }
+                break;
+            }
+            case PUBLISH:{
+                unsigned char dup, retained;
+                unsigned short id;
+                int qos, payloadlen;
+                MQTTString topic;
+                unsigned char* payload;
+                if(MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic, &payload, &payloadlen, &pkt[0], hlen + rem_len) == 1 && qos > 0){
+                    len = MQTTSerialize_ack(out, sizeof(out), PUBACK, 0, id);
+                }
+                if(len > 0 && send(fd, out, len, MSG_NOSIGNAL) != len){
+                    goto exit;
+                }
+                // el mismo paquete vuelve al cliente suscrito
+                len = 0;
+                if(send(fd, &pkt[0], hlen + rem_len, MSG_NOSIGNAL) != hlen + rem_len){
+                    goto exit;
+                }
+                break;
+            }
+            case PINGREQ:
+                // el codec no incluye el serializador de PINGRESP
+                out[0] = PINGRESP << 4;
+                out[1] = 0;
+                len = 2;
+                break;
+            case DISCONNECT:
+                goto exit;
+            default:
+                break;
+        }
+        if(len > 0 && send(fd, out, len, MSG_NOSIGNAL) != len){
+            break;
+        }
+    }
+exit:
+    close(fd);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Acepta conexiones hasta que se cierra el socket de escucha */
+static void brokerTask(int listener){
+    int fd;
+    while((fd = accept(listener, 0, 0)) >= 0){
+        std::thread(brokerSession, fd).detach();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void messageArrived(MQTT::MessageData& md){
+    int64_t now = nowUs();
+    // datos: nmero de secuencia y nmero de cliente
+    uint32_t seq = 0, id = 0;
+    if(md.message.payloadlen >= 2 * sizeof(seq)){
+        memcpy(&seq, md.message.payload, sizeof(seq));
+        memcpy(&id, (uint8_t*)md.message.payload + sizeof(seq), sizeof(id));
+    }
+    if(seq < s_sent_us.size()){
+        s_latency_us.push_back(now - s_sent_us[seq]);
+    }
+    if(id < s_client_received.size()){
+        s_client_received[id]++;
+    }
+    s_received++;
+}
+
+
+//------------------------------------------------------------------------------------
+static uint32_t percentile(std::vector<int64_t>& v, uint32_t pc){
+    if(v.empty()){
+        return 0;
+    }
+    size_t i = (v.size() * pc) / 100;
+    return (uint32_t)v[(i < v.size())? i : v.size() - 1];
+}
+
+
+//------------------------------------------------------------------------------------
+template<class Network>
+static int runBench(int port, uint32_t count, uint32_t size, MQTT::QoS qos, uint32_t window, uint32_t clients, bool drain){
+    typedef MQTT::Client<Network, LinuxCountdown, BENCH_PACKET_SIZE> BenchClient;
+    std::vector<Network*> networks(clients);
+    std::vector<BenchClient*> client(clients);
+    LinuxClientManager<Network, BenchClient> manager;
+    std::vector<uint32_t> sent(clients, 0);
+    s_client_received.assign(clients, 0);
+    int rc;
+    for(uint32_t c=0;c<clients;c++){
+        networks[c] = new Network();
+        client[c] = new BenchClient(*networks[c], 5000);
+        if((rc = networks[c]->connect("127.0.0.1", port)) != 0){
+            fprintf(stderr, "error de conexin TCP (%d)\n", rc);
+            return 1;
+        }
+        char id[16];
+        sprintf(id, "bench%u", c);
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        data.MQTTVersion = 4;
+        data.clientID.cstring = id;
+        if((rc = client[c]->connect(data)) != 0 || (rc = client[c]->subscribe(BENCH_TOPIC, MQTT::QOS0, messageArrived)) != 0){
+            fprintf(stderr, "error de conexin MQTT (%d)\n", rc);
+            return 1;
+        }
+        if(clients > 1 && manager.add(*networks[c], *client[c]) != 0){
+            fprintf(stderr, "error al aadir el cliente %u\n", c);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> payload(size, 'x');
+    int64_t t_start = nowUs();
+    int64_t t_last = t_start;
+    uint32_t i = 0;
+    while(i < count && nowUs() - t_last < 1000000){
+        // cada cliente mantiene como mximo 'window' mensajes pendientes de recibir
+        for(uint32_t c=0;c<clients && i<count;c++){
+            while(i < count && sent[c] - s_client_received[c] < window){
+                memcpy(&payload[0], &i, sizeof(i));
+                memcpy(&payload[sizeof(i)], &c, sizeof(c));
+                s_sent_us[i] = nowUs();
+                if((rc = client[c]->publish(BENCH_TOPIC, &payload[0], size, qos)) != 0){
+                    fprintf(stderr, "error en publish %u (%d)\n", i, rc);
+                    count = i;
+                    break;
+                }
+                sent[c]++;
+                i++;
+            }
+        }
+        uint32_t last = s_received;
+        if(clients > 1){
+            manager.run(1);
+        }
+        else if(drain){
+            client[0]->drain(1);
+        }
+        else{
+            client[0]->yield(1);
+        }
+        if(s_received != last){
+            t_last = nowUs();
+        }
+    }
+    // espera a que lleguen los ltimos mensajes
+    uint32_t last = s_received;
+    t_last = nowUs();
+    while(s_received < count && nowUs() - t_last < 500000){
+        if(clients > 1){
+            manager.run(10);
+        }
+        else if(drain){
+            client[0]->drain(10);
+        }
+        else{
+            client[0]->yield(10);
+        }
+        if(s_received != last){
+            last = s_received;
+            t_last = nowUs();
+        }
+    }
+    int64_t t_end = nowUs();
+    for(uint32_t c=0;c<clients;c++){
+        manager.remove(*client[c]);
+        client[c]->disconnect();
+        networks[c]->disconnect();
+        delete client[c];
+        delete networks[c];
+    }
+
+    std::sort(s_latency_us.begin(), s_latency_us.end());
+    double elapsed = (t_end - t_start) / 1000000.0;
+    printf("size=%u qos=%d window=%u clients=%u count=%u\n", size, (int)qos, window, clients, count);
+    printf("recibidos: %u/%u en %.3f s\n", s_received, count, elapsed);
+    printf("throughput: %.1f mensajes/s\n", (elapsed > 0)? (s_received / elapsed) : 0.0);
+    printf("latencia (us): p50=%u p99=%u max=%u\n", percentile(s_latency_us, 50), percentile(s_latency_us, 99), (s_latency_us.empty())? 0 : (uint32_t)s_latency_us.back());
+    return (s_received == count)? 0 : 1;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    uint32_t count = 100000;
+    uint32_t size = 32;
+    uint32_t window = 32;
+    uint32_t clients = 1;
+    MQTT::QoS qos = MQTT::QOS0;
+    bool uring = false;
+    bool drain = false;
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:q:w:c:ud")) != -1){
+        switch(opt){
+            case 'n': count = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'q': qos = (atoi(optarg) > 0)? MQTT::QOS1 : MQTT::QOS0; break;
+            case 'w': window = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'u': uring = true; break;
+            case 'd': drain = true; break;
+            default:
+                fprintf(stderr, "uso: %s [-n mensajes] [-s bytes] [-q 0|1] [-w ventana] [-c clientes] [-u] [-d]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(size < 8 || size > BENCH_PACKET_SIZE - 32 || count == 0 || window == 0 || clients == 0){
+        fprintf(stderr, "parmetros incorrectos\n");
+        return 1;
+    }
+
+    // broker en un puerto libre de 127.0.0.1
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0 ||
+       getsockname(listener, (struct sockaddr*)&addr, &addrlen) != 0){
+        fprintf(stderr, "no se ha podido iniciar el broker\n");
+        return 1;
+    }
+    std::thread broker(brokerTask, listener);
+
+    s_sent_us.assign(count, 0);
+    s_latency_us.reserve(count);
+    int rc;
+    if(uring){
+#if defined(MQTT_LINUX_IO_URING)
+        rc = runBench<LinuxUringNetwork>(ntohs(addr.sin_port), count, size, qos, window, clients, drain);
+#else
+        fprintf(stderr, "compilado sin soporte io_uring (make URING=1)\n");
+        rc = 1;
+#endif
+    }
+    else{
+        rc = runBench<LinuxNetwork>(ntohs(addr.sin_port), count, size, qos, window, clients, drain);
+    }
+    shutdown(listener, SHUT_RDWR);
+    broker.join();
+    close(listener);
+#if defined(MQTT_STACKTRACE)
+    FILE* f = fopen("stacktrace.txt", "w");
+    if(f){
+        StackTrace_dump(f);
+        fclose(f);
+    }
+#endif
+    return rc;
+}
@@ -0,0 +1,188 @@
+/*
+ * bench_MQTTLoopback.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Banco de pruebas de MQTT::Client contra el broker en proceso de MQTTLoopback.h, sin red ni broker externo.
+ *
+ *  Cada cliente est suscrito a su propio topic y publica en l, manteniendo como mximo una ventana de
+ *  publicaciones pendientes de recibir, como en bench_MQTTClient. Todos se atienden desde un nico hilo con
+ *  drain(0), y LoopbackBroker::step() avanza el reloj virtual hasta el siguiente paquete. El throughput y la
+ *  latencia se miden en ese reloj, de forma que el resultado slo depende de los parmetros y de la semilla: dos
+ *  ejecuciones iguales dan exactamente las mismas cifras en cualquier mquina. Se muestra tambin el tiempo real
+ *  que ha costado la simulacin.
+ *
+ *  Uso: bench_MQTTLoopback [-n mensajes] [-s bytes] [-q 0|1|2] [-w ventana] [-c clientes] [-l us] [-b bytes/s]
+ *                          [-p prdidas] [-r semilla]
+ *
+ *      -n  Nmero de mensajes (por defecto 100000)
+ *      -s  Tamao de los datos de cada publicacin (por defecto 32)
+ *      -q  QoS de las publicaciones y de las suscripciones (por defecto 0)
+ *      -w  Publicaciones pendientes de recibir como mximo en cada cliente (por defecto 32)
+ *      -c  Nmero de clientes (por defecto 1)
+ *      -l  Latencia de cada sentido del enlace, en microsegundos (por defecto 1000)
+ *      -b  Ancho de banda de cada sentido del enlace, en bytes/s (por defecto 0, sin lmite)
+ *      -p  Probabilidad de retransmisin de cada escritura, de 0 a 1 (por defecto 0)
+ *      -r  Semilla de las prdidas (por defecto 1)
+ *
+ *  Compilacin: make bench_MQTTLoopback (en este directorio)
+ */
+
+
+#include "MQTTClient.h"
+#include "MQTTLoopback.h"
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <vector>
+
+
+/** Tamao mximo de los paquetes MQTT del cliente */
+#define BENCH_PACKET_SIZE   1024
+
+
+typedef MQTT::Client<MQTT::LoopbackNetwork, MQTT::LoopbackCountdown, BENCH_PACKET_SIZE, 2, MQTT::ClientPolicy<2> > BenchClient;
+
+
+static std::vector<unsigned long long> s_sent_us;
+static std::vector<unsigned long long> s_latency_us;
+static std::vector<uint32_t> s_client_received;
+static uint32_t s_received = 0;
+
+
+//------------------------------------------------------------------------------------
+static void messageArrived(MQTT::MessageData& md){
+    // datos: nmero de secuencia y nmero de cliente
+    uint32_t seq = 0, id = 0;
+    if(md.message.payloadlen >= 2 * sizeof(seq)){
+        memcpy(&seq, md.message.payload, sizeof(seq));
+        memcpy(&id, (uint8_t*)md.message.payload + sizeof(seq), sizeof(id));
+    }
+    if(seq < s_sent_us.size()){
+        s_latency_us.push_back(MQTT::LoopbackClock::micros() - s_sent_us[seq]);
+    }
+    if(id < s_client_received.size()){
+        s_client_received[id]++;
+    }
+    s_received++;
+}
+
+
+//------------------------------------------------------------------------------------
+static unsigned long long percentile(std::vector<unsigned long long>& v, uint32_t pc){
+    if(v.empty()){
+        return 0;
+    }
+    size_t i = (v.size() * pc) / 100;
+    return v[(i < v.size())? i : v.size() - 1];
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    uint32_t count = 100000;
+    uint32_t size = 32;
+    uint32_t window = 32;
+    uint32_t clients = 1;
+    MQTT::QoS qos = MQTT::QOS0;
+    MQTT::LinkProfile profile(1000);
+    unsigned long long seed = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:q:w:c:l:b:p:r:")) != -1){
+        switch(opt){
+            case 'n': count = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'q': qos = (MQTT::QoS)std::min(std::max(atoi(optarg), 0), 2); break;
+            case 'w': window = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'l': profile.latency_us = strtoul(optarg, 0, 10); break;
+            case 'b': profile.bandwidth = strtoul(optarg, 0, 10); break;
+            case 'p': profile.loss = atof(optarg); break;
+            case 'r': seed = strtoull(optarg, 0, 10); break;
+            default:
+                fprintf(stderr, "uso: %s [-n mensajes] [-s bytes] [-q 0|1|2] [-w ventana] [-c clientes] [-l us] [-b bytes/s] "
+                        "[-p prdidas] [-r semilla]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(size < 8 || size > BENCH_PACKET_SIZE - 32 || count == 0 || window == 0 || clients == 0){
+        fprintf(stderr, "parmetros incorrectos\n");
+        return 1;
+    }
+
+    MQTT::LoopbackBroker broker(2, seed, window + 1);
+    std::vector<MQTT::LoopbackNetwork> networks(clients);
+    std::vector<BenchClient*> client(clients);
+    std::vector<std::vector<char> > topics(clients);
+    std::vector<uint32_t> sent(clients, 0);
+    s_client_received.assign(clients, 0);
+    s_sent_us.assign(count, 0);
+    s_latency_us.reserve(count);
+    int rc;
+    for(uint32_t c=0;c<clients;c++){
+        client[c] = new BenchClient(networks[c], 30000);
+        char id[16];
+        sprintf(id, "bench%u", c);
+        topics[c].resize(32);
+        sprintf(&topics[c][0], "bench/%u", c);
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        data.clientID.cstring = id;
+        networks[c].connect(broker, profile);
+        if((rc = client[c]->connect(data)) != 0 || (rc = client[c]->subscribe(&topics[c][0], qos, messageArrived)) != 0){
+            fprintf(stderr, "error de conexin MQTT (%d)\n", rc);
+            return 1;
+        }
+    }
+
+    auto wall_start = std::chrono::steady_clock::now();
+    unsigned long long t_start = MQTT::LoopbackClock::micros();
+    std::vector<uint8_t> payload(size, 'x');
+    uint32_t i = 0;
+    while(s_received < count){
+        bool busy = false;
+        // cada cliente mantiene como mximo 'window' mensajes pendientes de recibir
+        for(uint32_t c=0;c<clients && i<count;c++){
+            while(i < count && sent[c] - s_client_received[c] < window){
+                memcpy(&payload[0], &i, sizeof(i));
+                memcpy(&payload[sizeof(i)], &c, sizeof(c));
+                s_sent_us[i] = MQTT::LoopbackClock::micros();
+                if((rc = client[c]->publish(&topics[c][0], &payload[0], size, qos)) != 0){
+                    fprintf(stderr, "error en publish %u (%d)\n", i, rc);
+                    return 1;
+                }
+                sent[c]++;
+                i++;
+                busy = true;
+            }
+        }
+        for(uint32_t c=0;c<clients;c++){
+            if((rc = client[c]->drain(0)) < 0){
+                fprintf(stderr, "error en drain (%d)\n", rc);
+                return 1;
+            }
+            busy = busy || rc > 0;
+        }
+        if(!busy && !broker.step()){
+            break;  // no queda nada en camino
+        }
+    }
+    unsigned long long t_end = MQTT::LoopbackClock::micros();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    for(uint32_t c=0;c<clients;c++){
+        client[c]->disconnect();
+        networks[c].disconnect();
+        delete client[c];
+    }
+
+    std::sort(s_latency_us.begin(), s_latency_us.end());
+    double elapsed = (t_end - t_start) / 1000000.0;
+    printf("size=%u qos=%d window=%u clients=%u count=%u latency=%lu us bandwidth=%lu B/s loss=%g seed=%llu\n", size,
+           (int)qos, window, clients, count, profile.latency_us, profile.bandwidth, profile.loss, seed);
+    printf("recibidos: %u/%u en %.3f s virtuales, %lu retransmisiones\n", s_received, count, elapsed, broker.lost());
+    printf("throughput: %.1f mensajes/s\n", (elapsed > 0)? (s_received / elapsed) : 0.0);
+    printf("latencia (us): p50=%llu p99=%llu max=%llu\n", percentile(s_latency_us, 50), percentile(s_latency_us, 99),
+           (s_latency_us.empty())? 0ULL : s_latency_us.back());
+    printf("simulacin: %.3f s reales, %.1f mensajes/s\n", wall, (wall > 0)? (s_received / wall) : 0.0);
+    return (s_received == count)? 0 : 1;
+}
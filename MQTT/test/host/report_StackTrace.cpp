@@ -0,0 +1,84 @@
+/*
+ * report_StackTrace.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Informe de un volcado de StackTrace_dump (MQTTPacket compilado con MQTT_STACKTRACE). Suma los contadores de
+ *  todos los hilos por funcin y los muestra ordenados por tiempo total. El tiempo de cada funcin incluye el de
+ *  las funciones perfiladas a las que llama.
+ *
+ *  Uso: report_StackTrace [fichero]    (por defecto lee la entrada estndar)
+ *
+ *  Compilacin: make report_StackTrace (en este directorio)
+ */
+
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+
+struct Function {
+    std::string name;
+    unsigned long long calls;
+    unsigned long long ticks;
+    unsigned long long max;
+    int threads;
+};
+
+
+//------------------------------------------------------------------------------------
+static bool byTicks(const Function& a, const Function& b){
+    return a.ticks > b.ticks;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv){
+    FILE* f = (argc > 1)? fopen(argv[1], "r") : stdin;
+    if(f == 0){
+        fprintf(stderr, "no se puede abrir %s\n", argv[1]);
+        return 1;
+    }
+    std::map<std::string, Function> functions;
+    unsigned long long tps = 0;
+    char line[256], name[128];
+    unsigned long id;
+    unsigned long long calls, ticks, max;
+    while(fgets(line, sizeof(line), f)){
+        if(sscanf(line, "# StackTrace ticks_per_second %llu", &tps) == 1){
+            continue;
+        }
+        if(sscanf(line, "thread %lu %127s %llu %llu %llu", &id, name, &calls, &ticks, &max) != 5){
+            continue;
+        }
+        Function& fn = functions[name];
+        fn.name = name;
+        fn.calls += calls;
+        fn.ticks += ticks;
+        fn.max = std::max(fn.max, max);
+        fn.threads++;
+    }
+    if(f != stdin){
+        fclose(f);
+    }
+
+    std::vector<Function> v;
+    for(std::map<std::string, Function>::iterator it = functions.begin(); it != functions.end(); ++it){
+        v.push_back(it->second);
+    }
+    std::sort(v.begin(), v.end(), byTicks);
+
+    // sin frecuencia del reloj slo hay llamadas
+    double ns = (tps > 0)? 1e9 / (double)tps : 0;
+    printf("%-36s %6s %12s %12s %10s %10s\n", "funcin", "hilos", "llamadas", "total ms", "ns/llamada", "max us");
+    for(size_t i=0;i<v.size();i++){
+        Function& fn = v[i];
+        printf("%-36s %6d %12llu %12.3f %10.1f %10.1f\n", fn.name.c_str(), fn.threads, fn.calls, fn.ticks * ns / 1e6,
+               (fn.calls > 0)? fn.ticks * ns / fn.calls : 0, fn.max * ns / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * test_MQTTAsync.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::Async frente a un broker simulado. Se comprueba que:
+ *
+ *      - connect, subscribe, unsubscribe y publish no esperan a las respuestas, que llegan a los manejadores
+ *      - con la tabla de operaciones llena, un nuevo comando falla sin bloquear
+ *      - los PUBACK que llegan en orden inverso completan cada uno su publicacin, y las entradas se reutilizan
+ *        con identificadores nuevos
+ *      - una publicacin QoS2 se completa con el PUBCOMP, y una sin respuesta falla al vencer su plazo
+ *      - una suscripcin rechazada (0x80) se notifica y su manejador se elimina
+ *      - los mensajes llegan a todos los manejadores cuyo filtro coincide (+ y #), o al de por defecto
+ *      - el hilo de fondo enva los PINGREQ
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTAsync.h"
+#include <atomic>
+#include <set>
+
+
+typedef MQTT::Async<LinuxNetwork, LinuxCountdown, LinuxThread, LinuxMutex> Client;
+
+#define MAX_OPERATIONS      64
+#define COMMAND_TIMEOUT     500
+
+
+// contadores actualizados desde el hilo de fondo del cliente o desde el broker
+static std::atomic<int> s_connack(-1);
+static std::atomic<int> s_subacks(0), s_granted_a(-1), s_granted_bad(-1);
+static std::atomic<int> s_results(0), s_failures(0);
+static std::atomic<int> s_abc(0), s_all(0), s_default(0), s_bad(0);
+static std::atomic<int> s_unsubacks(0), s_disconnected(0);
+static std::atomic<int> s_broker_puback(0), s_broker_pubcomp(0), s_pings(0);
+static std::mutex s_ids_mutex;
+static std::multiset<unsigned short> s_result_ids;
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: retiene los PUBACK de "data" hasta recibir "release" y los enva en orden inverso,
+ *  no responde a "noack", rechaza las suscripciones a "bad/#" y publica tres mensajes al recibir "go"
+ */
+static void connectionTask(int fd){
+    unsigned char buf[256];
+    int len;
+    std::vector<unsigned short> held;
+    int type;
+    while((type = readPacket(fd, buf, &len)) > 0){
+        switch(type){
+            case CONNECT:
+                sendConnack(fd);
+                break;
+            case SUBSCRIBE:{
+                unsigned short id;
+                int count, qos;
+                MQTTString filter;
+                unsigned char dup;
+                MQTTDeserialize_subscribe(&dup, &id, 1, &count, &filter, &qos, buf, len);
+                std::string f(filter.lenstring.data, filter.lenstring.len);
+                unsigned char ack[8];
+                int granted = (f == "bad/#")? 0x80 : qos;
+                sendAll(fd, ack, MQTTSerialize_suback(ack, sizeof(ack), id, 1, &granted));
+                break;
+            }
+            case UNSUBSCRIBE:{
+                unsigned short id = (buf[2] << 8) | buf[3];
+                unsigned char ack[4];
+                sendAll(fd, ack, MQTTSerialize_unsuback(ack, sizeof(ack), id));
+                break;
+            }
+            case PUBLISH:{
+                PublishPacket pub(buf, len);
+                std::string t = pub.topic();
+                if(t == "data"){
+                    held.push_back(pub.id);
+                }
+                else if(t == "release"){
+                    while(!held.empty()){
+                        sendAck(fd, PUBACK, held.back());
+                        held.pop_back();
+                    }
+                }
+                else if(t == "go"){
+                    sendPublish(fd, "a/b/c", "msg");
+                    sendPublish(fd, "a/x", "msg", 1, 77);
+                    sendPublish(fd, "z/z", "msg", 2, 78);
+                }
+                else if(t == "q2"){
+                    sendAck(fd, PUBREC, pub.id);
+                }
+                break;
+            }
+            case PUBREL:
+                sendAck(fd, PUBCOMP, (buf[2] << 8) | buf[3]);
+                break;
+            case PUBACK:
+                if(((buf[2] << 8) | buf[3]) == 77){
+                    s_broker_puback++;
+                }
+                break;
+            case PUBREC:
+                sendAck(fd, PUBREL, (buf[2] << 8) | buf[3]);
+                break;
+            case PUBCOMP:
+                if(((buf[2] << 8) | buf[3]) == 78){
+                    s_broker_pubcomp++;
+                }
+                break;
+            case PINGREQ:
+                sendPingresp(fd);
+                s_pings++;
+                break;
+        }
+        if(type == DISCONNECT){
+            break;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onConnect(Client::Result* res){
+    s_connack = res->rc;
+}
+
+static void onSubscribe(Client::Result* res){
+    if(res->grantedQoS == 0x80){
+        s_granted_bad = res->grantedQoS;
+    }
+    else{
+        s_granted_a = res->grantedQoS;
+    }
+    s_subacks++;
+}
+
+static void onResult(Client::Result* res){
+    if(res->rc != MQTT::SUCCESS){
+        s_failures++;
+    }
+    else{
+        std::lock_guard<std::mutex> lock(s_ids_mutex);
+        s_result_ids.insert(res->id);
+    }
+    s_results++;
+}
+
+static void onUnsubscribe(Client::Result* res){
+    CHECK(res->rc == MQTT::SUCCESS);
+    s_unsubacks++;
+}
+
+static void onDisconnect(Client::Result* res){
+    s_disconnected++;
+}
+
+static void onABC(MQTT::MessageData& md){ s_abc++; }
+static void onAll(MQTT::MessageData& md){ s_all++; }
+static void onBad(MQTT::MessageData& md){ s_bad++; }
+static void onDefault(MQTT::MessageData& md){ s_default++; }
+
+
+//------------------------------------------------------------------------------------
+/** Espera hasta que se cumple la condicin, como mximo 3 segundos */
+template<class F> static bool waitFor(F cond){
+    LinuxCountdown timeout(3000);
+    while(!cond() && !timeout.expired()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return cond();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Llena la tabla de operaciones con publicaciones QoS1 retenidas por el broker, y las libera */
+static void publishWave(Client& client, std::set<unsigned short>& ids){
+    static char payload[] = "data";
+    int base = s_results;
+    for(int i=0;i<MAX_OPERATIONS;i++){
+        MQTT::Message msg = { MQTT::QOS1, false, false, 0, payload, 4 };
+        CHECK(client.publish(onResult, "data", &msg) == MQTT::SUCCESS);
+        ids.insert(msg.id);
+    }
+    CHECK(ids.size() == MAX_OPERATIONS);
+
+    // la tabla est llena: falla sin esperar
+    MQTT::Message extra = { MQTT::QOS1, false, false, 0, payload, 4 };
+    LinuxCountdown t(1000);
+    CHECK(client.publish(onResult, "data", &extra) == MQTT::FAILURE);
+    CHECK(t.left_ms() > 900);
+
+    MQTT::Message release = { MQTT::QOS0, false, false, 0, payload, 4 };
+    CHECK(client.publish(0, "release", &release) == MQTT::SUCCESS);
+    CHECK(waitFor([&]{ return s_results == base + MAX_OPERATIONS; }));
+    CHECK(s_failures == 0);
+    std::lock_guard<std::mutex> lock(s_ids_mutex);
+    CHECK(std::set<unsigned short>(s_result_ids.begin(), s_result_ids.end()) == ids);
+    s_result_ids.clear();
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    MQTT::Limits limits;
+    limits.MAX_MQTT_PACKET_SIZE = 256;
+    limits.MAX_CONCURRENT_OPERATIONS = MAX_OPERATIONS;
+    limits.command_timeout_ms = COMMAND_TIMEOUT;
+    Client* client = new Client(&network, limits);
+    CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"async";
+    data.keepAliveInterval = 1;
+    CHECK(client->connect(onConnect, &data) == MQTT::SUCCESS);
+    CHECK(waitFor([]{ return s_connack == 0; }));
+    CHECK(client->isConnected());
+
+    // suscripciones, una de ellas rechazada
+    CHECK(client->subscribe(onSubscribe, "a/+/c", MQTT::QOS1, onABC) == MQTT::SUCCESS);
+    CHECK(client->subscribe(onSubscribe, "a/#", MQTT::QOS1, onAll) == MQTT::SUCCESS);
+    CHECK(client->subscribe(onSubscribe, "bad/#", MQTT::QOS0, onBad) == MQTT::SUCCESS);
+    CHECK(waitFor([]{ return s_subacks == 3; }));
+    CHECK(s_granted_a == 1);
+    CHECK(s_granted_bad == 0x80);
+    client->setDefaultMessageHandler(onDefault);
+
+    // dos tandas de publicaciones con la tabla llena, la segunda reutiliza las entradas con otros ids
+    std::set<unsigned short> wave1, wave2;
+    publishWave(*client, wave1);
+    publishWave(*client, wave2);
+    for(std::set<unsigned short>::iterator it = wave2.begin(); it != wave2.end(); ++it){
+        CHECK(wave1.count(*it) == 0);
+    }
+
+    // QoS2 completa, y una publicacin sin respuesta que vence
+    static char payload[] = "x";
+    int base = s_results;
+    MQTT::Message q2 = { MQTT::QOS2, false, false, 0, payload, 1 };
+    CHECK(client->publish(onResult, "q2", &q2) == MQTT::SUCCESS);
+    MQTT::Message noack = { MQTT::QOS1, false, false, 0, payload, 1 };
+    LinuxCountdown t(5000);
+    CHECK(client->publish(onResult, "noack", &noack) == MQTT::SUCCESS);
+    CHECK(waitFor([&]{ return s_results == base + 2; }));
+    CHECK(s_failures == 1);
+    CHECK(5000 - t.left_ms() >= COMMAND_TIMEOUT);
+    CHECK(s_result_ids.count(q2.id) == 1);
+
+    // mensajes entrantes: a/b/c a los dos manejadores, a/x slo a a/#, z/z al de por defecto
+    MQTT::Message go = { MQTT::QOS0, false, false, 0, payload, 1 };
+    CHECK(client->publish(0, "go", &go) == MQTT::SUCCESS);
+    CHECK(waitFor([]{ return s_abc == 1 && s_all == 2 && s_default == 1 && s_broker_puback == 1 && s_broker_pubcomp == 1; }));
+
+    // sin a/#, a/x pasa al manejador por defecto
+    CHECK(client->unsubscribe(onUnsubscribe, "a/#") == MQTT::SUCCESS);
+    CHECK(waitFor([]{ return s_unsubacks == 1; }));
+    CHECK(client->publish(0, "go", &go) == MQTT::SUCCESS);
+    CHECK(waitFor([]{ return s_abc == 2 && s_default == 3 && s_broker_pubcomp == 2; }));
+    CHECK(s_all == 2);
+    CHECK(s_bad == 0);
+
+    // sin actividad, el hilo de fondo mantiene la conexin
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    CHECK(s_pings >= 1);
+    CHECK(client->isConnected());
+
+    CHECK(client->disconnect(onDisconnect) == MQTT::SUCCESS);
+    CHECK(s_disconnected == 1);
+    CHECK(!client->isConnected());
+    delete client;
+    network.disconnect();
+    broker.join();
+
+    printf("%d operaciones completadas, %d fallida por plazo, %d PINGREQ: %s\n", (int)s_results, (int)s_failures, (int)s_pings, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
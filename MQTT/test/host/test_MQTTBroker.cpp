@@ -0,0 +1,358 @@
+/*
+ * test_MQTTBroker.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba del broker embebido de MQTTLinuxBroker.h, en su propio hilo, con varios MQTT::Client por TCP local.
+ *  Se comprueba que:
+ *
+ *      - cada publicacin llega una sola vez a cada suscriptor, por + y #, aunque coincidan varios de sus
+ *        filtros, y los comodines no coinciden con los topics $
+ *      - QoS1 y QoS2 se entregan con el menor QoS de los dos, como mucho QoS1
+ *      - los mensajes retenidos llegan a las nuevas suscripciones, y uno vaco los borra
+ *      - una sesin persistente recibe al reconectar lo publicado mientras no estaba
+ *      - el will se publica si el cliente cae sin DISCONNECT, o si vence su keepalive
+ *      - 50 suscriptores QoS1 reciben todas las publicaciones
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTLinux.h"
+#include "MQTTLinuxBroker.h"
+#include "MQTTClient.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+
+#define PACKET_SIZE     256
+#define TIMEOUT_MS      2000
+#define CLIENTS         50
+#define MESSAGES        20
+
+
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 5> Client;
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+/** Lo ltimo recibido por cada suscriptor */
+struct Received {
+    int count;
+    int qos;
+    bool retained;
+    char topic[32];
+    char payload[32];
+};
+
+static Received s_received[4];
+static int s_many = 0;
+
+static std::atomic<bool> s_stop(false);
+static std::atomic<bool> s_inject(false);
+
+
+//------------------------------------------------------------------------------------
+static void store(Received& r, MQTT::MessageData& md){
+    r.count++;
+    r.qos = md.message.qos;
+    r.retained = md.message.retained;
+    snprintf(r.topic, sizeof(r.topic), "%.*s", md.topicName.lenstring.len, md.topicName.lenstring.data);
+    snprintf(r.payload, sizeof(r.payload), "%.*s", (int)md.message.payloadlen, (char*)md.message.payload);
+}
+
+static void on0(MQTT::MessageData& md){ store(s_received[0], md); }
+static void on1(MQTT::MessageData& md){ store(s_received[1], md); }
+static void on2(MQTT::MessageData& md){ store(s_received[2], md); }
+static void on3(MQTT::MessageData& md){ store(s_received[3], md); }
+static void onMany(MQTT::MessageData& md){ s_many++; }
+
+
+//------------------------------------------------------------------------------------
+/** El hilo del broker. Publica l mismo un mensaje $ cuando se le pide */
+static void serve(LinuxBroker* broker){
+    while(!s_stop){
+        broker->run(10);
+        if(s_inject.exchange(false)){
+            broker->publish("$SYS/uptime", "1", 1);
+            broker->publish("f/gateway", "gw", 2, 1);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static int connect(Client& client, LinuxNetwork& network, int port, const char* id, bool cleansession = true,
+                   const char* will = 0, int keepalive = 60){
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    data.cleansession = cleansession;
+    data.keepAliveInterval = keepalive;
+    if(will){
+        data.willFlag = 1;
+        data.will.topicName.cstring = (char*)will;
+        data.will.message.cstring = (char*)"gone";
+        data.will.qos = 1;
+    }
+    if(network.connect("127.0.0.1", port) != 0)
+        return MQTT::FAILURE;
+    return client.connect(data);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Atiende al cliente hasta que su contador llega a count, o pasa TIMEOUT_MS */
+static bool waitFor(Client& client, int& counter, int count){
+    LinuxCountdown timer(TIMEOUT_MS);
+    while(counter < count && !timer.expired())
+        client.yield(10);
+    return counter == count;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Comodines, una entrega por suscriptor, topics $ y QoS */
+static void testFanOut(int port){
+    LinuxNetwork net[3];
+    Client pub(net[0], TIMEOUT_MS), sub1(net[1], TIMEOUT_MS), sub2(net[2], TIMEOUT_MS);
+    memset(s_received, 0, sizeof(s_received));
+
+    CHECK(connect(pub, net[0], port, "pub") == MQTT::SUCCESS);
+    CHECK(connect(sub1, net[1], port, "sub1") == MQTT::SUCCESS);
+    CHECK(connect(sub2, net[2], port, "sub2") == MQTT::SUCCESS);
+    CHECK(sub1.subscribe("f/+/t", MQTT::QOS1, on1) == MQTT::SUCCESS);
+    CHECK(sub1.subscribe("f/x/t", MQTT::QOS0, on0) == MQTT::SUCCESS);
+    CHECK(sub2.subscribe("#", MQTT::QOS2, on2) == MQTT::SUCCESS);
+
+    // sub1 coincide por sus dos filtros y lo recibe una vez, con el mayor de sus QoS: el cliente lo pasa a
+    // los manejadores de ambos
+    CHECK(pub.publish("f/x/t", (void*)"a", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(waitFor(sub1, s_received[1].count, 1) && s_received[1].qos == 1);
+    sub1.yield(100);
+    CHECK(s_received[0].count == 1 && s_received[1].count == 1);
+    CHECK(waitFor(sub2, s_received[2].count, 1) && s_received[2].qos == 1);
+    CHECK(strcmp(s_received[2].topic, "f/x/t") == 0 && strcmp(s_received[2].payload, "a") == 0);
+
+    // QoS2 se acepta y se entrega como QoS1; QoS0 a QoS0
+    CHECK(pub.publish("f/y", (void*)"b", 1, MQTT::QOS2) == MQTT::SUCCESS);
+    CHECK(waitFor(sub2, s_received[2].count, 2) && s_received[2].qos == 1);
+    CHECK(pub.publish("f/y/t", (void*)"c", 1, MQTT::QOS0) == MQTT::SUCCESS);
+    CHECK(waitFor(sub1, s_received[1].count, 2) && s_received[1].qos == 0);
+    CHECK(waitFor(sub2, s_received[2].count, 3) && s_received[2].qos == 0);
+
+    // lo que publica el propio gateway: "#" no coincide con $SYS/uptime
+    s_inject = true;
+    CHECK(waitFor(sub2, s_received[2].count, 4) && strcmp(s_received[2].topic, "f/gateway") == 0);
+    sub2.yield(100);
+    CHECK(s_received[2].count == 4);
+    CHECK(s_received[1].count == 2);
+
+    // tras desuscribirse de uno, sigue recibiendo por el otro
+    CHECK(sub1.unsubscribe("f/+/t") == MQTT::SUCCESS);
+    CHECK(pub.publish("f/z/t", (void*)"d", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(pub.publish("f/x/t", (void*)"e", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(waitFor(sub1, s_received[0].count, 2) && strcmp(s_received[0].payload, "e") == 0);
+    sub1.yield(100);
+    CHECK(s_received[0].count == 2 && s_received[1].count == 2);
+
+    pub.disconnect();
+    sub1.disconnect();
+    sub2.disconnect();
+    for(int i=0; i<3; i++)
+        net[i].disconnect();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Mensajes retenidos */
+static void testRetained(int port){
+    LinuxNetwork net[2];
+    Client pub(net[0], TIMEOUT_MS), sub(net[1], TIMEOUT_MS);
+    MQTT::Message message;
+    memset(s_received, 0, sizeof(s_received));
+    memset(&message, 0, sizeof(message));
+
+    CHECK(connect(pub, net[0], port, "pub") == MQTT::SUCCESS);
+    message.qos = MQTT::QOS1;
+    message.retained = true;
+    message.payload = (void*)"on";
+    message.payloadlen = 2;
+    CHECK(pub.publish("r/a", message) == MQTT::SUCCESS);
+    message.payload = (void*)"off";
+    message.payloadlen = 3;
+    CHECK(pub.publish("r/b", message) == MQTT::SUCCESS);
+
+    // el ltimo de cada topic, con el menor QoS
+    CHECK(connect(sub, net[1], port, "sub") == MQTT::SUCCESS);
+    CHECK(sub.subscribe("r/a", MQTT::QOS0, on0) == MQTT::SUCCESS);
+    CHECK(waitFor(sub, s_received[0].count, 1));
+    CHECK(s_received[0].retained && s_received[0].qos == 0 && strcmp(s_received[0].payload, "on") == 0);
+
+    // uno vaco borra el de r/b
+    message.payloadlen = 0;
+    CHECK(pub.publish("r/b", message) == MQTT::SUCCESS);
+    CHECK(sub.subscribe("r/+", MQTT::QOS1, on1) == MQTT::SUCCESS);
+    CHECK(waitFor(sub, s_received[1].count, 1));
+    sub.yield(100);
+    CHECK(s_received[1].count == 1 && s_received[1].qos == 1 && strcmp(s_received[1].topic, "r/a") == 0);
+
+    // los mensajes en curso no llevan el flag
+    message.payloadlen = 2;
+    CHECK(pub.publish("r/a", message) == MQTT::SUCCESS);
+    CHECK(waitFor(sub, s_received[1].count, 2) && !s_received[1].retained);
+
+    pub.disconnect();
+    sub.disconnect();
+    net[0].disconnect();
+    net[1].disconnect();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Sesin persistente */
+static void testSession(int port){
+    LinuxNetwork net[2];
+    Client pub(net[0], TIMEOUT_MS), sub(net[1], TIMEOUT_MS);
+    memset(s_received, 0, sizeof(s_received));
+
+    CHECK(connect(sub, net[1], port, "persistent", false) == MQTT::SUCCESS);
+    CHECK(sub.subscribe("p/#", MQTT::QOS1, on3) == MQTT::SUCCESS);
+    sub.disconnect();
+    net[1].disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    CHECK(connect(pub, net[0], port, "pub") == MQTT::SUCCESS);
+    CHECK(pub.publish("p/1", (void*)"1", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(pub.publish("p/2", (void*)"2", 1, MQTT::QOS0) == MQTT::SUCCESS);    // QoS0 no se guarda
+    CHECK(pub.publish("p/3", (void*)"3", 1, MQTT::QOS1) == MQTT::SUCCESS);
+
+    // la suscripcin sigue en la sesin: el manejador del cliente se conserva en el objeto
+    CHECK(connect(sub, net[1], port, "persistent", false) == MQTT::SUCCESS);
+    CHECK(waitFor(sub, s_received[3].count, 2) && strcmp(s_received[3].payload, "3") == 0);
+    sub.yield(100);
+    CHECK(s_received[3].count == 2);
+
+    // una sesin limpia la descarta
+    sub.disconnect();
+    net[1].disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(pub.publish("p/4", (void*)"4", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(connect(sub, net[1], port, "persistent", true) == MQTT::SUCCESS);
+    sub.yield(200);
+    CHECK(s_received[3].count == 2);
+
+    pub.disconnect();
+    sub.disconnect();
+    net[0].disconnect();
+    net[1].disconnect();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Will al caer la conexin y al vencer el keepalive */
+static void testWill(int port){
+    LinuxNetwork net[3];
+    Client watcher(net[0], TIMEOUT_MS), dying(net[1], TIMEOUT_MS), silent(net[2], TIMEOUT_MS);
+    memset(s_received, 0, sizeof(s_received));
+
+    CHECK(connect(watcher, net[0], port, "watcher") == MQTT::SUCCESS);
+    CHECK(watcher.subscribe("w/+", MQTT::QOS1, on0) == MQTT::SUCCESS);
+
+    // DISCONNECT: sin will
+    CHECK(connect(dying, net[1], port, "dying", true, "w/dying") == MQTT::SUCCESS);
+    dying.disconnect();
+    net[1].disconnect();
+    watcher.yield(200);
+    CHECK(s_received[0].count == 0);
+
+    // se cierra el socket sin DISCONNECT
+    CHECK(connect(dying, net[1], port, "dying", true, "w/dying") == MQTT::SUCCESS);
+    net[1].disconnect();
+    dying.disconnect();
+    CHECK(waitFor(watcher, s_received[0].count, 1) && strcmp(s_received[0].topic, "w/dying") == 0);
+    CHECK(strcmp(s_received[0].payload, "gone") == 0);
+
+    // keepalive de 1 s sin trfico: el broker cierra a 1,5 s
+    CHECK(connect(silent, net[2], port, "silent", true, "w/silent", 1) == MQTT::SUCCESS);
+    LinuxCountdown timer(3000);
+    while(s_received[0].count < 2 && !timer.expired())
+        watcher.yield(10);
+    CHECK(s_received[0].count == 2 && strcmp(s_received[0].topic, "w/silent") == 0);
+    CHECK(timer.left_ms() > 1000 && timer.left_ms() < 1700);
+
+    watcher.disconnect();
+    net[0].disconnect();
+    net[2].disconnect();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Muchos suscriptores QoS1 */
+static void testMany(int port){
+    LinuxNetwork* net = new LinuxNetwork[CLIENTS + 1];
+    Client* clients[CLIENTS + 1];
+    char id[16];
+
+    for(int i=0; i<=CLIENTS; i++){
+        clients[i] = new Client(net[i], TIMEOUT_MS);
+        snprintf(id, sizeof(id), "many%d", i);
+        CHECK(connect(*clients[i], net[i], port, id) == MQTT::SUCCESS);
+        if(i > 0)
+            CHECK(clients[i]->subscribe("m/#", MQTT::QOS1, onMany) == MQTT::SUCCESS);
+    }
+    char payload[100];
+    memset(payload, 'x', sizeof(payload));
+    for(int i=0; i<MESSAGES; i++)
+        CHECK(clients[0]->publish("m/data", payload, sizeof(payload), MQTT::QOS1) == MQTT::SUCCESS);
+
+    // cada suscriptor tiene sus mensajes esperando en el socket
+    s_many = 0;
+    for(int i=1; i<=CLIENTS; i++){
+        int expected = i * MESSAGES;
+        waitFor(*clients[i], s_many, expected);
+    }
+    CHECK(s_many == CLIENTS * MESSAGES);
+
+    for(int i=0; i<=CLIENTS; i++){
+        clients[i]->disconnect();
+        net[i].disconnect();
+        delete clients[i];
+    }
+    delete [] net;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    LinuxBroker broker;
+    CHECK(broker.listen("127.0.0.1", 0) == 0);
+    int port = broker.port();
+    CHECK(port > 0);
+    std::thread thread(serve, &broker);
+
+    testFanOut(port);
+    testRetained(port);
+    testSession(port);
+    testWill(port);
+    testMany(port);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    s_stop = true;
+    thread.join();
+
+    // la sesin persistente de testSession se descart al final, solo queda el retenido r/a
+    LinuxBroker::Stats stats = broker.getStats();
+    CHECK(stats.connections == 0);
+    CHECK(stats.sessions == 0);
+    CHECK(stats.retained == 1);
+    CHECK(stats.dropped == 0);
+    CHECK(stats.delivered >= CLIENTS * MESSAGES);
+
+    printf("broker: %lu publicaciones, %lu entregas: %s\n", stats.published, stats.delivered, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * test_MQTTConnectAsync.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::Client::connectAsync frente a un broker simulado que se comporta segn el client id. Se comprueba
+ *  que:
+ *
+ *      - connectAsync vuelve sin esperar el CONNACK, y mientras tanto las dems operaciones fallan al momento
+ *      - drain completa la conexin y llama al callback con el CONNACK
+ *      - sin CONNACK, el callback recibe FAILURE al agotarse el timeout de comandos, y yield falla
+ *      - una conexin rechazada llega al callback con el cdigo del broker, sin conectar
+ *      - la publicacin QoS1 pendiente de la sesin se reenva sin esperar su PUBACK, que procesa drain
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include <chrono>
+#include <mutex>
+
+
+#define PACKET_SIZE     256
+#define TIMEOUT_MS      500
+#define SLOW_MS         200
+
+
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 5, MQTT::ClientPolicy<1, true> > Client;
+
+
+static std::mutex s_lock;
+static int s_dropped = 0;       // publicaciones en "drop" recibidas por el broker
+static int s_connacks = 0;
+static MQTT::connackData s_connack;
+
+
+//------------------------------------------------------------------------------------
+/** Una conexin del broker simulado, segn el client id: "slow" responde al CONNECT tras SLOW_MS, "silent" no
+ *  responde, "refused" lo rechaza (5, no autorizado), y el resto lo acepta al momento. Confirma las publicaciones,
+ *  salvo la primera del topic "drop", ante la que cierra la conexin */
+static void connectionTask(int fd){
+    unsigned char buf[PACKET_SIZE];
+    int len, type;
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        if(type == CONNECT){
+            MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+            MQTTDeserialize_connect(&data, buf, len);
+            std::string id(data.clientID.lenstring.data, data.clientID.lenstring.len);
+            if(id == "silent"){
+                continue;
+            }
+            if(id == "slow"){
+                std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_MS));
+            }
+            sendConnack(fd, (id == "refused")? 5 : 0, !data.cleansession);
+        }
+        else if(type == PUBLISH){
+            PublishPacket pub(buf, len);
+            bool drop = false;
+            if(pub.topic() == "drop"){
+                std::lock_guard<std::mutex> lock(s_lock);
+                drop = (++s_dropped == 1);
+            }
+            if(drop){
+                break;
+            }
+            sendAck(fd, PUBACK, pub.id);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onConnack(MQTT::connackData& data){
+    s_connack = data;
+    s_connacks++;
+}
+
+
+//------------------------------------------------------------------------------------
+static double elapsedMs(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Abre el socket e inicia la conexin MQTT sin esperarla */
+static int connectAsync(Client& client, LinuxNetwork& network, int port, const char* id, bool cleansession = true){
+    if(network.connect("127.0.0.1", port) != 0){
+        return MQTT::FAILURE;
+    }
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    data.cleansession = cleansession;
+    s_connacks = 0;
+    return client.connectAsync(data, onConnack);
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask, 6);
+    int port = broker.port();
+    if(!port){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    Client client(network, TIMEOUT_MS);
+    char payload[] = "21.5";
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+
+    // broker lento: connectAsync no lo espera
+    auto start = std::chrono::steady_clock::now();
+    CHECK(connectAsync(client, network, port, "slow") == MQTT::SUCCESS);
+    CHECK(client.isConnecting() && !client.isConnected());
+    CHECK(client.publish("t", payload, 4) == MQTT::FAILURE);
+    CHECK(client.connect(data) == MQTT::FAILURE);
+    double returned = elapsedMs(start);
+    CHECK(returned < SLOW_MS / 4);
+    while(s_connacks == 0 && elapsedMs(start) < 2 * TIMEOUT_MS){
+        CHECK(client.drain(10) >= 0);
+    }
+    double completed = elapsedMs(start);
+    CHECK(s_connacks == 1 && s_connack.rc == 0 && !s_connack.sessionPresent);
+    CHECK(completed >= SLOW_MS && client.isConnected() && !client.isConnecting());
+    CHECK(client.publish("t", payload, 4, MQTT::QOS1) == MQTT::SUCCESS);
+    client.disconnect();
+    network.disconnect();
+
+    // sin CONNACK: FAILURE al agotarse el timeout
+    start = std::chrono::steady_clock::now();
+    CHECK(connectAsync(client, network, port, "silent") == MQTT::SUCCESS);
+    int failed = 0;
+    while(s_connacks == 0 && elapsedMs(start) < 2 * TIMEOUT_MS){
+        failed += (client.yield(20) != MQTT::SUCCESS);
+    }
+    CHECK(s_connacks == 1 && s_connack.rc == MQTT::FAILURE && failed == 1);
+    CHECK(elapsedMs(start) >= TIMEOUT_MS && !client.isConnected() && !client.isConnecting());
+    network.disconnect();
+
+    // rechazada
+    CHECK(connectAsync(client, network, port, "refused") == MQTT::SUCCESS);
+    for(int i=0;i<50 && s_connacks == 0;i++){
+        client.drain(10);
+    }
+    CHECK(s_connacks == 1 && s_connack.rc == 5 && !client.isConnected() && !client.isConnecting());
+    network.disconnect();
+
+    // sesin persistente: la publicacin sin PUBACK se reenva al reconectar, y drain procesa su PUBACK
+    data.clientID.cstring = (char*)"session";
+    data.cleansession = 0;
+    CHECK(network.connect("127.0.0.1", port) == 0 && client.connect(data) == MQTT::SUCCESS);
+    CHECK(client.publish("drop", payload, 4, MQTT::QOS1) != MQTT::SUCCESS && !client.isConnected());
+    client.disconnect();
+    network.disconnect();
+    CHECK(connectAsync(client, network, port, "session", false) == MQTT::SUCCESS);
+    for(int i=0;i<50 && s_connacks == 0;i++){
+        client.drain(10);
+    }
+    CHECK(s_connacks == 1 && s_connack.rc == 0 && s_connack.sessionPresent && client.isConnected());
+    for(int i=0;i<5;i++){
+        client.drain(10);
+    }
+    client.disconnect();
+    network.disconnect();
+    // ya confirmada, no se reenva otra vez
+    CHECK(network.connect("127.0.0.1", port) == 0 && client.connect(data) == MQTT::SUCCESS);
+    client.disconnect();
+    network.disconnect();
+    broker.join();
+    CHECK(s_dropped == 2);
+
+    printf("connectAsync vuelve en %.2f ms, CONNACK en %.0f ms (broker a %d ms), sin CONNACK falla a los %d ms: %s\n",
+           returned, completed, SLOW_MS, TIMEOUT_MS, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
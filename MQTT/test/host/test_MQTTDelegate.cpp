@@ -0,0 +1,150 @@
+/*
+ * test_MQTTDelegate.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::Delegate y de su uso como manejador de MQTT::Client. Se comprueba que:
+ *
+ *      - enlaza funciones globales, funciones miembro (tambin con bind) y lambdas con capturas
+ *      - las copias, asignaciones y detach construyen y destruyen el objeto funcin las mismas veces
+ *      - sin funcin enlazada devuelve 0
+ *      - el cliente llama a una lambda con capturas y a una funcin miembro suscritas, sin trampolines estticos
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+
+
+typedef MQTT::Delegate<int, int> IntDelegate;
+
+
+//------------------------------------------------------------------------------------
+static int twice(int x){
+    return 2 * x;
+}
+
+
+//------------------------------------------------------------------------------------
+struct Adder {
+    Adder(int n) : n(n) {}
+    int add(int x){ return x + n; }
+    int n;
+};
+
+
+//------------------------------------------------------------------------------------
+/** Objeto funcin que cuenta sus instancias vivas */
+struct Counted {
+    static int alive;
+    Counted(const std::string& s) : s(s) { alive++; }
+    Counted(const Counted& c) : s(c.s) { alive++; }
+    ~Counted(){ alive--; }
+    int operator()(int x){ return x + (int)s.size(); }
+    std::string s;
+};
+int Counted::alive = 0;
+
+
+//------------------------------------------------------------------------------------
+/** Receptor de mensajes con estado, como MQNetBridge */
+struct Receiver {
+    Receiver() : count(0) {}
+    void onMessage(MQTT::MessageData& md){ count++; }
+    int count;
+};
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: tras el CONNECT enva dos publicaciones a "a/1" y tres a "b/2" */
+static void connectionTask(int fd){
+    unsigned char buf[256];
+    int len;
+    if(readPacket(fd, buf, &len) != CONNECT){
+        return;
+    }
+    sendConnack(fd);
+    const char* topics[] = { "a/1", "b/2", "a/1", "b/2", "b/2" };
+    for(int i=0;i<5;i++){
+        sendPublish(fd, topics[i], "x");
+    }
+    while(recv(fd, buf, sizeof(buf), 0) > 0){
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    // enlaces
+    IntDelegate d;
+    CHECK(!d.attached() && d(1) == 0);
+    d.attach(twice);
+    CHECK(d.attached() && d(21) == 42);
+    Adder adder(10);
+    d.attach(&adder, &Adder::add);
+    CHECK(d(1) == 11);
+    d = IntDelegate::bind<Adder, &Adder::add>(&adder);
+    adder.n = 20;
+    CHECK(d(1) == 21);
+    int base = 100;
+    d = IntDelegate([base](int x){ return base + x; });
+    CHECK(d(1) == 101);
+    d.attach((int (*)(int))0);
+    CHECK(!d.attached());
+
+    // ciclo de vida de un objeto funcin con estado no trivial
+    {
+        IntDelegate a((Counted(std::string("abcd"))));
+        CHECK(Counted::alive == 1 && a(1) == 5);
+        IntDelegate b(a);
+        IntDelegate c;
+        c = b;
+        CHECK(Counted::alive == 3 && b(1) == 5 && c(2) == 6);
+        b.detach();
+        CHECK(Counted::alive == 2 && b(1) == 0);
+        c.attach(twice);
+        CHECK(Counted::alive == 1 && c(2) == 4);
+        a = a;
+        CHECK(Counted::alive == 1 && a(0) == 4);
+    }
+    CHECK(Counted::alive == 0);
+
+    // manejadores del cliente
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    typedef MQTT::Client<LinuxNetwork, LinuxCountdown> Client;
+    LinuxNetwork network;
+    Client client(network, 2000);
+    CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"delegate";
+    CHECK(client.connect(data) == 0);
+    int a_count = 0;
+    std::string last;
+    Receiver receiver;
+    CHECK(client.setMessageHandler("a/+", Client::messageHandlerFP([&a_count, &last](MQTT::MessageData& md){
+        a_count++;
+        last.assign(md.topicName.lenstring.data, md.topicName.lenstring.len);
+    })) == MQTT::SUCCESS);
+    CHECK(client.setMessageHandler("b/+", Client::messageHandlerFP(&receiver, &Receiver::onMessage)) == MQTT::SUCCESS);
+    LinuxCountdown t(2000);
+    while(a_count + receiver.count < 5 && !t.expired()){
+        client.drain(100);
+    }
+    CHECK(a_count == 2 && last == "a/1");
+    CHECK(receiver.count == 3);
+    client.disconnect();
+    network.disconnect();
+    broker.join();
+
+    printf("Delegate de %d bytes, %d mensajes a una lambda y %d a una funcin miembro: %s\n", (int)sizeof(IntDelegate),
+           a_count, receiver.count, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
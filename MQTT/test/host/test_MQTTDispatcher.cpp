@@ -0,0 +1,134 @@
+/*
+ * test_MQTTDispatcher.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::WorkerPool con MQTT::Client. Un broker simulado enva 20000 publicaciones repartidas en 64
+ *  topics, numeradas por topic, y una de cada cincuenta mayor que las posiciones de la cola. El manejador tarda
+ *  unos 50 us por mensaje. Se comprueba que:
+ *
+ *      - cada topic recibe sus mensajes en orden, tambin los grandes que no pasan por la cola
+ *      - los manejadores se ejecutan en varios hilos a la vez (si hay ms de un ncleo)
+ *      - con las colas llenas el cliente deja de leer (backpressure) sin perder mensajes
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include "MQTTDispatcher.h"
+#include <atomic>
+
+
+#define TOPICS          64
+#define MESSAGES        20000
+#define WORKERS         4
+#define QUEUE_LEN       16
+#define SLOT_SIZE       64
+#define LARGE_SIZE      200
+#define HANDLER_US      50
+
+
+static std::atomic<int> s_received(0), s_disorder(0), s_active(0), s_max_active(0), s_large(0);
+static unsigned s_next[TOPICS];     // siguiente nmero esperado de cada topic, slo lo toca su trabajador
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: tras el CONNECT enva todas las publicaciones y espera a que el cliente se desconecte */
+static void connectionTask(int fd){
+    unsigned char buf[512];
+    int len;
+    if(readPacket(fd, buf, &len) != CONNECT){
+        return;
+    }
+    sendConnack(fd);
+
+    unsigned seq[TOPICS] = {0};
+    for(int i=0;i<MESSAGES;i++){
+        int k = (i * 7) % TOPICS;
+        char topic[16];
+        snprintf(topic, sizeof(topic), "dev/%d", k);
+        MQTTString t = MQTTString_initializer;
+        t.cstring = topic;
+        unsigned char payload[LARGE_SIZE] = {0};
+        memcpy(payload, &seq[k], sizeof(unsigned));
+        seq[k]++;
+        int size = (i % 50 == 0)? LARGE_SIZE : sizeof(unsigned);
+        len = MQTTSerialize_publish(buf, sizeof(buf), 0, 0, 0, 0, t, payload, size);
+        sendAll(fd, buf, len);
+    }
+    while(recv(fd, buf, sizeof(buf), 0) > 0){
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void messageArrived(MQTT::MessageData& md){
+    int active = ++s_active;
+    int max = s_max_active;
+    while(active > max && !s_max_active.compare_exchange_weak(max, active)){
+    }
+    int k = atoi(std::string(md.topicName.lenstring.data + 4, md.topicName.lenstring.len - 4).c_str());
+    unsigned seq;
+    memcpy(&seq, md.message.payload, sizeof(seq));
+    if(seq != s_next[k]){
+        s_disorder++;
+    }
+    s_next[k] = seq + 1;
+    if(md.message.payloadlen == LARGE_SIZE){
+        s_large++;
+    }
+    // trabajo del manejador
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(HANDLER_US);
+    while(std::chrono::steady_clock::now() < end){
+    }
+    --s_active;
+    s_received++;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        MQTT::WorkerPool<LinuxThread, LinuxMutex, LinuxSemaphore> pool(WORKERS, QUEUE_LEN, SLOT_SIZE);
+        LinuxNetwork network;
+        MQTT::Client<LinuxNetwork, LinuxCountdown, 256> client(network, 2000);
+        CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        data.clientID.cstring = (char*)"dispatcher";
+        CHECK(client.connect(data) == 0);
+        client.setMessageHandler("dev/+", messageArrived);
+        client.setDispatcher(&pool);
+
+        LinuxCountdown timeout(10000);
+        while(s_received < MESSAGES && !timeout.expired() && client.isConnected()){
+            client.yield(10);
+        }
+        CHECK(s_received == MESSAGES);
+        CHECK(s_disorder == 0);
+        CHECK(s_large == MESSAGES / 50);
+        CHECK(pool.stalls() > 0);
+        if(std::thread::hardware_concurrency() > 1){
+            CHECK(s_max_active > 1);
+        }
+        client.disconnect();
+        network.disconnect();
+        printf("%d esperas por cola llena, ", pool.stalls());
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    broker.join();
+
+    long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    printf("%d mensajes en %ld ms (%d ms en un solo hilo), hasta %d manejadores a la vez: %s\n", (int)s_received, ms,
+           MESSAGES * HANDLER_US / 1000, (int)s_max_active, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * test_MQTTDrain.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::Client::drain frente a un broker simulado. Se comprueba que:
+ *
+ *      - sin datos, drain(0) vuelve enseguida y drain(ms) espera como mximo ms
+ *      - ante una rfaga, cada llamada procesa como mucho su presupuesto de paquetes, y vuelve en cuanto no
+ *        quedan ms, sin agotar la espera
+ *      - un paquete del que slo ha llegado el primer byte se termina de leer con el timeout de los comandos
+ *      - el keepalive se comprueba en cada lote: se enva el PINGREQ y se procesa su PINGRESP
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include <atomic>
+
+
+#define BURST       100
+#define BUDGET      16
+
+
+static std::atomic<int> s_pings(0);
+static int s_inbound = 0;
+
+
+//------------------------------------------------------------------------------------
+static int serializePublish(unsigned char* buf, int buflen){
+    MQTTString t = MQTTString_initializer;
+    t.cstring = (char*)"in/data";
+    return MQTTSerialize_publish(buf, buflen, 0, 0, 0, 0, t, (unsigned char*)"0123456789", 10);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: ante "burst" enva una rfaga de publicaciones de una vez, ante "split" enva una publicacin
+ *  en dos partes separadas 100 ms, y responde a los PINGREQ */
+static void connectionTask(int fd){
+    unsigned char buf[512];
+    int len, type;
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        switch(type){
+            case CONNECT:
+                sendConnack(fd);
+                break;
+            case PUBLISH:{
+                std::string t = PublishPacket(buf, len).topic();
+                unsigned char out[64 * BURST];
+                if(t == "burst"){
+                    int n = 0;
+                    for(int i=0;i<BURST;i++){
+                        n += serializePublish(&out[n], sizeof(out) - n);
+                    }
+                    sendAll(fd, out, n);
+                }
+                else if(t == "split"){
+                    int n = serializePublish(out, sizeof(out));
+                    sendAll(fd, out, 1);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    sendAll(fd, &out[1], n - 1);
+                }
+                break;
+            }
+            case PINGREQ:
+                s_pings++;
+                sendPingresp(fd);
+                break;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onData(MQTT::MessageData& md){
+    s_inbound++;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    MQTT::Client<LinuxNetwork, LinuxCountdown, 256> client(network, 2000);
+    CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"drain";
+    data.keepAliveInterval = 1;
+    CHECK(client.connect(data) == 0);
+    client.setMessageHandler("in/data", onData);
+
+    // sin datos
+    LinuxCountdown t(1000);
+    CHECK(client.drain(0) == 0);
+    CHECK(t.left_ms() > 990);
+    t.countdown_ms(1000);
+    CHECK(client.drain(100) == 0);
+    CHECK(t.left_ms() <= 905 && t.left_ms() > 800);
+
+    // rfaga: el primer lote espera a que llegue, los siguientes slo toman lo que ya hay
+    char one[] = "1";
+    CHECK(client.publish("burst", one, 1, MQTT::QOS0) == MQTT::SUCCESS);
+    t.countdown_ms(1000);
+    CHECK(client.drain(1000, BUDGET) == BUDGET);
+    CHECK(t.left_ms() > 900);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int total = BUDGET, batches = 1, rc;
+    while((rc = client.drain(0, BUDGET)) > 0){
+        CHECK(rc <= BUDGET);
+        total += rc;
+        batches++;
+    }
+    CHECK(rc == 0);
+    CHECK(total == BURST && s_inbound == BURST);
+    CHECK(batches == (BURST + BUDGET - 1) / BUDGET);
+
+    // paquete partido: drain(0) encuentra el primer byte y espera al resto
+    CHECK(client.publish("split", one, 1, MQTT::QOS0) == MQTT::SUCCESS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(client.drain(0) == 1);
+    CHECK(s_inbound == BURST + 1);
+    CHECK(client.isConnected());
+
+    // keepalive: tras el intervalo sin trfico un lote vaco enva el PINGREQ, el siguiente recibe el PINGRESP
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    CHECK(client.drain(0) == 0);
+    t.countdown_ms(1000);
+    while(s_pings == 0 && !t.expired()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(s_pings == 1);
+    CHECK(client.drain(500) == 1);
+    CHECK(client.isConnected());
+
+    client.disconnect();
+    network.disconnect();
+    broker.join();
+
+    printf("%d publicaciones en %d lotes de hasta %d, %d PINGREQ: %s\n", total, batches, BUDGET, (int)s_pings,
+           (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
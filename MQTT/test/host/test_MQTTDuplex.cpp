@@ -0,0 +1,223 @@
+/*
+ * test_MQTTDuplex.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::DuplexClient frente a un broker simulado. Se comprueba que:
+ *
+ *      - mientras un manejador de mensajes lento ocupa el hilo lector, otro hilo publica sin esperar por l
+ *      - desde un manejador, publicar QoS0 funciona, mientras que publicar QoS1, suscribirse, desuscribirse y
+ *        desconectar fallan al momento en lugar de bloquear el hilo lector, que sigue atendiendo al resto
+ *      - varios hilos publican QoS1 a la vez, cada uno recibe su PUBACK, mientras el broker inunda al cliente
+ *        con publicaciones entrantes que llegan todas a su manejador
+ *
+ *  Muestra la latencia de las publicaciones QoS1 durante la inundacin.
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTDuplexClient.h"
+#include <algorithm>
+#include <atomic>
+
+
+typedef MQTT::DuplexClient<LinuxNetwork, LinuxCountdown, LinuxThread, LinuxMutex, LinuxSemaphore, 256, 5, 8> Client;
+
+#define WRITERS         4
+#define PUBLICATIONS    500         // por hilo
+#define FLOOD           50000       // publicaciones entrantes
+
+
+static std::atomic<int> s_slow(0), s_inbound(0), s_published(0), s_out0(0);
+static std::atomic<int> s_reentrant(0), s_rc_qos0(-1), s_rc_qos1(-1), s_rc_sub(-1), s_rc_unsub(-1), s_rc_disc(-1);
+static std::atomic<long> s_reentrant_ms(-1);
+static Client* s_client;
+static std::mutex s_send_mutex;     // el broker escribe desde dos hilos: cada paquete se enva entero
+
+
+//------------------------------------------------------------------------------------
+static void floodTask(int fd){
+    for(int i=0;i<FLOOD;i++){
+        std::lock_guard<std::mutex> lock(s_send_mutex);
+        sendPublish(fd, "in/data", "0123456789");
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: confirma todo, y ante "slow", "reentrant" o "flood" enva la publicacin correspondiente o la
+ *  inundacin */
+static void connectionTask(int fd){
+    unsigned char buf[512];
+    int len, type;
+    std::thread flood;
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        std::lock_guard<std::mutex> lock(s_send_mutex);
+        unsigned char ack[8];
+        switch(type){
+            case CONNECT:
+                sendConnack(fd);
+                break;
+            case SUBSCRIBE:{
+                int granted = 0;
+                sendAll(fd, ack, MQTTSerialize_suback(ack, sizeof(ack), (buf[2] << 8) | buf[3], 1, &granted));
+                break;
+            }
+            case PUBLISH:{
+                PublishPacket pub(buf, len);
+                std::string t = pub.topic();
+                if(pub.qos == 1){
+                    sendAck(fd, PUBACK, pub.id);
+                }
+                if(t == "slow"){
+                    sendPublish(fd, "in/slow", "0123456789");
+                }
+                else if(t == "reentrant"){
+                    sendPublish(fd, "in/reentrant", "0123456789");
+                }
+                else if(t == "out0"){
+                    s_out0++;
+                }
+                else if(t == "flood"){
+                    flood = std::thread(floodTask, fd);
+                }
+                else if(t == "out"){
+                    s_published++;
+                }
+                break;
+            }
+            case PINGREQ:
+                sendPingresp(fd);
+                break;
+        }
+    }
+    if(flood.joinable()){
+        flood.join();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onSlow(MQTT::MessageData& md){
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    s_slow++;
+}
+
+static void onData(MQTT::MessageData& md){
+    s_inbound++;
+}
+
+/** Desde el hilo lector: slo la publicacin QoS0 puede completarse sin esperar un ack */
+static void onReentrant(MQTT::MessageData& md){
+    char payload[] = "h";
+    LinuxCountdown t(10000);
+    s_rc_qos1 = s_client->publish("out1", payload, 1, MQTT::QOS1);
+    s_rc_sub = s_client->subscribe("in/other", MQTT::QOS0, onData);
+    s_rc_unsub = s_client->unsubscribe("in/data");
+    s_rc_disc = s_client->disconnect();
+    s_reentrant_ms = 10000 - t.left_ms();
+    s_rc_qos0 = s_client->publish("out0", payload, 1, MQTT::QOS0);
+    s_reentrant++;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Hilo escritor: publica QoS1 y guarda la latencia de cada publicacin */
+static void writerTask(Client* client, std::vector<long>* latency){
+    char payload[] = "payload";
+    for(int i=0;i<PUBLICATIONS;i++){
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = client->publish("out", payload, sizeof(payload), MQTT::QOS1);
+        auto t1 = std::chrono::steady_clock::now();
+        CHECK(rc == MQTT::SUCCESS);
+        latency->push_back((long)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count());
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    Client client(network, 5000);
+    s_client = &client;
+    CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"duplex";
+    CHECK(client.connect(data) == 0);
+    CHECK(client.subscribe("in/slow", MQTT::QOS0, onSlow) == MQTT::SUCCESS);
+    CHECK(client.subscribe("in/data", MQTT::QOS0, onData) == MQTT::SUCCESS);
+    CHECK(client.subscribe("in/reentrant", MQTT::QOS0, onReentrant) == MQTT::SUCCESS);
+
+    // el manejador lento ocupa el hilo lector, una publicacin QoS0 de otro hilo no le espera
+    char one[] = "1";
+    CHECK(client.publish("slow", one, 1, MQTT::QOS0) == MQTT::SUCCESS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    LinuxCountdown t(1000);
+    CHECK(client.publish("fast", one, 1, MQTT::QOS0) == MQTT::SUCCESS);
+    CHECK(t.left_ms() > 900);
+    CHECK(s_slow == 0);
+    LinuxCountdown wait(2000);
+    while(s_slow == 0 && !wait.expired()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(s_slow == 1);
+
+    // llamadas desde un manejador: las que esperan un ack fallan sin bloquear, la QoS0 se publica
+    CHECK(client.publish("reentrant", one, 1, MQTT::QOS1) == MQTT::SUCCESS);
+    LinuxCountdown reentrant(2000);
+    while(s_reentrant == 0 && !reentrant.expired()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(s_reentrant == 1);
+    CHECK(s_rc_qos1 == MQTT::FAILURE);
+    CHECK(s_rc_sub == MQTT::FAILURE);
+    CHECK(s_rc_unsub == MQTT::FAILURE);
+    CHECK(s_rc_disc == MQTT::FAILURE);
+    CHECK(s_reentrant_ms >= 0 && s_reentrant_ms < 100);
+    CHECK(s_rc_qos0 == MQTT::SUCCESS);
+    CHECK(client.isConnected());
+    // el hilo lector sigue atendiendo los acks de los dems hilos
+    CHECK(client.publish("ping", one, 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(s_out0 == 1);
+
+    // varios escritores QoS1 durante la inundacin
+    CHECK(client.publish("flood", one, 1, MQTT::QOS1) == MQTT::SUCCESS);
+    std::vector<long> latency[WRITERS];
+    std::vector<std::thread> writers;
+    for(int i=0;i<WRITERS;i++){
+        writers.push_back(std::thread(writerTask, &client, &latency[i]));
+    }
+    for(int i=0;i<WRITERS;i++){
+        writers[i].join();
+    }
+    LinuxCountdown flood(5000);
+    while(s_inbound < FLOOD && !flood.expired()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(s_inbound == FLOOD);
+    CHECK(client.isConnected());
+    CHECK(client.disconnect() == MQTT::SUCCESS);
+    network.disconnect();
+    broker.join();
+    CHECK(s_published == WRITERS * PUBLICATIONS);
+
+    std::vector<long> all;
+    for(int i=0;i<WRITERS;i++){
+        all.insert(all.end(), latency[i].begin(), latency[i].end());
+    }
+    std::sort(all.begin(), all.end());
+    long p50 = all.empty()? 0 : all[all.size() / 2];
+    long p99 = all.empty()? 0 : all[all.size() * 99 / 100];
+    printf("%d publicaciones QoS1 desde %d hilos con %d entrantes, latencia (us) p50=%ld p99=%ld: %s\n", (int)s_published, WRITERS, (int)s_inbound,
+           p50, p99, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * test_MQTTLinuxManager.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de LinuxClientManager con clientes y redes simulados sobre pipes, de forma que los eventos de cada ronda
+ *  son deterministas. Se comprueba que:
+ *
+ *      - un cliente que se elimina a s mismo desde su manejador deja de procesarse, aunque su red tenga datos
+ *        pendientes
+ *      - si un manejador elimina otro cliente con un evento en la misma ronda y aade uno nuevo, el evento del
+ *        eliminado no llega al nuevo
+ *      - un cliente cuyo drain falla se entrega al manejador de desconexin, y su entrada se reutiliza despus
+ *      - los datos que la red ya ha ledo (sin evento de epoll) se procesan sin esperar al plazo de run()
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTClient.h"
+#include "MQTTLinuxManager.h"
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+/** Red simulada: un pipe que se hace legible al escribir en l, y datos pendientes a voluntad */
+struct FakeNetwork {
+    int fds[2];
+    bool buffered;
+
+    FakeNetwork() : buffered(false) {
+        if(pipe2(fds, O_NONBLOCK) != 0){
+            fds[0] = fds[1] = -1;
+        }
+    }
+    ~FakeNetwork() {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    int fd() { return fds[0]; }
+    bool pending() { return buffered; }
+    void signal() { CHECK(write(fds[1], "x", 1) == 1); }
+    void clear() { char buf[16]; while(read(fds[0], buf, sizeof(buf)) > 0); }
+};
+
+
+struct FakeClient;
+typedef LinuxClientManager<FakeNetwork, FakeClient> Manager;
+
+/** Cliente simulado: drain() ejecuta la accin indicada, como lo hara un manejador de mensajes */
+struct FakeClient {
+    typedef void (*Action)(FakeClient&);
+    int drains;
+    int result;
+    Action action;
+
+    FakeClient() : drains(0), result(0), action(0) {}
+    int drain(int timeout_ms, int budget) {
+        drains++;
+        if(action){
+            action(*this);
+        }
+        return result;
+    }
+    int keepalive() { return 0; }
+    bool isConnected() { return true; }
+};
+
+
+static Manager* s_manager;
+static FakeNetwork s_net[3];
+static FakeClient s_client[3];
+static int s_disconnected = 0;
+
+
+//------------------------------------------------------------------------------------
+static void removeSelf(FakeClient& c){
+    s_manager->remove(c);
+}
+
+
+//------------------------------------------------------------------------------------
+/** El primero de los dos clientes que se procesa elimina al otro y aade el tercero */
+static void replaceOther(FakeClient& c){
+    FakeClient& other = (&c == &s_client[0])? s_client[1] : s_client[0];
+    if(s_manager->remove(other) == 0){
+        CHECK(s_manager->add(s_net[2], s_client[2]) == 0);
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Consume los datos que la red tena ya ledos */
+static void consume(FakeClient& c){
+    s_net[&c - s_client].buffered = false;
+}
+
+
+//------------------------------------------------------------------------------------
+static void onDisconnect(FakeNetwork& network, FakeClient& client){
+    CHECK(&network == &s_net[0] && &client == &s_client[0]);
+    s_disconnected++;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    Manager manager(60000);
+    s_manager = &manager;
+    manager.setDisconnectHandler(onDisconnect);
+
+    // el cliente se elimina con datos pendientes en su red: no vuelve a procesarse
+    s_client[0].action = removeSelf;
+    s_net[0].buffered = true;
+    CHECK(manager.add(s_net[0], s_client[0]) == 0);
+    s_net[0].signal();
+    CHECK(manager.run(100) == 1);
+    CHECK(s_client[0].drains == 1);
+    CHECK(manager.size() == 0);
+    s_net[0].buffered = false;
+
+    // dos clientes con evento en la misma ronda: el que se procesa primero sustituye al otro por el tercero
+    s_client[0].drains = 0;
+    s_client[0].action = replaceOther;
+    s_client[1].action = replaceOther;
+    CHECK(manager.add(s_net[0], s_client[0]) == 0);
+    CHECK(manager.add(s_net[1], s_client[1]) == 0);
+    s_net[1].signal();
+    CHECK(manager.run(100) == 2);
+    CHECK(s_client[0].drains + s_client[1].drains == 1);
+    CHECK(s_client[2].drains == 0);
+    CHECK(manager.size() == 2);
+    // el tercero recibe sus propios eventos
+    s_net[2].signal();
+    manager.run(100);
+    CHECK(s_client[2].drains == 1);
+
+    // deja slo el primer cliente, cuyo drain falla: se desconecta y su entrada se reutiliza
+    manager.remove(s_client[0]);
+    manager.remove(s_client[1]);
+    manager.remove(s_client[2]);
+    CHECK(manager.size() == 0);
+    s_client[0].action = 0;
+    s_client[0].result = -1;
+    CHECK(manager.add(s_net[0], s_client[0]) == 0);
+    manager.run(100);
+    CHECK(s_disconnected == 1);
+    CHECK(manager.size() == 0);
+    s_client[1].action = 0;
+    CHECK(manager.add(s_net[1], s_client[1]) == 0);
+    CHECK(manager.size() == 1);
+
+    // datos ya ledos por la red, como los que deja un publish QoS1 al esperar su PUBACK: no generan evento
+    s_net[1].clear();
+    s_client[1].drains = 0;
+    s_client[1].action = consume;
+    s_net[1].buffered = true;
+    LinuxCountdown timer(1000);
+    manager.run(500);
+    CHECK(s_client[1].drains == 1);
+    CHECK(!s_net[1].buffered);
+    CHECK(timer.left_ms() > 900);
+
+    printf("cliente eliminado desde su manejador, sustitucin en la misma ronda, %d desconexin: %s\n", s_disconnected, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
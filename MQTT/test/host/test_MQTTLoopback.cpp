@@ -0,0 +1,289 @@
+/*
+ * test_MQTTLoopback.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba del broker en proceso de MQTTLoopback.h con varios MQTT::Client en un nico hilo. Se comprueba que:
+ *
+ *      - la latencia y el ancho de banda del enlace dan tiempos exactos en el reloj virtual
+ *      - las publicaciones QoS0, 1 y 2 llegan a cada suscriptor con el menor QoS de los dos, por + y #
+ *      - los mensajes retenidos llegan a las nuevas suscripciones, y uno vaco los borra
+ *      - una sesin persistente recibe al reconectar lo publicado mientras no estaba
+ *      - el will se publica si el cliente cae sin DISCONNECT
+ *      - con prdidas, la misma semilla repite exactamente la misma ejecucin
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTClient.h"
+#include "MQTTLoopback.h"
+#include <chrono>
+
+
+#define PACKET_SIZE     256
+#define TIMEOUT_MS      5000
+
+
+typedef MQTT::ClientMetrics<MQTT::LoopbackMicroTick> Metrics;
+typedef MQTT::Client<MQTT::LoopbackNetwork, MQTT::LoopbackCountdown, PACKET_SIZE, 5,
+        MQTT::ClientPolicy<2, true, MQTT::OWN_BUFFERS, false, MQTT::QoS2IdSet<10>, Metrics> > Client;
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+/** Lo ltimo recibido por cada suscriptor */
+struct Received {
+    int count;
+    int qos;
+    bool retained;
+    char topic[32];
+    char payload[32];
+};
+
+static Received s_received[4];
+
+
+//------------------------------------------------------------------------------------
+static void store(Received& r, MQTT::MessageData& md){
+    r.count++;
+    r.qos = md.message.qos;
+    r.retained = md.message.retained;
+    snprintf(r.topic, sizeof(r.topic), "%.*s", md.topicName.lenstring.len, md.topicName.lenstring.data);
+    snprintf(r.payload, sizeof(r.payload), "%.*s", (int)md.message.payloadlen, (char*)md.message.payload);
+}
+
+static void on1(MQTT::MessageData& md){ store(s_received[1], md); }
+static void on2(MQTT::MessageData& md){ store(s_received[2], md); }
+static void on3(MQTT::MessageData& md){ store(s_received[3], md); }
+
+
+//------------------------------------------------------------------------------------
+static int connect(Client& client, MQTT::LoopbackNetwork& network, MQTT::LoopbackBroker& broker, const char* id,
+                   const MQTT::LinkProfile& profile = MQTT::LinkProfile(), bool cleansession = true){
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    data.cleansession = cleansession;
+    network.connect(broker, profile);
+    return client.connect(data);
+}
+
+
+//------------------------------------------------------------------------------------
+static unsigned long long now(){
+    return MQTT::LoopbackClock::micros();
+}
+
+
+//------------------------------------------------------------------------------------
+/** Latencia y ancho de banda: los tiempos de ida y vuelta son exactos */
+static void testTiming(){
+    MQTT::LoopbackBroker broker;
+    MQTT::LoopbackNetwork network;
+    Client client(network, TIMEOUT_MS);
+    char payload[100];
+    memset(payload, 'x', sizeof(payload));
+
+    // 10 ms en cada sentido
+    unsigned long long start = now();
+    CHECK(connect(client, network, broker, "timing", MQTT::LinkProfile(10000)) == MQTT::SUCCESS);
+    CHECK(now() - start == 20000);
+    start = now();
+    CHECK(client.publish("t", payload, sizeof(payload), MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(now() - start == 20000);
+    start = now();
+    CHECK(client.publish("t", payload, sizeof(payload), MQTT::QOS2) == MQTT::SUCCESS);
+    CHECK(now() - start == 40000);
+    client.disconnect();
+    network.disconnect();
+
+    // 10000 bytes/s sin latencia: 100 us por byte
+    CHECK(connect(client, network, broker, "timing", MQTT::LinkProfile(0, 10000)) == MQTT::SUCCESS);
+    start = now();
+    CHECK(client.publish("t", payload, sizeof(payload), MQTT::QOS1) == MQTT::SUCCESS);
+    // PUBLISH de 2 + 2 + 1 + 2 + 100 bytes, PUBACK de 4
+    CHECK(now() - start == (107 + 4) * 100);
+
+    Metrics::Data data;
+    client.getMetrics().snapshot(data);
+    CHECK(data.publishAck.count() == 3 && data.publishAck.min() == 11100 && data.publishAck.max() == 40000);
+    client.disconnect();
+    network.disconnect();
+}
+
+
+//------------------------------------------------------------------------------------
+/** QoS de cada suscriptor, comodines y mensajes retenidos */
+static void testFanOut(){
+    MQTT::LoopbackBroker broker;
+    MQTT::LoopbackNetwork net[4];
+    Client pub(net[0], TIMEOUT_MS), sub1(net[1], TIMEOUT_MS), sub2(net[2], TIMEOUT_MS), late(net[3], TIMEOUT_MS);
+    MQTT::LinkProfile profile(1000);
+    memset(s_received, 0, sizeof(s_received));
+
+    CHECK(connect(pub, net[0], broker, "pub", profile) == MQTT::SUCCESS);
+    CHECK(connect(sub1, net[1], broker, "sub1", profile) == MQTT::SUCCESS);
+    CHECK(connect(sub2, net[2], broker, "sub2", profile) == MQTT::SUCCESS);
+    CHECK(sub1.subscribe("s/+", MQTT::QOS2, on1) == MQTT::SUCCESS);
+    CHECK(sub2.subscribe("s/#", MQTT::QOS1, on2) == MQTT::SUCCESS);
+
+    for(int qos=0; qos<=2; qos++){
+        char payload[8];
+        snprintf(payload, sizeof(payload), "q%d", qos);
+        CHECK(pub.publish("s/1", payload, strlen(payload), (MQTT::QoS)qos) == MQTT::SUCCESS);
+        sub1.yield(10);
+        sub2.yield(10);
+        CHECK(s_received[1].count == qos + 1 && s_received[1].qos == qos && strcmp(s_received[1].payload, payload) == 0);
+        CHECK(s_received[2].count == qos + 1 && s_received[2].qos == ((qos < 1)? qos : 1));
+    }
+    // "s/#" tambin recibe "s", "s/+" no. isTopicMatched del cliente no lo reconoce, llega al handler por defecto
+    sub2.setDefaultMessageHandler(on2);
+    CHECK(pub.publish("s", (void*)"x", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    sub1.yield(10);
+    sub2.yield(10);
+    CHECK(s_received[1].count == 3 && s_received[2].count == 4 && strcmp(s_received[2].topic, "s") == 0);
+
+    // retenido, para las suscripciones posteriores
+    CHECK(pub.publish("r/x", (void*)"21.5", 4, MQTT::QOS1, true) == MQTT::SUCCESS);
+    CHECK(connect(late, net[3], broker, "late", profile) == MQTT::SUCCESS);
+    CHECK(late.subscribe("r/#", MQTT::QOS2, on3) == MQTT::SUCCESS);
+    late.yield(10);
+    CHECK(s_received[3].count == 1 && s_received[3].retained && s_received[3].qos == 1 && strcmp(s_received[3].payload, "21.5") == 0);
+    // uno vaco lo borra
+    CHECK(pub.publish("r/x", (void*)"", 0, MQTT::QOS0, true) == MQTT::SUCCESS);
+    late.yield(10);
+    CHECK(late.unsubscribe("r/#") == MQTT::SUCCESS);
+    int count = s_received[3].count;
+    CHECK(late.subscribe("r/#", MQTT::QOS2, on3) == MQTT::SUCCESS);
+    late.yield(10);
+    CHECK(s_received[3].count == count);
+    CHECK(broker.published() == 6 && broker.dropped() == 0);
+
+    for(int i=0;i<4;i++){
+        net[i].disconnect();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Sesin persistente y will */
+static void testSessions(){
+    MQTT::LoopbackBroker broker;
+    MQTT::LoopbackNetwork net[3];
+    Client pub(net[0], TIMEOUT_MS), sub(net[1], TIMEOUT_MS), dying(net[2], TIMEOUT_MS);
+    memset(s_received, 0, sizeof(s_received));
+
+    CHECK(connect(pub, net[0], broker, "pub") == MQTT::SUCCESS);
+    CHECK(connect(sub, net[1], broker, "persistent", MQTT::LinkProfile(), false) == MQTT::SUCCESS);
+    CHECK(sub.subscribe("p/#", MQTT::QOS2, on1) == MQTT::SUCCESS);
+    CHECK(sub.subscribe("will", MQTT::QOS1, on1) == MQTT::SUCCESS);
+    sub.disconnect();
+    net[1].disconnect();
+
+    // mientras no est
+    CHECK(pub.publish("p/1", (void*)"a", 1, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(pub.publish("p/2", (void*)"b", 1, MQTT::QOS2) == MQTT::SUCCESS);
+    CHECK(pub.publish("p/3", (void*)"c", 1, MQTT::QOS0) == MQTT::SUCCESS);
+    MQTT::connackData connack;
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"persistent";
+    data.cleansession = 0;
+    net[1].connect(broker);
+    CHECK(sub.connect(data, connack) == MQTT::SUCCESS && connack.sessionPresent);
+    // el cliente no conserva los handlers, slo el broker las suscripciones
+    sub.setMessageHandler("p/#", on1);
+    sub.setMessageHandler("will", on1);
+    sub.yield(10);
+    CHECK(s_received[1].count == 2 && strcmp(s_received[1].topic, "p/2") == 0 && s_received[1].qos == 2);
+
+    // cae sin DISCONNECT
+    data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"dying";
+    data.willFlag = 1;
+    data.will.topicName.cstring = (char*)"will";
+    data.will.message.cstring = (char*)"bye";
+    data.will.qos = 1;
+    net[2].connect(broker);
+    CHECK(dying.connect(data) == MQTT::SUCCESS);
+    net[2].disconnect();
+    dying.disconnect();
+    sub.yield(10);
+    CHECK(s_received[1].count == 3 && strcmp(s_received[1].payload, "bye") == 0);
+
+    // con DISCONNECT no
+    net[2].connect(broker);
+    CHECK(dying.connect(data) == MQTT::SUCCESS);
+    dying.disconnect();
+    net[2].disconnect();
+    sub.yield(10);
+    CHECK(s_received[1].count == 3);
+
+    // un client id vaco slo con sesin limpia
+    data = MQTTPacket_connectData_initializer;
+    data.cleansession = 0;
+    net[2].connect(broker);
+    CHECK(dying.connect(data, connack) != MQTT::SUCCESS && connack.rc == 2);
+
+    for(int i=0;i<3;i++){
+        net[i].disconnect();
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+struct Run {
+    unsigned long long elapsed;
+    unsigned long lost;
+    unsigned long p50, p99;
+    int failed;
+};
+
+/** 200 publicaciones QoS1 por un enlace de 25 ms, 1 Mbit/s y un 5% de prdidas */
+static Run lossyRun(unsigned long long seed){
+    MQTT::LoopbackBroker broker(2, seed);
+    MQTT::LoopbackNetwork network;
+    Client client(network, TIMEOUT_MS);
+    Run run = {0, 0, 0, 0, 0};
+    char payload[64];
+    memset(payload, 'x', sizeof(payload));
+
+    unsigned long long start = now();
+    run.failed += (connect(client, network, broker, "lossy", MQTT::LinkProfile(25000, 125000, 0.05)) != MQTT::SUCCESS);
+    for(int i=0;i<200;i++){
+        run.failed += (client.publish("t", payload, sizeof(payload), MQTT::QOS1) != MQTT::SUCCESS);
+    }
+    client.disconnect();
+    network.disconnect();
+    run.elapsed = now() - start;
+    run.lost = broker.lost();
+    Metrics::Data data;
+    client.getMetrics().snapshot(data);
+    run.p50 = data.publishAck.percentile(50.0);
+    run.p99 = data.publishAck.percentile(99.0);
+    return run;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    testTiming();
+    testFanOut();
+    testSessions();
+
+    auto start = std::chrono::steady_clock::now();
+    Run a = lossyRun(7);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Run b = lossyRun(7);
+    CHECK(a.failed == 0 && a.lost > 0 && a.p99 > a.p50 && a.p50 >= 50000);
+    CHECK(a.elapsed == b.elapsed && a.lost == b.lost && a.p50 == b.p50 && a.p99 == b.p99);
+    // el tiempo virtual no se espera
+    CHECK(wall < a.elapsed / 1e6 / 10);
+
+    printf("200 publicaciones QoS1 con 25 ms y 5%% de prdidas: %.2f s virtuales en %.3f ms, p50 %lu us, p99 %lu us, "
+           "%lu retransmisiones, repetible: %s\n", a.elapsed / 1e6, wall * 1000, a.p50, a.p99, a.lost, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
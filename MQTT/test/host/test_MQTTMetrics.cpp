@@ -0,0 +1,218 @@
+/*
+ * test_MQTTMetrics.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de las mtricas de MQTT::Client (MQTTMetrics.h) frente a un broker simulado. Se comprueba que:
+ *
+ *      - LatencyHistogram da los percentiles con un error menor de 1/2^SUB_BITS
+ *      - los contadores por tipo de paquete y los histogramas de PUBACK y SUBACK cuadran con lo enviado
+ *      - un snapshot tomado desde otro hilo mientras el cliente publica es siempre coherente
+ *      - una publicacin que no cabe en el buffer cuenta como bufferOverflow
+ *      - el PINGRESP llega al histograma, su falta cuenta como keepaliveTimeout, y se cuentan las reconexiones
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include <atomic>
+#include <chrono>
+
+
+#define PACKET_SIZE     256
+#define TIMEOUT_MS      1000
+#define PUBLICATIONS    5000
+
+
+typedef MQTT::ClientMetrics<LinuxMicroTick> Metrics;
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 5,
+        MQTT::ClientPolicy<1, true, MQTT::OWN_BUFFERS, false, MQTT::QoS2IdSet<0>, Metrics> > Client;
+
+
+//------------------------------------------------------------------------------------
+/** Una conexin del broker simulado: acepta el CONNECT, confirma publicaciones y suscripciones, y responde a
+ *  los PINGREQ salvo si el client id es "deaf" */
+static void connectionTask(int fd){
+    unsigned char buf[PACKET_SIZE];
+    int len, type;
+    bool deaf = false;
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        unsigned char ack[8];
+        if(type == CONNECT){
+            MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+            MQTTDeserialize_connect(&data, buf, len);
+            deaf = (std::string(data.clientID.lenstring.data, data.clientID.lenstring.len) == "deaf");
+            sendConnack(fd);
+        }
+        else if(type == PUBLISH){
+            PublishPacket pub(buf, len);
+            if(pub.qos > 0){
+                sendAck(fd, PUBACK, pub.id);
+            }
+        }
+        else if(type == SUBSCRIBE){
+            unsigned char dup;
+            unsigned short id;
+            int count, qos[4];
+            MQTTString topics[4];
+            MQTTDeserialize_subscribe(&dup, &id, 4, &count, topics, qos, buf, len);
+            sendAll(fd, ack, MQTTSerialize_suback(ack, sizeof(ack), id, count, qos));
+        }
+        else if(type == PINGREQ && !deaf){
+            sendPingresp(fd);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onMessage(MQTT::MessageData&){
+}
+
+
+//------------------------------------------------------------------------------------
+static int connect(Client& client, LinuxNetwork& network, int port, const char* id, int keepalive){
+    if(network.connect("127.0.0.1", port) != 0){
+        return MQTT::FAILURE;
+    }
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    data.keepAliveInterval = keepalive;
+    return client.connect(data);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Percentiles de valores conocidos, del 1 al 100000 */
+static void testHistogram(){
+    MQTT::LatencyHistogram<> h;
+    CHECK(h.count() == 0 && h.percentile(50.0) == 0);
+    for(unsigned long v=1; v<=100000; v++){
+        h.record(v);
+    }
+    CHECK(h.count() == 100000 && h.min() == 1 && h.max() == 100000 && h.mean() == 50000);
+    const double percents[] = {1.0, 10.0, 50.0, 90.0, 99.0, 99.9};
+    for(double p : percents){
+        double exact = p * 1000.0;
+        double got = h.percentile(p);
+        CHECK(got >= exact && got <= exact * 1.125);
+    }
+    CHECK(h.percentile(100.0) == 100000);
+
+    // los valores pequeos tienen un bucket cada uno
+    MQTT::LatencyHistogram<> small;
+    small.record(3);
+    small.record(7);
+    CHECK(small.percentile(50.0) == 3 && small.percentile(100.0) == 7);
+
+    // por encima de 2^MAX_BITS, en el ltimo bucket
+    MQTT::LatencyHistogram<3, 10> clamped;
+    clamped.record(5000);
+    CHECK(clamped.max() == 1023 && clamped.percentile(50.0) == 1023);
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    testHistogram();
+
+    FakeBroker broker(connectionTask, 3);
+    int port = broker.port();
+    if(!port){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    Client client(network, TIMEOUT_MS);
+    static Metrics::Data data;
+    char payload[] = "21.5";
+
+    // tamao de cada publicacin
+    unsigned char packet[PACKET_SIZE];
+    MQTTString topic = MQTTString_initializer;
+    topic.cstring = (char*)"t";
+    unsigned long long publen = MQTTSerialize_publish(packet, sizeof(packet), 0, 1, 0, 1, topic, (unsigned char*)payload, 4);
+
+    CHECK(connect(client, network, port, "metrics", 0) == MQTT::SUCCESS);
+    CHECK(client.subscribe("s/#", MQTT::QOS1, onMessage) == MQTT::SUCCESS);
+
+    // snapshots desde otro hilo mientras se publica
+    std::atomic<bool> done(false);
+    int snapshots = 0, inconsistent = 0;
+    std::thread reader([&](){
+        static Metrics::Data copy;
+        while(!done){
+            client.getMetrics().snapshot(copy);
+            snapshots++;
+            unsigned long pubs = copy.packetsSent[PUBLISH], acks = copy.packetsReceived[PUBACK];
+            if(copy.bytesSent[PUBLISH] != pubs * publen || copy.bytesReceived[PUBACK] != acks * 4 ||
+               acks > pubs || copy.publishAck.count() > acks || copy.publishAck.count() + 1 < acks){
+                inconsistent++;
+            }
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    int failed = 0;
+    for(int i=0;i<PUBLICATIONS;i++){
+        failed += (client.publish("t", payload, 4, MQTT::QOS1) != MQTT::SUCCESS);
+    }
+    double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    done = true;
+    reader.join();
+    CHECK(failed == 0 && snapshots > 0 && inconsistent == 0);
+
+    client.getMetrics().snapshot(data);
+    CHECK(data.packetsSent[CONNECT] == 1 && data.packetsReceived[CONNACK] == 1 && data.bytesReceived[CONNACK] == 4);
+    CHECK(data.packetsSent[SUBSCRIBE] == 1 && data.packetsReceived[SUBACK] == 1 && data.subscribeAck.count() == 1);
+    CHECK(data.packetsSent[PUBLISH] == PUBLICATIONS && data.bytesSent[PUBLISH] == PUBLICATIONS * publen);
+    CHECK(data.packetsReceived[PUBACK] == PUBLICATIONS && data.publishAck.count() == PUBLICATIONS);
+    CHECK(data.publishAck.min() <= data.publishAck.percentile(50.0) && data.publishAck.percentile(99.0) <= data.publishAck.max());
+    CHECK(data.publishAck.mean() <= elapsed / PUBLICATIONS);
+    CHECK(data.writes >= PUBLICATIONS + 2 && data.reads >= 2 * (PUBLICATIONS + 2));
+    CHECK(data.connects == 1 && data.reconnects == 0 && data.bufferOverflows == 0 && data.keepaliveTimeouts == 0);
+    unsigned long p50 = data.publishAck.percentile(50.0), p99 = data.publishAck.percentile(99.0);
+
+    // no cabe en PACKET_SIZE
+    char big[PACKET_SIZE];
+    memset(big, 'x', sizeof(big));
+    CHECK(client.publish("t", big, sizeof(big), MQTT::QOS1) != MQTT::SUCCESS);
+    client.getMetrics().snapshot(data);
+    CHECK(data.bufferOverflows == 1 && data.packetsSent[PUBLISH] == PUBLICATIONS);
+    client.disconnect();
+    network.disconnect();
+
+    // keepalive de 1 s: el PINGRESP llega al histograma
+    CHECK(connect(client, network, port, "ping", 1) == MQTT::SUCCESS);
+    start = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1500)){
+        CHECK(client.yield(50) == MQTT::SUCCESS);
+    }
+    client.getMetrics().snapshot(data);
+    CHECK(data.packetsSent[PINGREQ] >= 1 && data.pingResponse.count() == data.packetsReceived[PINGRESP]);
+    CHECK(data.pingResponse.count() >= 1 && data.connects == 2 && data.reconnects == 1);
+    client.disconnect();
+    network.disconnect();
+
+    // sin PINGRESP: keepaliveTimeout
+    CHECK(connect(client, network, port, "deaf", 1) == MQTT::SUCCESS);
+    start = std::chrono::steady_clock::now();
+    int rc = MQTT::SUCCESS;
+    while(rc == MQTT::SUCCESS && std::chrono::steady_clock::now() - start < std::chrono::milliseconds(4000)){
+        rc = client.yield(50);
+    }
+    client.getMetrics().snapshot(data);
+    CHECK(rc != MQTT::SUCCESS && !client.isConnected());
+    CHECK(data.keepaliveTimeouts == 1 && data.connects == 3 && data.reconnects == 2);
+    network.disconnect();
+    broker.join();
+
+    printf("%d publicaciones QoS1: PUBACK p50 %lu us, p99 %lu us, %d snapshots concurrentes: %s\n",
+           PUBLICATIONS, p50, p99, snapshots, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * test_MQTTPacketPool.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::PacketPool con dos clientes POOLED_BUFFERS y sesin persistente que comparten cinco buffers,
+ *  frente a un broker simulado. Se comprueba que:
+ *
+ *      - el pool entrega, comparte (retain) y recupera sus buffers, y devuelve 0 cuando se agota
+ *      - un cliente sin buffers propios ocupa tres buffers menos que uno con ellos, salvo el relleno
+ *      - la publicacin QoS1 guardada para la sesin vuelve al pool al recibir su PUBACK
+ *      - si la conexin cae antes del PUBACK, la publicacin se reenva igual al reconectar, y el cliente desconectado
+ *        slo retiene ese buffer
+ *      - con el pool agotado el connect falla sin enviar nada
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include <mutex>
+
+
+#define PACKET_SIZE     256
+#define POOL_SIZE       5
+
+
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 2, MQTT::ClientPolicy<1, true, MQTT::POOLED_BUFFERS> > Pooled;
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 2, MQTT::ClientPolicy<1, true, MQTT::OWN_BUFFERS> > Own;
+
+
+static std::mutex s_lock;
+static std::vector<std::string> s_published;    // "topic id payload" de cada publicacin recibida por el broker
+static bool s_dropped = false;
+
+
+//------------------------------------------------------------------------------------
+/** Una conexin del broker simulado: confirma las publicaciones, salvo la primera del topic "drop", ante la que
+ *  cierra la conexin */
+static void connectionTask(int fd){
+    unsigned char buf[PACKET_SIZE];
+    int len, type;
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        if(type == CONNECT){
+            sendConnack(fd);
+        }
+        else if(type == PUBLISH){
+            PublishPacket pub(buf, len);
+            std::string t = pub.topic();
+            bool drop;
+            {
+                std::lock_guard<std::mutex> lock(s_lock);
+                s_published.push_back(t + " " + std::to_string(pub.id) + " " + std::string((char*)pub.payload, pub.payloadlen));
+                drop = (t == "drop" && !s_dropped);
+                s_dropped = s_dropped || drop;
+            }
+            if(drop){
+                break;
+            }
+            sendAck(fd, PUBACK, pub.id);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static int connect(Pooled& client, LinuxNetwork& network, int port, const char* id){
+    if(network.connect("127.0.0.1", port) != 0){
+        return MQTT::FAILURE;
+    }
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    data.cleansession = 0;
+    return client.connect(data);
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    // el pool por s solo
+    {
+        MQTT::PacketPool pool(3, PACKET_SIZE);
+        unsigned char* a = pool.alloc();
+        unsigned char* b = pool.alloc();
+        unsigned char* c = pool.alloc();
+        CHECK(a && b && c && a != b && b != c && pool.available() == 0);
+        CHECK(pool.alloc() == 0);
+        pool.retain(b);
+        pool.release(b);
+        CHECK(pool.available() == 0);
+        pool.release(b);
+        CHECK(pool.available() == 1 && pool.alloc() == b);
+        pool.release(a);
+        pool.release(b);
+        pool.release(c);
+        CHECK(pool.available() == 3);
+    }
+    CHECK(sizeof(Own) - sizeof(Pooled) > 3 * (PACKET_SIZE - 8));
+
+    FakeBroker broker(connectionTask, 4);
+    int port = broker.port();
+    if(!port){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    MQTT::PacketPool pool(POOL_SIZE, PACKET_SIZE);
+    LinuxNetwork netA, netB;
+    Pooled a(netA, 2000), b(netB, 2000);
+    CHECK(a.setPacketPool(&pool) == MQTT::SUCCESS && b.setPacketPool(&pool) == MQTT::SUCCESS);
+    CHECK(connect(a, netA, port, "a") == MQTT::SUCCESS);
+    CHECK(connect(b, netB, port, "b") == MQTT::SUCCESS);
+    CHECK(pool.available() == POOL_SIZE - 4);
+
+    // publicacin confirmada: su buffer vuelve al pool
+    char uno[] = "uno", dos[] = "dos";
+    CHECK(a.publish("ok", uno, 3, MQTT::QOS1) == MQTT::SUCCESS);
+    CHECK(pool.available() == POOL_SIZE - 4);
+
+    // conexin perdida antes del PUBACK: b retiene la publicacin, y slo ella tras desconectarse
+    unsigned short id = 0;
+    CHECK(b.publish("drop", dos, 3, id, MQTT::QOS1) != MQTT::SUCCESS);
+    CHECK(!b.isConnected());
+    CHECK(pool.available() == POOL_SIZE - 5);
+    b.disconnect();
+    netB.disconnect();
+    CHECK(pool.available() == POOL_SIZE - 3);
+
+    // al reconectar se reenva, y se libera con su PUBACK
+    CHECK(connect(b, netB, port, "b") == MQTT::SUCCESS);
+    CHECK(pool.available() == POOL_SIZE - 4);
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        std::string expected = "drop " + std::to_string(id) + " dos";
+        CHECK(s_published.size() == 3 && s_published[1] == expected && s_published[2] == expected);
+    }
+
+    // pool agotado
+    {
+        LinuxNetwork netC;
+        Pooled c(netC, 2000);
+        CHECK(c.setPacketPool(&pool) == MQTT::SUCCESS);
+        CHECK(connect(c, netC, port, "c") != MQTT::SUCCESS);
+        netC.disconnect();
+    }
+    CHECK(pool.available() == POOL_SIZE - 4);
+
+    a.disconnect();
+    b.disconnect();
+    netA.disconnect();
+    netB.disconnect();
+    CHECK(pool.available() == POOL_SIZE);
+    broker.join();
+
+    printf("cliente de %d bytes con el pool, %d con buffers propios, %d publicaciones en el broker: %s\n",
+           (int)sizeof(Pooled), (int)sizeof(Own), (int)s_published.size(), (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * test_MQTTPolicy.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::ClientPolicy: en el mismo programa un sensor slo QoS0, sin persistencia y con un nico buffer,
+ *  y una pasarela con QoS2, frente a un broker simulado. Se comprueba que:
+ *
+ *      - el sensor ocupa al menos dos buffers de paquete menos que la pasarela
+ *      - el sensor se suscribe y publica con QoS0 aunque se le pida ms, y recibe bien con el buffer compartido
+ *      - la pasarela completa los flujos QoS2 de entrada y de salida, y no entrega dos veces un duplicado
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include <atomic>
+
+
+#define PACKET_SIZE     512
+#define MSG_ID          7
+
+
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 2, MQTT::ClientPolicy<0, false, MQTT::SHARED_BUFFER> > Sensor;
+typedef MQTT::Client<LinuxNetwork, LinuxCountdown, PACKET_SIZE, 2, MQTT::ClientPolicy<2> > Gateway;
+
+
+static std::atomic<int> s_subQoS(-1), s_pubQoS(-1), s_pubrec(0), s_pubrel(0), s_pubcomp(0);
+static int s_received = 0;
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: concede la QoS pedida en cada suscripcin y publica un mensaje con ella, dos veces y seguido
+ *  de su PUBREL si es QoS2. Responde a las publicaciones del cliente segn su QoS */
+static void connectionTask(int fd){
+    unsigned char buf[PACKET_SIZE];
+    int len, type;
+    while((type = readPacket(fd, buf, &len)) > 0 && type != DISCONNECT){
+        unsigned char out[PACKET_SIZE];
+        unsigned char dup;
+        unsigned short id;
+        switch(type){
+            case CONNECT:
+                sendConnack(fd);
+                break;
+            case SUBSCRIBE:{
+                int count, qos;
+                MQTTString filter;
+                MQTTDeserialize_subscribe(&dup, &id, 1, &count, &filter, &qos, buf, len);
+                s_subQoS = qos;
+                sendAll(fd, out, MQTTSerialize_suback(out, sizeof(out), id, 1, &qos));
+                for(int i=0;i<((qos == 2)? 2 : 1);i++){
+                    sendPublish(fd, "in/data", "hola", qos, (qos > 0)? MSG_ID : 0, i);
+                }
+                if(qos == 2){
+                    sendAck(fd, PUBREL, MSG_ID);
+                }
+                break;
+            }
+            case PUBLISH:{
+                PublishPacket pub(buf, len);
+                s_pubQoS = pub.qos;
+                if(pub.qos > 0){
+                    sendAck(fd, (pub.qos == 1)? PUBACK : PUBREC, pub.id);
+                }
+                break;
+            }
+            case PUBREC:
+                s_pubrec++;
+                break;
+            case PUBREL:
+                s_pubrel++;
+                MQTTDeserialize_ack(&out[0], &dup, &id, buf, len);
+                sendAck(fd, PUBCOMP, id);
+                break;
+            case PUBCOMP:
+                s_pubcomp++;
+                break;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void onData(MQTT::MessageData& md){
+    CHECK(MQTTPacket_equals(&md.topicName, (char*)"in/data"));
+    CHECK(md.message.payloadlen == 4 && memcmp(md.message.payload, "hola", 4) == 0);
+    s_received++;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Conecta el cliente, se suscribe con QoS2 y publica con QoS2, devuelve la QoS concedida */
+template<class Client>
+static int run(Client& client, LinuxNetwork& network, int port, const char* id){
+    CHECK(network.connect("127.0.0.1", port) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)id;
+    CHECK(client.connect(data) == 0);
+    MQTT::subackData granted;
+    granted.grantedQoS = -1;
+    CHECK(client.subscribe("in/#", MQTT::QOS2, onData, granted) == MQTT::SUCCESS);
+    client.yield(200);
+    char one[] = "1";
+    CHECK(client.publish("out/data", one, 1, MQTT::QOS2) == MQTT::SUCCESS);
+    CHECK(client.isConnected());
+    client.disconnect();
+    network.disconnect();
+    return granted.grantedQoS;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask, 2);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+    CHECK(sizeof(Gateway) >= sizeof(Sensor) + 2 * PACKET_SIZE);
+
+    // sensor: todo con QoS0
+    {
+        LinuxNetwork network;
+        Sensor sensor(network, 2000);
+        CHECK(run(sensor, network, broker.port(), "sensor") == 0);
+        CHECK(s_subQoS == 0 && s_pubQoS == 0);
+        CHECK(s_received == 1);
+        CHECK(s_pubrec == 0 && s_pubrel == 0 && s_pubcomp == 0);
+    }
+
+    // pasarela: el duplicado se confirma de nuevo pero no se entrega
+    {
+        LinuxNetwork network;
+        Gateway gateway(network, 2000);
+        CHECK(run(gateway, network, broker.port(), "gateway") == 2);
+        CHECK(s_subQoS == 2 && s_pubQoS == 2);
+        CHECK(s_received == 2);
+        CHECK(s_pubrec == 2 && s_pubcomp == 1 && s_pubrel == 1);
+    }
+
+    broker.join();
+
+    printf("sensor QoS0 de %d bytes, pasarela QoS2 de %d bytes: %s\n", (int)sizeof(Sensor), (int)sizeof(Gateway),
+           (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * test_MQTTQoS2Ids.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de los conjuntos de ids QoS2 entrantes de MQTT::Client (QoS2IdSet y QoS2IdBitmap) frente a std::set, con
+ *  ids consecutivos como los de un broker y con ids al azar. Se comprueba que:
+ *
+ *      - contains, insert y erase coinciden con std::set en todo momento, tambin tras borrar en medio de una
+ *        secuencia de colisiones
+ *      - QoS2IdSet<N> rechaza el id N+1 y vuelve a admitir tras liberar uno
+ *      - el coste por operacin no crece con N, a diferencia de la bsqueda lineal anterior
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTLinux.h"
+#include "MQTTClient.h"
+#include <chrono>
+#include <random>
+#include <set>
+
+
+#define OPS     200000
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+//------------------------------------------------------------------------------------
+/** La tabla lineal de las versiones anteriores, como referencia de tiempos */
+template<int N>
+struct LinearIds {
+    unsigned short ids[N];
+    LinearIds(){
+        clear();
+    }
+    bool contains(unsigned short id) const{
+        for(int i=0;i<N;i++){
+            if(ids[i] == id){
+                return true;
+            }
+        }
+        return false;
+    }
+    bool insert(unsigned short id){
+        for(int i=0;i<N;i++){
+            if(ids[i] == 0){
+                ids[i] = id;
+                return true;
+            }
+        }
+        return false;
+    }
+    void erase(unsigned short id){
+        for(int i=0;i<N;i++){
+            if(ids[i] == id){
+                ids[i] = 0;
+                return;
+            }
+        }
+    }
+    void clear(){
+        memset(ids, 0, sizeof(ids));
+    }
+};
+
+
+//------------------------------------------------------------------------------------
+/** Operaciones al azar sobre ids en [1, range], comparadas con std::set. Con capacity > 0 no se supera */
+template<class Ids>
+static void compare(Ids& ids, int range, int capacity, unsigned seed){
+    std::mt19937 rnd(seed);
+    std::set<unsigned short> ref;
+    ids.clear();
+    for(int i=0;i<OPS;i++){
+        unsigned short id = 1 + rnd() % range;
+        switch(rnd() % 3){
+            case 0:
+                CHECK(ids.contains(id) == (ref.count(id) != 0));
+                break;
+            case 1:{
+                bool full = capacity > 0 && (int)ref.size() == capacity && ref.count(id) == 0;
+                bool ok = ids.insert(id);
+                CHECK(ok == !full);
+                if(ok){
+                    ref.insert(id);
+                }
+                break;
+            }
+            case 2:
+                ids.erase(id);
+                ref.erase(id);
+                break;
+        }
+    }
+    for(int id=1;id<=range;id++){
+        CHECK(ids.contains(id) == (ref.count(id) != 0));
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Flujo QoS2 de un broker: n mensajes en vuelo con ids consecutivos, cada PUBREL libera el ms antiguo */
+template<class Ids>
+static double flow(Ids& ids, int n){
+    ids.clear();
+    unsigned short next = 1, oldest = 1;
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i=0;i<OPS;i++){
+        if(!ids.contains(next) && ids.insert(next)){
+            next = (next == 65535)? 1 : next + 1;
+        }
+        if(i >= n){
+            ids.erase(oldest);
+            oldest = (oldest == 65535)? 1 : oldest + 1;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    CHECK(next != oldest);
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / OPS;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    static MQTT::QoS2IdSet<10> set10;
+    static MQTT::QoS2IdSet<1000> set1000;
+    static MQTT::QoS2IdBitmap bitmap;
+    static LinearIds<1000> linear1000;
+
+    // capacidad
+    for(int i=1;i<=10;i++){
+        CHECK(set10.insert(i));
+    }
+    CHECK(!set10.insert(11));
+    CHECK(set10.insert(5));
+    set10.erase(5);
+    CHECK(!set10.contains(5) && set10.insert(11) && set10.contains(11));
+
+    // colisiones: ids que caen en el mismo hueco, se borra el primero y el resto se sigue encontrando
+    set10.clear();
+    CHECK(set10.insert(3) && set10.insert(3 + 32) && set10.insert(4) && set10.insert(3 + 64));
+    set10.erase(3);
+    CHECK(set10.contains(3 + 32) && set10.contains(4) && set10.contains(3 + 64) && !set10.contains(3));
+    set10.erase(3 + 32);
+    CHECK(set10.contains(4) && set10.contains(3 + 64));
+
+    // al azar frente a std::set
+    compare(set10, 40, 10, 1);
+    compare(set10, 65535, 10, 2);
+    compare(set1000, 3000, 1000, 3);
+    compare(set1000, 65535, 1000, 4);
+    compare(bitmap, 65535, 0, 5);
+    compare(bitmap, 100, 0, 6);
+
+    double ns10 = flow(set10, 10), ns1000 = flow(set1000, 1000), nsBitmap = flow(bitmap, 30000);
+    double nsLinear = flow(linear1000, 1000);
+    printf("ns por mensaje QoS2: QoS2IdSet<10> %.1f, QoS2IdSet<1000> %.1f, QoS2IdBitmap (30000 en vuelo) %.1f, "
+           "tabla lineal de 1000 %.1f: %s\n", ns10, ns1000, nsBitmap, nsLinear, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * test_MQTTStream.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de la recepcin por fragmentos de MQTT::Client (setStreamHandler). Un broker simulado enva al cliente,
+ *  cuyo buffer de paquetes es de 128 bytes, una publicacin QoS1 de 1 MB, una de 300 bytes a un topic distinto,
+ *  una publicacin normal y una QoS1 de 1 MB al mismo topic. Cuando el cliente publica en "go", ya sin manejador de
+ *  fragmentos, el broker enva otra publicacin de 1 MB y otra normal. Se comprueba que:
+ *
+ *      - el manejador recibe primero el topic y luego los fragmentos en orden, con el contenido correcto
+ *      - el flujo no se desincroniza: la publicacin normal posterior llega a su manejador de suscripcin
+ *      - las publicaciones grandes QoS1 se confirman con su PUBACK
+ *      - sin manejador de fragmentos, una publicacin grande se descarta sin perder la sincronizacin
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+
+
+#define STREAM_PACKET_SIZE  128
+#define LARGE_SIZE          (1024 * 1024)
+
+
+static int s_streams = 0;           // publicaciones recibidas completas por fragmentos
+static int s_fragments = 0;
+static size_t s_expected = 0;       // siguiente posicin esperada
+static int s_messages = 0;          // publicaciones normales recibidas
+static int s_pubacks = 0;           // PUBACK recibidos por el broker
+static std::vector<unsigned short> s_ack_ids;
+
+
+//------------------------------------------------------------------------------------
+static unsigned char pattern(size_t i){
+    return (unsigned char)((i * 7) ^ (i >> 8));
+}
+
+
+//------------------------------------------------------------------------------------
+/** Enva una publicacin de size bytes con el patrn de pattern() */
+static void sendPattern(int fd, const char* topic, int qos, unsigned short id, size_t size){
+    MQTTString t = MQTTString_initializer;
+    t.cstring = (char*)topic;
+    std::vector<unsigned char> payload(size);
+    for(size_t i=0;i<size;i++){
+        payload[i] = pattern(i);
+    }
+    std::vector<unsigned char> pkt(size + 64);
+    int len = MQTTSerialize_publish(&pkt[0], pkt.size(), 0, qos, 0, id, t, &payload[0], size);
+    sendAll(fd, &pkt[0], len);
+}
+
+
+//------------------------------------------------------------------------------------
+/** Broker simulado: responde al CONNECT, enva las publicaciones y recoge los PUBACK */
+static void connectionTask(int fd){
+    unsigned char buf[256];
+    int len, type;
+    if(readPacket(fd, buf, &len) != CONNECT){
+        return;
+    }
+    sendConnack(fd);
+
+    sendPattern(fd, "fw/image", 1, 10, LARGE_SIZE);
+    sendPattern(fd, "other/topic", 0, 0, 300);
+    sendPattern(fd, "small/msg", 0, 0, 20);
+    sendPattern(fd, "fw/image", 1, 11, LARGE_SIZE);
+
+    // PUBACK y PUBLISH del cliente (paquetes pequeos), hasta que se desconecta
+    while((type = readPacket(fd, buf, &len)) > 0){
+        if(type == PUBACK && len == 4){
+            s_ack_ids.push_back((buf[2] << 8) | buf[3]);
+            s_pubacks++;
+        }
+        if(type == PUBLISH){
+            sendPattern(fd, "fw/image", 0, 0, LARGE_SIZE);
+            sendPattern(fd, "small/msg", 0, 0, 20);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void streamArrived(MQTT::StreamData& sd){
+    std::string topic(sd.topicName.lenstring.data, sd.topicName.lenstring.len);
+    if(topic != "fw/image"){
+        // se descarta en el propio manejador
+        return;
+    }
+    CHECK(sd.total == LARGE_SIZE);
+    CHECK(sd.offset == s_expected);
+    if(sd.offset == 0 && sd.message.payloadlen == 0){
+        // inicio de la publicacin: slo el topic
+        CHECK(sd.message.qos == MQTT::QOS1);
+        return;
+    }
+    const unsigned char* p = (const unsigned char*)sd.message.payload;
+    for(size_t i=0;i<sd.message.payloadlen;i++){
+        if(p[i] != pattern(sd.offset + i)){
+            CHECK(p[i] == pattern(sd.offset + i));
+            break;
+        }
+    }
+    s_fragments++;
+    s_expected += sd.message.payloadlen;
+    if(s_expected == sd.total){
+        s_streams++;
+        s_expected = 0;
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static void messageArrived(MQTT::MessageData& md){
+    CHECK(md.message.payloadlen == 20);
+    s_messages++;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    FakeBroker broker(connectionTask);
+    if(!broker.port()){
+        printf("no se ha podido iniciar el broker\n");
+        return 1;
+    }
+
+    LinuxNetwork network;
+    MQTT::Client<LinuxNetwork, LinuxCountdown, STREAM_PACKET_SIZE> client(network, 2000);
+    CHECK(network.connect("127.0.0.1", broker.port()) == 0);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"stream";
+    CHECK(client.connect(data) == 0);
+    client.setMessageHandler("small/msg", messageArrived);
+    client.setStreamHandler(streamArrived);
+
+    LinuxCountdown timeout(5000);
+    while((s_streams < 2 || s_messages < 1) && !timeout.expired() && client.isConnected()){
+        client.yield(10);
+    }
+    CHECK(s_streams == 2);
+    CHECK(s_messages == 1);
+    CHECK(client.isConnected());
+
+    // sin manejador de fragmentos la publicacin se descarta, y la siguiente llega igualmente
+    client.setStreamHandler(0);
+    CHECK(client.publish("go", (void*)"1", 1) == 0);
+    while(s_messages < 2 && !timeout.expired() && client.isConnected()){
+        client.yield(10);
+    }
+    CHECK(s_streams == 2);
+    CHECK(s_messages == 2);
+    CHECK(client.isConnected());
+    client.disconnect();
+    network.disconnect();
+    broker.join();
+    CHECK(s_pubacks == 2);
+    CHECK(s_ack_ids.size() == 2 && s_ack_ids[0] == 10 && s_ack_ids[1] == 11);
+
+    printf("%d publicaciones de %d bytes en %d fragmentos, %d PUBACK: %s\n", s_streams, LARGE_SIZE, s_fragments, s_pubacks, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * test_MQTTSubscribeMany.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::Client::subscribeMany/unsubscribeMany frente al broker en proceso de MQTTLoopback.h, con un
+ *  enlace de RTT_MS de ida y vuelta en el reloj virtual, como si estuviera lejos. Se comprueba que:
+ *
+ *      - 200 suscripciones se envan en paquetes SUBSCRIBE de varios topics, todos antes de esperar a sus SUBACK,
+ *        y se restauran en un par de RTT en lugar de 200
+ *      - cada topic recibe su QoS concedida, 0x80 los rechazados por el broker, y la QoS pedida se limita a la de
+ *        la poltica del cliente
+ *      - sin callback, los mensajes van al manejador por defecto; con l, BUFFER_OVERFLOW si no caben todos
+ *      - un topic que no cabe en un paquete devuelve BUFFER_OVERFLOW sin enviar nada ni desconectar
+ *      - unsubscribeMany elimina los 200 topics y sus manejadores
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "test_util.h"
+#include "MQTTClient.h"
+#include "MQTTLoopback.h"
+
+
+#define PACKET_SIZE     256
+#define RTT_MS          20
+#define TOPICS          200
+
+
+typedef MQTT::ClientMetrics<MQTT::LoopbackMicroTick> Metrics;
+typedef MQTT::Client<MQTT::LoopbackNetwork, MQTT::LoopbackCountdown, PACKET_SIZE, 5,
+        MQTT::ClientPolicy<1, true, MQTT::OWN_BUFFERS, false, MQTT::QoS2IdSet<0>, Metrics> > Client;
+
+
+static int s_default = 0;
+static int s_handled = 0;
+
+
+//------------------------------------------------------------------------------------
+static void onDefault(MQTT::MessageData&){
+    s_default++;
+}
+
+
+//------------------------------------------------------------------------------------
+static void onMessage(MQTT::MessageData&){
+    s_handled++;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Paquetes de un tipo enviados por el cliente */
+static unsigned long sent(Client& client, int type){
+    Metrics::Data data;
+    client.getMetrics().snapshot(data);
+    return data.packetsSent[type];
+}
+
+
+//------------------------------------------------------------------------------------
+/** Tiempo del reloj virtual en ms desde start */
+static double elapsedMs(unsigned long long start){
+    return (MQTT::LoopbackClock::micros() - start) / 1000.0;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    MQTT::LoopbackBroker broker;
+    MQTT::LoopbackNetwork network;
+    Client client(network, 2000);
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.clientID.cstring = (char*)"many";
+    CHECK(network.connect(broker, MQTT::LinkProfile(RTT_MS * 1000 / 2)) == 0);
+    CHECK(client.connect(data) == MQTT::SUCCESS);
+    client.setDefaultMessageHandler(onDefault);
+
+    std::vector<std::string> names;
+    std::vector<const char*> topics;
+    for(int i=0;i<TOPICS;i++){
+        char name[32];
+        sprintf(name, (i == 7)? "sensor/#/%03d" : "sensor/%03d/temp", i);
+        names.push_back(name);
+    }
+    for(auto& n : names){
+        topics.push_back(n.c_str());
+    }
+
+    // suscripcin de uno en uno, como referencia: un RTT por topic
+    int granted[TOPICS];
+    unsigned long long start = MQTT::LoopbackClock::micros();
+    for(int i=0;i<10;i++){
+        CHECK(client.subscribeMany(1, &topics[i], MQTT::QOS1, Client::messageHandlerFP(), granted) == MQTT::SUCCESS);
+    }
+    double one_by_one = elapsedMs(start) * TOPICS / 10;
+    CHECK(one_by_one == TOPICS * RTT_MS);
+
+    // todas de una vez, con QoS2 limitada a la QoS1 de la poltica: el broker concede hasta QoS2
+    start = MQTT::LoopbackClock::micros();
+    CHECK(client.subscribeMany(TOPICS, &topics[0], MQTT::QOS2, Client::messageHandlerFP(), granted) == MQTT::SUCCESS);
+    double many = elapsedMs(start);
+    CHECK(many < 3 * RTT_MS);
+    bool qos_ok = true;
+    for(int i=0;i<TOPICS;i++){
+        qos_ok = qos_ok && (granted[i] == ((i == 7)? 0x80 : 1));
+    }
+    CHECK(qos_ok);
+    int packets = (int)sent(client, SUBSCRIBE) - 10;
+    CHECK(packets > 1 && packets < TOPICS / 10);
+
+    // sin callback, sus mensajes van al manejador por defecto
+    char payload[] = "21.5";
+    CHECK(client.publish(topics[100], payload, 4) == MQTT::SUCCESS);
+    for(int i=0;i<10 && s_default == 0;i++){
+        client.yield(RTT_MS);
+    }
+    CHECK(s_default == 1);
+
+    // con callback, slo caben cinco manejadores
+    const char* few[3] = { topics[1], topics[2], topics[3] };
+    CHECK(client.subscribeMany(3, few, MQTT::QOS0, onMessage, granted) == MQTT::SUCCESS);
+    CHECK(granted[0] == 0 && granted[1] == 0 && granted[2] == 0);
+    CHECK(client.subscribeMany(5, &topics[10], MQTT::QOS0, onMessage, granted) == MQTT::BUFFER_OVERFLOW);
+    CHECK(client.isConnected() && granted[4] == 0);
+    CHECK(client.publish(topics[2], payload, 4) == MQTT::SUCCESS);
+    for(int i=0;i<10 && s_handled == 0;i++){
+        client.yield(RTT_MS);
+    }
+    CHECK(s_handled == 1 && s_default == 1);
+
+    // un topic que no cabe en un paquete
+    std::string large(PACKET_SIZE, 'x');
+    const char* mixed[2] = { topics[0], large.c_str() };
+    unsigned long before = sent(client, SUBSCRIBE);
+    CHECK(client.subscribeMany(2, mixed, MQTT::QOS0, Client::messageHandlerFP(), granted) == MQTT::BUFFER_OVERFLOW);
+    CHECK(client.isConnected() && sent(client, SUBSCRIBE) == before && granted[0] == 0x80);
+
+    // y la baja de todos: el broker ya no entrega sus mensajes
+    unsigned long delivered = broker.delivered();
+    CHECK(client.unsubscribeMany(TOPICS, &topics[0]) == MQTT::SUCCESS);
+    CHECK(client.isConnected() && sent(client, UNSUBSCRIBE) > 1);
+    CHECK(client.publish(topics[2], payload, 4) == MQTT::SUCCESS);
+    for(int i=0;i<5;i++){
+        client.yield(RTT_MS);
+    }
+    CHECK(broker.delivered() == delivered && s_handled == 1 && s_default == 1);
+    // ni el cliente guarda su manejador: con un filtro que los cubre, van al de por defecto
+    const char* all[1] = { "sensor/#" };
+    CHECK(client.subscribeMany(1, all, MQTT::QOS0, Client::messageHandlerFP(), granted) == MQTT::SUCCESS);
+    CHECK(client.publish(topics[2], payload, 4) == MQTT::SUCCESS);
+    for(int i=0;i<5;i++){
+        client.yield(RTT_MS);
+    }
+    CHECK(s_handled == 1 && s_default == 2);
+
+    client.disconnect();
+    network.disconnect();
+
+    printf("%d suscripciones en %d paquetes: %.1f ms (RTT %d ms), de una en una %.0f ms: %s\n",
+           TOPICS, packets, many, RTT_MS, one_by_one, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
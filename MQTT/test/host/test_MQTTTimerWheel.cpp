@@ -0,0 +1,103 @@
+/*
+ * test_MQTTTimerWheel.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de MQTT::TimerWheel con un reloj simulado. Arma temporizadores aleatorios en todos los niveles de la
+ *  rueda (incluido el paso por cero del reloj), cancela y rearma parte de ellos, y comprueba que cada uno expira
+ *  una nica vez, nunca antes de tiempo y como mximo dos ticks tarde.
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTTimerWheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+
+/** Reloj simulado, comienza cerca del desbordamiento para probar el paso por cero */
+struct FakeClock {
+    static unsigned long ms;
+    static unsigned long now() { return ms; }
+};
+unsigned long FakeClock::ms = (unsigned long)-50000;
+
+
+/** Temporizador de prueba */
+struct TestTimer {
+    MQTT::WheelTimer timer;
+    unsigned long armed;
+    unsigned long delay;
+    int fired;
+    bool cancelled;
+};
+
+static int s_errors = 0;
+static const unsigned long TickMs = 10;
+
+
+//------------------------------------------------------------------------------------
+static void onExpiry(MQTT::WheelTimer& timer, void* context){
+    TestTimer* t = (TestTimer*)context;
+    long elapsed = (long)(FakeClock::ms - t->armed);
+    t->fired++;
+    if(t->cancelled || t->fired > 1 || elapsed < (long)t->delay || elapsed > (long)(t->delay + 2 * TickMs)){
+        if(s_errors++ < 10){
+            printf("ERROR: retardo=%lu transcurrido=%ld expiraciones=%d cancelado=%d\n", t->delay, elapsed, t->fired, t->cancelled);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    MQTT::TimerWheel<FakeClock> wheel(TickMs);
+    std::vector<TestTimer> timers(5000);
+    srand(1);
+    for(size_t i=0;i<timers.size();i++){
+        TestTimer& t = timers[i];
+        t.timer.attach(onExpiry, &t);
+        // retardos de todos los niveles: hasta 640 ms, 40 s, 45 min y 44 h (el mximo con ticks de 10 ms son 46 h)
+        static const unsigned long ranges[] = { 640, 40000, 2700000, 160000000 };
+        t.delay = rand() % ranges[i % 4];
+        t.armed = FakeClock::ms;
+        t.fired = 0;
+        t.cancelled = false;
+        wheel.start(t.timer, t.delay);
+        FakeClock::ms += rand() % 3;
+        wheel.run();
+    }
+    // cancela uno de cada diez y rearma otro de cada diez
+    for(size_t i=0;i<timers.size();i+=10){
+        if(!timers[i].fired){
+            timers[i].cancelled = true;
+            wheel.stop(timers[i].timer);
+        }
+        TestTimer& r = timers[i + 5];
+        if(!r.fired){
+            r.armed = FakeClock::ms;
+            r.delay = rand() % 100000;
+            wheel.start(r.timer, r.delay);
+        }
+    }
+    // avanza el reloj a saltos irregulares hasta que expiran todos
+    unsigned long steps = 0;
+    while(wheel.size() > 0){
+        unsigned long wait = wheel.next_ms(60000);
+        FakeClock::ms += (wait > 0)? (1 + rand() % wait) : 1;
+        wheel.run();
+        steps++;
+    }
+    for(size_t i=0;i<timers.size();i++){
+        if(!timers[i].cancelled && timers[i].fired != 1){
+            if(s_errors++ < 10){
+                printf("ERROR: temporizador %u no ha expirado\n", (unsigned)i);
+            }
+        }
+    }
+    printf("%u temporizadores, %lu pasos: %s\n", (unsigned)timers.size(), steps, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
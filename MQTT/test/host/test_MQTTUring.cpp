@@ -0,0 +1,123 @@
+/*
+ * test_MQTTUring.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba de LinuxUringNetwork contra un extremo TCP en el propio proceso. Se pide un anillo de una sola entrada,
+ *  que LinuxUringNetwork ampla a las dos que ocupa cada transferencia, de forma que cada una lo llena. Se
+ *  comprueba que:
+ *
+ *      - una escritura mayor que el buffer de envo registrado llega completa y en orden
+ *      - una lectura mayor que el buffer de recepcin registrado se completa con el contenido correcto, y las
+ *        lecturas pequeas se sirven del buffer
+ *      - una lectura sin datos respeta el plazo y devuelve 0
+ *      - al cerrar el otro extremo, la lectura devuelve error
+ *      - una nueva conexin sin desconectar antes libera el socket registrado y vuelve a transferir datos
+ *
+ *  Slo se compila con make URING=1 (necesita liburing). Compilacin: make URING=1 test (en este directorio)
+ */
+
+
+#include "MQTTLinux.h"
+#include <thread>
+#include <vector>
+
+
+#define WRITE_SIZE      (3 * MQTTLINUX_TX_BUFFER_SIZE + 100)
+#define READ_SIZE       (3 * MQTTLINUX_RX_BUFFER_SIZE + 100)
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+//------------------------------------------------------------------------------------
+static unsigned char pattern(size_t i){
+    return (unsigned char)((i * 7) ^ (i >> 8));
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+       getsockname(listener, (struct sockaddr*)&addr, &addrlen) != 0){
+        printf("no se ha podido iniciar el servidor\n");
+        return 1;
+    }
+
+    LinuxUringNetwork network(1);
+    int rc = network.connect("127.0.0.1", ntohs(addr.sin_port));
+    if(rc == -ENOSYS){
+        printf("io_uring no disponible en este sistema\n");
+        return 1;
+    }
+    CHECK(rc == 0);
+    int peer = accept(listener, 0, 0);
+    CHECK(peer >= 0);
+
+    // escritura mayor que el buffer de envo, leda por el otro extremo en paralelo
+    std::vector<unsigned char> out(WRITE_SIZE);
+    for(size_t i=0;i<out.size();i++){
+        out[i] = pattern(i);
+    }
+    std::vector<unsigned char> in(WRITE_SIZE);
+    std::thread reader([&](){
+        size_t got = 0;
+        while(got < in.size()){
+            ssize_t n = recv(peer, &in[got], in.size() - got, 0);
+            if(n <= 0){
+                break;
+            }
+            got += n;
+        }
+    });
+    CHECK(network.write(&out[0], out.size(), 2000) == (int)out.size());
+    reader.join();
+    CHECK(in == out);
+
+    // lectura mayor que el buffer de recepcin, en una sola llamada y luego byte a byte
+    std::vector<unsigned char> data(READ_SIZE + 10);
+    for(size_t i=0;i<data.size();i++){
+        data[i] = pattern(i + 1);
+    }
+    CHECK(send(peer, &data[0], data.size(), MSG_NOSIGNAL) == (ssize_t)data.size());
+    std::vector<unsigned char> buf(data.size());
+    CHECK(network.read(&buf[0], READ_SIZE, 2000) == READ_SIZE);
+    for(int i=0;i<10;i++){
+        CHECK(network.read(&buf[READ_SIZE + i], 1, 2000) == 1);
+    }
+    CHECK(buf == data);
+
+    // sin datos, la lectura finaliza al cumplirse el plazo
+    LinuxCountdown elapsed(1000);
+    CHECK(network.read(&buf[0], 1, 100) == 0);
+    int waited = 1000 - elapsed.left_ms();
+    CHECK(waited >= 90 && waited < 500);
+
+    // el otro extremo cierra la conexin
+    close(peer);
+    CHECK(network.read(&buf[0], 1, 1000) < 0);
+
+    // reconexin sin disconnect() previo
+    CHECK(network.connect("127.0.0.1", ntohs(addr.sin_port)) == 0);
+    peer = accept(listener, 0, 0);
+    CHECK(peer >= 0);
+    CHECK(network.write(&out[0], 10, 1000) == 10);
+    CHECK(recv(peer, &in[0], 10, MSG_WAITALL) == 10 && memcmp(&in[0], &out[0], 10) == 0);
+    CHECK(send(peer, &data[0], 10, MSG_NOSIGNAL) == 10);
+    CHECK(network.read(&buf[0], 10, 1000) == 10 && memcmp(&buf[0], &data[0], 10) == 0);
+    close(peer);
+    network.disconnect();
+    close(listener);
+
+    printf("%d bytes enviados, %d recibidos, anillo de 2 entradas: %s\n", WRITE_SIZE, READ_SIZE + 10, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * test_StackTrace.cpp
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Prueba del perfilador de StackTrace.c, con el codec MQTTPacket compilado con MQTT_STACKTRACE. Varios hilos
+ *  serializan y deserializan publicaciones a la vez. Se comprueba que:
+ *
+ *      - cada hilo tiene sus propios contadores, con el nmero exacto de llamadas de cada funcin
+ *      - las funciones anidadas (MQTTPacket_encode dentro de MQTTSerialize_publish) se cuentan aparte
+ *      - StackTrace_get muestra la pila de llamadas de un hilo
+ *      - StackTrace_reset pone a cero los contadores
+ *
+ *  El volcado se escribe en stacktrace.txt, que make test pasa a report_StackTrace.
+ *
+ *  Compilacin: make test (en este directorio)
+ */
+
+
+#include "MQTTPacket.h"
+#include "StackTrace.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+#define THREADS     4
+#define CALLS       100000
+
+
+static int s_errors = 0;
+static std::atomic<int> s_codec_errors(0);
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+//------------------------------------------------------------------------------------
+static void codecTask(){
+    unsigned char buf[128];
+    unsigned char payload[32] = {0};
+    for(int i=0;i<CALLS;i++){
+        MQTTString t = MQTTString_initializer;
+        t.cstring = (char*)"dev/data";
+        int len = MQTTSerialize_publish(buf, sizeof(buf), 0, 1, 0, (unsigned short)(i + 1), t, payload, sizeof(payload));
+        unsigned char dup, retained;
+        unsigned short id;
+        int qos, payloadlen;
+        unsigned char* p;
+        MQTTString topic;
+        if(MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic, &p, &payloadlen, buf, len) != 1 || id != (unsigned short)(i + 1)){
+            s_codec_errors++;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+/** Lee un volcado: llamadas de cada hilo y funcin */
+static std::map<std::string, unsigned long long> readDump(const char* file, int* threads){
+    std::map<std::string, unsigned long long> calls;
+    std::map<unsigned long, bool> ids;
+    FILE* f = fopen(file, "r");
+    char line[256], name[128];
+    unsigned long id;
+    unsigned long long n, ticks, max;
+    while(f && fgets(line, sizeof(line), f)){
+        if(sscanf(line, "thread %lu %127s %llu %llu %llu", &id, name, &n, &ticks, &max) == 5){
+            calls[std::to_string(id) + " " + name] = n;
+            ids[id] = true;
+        }
+    }
+    if(f){
+        fclose(f);
+    }
+    *threads = (int)ids.size();
+    return calls;
+}
+
+
+//------------------------------------------------------------------------------------
+int main(){
+    StackTrace_reset();
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i=0;i<THREADS;i++){
+        threads.push_back(std::thread(codecTask));
+    }
+    for(int i=0;i<THREADS;i++){
+        threads[i].join();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    CHECK(s_codec_errors == 0);
+
+    FILE* f = fopen("stacktrace.txt", "w");
+    CHECK(f != 0);
+    if(f){
+        CHECK(StackTrace_dump(f) > 0);
+        fclose(f);
+    }
+    int nthreads = 0;
+    std::map<std::string, unsigned long long> calls = readDump("stacktrace.txt", &nthreads);
+    CHECK(nthreads == THREADS);
+    int checked = 0;
+    for(auto it = calls.begin(); it != calls.end(); ++it){
+        std::string fn = it->first.substr(it->first.find(' ') + 1);
+        if(fn == "MQTTSerialize_publish" || fn == "MQTTDeserialize_publish" || fn == "MQTTPacket_encode"){
+            CHECK(it->second == CALLS);
+            checked++;
+        }
+    }
+    CHECK(checked == 3 * THREADS);
+
+    // pila de llamadas, desde un hilo con la pila en curso
+    unsigned long id = 0;
+    std::string stack;
+    std::thread([&](){
+        StackTrace_entry("exterior", __LINE__, TRACE_MINIMUM);
+        StackTrace_entry("interior", __LINE__, TRACE_MINIMUM);
+        for(id=1;id<=THREADS + 1 && stack.empty();id++){
+            stack = StackTrace_get(id);
+        }
+    }).join();
+    CHECK(stack == "interior <- exterior");
+
+    // puesta a cero
+    StackTrace_reset();
+    f = fopen("/dev/null", "w");
+    if(f){
+        CHECK(StackTrace_dump(f) == 0);
+        fclose(f);
+    }
+
+    long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    printf("%d hilos con %d funciones perfiladas, %d publicaciones por hilo en %ld ms: %s\n", nthreads,
+           (int)calls.size() / ((nthreads > 0)? nthreads : 1), CALLS, ms, (s_errors)? "ERROR" : "OK");
+    return (s_errors)? 1 : 0;
+}
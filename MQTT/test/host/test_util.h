@@ -0,0 +1,215 @@
+/*
+ * test_util.h
+ *
+ *  Created on: Oct 2026
+ *      Author: raulMrello
+ *
+ *  Utilidades comunes de las pruebas del cliente MQTT en Linux: la macro CHECK, la lectura y escritura de paquetes
+ *  completos en un socket, y FakeBroker, el broker simulado que escucha en un puerto local y atiende cada conexin
+ *  en su propio hilo. Cada prueba aporta slo el comportamiento de su broker.
+ */
+
+#ifndef _HOST_TEST_UTIL_H
+#define _HOST_TEST_UTIL_H
+
+#include "MQTTLinux.h"
+#include "MQTTPacket.h"
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static int s_errors = 0;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("ERROR (lnea %d): %s\n", __LINE__, #cond); s_errors++; } }while(0)
+
+
+//------------------------------------------------------------------------------------
+static inline void sendAll(int fd, const unsigned char* buf, int len){
+    while(len > 0){
+        ssize_t rc = send(fd, buf, len, MSG_NOSIGNAL);
+        if(rc <= 0){
+            return;
+        }
+        buf += rc;
+        len -= rc;
+    }
+}
+
+
+//------------------------------------------------------------------------------------
+static inline bool readAll(int fd, unsigned char* buf, int len){
+    while(len > 0){
+        ssize_t rc = recv(fd, buf, len, 0);
+        if(rc <= 0){
+            return false;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+/** Lee un paquete completo, devuelve su tipo o -1 si se ha cerrado la conexin */
+static inline int readPacket(int fd, unsigned char* buf, int* len){
+    int rem_len = 0, multiplier = 1, n = 1;
+    if(!readAll(fd, buf, 1)){
+        return -1;
+    }
+    do{
+        if(!readAll(fd, &buf[n], 1)){
+            return -1;
+        }
+        rem_len += (buf[n] & 127) * multiplier;
+        multiplier *= 128;
+    }while(buf[n++] & 128);
+    if(!readAll(fd, &buf[n], rem_len)){
+        return -1;
+    }
+    *len = n + rem_len;
+    return buf[0] >> 4;
+}
+
+
+//------------------------------------------------------------------------------------
+static inline void sendConnack(int fd, int rc = 0, bool sessionPresent = false){
+    unsigned char buf[4];
+    sendAll(fd, buf, MQTTSerialize_connack(buf, sizeof(buf), rc, sessionPresent));
+}
+
+
+//------------------------------------------------------------------------------------
+/** Enva un PUBACK, PUBREC, PUBREL o PUBCOMP */
+static inline void sendAck(int fd, int type, unsigned short id){
+    unsigned char buf[4];
+    sendAll(fd, buf, MQTTSerialize_ack(buf, sizeof(buf), type, 0, id));
+}
+
+
+//------------------------------------------------------------------------------------
+static inline void sendPingresp(int fd){
+    // el codec no serializa el PINGRESP
+    const unsigned char buf[2] = { PINGRESP << 4, 0 };
+    sendAll(fd, buf, sizeof(buf));
+}
+
+
+//------------------------------------------------------------------------------------
+/** Enva una publicacin con un payload de texto */
+static inline void sendPublish(int fd, const char* topic, const char* payload, int qos = 0, unsigned short id = 0,
+                               unsigned char dup = 0){
+    unsigned char buf[256];
+    MQTTString t = MQTTString_initializer;
+    t.cstring = (char*)topic;
+    sendAll(fd, buf, MQTTSerialize_publish(buf, sizeof(buf), dup, qos, 0, id, t, (unsigned char*)payload, (int)strlen(payload)));
+}
+
+
+//---------------------------------------------------------------------------------
+//- struct PublishPacket ----------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+/** Publicacin recibida por el broker simulado, decodificada sobre el buffer del paquete */
+struct PublishPacket {
+
+    PublishPacket(unsigned char* buf, int len){
+        MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topicName, &payload, &payloadlen, buf, len);
+    }
+
+    std::string topic() const {
+        return std::string(topicName.lenstring.data, topicName.lenstring.len);
+    }
+
+    unsigned char dup, retained;
+    unsigned short id;
+    int qos, payloadlen;
+    unsigned char* payload;
+    MQTTString topicName;
+};
+
+
+//---------------------------------------------------------------------------------
+//- class FakeBroker --------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+
+/** Broker simulado: acepta el nmero de conexiones indicado en un puerto local y atiende cada una en su propio hilo
+ *  con la funcin de la prueba, tras la cual cierra el socket.
+ *
+ *      FakeBroker broker(connectionTask, 2);
+ *      if(!broker.port()){ ... }
+ *      network.connect("127.0.0.1", broker.port());
+ *      ...
+ *      broker.join();
+ */
+class FakeBroker {
+
+public:
+
+    typedef std::function<void(int fd)> Connection;
+
+    FakeBroker(Connection connection, int connections = 1) : _connection(connection), _port(0) {
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(_listener < 0 || bind(_listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(_listener, connections) != 0 ||
+           getsockname(_listener, (struct sockaddr*)&addr, &addrlen) != 0){
+            return;
+        }
+        _port = ntohs(addr.sin_port);
+        _acceptor = std::thread(&FakeBroker::acceptTask, this, connections);
+    }
+
+    ~FakeBroker(){
+        join();
+    }
+
+    /** @return Puerto local del broker, o 0 si no se ha podido iniciar */
+    int port() const {
+        return _port;
+    }
+
+    /** Espera a que se hayan aceptado y atendido todas las conexiones */
+    void join(){
+        if(_acceptor.joinable()){
+            _acceptor.join();
+        }
+        if(_listener >= 0){
+            close(_listener);
+            _listener = -1;
+        }
+    }
+
+private:
+
+    void acceptTask(int connections){
+        std::vector<std::thread> threads;
+        for(int i=0;i<connections;i++){
+            int fd = accept(_listener, 0, 0);
+            if(fd < 0){
+                break;
+            }
+            threads.push_back(std::thread([this, fd](){
+                _connection(fd);
+                close(fd);
+            }));
+        }
+        for(auto& t : threads){
+            t.join();
+        }
+    }
+
+    Connection _connection;
+    int _listener;
+    int _port;
+    std::thread _acceptor;
+};
+
+#endif  /** _HOST_TEST_UTIL_H */